@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "glib.h"
 #include "glib/gstdio.h"
@@ -58,13 +59,31 @@
 static GHashTable* logs;
 static GHashTable* groupchat_logs;
 
+// Log lines are collected per file and written once this many bytes are
+// pending, or from chat_log_process_events() once the oldest pending line
+// waited for the flush interval
+#define CHAT_LOG_FLUSH_BYTES 8192
+#define CHAT_LOG_FLUSH_INTERVAL G_TIME_SPAN_SECOND
+
+// When pending lines of any log have to be written, 0 if there are none
+static gint64 flush_due;
+
 struct dated_chat_log
 {
     gchar* filename;
     GDateTime* date;
+    // local midnight after date, the log rolls over to a new file then
+    gint64 roll_time;
+    // the open file and its inode, a deleted or replaced file is noticed
+    // before the next write and opened again
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    GString* pending;
 };
 
 static gboolean _log_roll_needed(struct dated_chat_log* dated_log);
+static void _log_append(struct dated_chat_log* dated_log, const char* const fmt, ...);
 static struct dated_chat_log* _create_chatlog(const char* const other, const char* const login);
 static struct dated_chat_log* _create_groupchat_log(const char* const room, const char* const login);
 static void _free_chat_log(struct dated_chat_log* dated_log);
@@ -240,11 +259,6 @@ _chat_log_chat(const char* const login, const char* const other, const char* msg
         dated_log = _create_chatlog(other_name, login);
         g_hash_table_insert(logs, strdup(other_name), dated_log);
 
-        // log entry exists but file removed
-    } else if (!g_file_test(dated_log->filename, G_FILE_TEST_EXISTS)) {
-        dated_log = _create_chatlog(other_name, login);
-        g_hash_table_replace(logs, strdup(other_name), dated_log);
-
         // log file needs rolling
     } else if (_log_roll_needed(dated_log)) {
         dated_log = _create_chatlog(other_name, login);
@@ -262,34 +276,25 @@ _chat_log_chat(const char* const login, const char* const other, const char* msg
     }
 
     auto_gchar gchar* date_fmt = g_date_time_format_iso8601(timestamp);
-    FILE* chatlogp = fopen(dated_log->filename, "a");
-    g_chmod(dated_log->filename, S_IRUSR | S_IWUSR);
-    if (chatlogp) {
-        if (direction == PROF_IN_LOG) {
-            if (strncmp(msg, "/me ", 4) == 0) {
-                if (resourcepart) {
-                    fprintf(chatlogp, "%s - *%s %s\n", date_fmt, resourcepart, msg + 4);
-                } else {
-                    fprintf(chatlogp, "%s - *%s %s\n", date_fmt, other, msg + 4);
-                }
+    if (direction == PROF_IN_LOG) {
+        if (strncmp(msg, "/me ", 4) == 0) {
+            if (resourcepart) {
+                _log_append(dated_log, "%s - *%s %s\n", date_fmt, resourcepart, msg + 4);
             } else {
-                if (resourcepart) {
-                    fprintf(chatlogp, "%s - %s: %s\n", date_fmt, resourcepart, msg);
-                } else {
-                    fprintf(chatlogp, "%s - %s: %s\n", date_fmt, other, msg);
-                }
+                _log_append(dated_log, "%s - *%s %s\n", date_fmt, other, msg + 4);
             }
         } else {
-            if (strncmp(msg, "/me ", 4) == 0) {
-                fprintf(chatlogp, "%s - *me %s\n", date_fmt, msg + 4);
+            if (resourcepart) {
+                _log_append(dated_log, "%s - %s: %s\n", date_fmt, resourcepart, msg);
             } else {
-                fprintf(chatlogp, "%s - me: %s\n", date_fmt, msg);
+                _log_append(dated_log, "%s - %s: %s\n", date_fmt, other, msg);
             }
         }
-        fflush(chatlogp);
-        int result = fclose(chatlogp);
-        if (result == EOF) {
-            log_error("Error closing file %s, errno = %d", dated_log->filename, errno);
+    } else {
+        if (strncmp(msg, "/me ", 4) == 0) {
+            _log_append(dated_log, "%s - *me %s\n", date_fmt, msg + 4);
+        } else {
+            _log_append(dated_log, "%s - me: %s\n", date_fmt, msg);
         }
     }
 
@@ -368,30 +373,131 @@ _groupchat_log_chat(const gchar* const login, const gchar* const room, const gch
         // log exists but needs rolling
     } else if (_log_roll_needed(dated_log)) {
         dated_log = _create_groupchat_log(room, login);
-        g_hash_table_replace(logs, strdup(room), dated_log);
+        g_hash_table_replace(groupchat_logs, strdup(room), dated_log);
     }
 
     GDateTime* dt_tmp = g_date_time_new_now_local();
 
     auto_gchar gchar* date_fmt = g_date_time_format_iso8601(dt_tmp);
 
-    FILE* grpchatlogp = fopen(dated_log->filename, "a");
-    g_chmod(dated_log->filename, S_IRUSR | S_IWUSR);
-    if (grpchatlogp) {
-        if (strncmp(msg, "/me ", 4) == 0) {
-            fprintf(grpchatlogp, "%s - *%s %s\n", date_fmt, nick, msg + 4);
-        } else {
-            fprintf(grpchatlogp, "%s - %s: %s\n", date_fmt, nick, msg);
+    if (strncmp(msg, "/me ", 4) == 0) {
+        _log_append(dated_log, "%s - *%s %s\n", date_fmt, nick, msg + 4);
+    } else {
+        _log_append(dated_log, "%s - %s: %s\n", date_fmt, nick, msg);
+    }
+
+    g_date_time_unref(dt_tmp);
+}
+
+// Open the log file, or open it again if it was deleted or replaced since
+static gboolean
+_log_open(struct dated_chat_log* dated_log)
+{
+    if (dated_log->fd != -1) {
+        close(dated_log->fd);
+    }
+
+    // the directory may have been removed together with the file
+    auto_gchar gchar* dir = g_path_get_dirname(dated_log->filename);
+    g_mkdir_with_parents(dir, S_IRWXU);
+
+    dated_log->fd = open(dated_log->filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (dated_log->fd == -1) {
+        log_error("Error opening chat log %s: %s", dated_log->filename, strerror(errno));
+        return FALSE;
+    }
+
+    struct stat st;
+    fchmod(dated_log->fd, S_IRUSR | S_IWUSR);
+    if (fstat(dated_log->fd, &st) == 0) {
+        dated_log->dev = st.st_dev;
+        dated_log->ino = st.st_ino;
+    }
+
+    return TRUE;
+}
+
+// Write the pending lines of a log with a single write(). The file is only
+// checked by inode here, not for every message.
+static void
+_log_flush(struct dated_chat_log* dated_log)
+{
+    if (dated_log->pending->len == 0) {
+        return;
+    }
+    if (!dated_log->filename) {
+        g_string_truncate(dated_log->pending, 0);
+        return;
+    }
+
+    struct stat st;
+    if (dated_log->fd == -1 || stat(dated_log->filename, &st) != 0 || st.st_dev != dated_log->dev || st.st_ino != dated_log->ino) {
+        if (!_log_open(dated_log)) {
+            g_string_truncate(dated_log->pending, 0);
+            return;
         }
+    }
 
-        fflush(grpchatlogp);
-        int result = fclose(grpchatlogp);
-        if (result == EOF) {
-            log_error("Error closing file %s, errno = %d", dated_log->filename, errno);
+    const char* data = dated_log->pending->str;
+    gsize left = dated_log->pending->len;
+    while (left > 0) {
+        ssize_t written = write(dated_log->fd, data, left);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Error writing chat log %s: %s", dated_log->filename, strerror(errno));
+            break;
         }
+        data += written;
+        left -= written;
     }
 
-    g_date_time_unref(dt_tmp);
+    g_string_truncate(dated_log->pending, 0);
+}
+
+static void
+_log_append(struct dated_chat_log* dated_log, const char* const fmt, ...)
+{
+    va_list arg;
+    va_start(arg, fmt);
+    g_string_append_vprintf(dated_log->pending, fmt, arg);
+    va_end(arg);
+
+    if (dated_log->pending->len >= CHAT_LOG_FLUSH_BYTES) {
+        _log_flush(dated_log);
+    } else if (!flush_due) {
+        flush_due = g_get_monotonic_time() + CHAT_LOG_FLUSH_INTERVAL;
+    }
+}
+
+static void
+_flush_logs(GHashTable* table)
+{
+    if (!table) {
+        return;
+    }
+
+    GHashTableIter iter;
+    gpointer dated_log;
+    g_hash_table_iter_init(&iter, table);
+    while (g_hash_table_iter_next(&iter, NULL, &dated_log)) {
+        _log_flush(dated_log);
+    }
+}
+
+// Write the lines that waited for the flush interval, called from the main
+// loop
+void
+chat_log_process_events(void)
+{
+    if (!flush_due || g_get_monotonic_time() < flush_due) {
+        return;
+    }
+
+    flush_due = 0;
+    _flush_logs(logs);
+    _flush_logs(groupchat_logs);
 }
 
 void
@@ -418,48 +524,58 @@ _get_log_filename(const char* const other, const char* const login, GDateTime* d
 }
 
 static struct dated_chat_log*
-_create_chatlog(const char* const other, const char* const login)
+_dated_log_new(const char* const filename, GDateTime* now)
 {
-    GDateTime* now = g_date_time_new_now_local();
-    auto_char char* filename = _get_log_filename(other, login, now, FALSE);
-
     struct dated_chat_log* new_log = malloc(sizeof(struct dated_chat_log));
-    new_log->filename = strdup(filename);
+    new_log->filename = g_strdup(filename);
     new_log->date = now;
+    new_log->fd = -1;
+    new_log->dev = 0;
+    new_log->ino = 0;
+    new_log->pending = g_string_new(NULL);
+
+    GDateTime* midnight = g_date_time_new_local(g_date_time_get_year(now), g_date_time_get_month(now), g_date_time_get_day_of_month(now), 0, 0, 0);
+    GDateTime* next_midnight = g_date_time_add_days(midnight, 1);
+    new_log->roll_time = date_time_to_usec(next_midnight);
+    g_date_time_unref(next_midnight);
+    g_date_time_unref(midnight);
 
     return new_log;
 }
 
+static struct dated_chat_log*
+_create_chatlog(const char* const other, const char* const login)
+{
+    GDateTime* now = g_date_time_new_now_local();
+    auto_char char* filename = _get_log_filename(other, login, now, FALSE);
+
+    return _dated_log_new(filename, now);
+}
+
 static struct dated_chat_log*
 _create_groupchat_log(const char* const room, const char* const login)
 {
     GDateTime* now = g_date_time_new_now_local();
     auto_char char* filename = _get_log_filename(room, login, now, TRUE);
 
-    struct dated_chat_log* new_log = malloc(sizeof(struct dated_chat_log));
-    new_log->filename = strdup(filename);
-    new_log->date = now;
-
-    return new_log;
+    return _dated_log_new(filename, now);
 }
 
 static gboolean
 _log_roll_needed(struct dated_chat_log* dated_log)
 {
-    gboolean result = FALSE;
-    GDateTime* now = g_date_time_new_now_local();
-    if (g_date_time_get_day_of_year(dated_log->date) != g_date_time_get_day_of_year(now)) {
-        result = TRUE;
-    }
-    g_date_time_unref(now);
-
-    return result;
+    return g_get_real_time() >= dated_log->roll_time;
 }
 
 static void
 _free_chat_log(struct dated_chat_log* dated_log)
 {
     if (dated_log) {
+        _log_flush(dated_log);
+        if (dated_log->fd != -1) {
+            close(dated_log->fd);
+        }
+        g_string_free(dated_log->pending, TRUE);
         if (dated_log->filename) {
             g_free(dated_log->filename);
             dated_log->filename = NULL;
@@ -57,6 +57,7 @@ void chat_log_otr_msg_in(ProfMessage* message);
 void chat_log_pgp_msg_in(ProfMessage* message);
 void chat_log_omemo_msg_in(ProfMessage* message);
 
+void chat_log_process_events(void);
 void chat_log_close(void);
 
 void groupchat_log_init(void);
@@ -0,0 +1,509 @@
+/*
+ * chatlog_import.c
+ * vim: expandtab:ts=4:sts=4:sw=4
+ *
+ * Copyright (C) 2020 - 2023 Michael Vetter <jubalh@iodoru.org>
+ *
+ * This file is part of Profanity.
+ *
+ * Profanity is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Profanity is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Profanity.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give permission to
+ * link the code of portions of this program with the OpenSSL library under
+ * certain conditions as described in each individual source file, and
+ * distribute linked combinations including the two.
+ *
+ * You must obey the GNU General Public License in all respects for all of the
+ * code used other than OpenSSL. If you modify file(s) with this exception, you
+ * may extend this exception to your version of the file(s), but you are not
+ * obligated to do so. If you do not wish to do so, delete this exception
+ * statement from your version. If you delete this exception statement from all
+ * source files in the program, then also delete it here.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib.h>
+
+#include "log.h"
+#include "common.h"
+#include "chatlog_import.h"
+#include "database.h"
+#include "config/files.h"
+#include "ui/ui.h"
+#include "xmpp/xmpp.h"
+#include "xmpp/muc.h"
+
+// Files are parsed by a pool of worker threads and their messages are handed
+// to the database writer thread, which writes them in large transactions.
+#define CHAT_LOG_IMPORT_THREADS_MAX 8
+
+typedef struct chat_log_import_t
+{
+    gchar* barejid;
+    // own nick in rooms by room, nick where a room is not known
+    gchar* nick;
+    GHashTable* room_nicks;
+    gchar* dir;
+    // lines written after the import started are already in the database
+    gint64 started;
+    gint cancelled;
+    gint done;
+    // protects stats while the workers run
+    GMutex mutex;
+    ChatLogImportStats stats;
+} ChatLogImport;
+
+// A log file of a contact or room, chatlog.c writes one per day
+typedef struct chat_log_import_file_t
+{
+    gchar* path;
+    gchar* jid;
+    gchar* resource;
+    prof_msg_type_t type;
+} ChatLogImportFile;
+
+// The message being parsed, continuation lines of multi-line messages are
+// appended to it
+typedef struct chat_log_import_message_t
+{
+    gboolean valid;
+    gint64 timestamp;
+    gchar* name;
+    GString* text;
+} ChatLogImportMessage;
+
+static ChatLogImport* g_import;
+static GThread* g_import_thread;
+
+static void
+_import_file_free(ChatLogImportFile* file)
+{
+    g_free(file->path);
+    g_free(file->jid);
+    g_free(file->resource);
+    g_free(file);
+}
+
+static void
+_import_stats_add(ChatLogImportStats* stats, const ChatLogImportStats* const add)
+{
+    stats->files += add->files;
+    stats->failed += add->failed;
+    stats->bytes += add->bytes;
+    stats->lines += add->lines;
+    stats->messages += add->messages;
+    stats->malformed += add->malformed;
+    stats->skipped += add->skipped;
+}
+
+// Parse "<timestamp> - <name>: <text>" or "<timestamp> - *<name> <text>" as
+// written by chatlog.c, the latter for /me messages. The name ends at the
+// first ": ", a timestamp without an offset is taken to be in tz. header
+// points into line.
+gboolean
+chat_log_import_parse_header(const char* line, gsize len, GTimeZone* tz, ChatLogImportHeader* header)
+{
+    if (len == 0 || !g_ascii_isdigit(line[0])) {
+        return FALSE;
+    }
+
+    const char* sep = g_strstr_len(line, len, " - ");
+    char timestamp[64];
+    if (!sep || sep - line >= sizeof(timestamp)) {
+        return FALSE;
+    }
+
+    const char* rest = sep + 3;
+    const char* end = line + len;
+    const char* name_end;
+
+    header->me = rest < end && rest[0] == '*';
+    if (header->me) {
+        rest++;
+        name_end = memchr(rest, ' ', end - rest);
+        header->text = name_end ? name_end + 1 : NULL;
+    } else {
+        name_end = g_strstr_len(rest, end - rest, ": ");
+        header->text = name_end ? name_end + 2 : NULL;
+    }
+
+    if (!name_end || name_end == rest) {
+        return FALSE;
+    }
+
+    memcpy(timestamp, line, sep - line);
+    timestamp[sep - line] = '\0';
+    GDateTime* dt = g_date_time_new_from_iso8601(timestamp, tz);
+    if (!dt) {
+        return FALSE;
+    }
+    header->timestamp = date_time_to_usec(dt);
+    g_date_time_unref(dt);
+
+    header->name = rest;
+    header->name_len = name_end - rest;
+    header->text_len = end - header->text;
+
+    return TRUE;
+}
+
+// Own nick in room as far as it is known, the nick may have been another one
+// when older logs were written
+static const char*
+_import_own_nick(ChatLogImport* imp, const char* const room)
+{
+    const char* nick = g_hash_table_lookup(imp->room_nicks, room);
+    return nick ? nick : imp->nick;
+}
+
+static void
+_import_submit(ChatLogImport* imp, ChatLogImportFile* file, ChatLogImportMessage* msg, ChatLogImportStats* stats)
+{
+    if (!msg->valid) {
+        return;
+    }
+    msg->valid = FALSE;
+
+    if (msg->timestamp >= imp->started) {
+        stats->skipped++;
+        return;
+    }
+
+    gboolean added;
+    stats->messages++;
+
+    // chatlog.c logs own messages in rooms with the own nick, they are stored
+    // like the ones log_database_add_outgoing_muc() writes
+    if (file->type == PROF_MSG_TYPE_MUC && g_strcmp0(msg->name, _import_own_nick(imp, file->jid)) == 0) {
+        added = log_database_import_add(imp->barejid, NULL, file->jid, NULL, msg->text->str, msg->timestamp, file->type);
+    } else if (file->type == PROF_MSG_TYPE_MUC) {
+        added = log_database_import_add(file->jid, msg->name, imp->barejid, NULL, msg->text->str, msg->timestamp, file->type);
+    } else if (g_strcmp0(msg->name, "me") == 0) {
+        added = log_database_import_add(imp->barejid, NULL, file->jid, file->resource, msg->text->str, msg->timestamp, file->type);
+    } else {
+        added = log_database_import_add(file->jid, file->resource, imp->barejid, NULL, msg->text->str, msg->timestamp, file->type);
+    }
+
+    if (!added) {
+        g_atomic_int_set(&imp->cancelled, TRUE);
+    }
+}
+
+// Parse the mapped contents of a log file and queue its messages
+static void
+_import_parse(ChatLogImport* imp, ChatLogImportFile* file, const char* data, gsize length, ChatLogImportStats* stats)
+{
+    const char* end = data + length;
+    GTimeZone* tz = g_time_zone_new_local();
+    ChatLogImportMessage msg = { 0 };
+    ChatLogImportHeader header;
+
+    msg.text = g_string_new(NULL);
+
+    for (const char* line = data; line < end && !g_atomic_int_get(&imp->cancelled);) {
+        const char* eol = memchr(line, '\n', end - line);
+        gsize len = (eol ? eol : end) - line;
+        stats->lines++;
+
+        if (chat_log_import_parse_header(line, len, tz, &header)) {
+            _import_submit(imp, file, &msg, stats);
+
+            g_free(msg.name);
+            msg.name = g_strndup(header.name, header.name_len);
+            g_string_assign(msg.text, header.me ? "/me " : "");
+            g_string_append_len(msg.text, header.text, header.text_len);
+            msg.timestamp = header.timestamp;
+            msg.valid = TRUE;
+        } else if (msg.valid) {
+            g_string_append_c(msg.text, '\n');
+            g_string_append_len(msg.text, line, len);
+        } else {
+            stats->malformed++;
+        }
+
+        line = eol ? eol + 1 : end;
+    }
+    _import_submit(imp, file, &msg, stats);
+
+    g_string_free(msg.text, TRUE);
+    g_free(msg.name);
+    g_time_zone_unref(tz);
+}
+
+// Worker thread: map a log file and parse it. Files are not read into
+// memory, so large logs cost no more than their pages being touched.
+static void
+_import_file(gpointer data, gpointer user_data)
+{
+    ChatLogImportFile* file = data;
+    ChatLogImport* imp = user_data;
+    ChatLogImportStats stats = { 0 };
+
+    if (!g_atomic_int_get(&imp->cancelled)) {
+        GMappedFile* mapped = g_mapped_file_new(file->path, FALSE, NULL);
+        if (mapped) {
+            stats.files = 1;
+            stats.bytes = g_mapped_file_get_length(mapped);
+            _import_parse(imp, file, g_mapped_file_get_contents(mapped), stats.bytes, &stats);
+            g_mapped_file_unref(mapped);
+        } else {
+            stats.failed = 1;
+        }
+
+        g_mutex_lock(&imp->mutex);
+        _import_stats_add(&imp->stats, &stats);
+        g_mutex_unlock(&imp->mutex);
+    }
+
+    _import_file_free(file);
+}
+
+// Directories of private chats in rooms are named after the room and the nick
+// joined by '_', which is unusual in domains
+static gchar*
+_import_split_resource(char* jid)
+{
+    char* at = strchr(jid, '@');
+    char* sep = at ? strchr(at, '_') : NULL;
+
+    if (!sep) {
+        return NULL;
+    }
+
+    *sep = '\0';
+    return g_strdup(sep + 1);
+}
+
+// Queue the log files below dir, one directory per contact or room
+static void
+_import_scan(ChatLogImport* imp, GThreadPool* pool, const char* const dir, prof_msg_type_t type)
+{
+    GDir* contacts = g_dir_open(dir, 0, NULL);
+    if (!contacts) {
+        return;
+    }
+
+    const gchar* name;
+    while ((name = g_dir_read_name(contacts)) && !g_atomic_int_get(&imp->cancelled)) {
+        if (type == PROF_MSG_TYPE_CHAT && g_strcmp0(name, "rooms") == 0) {
+            continue;
+        }
+
+        auto_gchar gchar* path = g_build_filename(dir, name, NULL);
+        GDir* logs = g_dir_open(path, 0, NULL);
+        if (!logs) {
+            continue;
+        }
+
+        auto_char char* jid = str_replace(name, "_at_", "@");
+        auto_gchar gchar* resource = type == PROF_MSG_TYPE_CHAT ? _import_split_resource(jid) : NULL;
+
+        const gchar* log_name;
+        while ((log_name = g_dir_read_name(logs))) {
+            if (!g_str_has_suffix(log_name, ".log")) {
+                continue;
+            }
+
+            ChatLogImportFile* file = g_new0(ChatLogImportFile, 1);
+            file->path = g_build_filename(path, log_name, NULL);
+            file->jid = g_strdup(jid);
+            file->resource = g_strdup(resource);
+            file->type = resource ? PROF_MSG_TYPE_MUCPM : type;
+            g_thread_pool_push(pool, file, NULL);
+        }
+        g_dir_close(logs);
+    }
+    g_dir_close(contacts);
+}
+
+static ChatLogImport*
+_import_new(const char* const barejid, const char* const nick)
+{
+    if (!log_database_import_begin()) {
+        return NULL;
+    }
+
+    ChatLogImport* imp = g_new0(ChatLogImport, 1);
+    imp->barejid = g_strdup(barejid);
+    imp->nick = g_strdup(nick);
+    imp->room_nicks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    imp->dir = files_get_account_data_path(DIR_CHATLOGS, barejid);
+    imp->started = g_get_real_time();
+    g_mutex_init(&imp->mutex);
+
+    return imp;
+}
+
+static void
+_import_free(ChatLogImport* imp)
+{
+    g_free(imp->barejid);
+    g_free(imp->nick);
+    g_hash_table_destroy(imp->room_nicks);
+    g_free(imp->dir);
+    g_mutex_clear(&imp->mutex);
+    g_free(imp);
+}
+
+static void
+_import_run(ChatLogImport* imp)
+{
+    gint64 start = g_get_monotonic_time();
+    guint threads = CLAMP(g_get_num_processors(), 1, CHAT_LOG_IMPORT_THREADS_MAX);
+    GThreadPool* pool = g_thread_pool_new(_import_file, imp, threads, FALSE, NULL);
+
+    _import_scan(imp, pool, imp->dir, PROF_MSG_TYPE_CHAT);
+    auto_gchar gchar* rooms = g_build_filename(imp->dir, "rooms", NULL);
+    _import_scan(imp, pool, rooms, PROF_MSG_TYPE_MUC);
+
+    // waits for the queued files
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    DbImportStats db_stats;
+    log_database_import_end(&db_stats);
+
+    imp->stats.written = db_stats.written;
+    imp->stats.skipped += db_stats.skipped;
+    imp->stats.seconds = (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC;
+    imp->stats.cancelled = g_atomic_int_get(&imp->cancelled);
+}
+
+// Nicks of the bookmarked and joined rooms, only known while connected
+static void
+_import_add_room_nicks(ChatLogImport* imp)
+{
+    GList* bookmarks = bookmark_get_list();
+    for (GList* curr = bookmarks; curr; curr = g_list_next(curr)) {
+        Bookmark* bookmark = curr->data;
+        if (bookmark->nick) {
+            g_hash_table_replace(imp->room_nicks, g_strdup(bookmark->barejid), g_strdup(bookmark->nick));
+        }
+    }
+    g_list_free(bookmarks);
+
+    GList* rooms = muc_rooms();
+    for (GList* curr = rooms; curr; curr = g_list_next(curr)) {
+        const char* nick = muc_nick(curr->data);
+        if (nick) {
+            g_hash_table_replace(imp->room_nicks, g_strdup(curr->data), g_strdup(nick));
+        }
+    }
+    g_list_free(rooms);
+}
+
+// Import the logs of an account and wait for it, nick is the account's nick
+// in rooms. The database of the account has to be open. Returns FALSE if
+// another import is running.
+gboolean
+chat_log_import_run(const char* const barejid, const char* const nick, ChatLogImportStats* stats)
+{
+    ChatLogImport* imp = _import_new(barejid, nick);
+    if (!imp) {
+        return FALSE;
+    }
+
+    _import_run(imp);
+    *stats = imp->stats;
+    _import_free(imp);
+
+    return TRUE;
+}
+
+static gpointer
+_import_thread(gpointer data)
+{
+    ChatLogImport* imp = data;
+
+    _import_run(imp);
+    g_atomic_int_set(&imp->done, TRUE);
+
+    return NULL;
+}
+
+// Import the logs of the connected account in the background, the result is
+// shown by chat_log_import_process_events()
+gboolean
+chat_log_import_start(const char* const barejid, const char* const nick)
+{
+    if (g_import_thread) {
+        return FALSE;
+    }
+
+    g_import = _import_new(barejid, nick);
+    if (!g_import) {
+        return FALSE;
+    }
+    _import_add_room_nicks(g_import);
+
+    log_info("Importing chat logs from %s", g_import->dir);
+    g_import_thread = g_thread_new("chatlog-import", _import_thread, g_import);
+
+    return TRUE;
+}
+
+gboolean
+chat_log_import_running(void)
+{
+    return g_import_thread != NULL;
+}
+
+void
+chat_log_import_process_events(void)
+{
+    if (!g_import_thread || !g_atomic_int_get(&g_import->done)) {
+        return;
+    }
+
+    g_thread_join(g_import_thread);
+    g_import_thread = NULL;
+
+    auto_gchar gchar* result = chat_log_import_stats_str(&g_import->stats);
+    log_info("%s", result);
+    cons_show("%s", result);
+    cons_alert(NULL);
+
+    g_clear_pointer(&g_import, _import_free);
+}
+
+// Cancel a background import and wait for it
+void
+chat_log_import_close(void)
+{
+    if (!g_import_thread) {
+        return;
+    }
+
+    g_atomic_int_set(&g_import->cancelled, TRUE);
+    g_thread_join(g_import_thread);
+    g_import_thread = NULL;
+    g_clear_pointer(&g_import, _import_free);
+}
+
+gchar*
+chat_log_import_stats_str(const ChatLogImportStats* const stats)
+{
+    gdouble seconds = MAX(stats->seconds, 0.001);
+    gdouble mib = stats->bytes / (1024.0 * 1024.0);
+
+    return g_strdup_printf("Chat log import %s: %u files (%.1f MiB, %" G_GUINT64_FORMAT " lines) in %.1f seconds, "
+                           "%" G_GUINT64_FORMAT " messages written, %" G_GUINT64_FORMAT " skipped, %" G_GUINT64_FORMAT " malformed lines, %u unreadable files. "
+                           "%.0f messages/s, %.1f MiB/s.",
+                           stats->cancelled ? "cancelled" : "finished",
+                           stats->files, mib, stats->lines, stats->seconds,
+                           stats->written, stats->skipped, stats->malformed, stats->failed,
+                           stats->messages / seconds, mib / seconds);
+}
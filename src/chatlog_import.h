@@ -0,0 +1,75 @@
+/*
+ * chatlog_import.h
+ * vim: expandtab:ts=4:sts=4:sw=4
+ *
+ * Copyright (C) 2020 - 2023 Michael Vetter <jubalh@iodoru.org>
+ *
+ * This file is part of Profanity.
+ *
+ * Profanity is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Profanity is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Profanity.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give permission to
+ * link the code of portions of this program with the OpenSSL library under
+ * certain conditions as described in each individual source file, and
+ * distribute linked combinations including the two.
+ *
+ * You must obey the GNU General Public License in all respects for all of the
+ * code used other than OpenSSL. If you modify file(s) with this exception, you
+ * may extend this exception to your version of the file(s), but you are not
+ * obligated to do so. If you do not wish to do so, delete this exception
+ * statement from your version. If you delete this exception statement from all
+ * source files in the program, then also delete it here.
+ *
+ */
+
+#ifndef CHATLOG_IMPORT_H
+#define CHATLOG_IMPORT_H
+
+#include <glib.h>
+
+// Result of an import of the flat-file logs written by chatlog.c
+typedef struct chat_log_import_stats_t
+{
+    guint files;
+    guint failed;
+    guint64 bytes;
+    guint64 lines;
+    guint64 messages;
+    guint64 malformed;
+    guint64 written;
+    guint64 skipped;
+    gdouble seconds;
+    gboolean cancelled;
+} ChatLogImportStats;
+
+// The first line of a message in a log file, name and text point into the line
+typedef struct chat_log_import_header_t
+{
+    gint64 timestamp;
+    const char* name;
+    gsize name_len;
+    const char* text;
+    gsize text_len;
+    gboolean me;
+} ChatLogImportHeader;
+
+gboolean chat_log_import_run(const char* const barejid, const char* const nick, ChatLogImportStats* stats);
+gboolean chat_log_import_start(const char* const barejid, const char* const nick);
+gboolean chat_log_import_running(void);
+void chat_log_import_process_events(void);
+void chat_log_import_close(void);
+gchar* chat_log_import_stats_str(const ChatLogImportStats* const stats);
+gboolean chat_log_import_parse_header(const char* line, gsize len, GTimeZone* tz, ChatLogImportHeader* header);
+
+#endif
@@ -272,6 +272,9 @@ static Autocomplete status_ac;
 static Autocomplete status_state_ac;
 static Autocomplete logging_ac;
 static Autocomplete logging_group_ac;
+static Autocomplete logging_db_ac;
+static Autocomplete logging_db_sync_ac;
+static Autocomplete logging_db_retention_ac;
 static Autocomplete privacy_ac;
 static Autocomplete privacy_log_ac;
 static Autocomplete color_ac;
@@ -408,6 +411,8 @@ cmd_ac_init(void)
 
     log_ac = autocomplete_new();
     autocomplete_add(log_ac, "maxsize");
+    autocomplete_add(log_ac, "segments");
+    autocomplete_add(log_ac, "segmentsize");
     autocomplete_add(log_ac, "rotate");
     autocomplete_add(log_ac, "shared");
     autocomplete_add(log_ac, "where");
@@ -484,6 +489,9 @@ cmd_ac_init(void)
     autocomplete_add(account_set_ac, "auth");
     autocomplete_add(account_set_ac, "theme");
     autocomplete_add(account_set_ac, "session_alarm");
+    autocomplete_add(account_set_ac, "retention_chat");
+    autocomplete_add(account_set_ac, "retention_muc");
+    autocomplete_add(account_set_ac, "retention_mucpm");
 
     account_clear_ac = autocomplete_new();
     autocomplete_add(account_clear_ac, "password");
@@ -498,6 +506,9 @@ cmd_ac_init(void)
     autocomplete_add(account_clear_ac, "muc");
     autocomplete_add(account_clear_ac, "resource");
     autocomplete_add(account_clear_ac, "session_alarm");
+    autocomplete_add(account_clear_ac, "retention_chat");
+    autocomplete_add(account_clear_ac, "retention_muc");
+    autocomplete_add(account_clear_ac, "retention_mucpm");
 
     account_default_ac = autocomplete_new();
     autocomplete_add(account_default_ac, "set");
@@ -1084,6 +1095,26 @@ cmd_ac_init(void)
     logging_ac = autocomplete_new();
     autocomplete_add(logging_ac, "chat");
     autocomplete_add(logging_ac, "group");
+    autocomplete_add(logging_ac, "db");
+    autocomplete_add(logging_ac, "import");
+
+    logging_db_ac = autocomplete_new();
+    autocomplete_add(logging_db_ac, "batch");
+    autocomplete_add(logging_db_ac, "interval");
+    autocomplete_add(logging_db_ac, "cache");
+    autocomplete_add(logging_db_ac, "wal");
+    autocomplete_add(logging_db_ac, "sync");
+    autocomplete_add(logging_db_ac, "retention");
+
+    logging_db_sync_ac = autocomplete_new();
+    autocomplete_add(logging_db_sync_ac, "off");
+    autocomplete_add(logging_db_sync_ac, "normal");
+    autocomplete_add(logging_db_sync_ac, "full");
+
+    logging_db_retention_ac = autocomplete_new();
+    autocomplete_add(logging_db_retention_ac, "chat");
+    autocomplete_add(logging_db_retention_ac, "muc");
+    autocomplete_add(logging_db_retention_ac, "mucpm");
 
     privacy_ac = autocomplete_new();
     autocomplete_add(privacy_ac, "logging");
@@ -1709,6 +1740,9 @@ cmd_ac_reset(ProfWin* window)
     autocomplete_reset(status_state_ac);
     autocomplete_reset(logging_ac);
     autocomplete_reset(logging_group_ac);
+    autocomplete_reset(logging_db_ac);
+    autocomplete_reset(logging_db_sync_ac);
+    autocomplete_reset(logging_db_retention_ac);
     autocomplete_reset(privacy_ac);
     autocomplete_reset(privacy_log_ac);
     autocomplete_reset(color_ac);
@@ -1898,6 +1932,9 @@ cmd_ac_uninit(void)
     autocomplete_free(status_state_ac);
     autocomplete_free(logging_ac);
     autocomplete_free(logging_group_ac);
+    autocomplete_free(logging_db_ac);
+    autocomplete_free(logging_db_sync_ac);
+    autocomplete_free(logging_db_retention_ac);
     autocomplete_free(privacy_ac);
     autocomplete_free(privacy_log_ac);
     autocomplete_free(color_ac);
@@ -4287,6 +4324,26 @@ _logging_autocomplete(ProfWin* window, const char* const input, gboolean previou
     }
 
     result = autocomplete_param_with_ac(input, "/logging group", logging_group_ac, TRUE, previous);
+    if (result) {
+        return result;
+    }
+
+    result = autocomplete_param_with_func(input, "/logging db wal", prefs_autocomplete_boolean_choice, previous, NULL);
+    if (result) {
+        return result;
+    }
+
+    result = autocomplete_param_with_ac(input, "/logging db sync", logging_db_sync_ac, TRUE, previous);
+    if (result) {
+        return result;
+    }
+
+    result = autocomplete_param_with_ac(input, "/logging db retention", logging_db_retention_ac, TRUE, previous);
+    if (result) {
+        return result;
+    }
+
+    result = autocomplete_param_with_ac(input, "/logging db", logging_db_ac, TRUE, previous);
     return result;
 }
 
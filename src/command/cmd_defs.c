@@ -1654,23 +1654,44 @@ static const struct cmd_t command_defs[] = {
     },
 
     { CMD_PREAMBLE("/logging",
-                   parse_args, 2, 3, &cons_logging_setting)
+                   parse_args, 1, 4, &cons_logging_setting)
       CMD_MAINFUNC(cmd_logging)
       CMD_TAGS(
               CMD_TAG_CHAT)
       CMD_SYN(
-              "/logging chat|group on|off")
+              "/logging chat|group on|off",
+              "/logging db batch <messages>",
+              "/logging db interval <milliseconds>",
+              "/logging db cache <kilobytes>",
+              "/logging db wal on|off",
+              "/logging db sync off|normal|full",
+              "/logging db retention chat|muc|mucpm <policy>",
+              "/logging import")
       CMD_DESC(
               "Configure chat logging. "
               "Switch logging on or off. "
               "Chat logging will be enabled if /history is set to on. "
-              "When disabling this option, /history will also be disabled. ")
+              "When disabling this option, /history will also be disabled. "
+              "Messages are written to the database in batches by a background thread, a batch is committed when it is full or when its oldest message waited for the batch interval. "
+              "History pages read from the database are kept in a cache, its usage is shown by /logging. "
+              "Old messages are removed from the database by a background job according to the retention policies, it runs every 6 hours and after a policy changed. "
+              "Flat-file chat logs written by earlier versions can be imported into the database, messages already in the database are skipped.")
       CMD_ARGS(
               { "chat on|off", "Enable/Disable regular chat logging." },
-              { "group on|off", "Enable/Disable groupchat (room) logging." })
+              { "group on|off", "Enable/Disable groupchat (room) logging." },
+              { "db batch <messages>", "Number of messages written to the database in one transaction, default 50. Use 1 to write every message immediately." },
+              { "db interval <milliseconds>", "Maximum time a message waits before its batch is written, default 1000." },
+              { "db cache <kilobytes>", "Memory used to cache history pages, default 4096. Use 0 to disable the cache." },
+              { "db wal on|off", "Use SQLite write-ahead logging for the database, default on. Takes effect on the next connect." },
+              { "db sync off|normal|full", "SQLite synchronous level, default normal. 'off' is fastest but may lose the latest messages on power loss. Takes effect on the next connect." },
+              { "db retention chat|muc|mucpm <policy>", "How long messages of chats, rooms or room private messages are kept: 'forever' (default), '<days>d' or '<messages>' to keep the latest messages per conversation. Can be overridden per account, see /account." },
+              { "import", "Import the flat-file chat logs of the connected account into the database in the background. Use 'profanity --import-logs <account>' to import without connecting." })
       CMD_EXAMPLES(
               "/logging chat on",
-              "/logging group off")
+              "/logging group off",
+              "/logging db batch 100",
+              "/logging db retention muc 5000",
+              "/logging db retention chat 365d")
     },
 
     { CMD_PREAMBLE("/states",
@@ -1891,6 +1912,8 @@ static const struct cmd_t command_defs[] = {
               "/log where",
               "/log rotate on|off",
               "/log maxsize <bytes>",
+              "/log segments <count>",
+              "/log segmentsize <bytes>",
               "/log shared on|off",
               "/log level INFO|DEBUG|WARN|ERROR")
       CMD_DESC(
@@ -1899,6 +1922,8 @@ static const struct cmd_t command_defs[] = {
               { "where", "Show the current log file location." },
               { "rotate on|off", "Rotate log, default on. Does not take effect if you specified a filename yourself when starting Profanity." },
               { "maxsize <bytes>", "With rotate enabled, specifies the max log size, defaults to 10485760 (10MB)." },
+              { "segments <count>", "Number of rotated logs to keep, the oldest are removed. Default 20." },
+              { "segmentsize <bytes>", "Total size of the rotated logs to keep, the oldest are removed. Default 104857600 (100MB)." },
               { "shared on|off", "Share logs between all instances, default: on. When off, the process id will be included in the log filename. Does not take effect if you specified a filename yourself when starting Profanity." },
               {"level INFO|DEBUG|WARN|ERROR", "Set the log level. Default is INFO. Only works with default log file, not with user provided log file during startup via -f." })
     },
@@ -2070,6 +2095,7 @@ static const struct cmd_t command_defs[] = {
               "/account set <account> auth default|legacy",
               "/account set <account> theme <theme>",
               "/account set <account> session_alarm <max_sessions>",
+              "/account set <account> retention_chat|retention_muc|retention_mucpm <policy>",
               "/account clear <account> password",
               "/account clear <account> eval_password",
               "/account clear <account> server",
@@ -2080,7 +2106,8 @@ static const struct cmd_t command_defs[] = {
               "/account clear <account> clientid",
               "/account clear <account> muc",
               "/account clear <account> resource",
-              "/account clear <account> session_alarm")
+              "/account clear <account> session_alarm",
+              "/account clear <account> retention_chat|retention_muc|retention_mucpm")
       CMD_DESC(
               "Commands for creating and managing accounts. "
               "Calling with no arguments will display information for the current account.")
@@ -2118,6 +2145,7 @@ static const struct cmd_t command_defs[] = {
               { "set <account> auth legacy", "Allow legacy authentication." },
               { "set <account> theme <theme>", "Set the UI theme for the account." },
               { "set <account> session_alarm <max_sessions>", "Alarm about suspicious activity if sessions count exceeds max_sessions." },
+              { "set <account> retention_chat|retention_muc|retention_mucpm <policy>", "Override the global chat log retention for this account, see /logging." },
               { "clear <account> server", "Remove the server setting for this account." },
               { "clear <account> port", "Remove the port setting for this account." },
               { "clear <account> password", "Remove the password setting for this account." },
@@ -2129,7 +2157,8 @@ static const struct cmd_t command_defs[] = {
               { "clear <account> theme", "Clear the theme setting for the account, the global theme will be used." },
               { "clear <account> resource", "Remove the resource setting for this account." },
               { "clear <account> muc", "Remove the default MUC service setting." },
-              { "clear <account> session_alarm", "Disable the session alarm." })
+              { "clear <account> session_alarm", "Disable the session alarm." },
+              { "clear <account> retention_chat|retention_muc|retention_mucpm", "Remove the retention override, the global policy will be used." })
       CMD_EXAMPLES(
               "/account add me",
               "/account set me jid ulfhednar@valhalla.edda",
@@ -2261,17 +2290,61 @@ static const struct cmd_t command_defs[] = {
     },
 
     { CMD_PREAMBLE("/export",
-                   parse_args, 1, 1, NULL)
+                   parse_args, 1, 7, NULL)
       CMD_MAINFUNC(cmd_export)
       CMD_SYN(
-              "/export <filepath>")
-      CMD_DESC(
-              "Exports contacts to a csv file.")
-      CMD_ARGS(
-              { "<filepath>", "Path to the output file." })
+              "/export <filepath>",
+              "/export history <filepath> [format:jsonl|csv] [with:<contact>] [room:<room>] [after:<date>] [before:<date>]",
+              "/export history cancel")
+      CMD_DESC(
+              "Exports contacts to a csv file, or the messages stored in the chat log database. "
+              "Messages are written in timestamp order, one per line, as JSON objects or CSV records. "
+              "The history is exported in the background, a message is shown once it is done.")
+      CMD_ARGS(
+              { "<filepath>", "Path to the output file." },
+              { "history <filepath>", "Export the message history, an existing file is replaced once the export is complete." },
+              { "history cancel", "Stop the running export, an existing file is left untouched." },
+              { "format:jsonl|csv", "Output format, JSON Lines by default." },
+              { "with:<contact>", "Only messages of the one to one chat with a contact." },
+              { "room:<room>", "Only messages of a room." },
+              { "after:<date>", "Only messages from this day (YYYY-MM-DD) on." },
+              { "before:<date>", "Only messages before this day (YYYY-MM-DD)." })
       CMD_EXAMPLES(
               "/export /path/to/output.csv",
-              "/export ~/contacts.csv")
+              "/export ~/contacts.csv",
+              "/export history ~/history.jsonl",
+              "/export history ~/alice.csv format:csv with:alice@example.org after:2024-01-01")
+    },
+
+    { CMD_PREAMBLE("/search",
+                   parse_args_as_one, 1, 1, NULL)
+      CMD_MAINFUNC(cmd_search)
+      CMD_TAGS(
+              CMD_TAG_CHAT,
+              CMD_TAG_GROUPCHAT)
+      CMD_SYN(
+              "/search [with:<contact>] [room:<room>] [after:<date>] [before:<date>] <terms>",
+              "/search more",
+              "/search open <n>")
+      CMD_DESC(
+              "Search the messages stored in the chat log database, the best matches are listed first. "
+              "A message has to contain all terms. Quote several words to search for a phrase, "
+              "a term ending in '*' matches all words starting with it. "
+              "Dates are given as YYYY-MM-DD. "
+              "Results from chat rooms can be opened in the window of a room you are in.")
+      CMD_ARGS(
+              { "<terms>", "The words to search for." },
+              { "with:<contact>", "Only search the one to one chat with contact, by JID or nickname." },
+              { "room:<room>", "Only search the messages of a chat room." },
+              { "after:<date>", "Only search messages sent on or after date." },
+              { "before:<date>", "Only search messages sent before date." },
+              { "more", "Show the next results of the last search." },
+              { "open <n>", "Open the chat or room window at the n-th result of the last search." })
+      CMD_EXAMPLES(
+              "/search mead",
+              "/search with:thor@valhalla.edda \"mead hall\"",
+              "/search room:council@conference.valhalla.edda after:2023-01-01 ragna*",
+              "/search open 2")
     },
 
     { CMD_PREAMBLE("/cmd",
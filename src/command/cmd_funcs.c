@@ -61,6 +61,8 @@
 #include "profanity.h"
 #include "log.h"
 #include "common.h"
+#include "database.h"
+#include "chatlog_import.h"
 #include "command/cmd_funcs.h"
 #include "command/cmd_defs.h"
 #include "command/cmd_ac.h"
@@ -80,6 +82,7 @@
 #include "tools/plugin_download.h"
 #include "tools/bookmark_ignore.h"
 #include "tools/editor.h"
+#include "xmpp/message.h"
 #include "plugins/plugins.h"
 #include "ui/ui.h"
 #include "ui/window_list.h"
@@ -129,6 +132,7 @@ static void _who_roster(ProfWin* window, const char* const command, gchar** args
 static gboolean _cmd_execute(ProfWin* window, const char* const command, const char* const inp);
 static gboolean _cmd_execute_default(ProfWin* window, const char* inp);
 static gboolean _cmd_execute_alias(ProfWin* window, const char* const inp, gboolean* ran);
+static gboolean _search_parse_date(const char* const str, gint64* time);
 static gboolean
 _string_matches_one_of(const char* what, const char* is, bool is_can_be_null, const char* first, ...) __attribute__((sentinel));
 static gboolean
@@ -912,6 +916,25 @@ _account_set_max_sessions(char* account_name, char* max_sessions_raw)
     return TRUE;
 }
 
+gboolean
+_account_set_retention(char* account_name, char* type, char* policy)
+{
+    gint days, messages;
+    if (!log_database_parse_retention(policy, &days, &messages)) {
+        cons_show("Invalid retention policy '%s', use forever, <days>d or <messages>.", policy);
+        cons_show("");
+        return TRUE;
+    }
+
+    accounts_set_retention(account_name, type, policy);
+    if (g_strcmp0(session_get_account_name(), account_name) == 0) {
+        log_database_update_retention();
+    }
+    cons_show("Updated %s retention for account %s: %s", type, account_name, policy);
+    cons_show("");
+    return TRUE;
+}
+
 gboolean
 _account_set_presence_priority(char* account_name, char* presence, char* priority)
 {
@@ -1006,6 +1029,12 @@ cmd_account_set(ProfWin* window, const char* const command, gchar** args)
         return _account_set_auth(account_name, value);
     if (strcmp(property, "session_alarm") == 0)
         return _account_set_max_sessions(account_name, value);
+    if (strcmp(property, "retention_chat") == 0)
+        return _account_set_retention(account_name, "chat", value);
+    if (strcmp(property, "retention_muc") == 0)
+        return _account_set_retention(account_name, "muc", value);
+    if (strcmp(property, "retention_mucpm") == 0)
+        return _account_set_retention(account_name, "mucpm", value);
 
     if (valid_resource_presence_string(property)) {
         return _account_set_presence_priority(account_name, property, value);
@@ -1069,6 +1098,13 @@ cmd_account_clear(ProfWin* window, const char* const command, gchar** args)
     } else if (strcmp(property, "session_alarm") == 0) {
         accounts_clear_max_sessions(account_name);
         cons_show("Disabled session alarm for account %s", account_name);
+    } else if (strcmp(property, "retention_chat") == 0 || strcmp(property, "retention_muc") == 0 || strcmp(property, "retention_mucpm") == 0) {
+        const char* type = property + strlen("retention_");
+        accounts_clear_retention(account_name, type);
+        if (g_strcmp0(session_get_account_name(), account_name) == 0) {
+            log_database_update_retention();
+        }
+        cons_show("Removed %s retention for account %s", type, account_name);
     } else {
         cons_show("Invalid property: %s", property);
     }
@@ -1150,6 +1186,92 @@ _writecsv(int fd, const char* const str)
     return 0;
 }
 
+// The history export that is running and its file, 0 and NULL if there is none
+static guint export_request = 0;
+static gchar* export_path = NULL;
+
+static void
+_export_history_done(gboolean success, guint64 count, const GError* error, gpointer user_data)
+{
+    if (success) {
+        cons_show("Exported %" G_GUINT64_FORMAT " messages to %s.", count, export_path);
+    } else {
+        cons_show_error("Export to %s failed: %s", export_path, error ? error->message : "unknown error");
+    }
+
+    export_request = 0;
+    GFREE_SET_NULL(export_path);
+}
+
+// /export history <filepath> [format:jsonl|csv] [with:<contact>] [room:<room>] [after:<date>] [before:<date>]
+// /export history cancel
+static void
+_export_history(const char* const command, gchar** args)
+{
+    if (args[0] == NULL) {
+        cons_bad_cmd_usage(command);
+        return;
+    }
+
+    if (g_strcmp0(args[0], "cancel") == 0 && args[1] == NULL) {
+        if (!export_path) {
+            cons_show("No export is running.");
+            return;
+        }
+        log_database_cancel_history(export_request);
+        cons_show("Export to %s cancelled.", export_path);
+        export_request = 0;
+        GFREE_SET_NULL(export_path);
+        return;
+    }
+
+    if (export_path) {
+        cons_show("An export to %s is running, use '/export history cancel' to stop it.", export_path);
+        return;
+    }
+
+    db_export_format_t format = DB_EXPORT_JSONL;
+    auto_gchar gchar* with_jid = NULL;
+    const char* type = NULL;
+    gint64 after = 0;
+    gint64 before = 0;
+
+    for (int i = 1; args[i] != NULL; i++) {
+        const char* arg = args[i];
+
+        if (g_strcmp0(arg, "format:jsonl") == 0) {
+            format = DB_EXPORT_JSONL;
+        } else if (g_strcmp0(arg, "format:csv") == 0) {
+            format = DB_EXPORT_CSV;
+        } else if (g_str_has_prefix(arg, "with:")) {
+            const char* value = arg + strlen("with:");
+            const char* barejid = roster_barejid_from_name(value);
+            g_free(with_jid);
+            with_jid = g_strdup(barejid ? barejid : value);
+            type = "chat";
+        } else if (g_str_has_prefix(arg, "room:")) {
+            g_free(with_jid);
+            with_jid = g_strdup(arg + strlen("room:"));
+            type = "muc";
+        } else if (g_str_has_prefix(arg, "after:") || g_str_has_prefix(arg, "before:")) {
+            gboolean is_after = g_str_has_prefix(arg, "after:");
+            const char* value = strchr(arg, ':') + 1;
+            if (!_search_parse_date(value, is_after ? &after : &before)) {
+                cons_show("Invalid date '%s', use YYYY-MM-DD.", value);
+                return;
+            }
+        } else {
+            cons_bad_cmd_usage(command);
+            return;
+        }
+    }
+
+    auto_char char* path = get_expanded_path(args[0]);
+    export_path = g_strdup(path);
+    cons_show("Exporting messages to %s...", path);
+    export_request = log_database_export_async(path, format, with_jid, type, after, before, _export_history_done, NULL);
+}
+
 gboolean
 cmd_export(ProfWin* window, const char* const command, gchar** args)
 {
@@ -1159,6 +1281,12 @@ cmd_export(ProfWin* window, const char* const command, gchar** args)
         cons_show("You are not currently connected.");
         cons_show("");
         return TRUE;
+    } else if (g_strcmp0(args[0], "history") == 0) {
+        _export_history(command, &args[1]);
+        return TRUE;
+    } else if (args[1] != NULL) {
+        cons_bad_cmd_usage(command);
+        return TRUE;
     } else {
         int fd;
         GSList* list = NULL;
@@ -6425,6 +6553,7 @@ cmd_log(ProfWin* window, const char* const command, gchar** args)
         gboolean res = strtoi_range(value, &intval, PREFS_MIN_LOG_SIZE, INT_MAX, &err_msg);
         if (res) {
             prefs_set_max_log_size(intval);
+            log_reload_rotation();
             cons_show("Log maximum size set to %d bytes", intval);
         } else {
             cons_show(err_msg);
@@ -6432,8 +6561,35 @@ cmd_log(ProfWin* window, const char* const command, gchar** args)
         return TRUE;
     }
 
+    if (strcmp(subcmd, "segments") == 0) {
+        int intval = 0;
+        auto_char char* err_msg = NULL;
+        if (strtoi_range(value, &intval, 1, INT_MAX, &err_msg)) {
+            prefs_set_log_segments(intval);
+            log_reload_rotation();
+            cons_show("Keeping at most %d rotated logs", intval);
+        } else {
+            cons_show(err_msg);
+        }
+        return TRUE;
+    }
+
+    if (strcmp(subcmd, "segmentsize") == 0) {
+        int intval = 0;
+        auto_char char* err_msg = NULL;
+        if (strtoi_range(value, &intval, PREFS_MIN_LOG_SIZE, INT_MAX, &err_msg)) {
+            prefs_set_log_segments_size(intval);
+            log_reload_rotation();
+            cons_show("Rotated logs limited to %d bytes in total", intval);
+        } else {
+            cons_show(err_msg);
+        }
+        return TRUE;
+    }
+
     if (strcmp(subcmd, "rotate") == 0) {
         _cmd_set_boolean_preference(value, "Log rotate", PREF_LOG_ROTATE);
+        log_reload_rotation();
         return TRUE;
     }
 
@@ -6448,6 +6604,7 @@ cmd_log(ProfWin* window, const char* const command, gchar** args)
         if (log_level_from_string(value, &prof_log_level) == 0) {
             log_close();
             log_init(prof_log_level, NULL);
+            connection_reload_log_level();
 
             cons_show("Log level changed to: %s.", value);
             return TRUE;
@@ -6887,6 +7044,89 @@ cmd_logging(ProfWin* window, const char* const command, gchar** args)
         return TRUE;
     } else if (g_strcmp0(args[0], "group") == 0 && args[1] != NULL) {
         return _cmd_set_boolean_preference(args[1], "Groupchat logging", PREF_GRLOG);
+    } else if (g_strcmp0(args[0], "import") == 0 && args[1] == NULL) {
+        if (connection_get_status() != JABBER_CONNECTED) {
+            cons_show("You are not currently connected.");
+        } else if (chat_log_import_running()) {
+            cons_show("The chat logs are already being imported.");
+        } else {
+            auto_char char* barejid = connection_get_barejid();
+            ProfAccount* account = accounts_get_account(session_get_account_name());
+            if (account && chat_log_import_start(barejid, account->muc_nick)) {
+                cons_show("Importing chat logs into the database in the background.");
+            } else {
+                cons_show_error("Could not start the chat log import.");
+            }
+            account_free(account);
+        }
+        return TRUE;
+    } else if (g_strcmp0(args[0], "db") == 0 && args[1] != NULL && args[2] != NULL) {
+        int intval = 0;
+        auto_char char* err_msg = NULL;
+
+        if (g_strcmp0(args[1], "batch") == 0) {
+            if (strtoi_range(args[2], &intval, 1, 10000, &err_msg)) {
+                prefs_set_dblog_batch_size(intval);
+                cons_show("Database logging batch size set to %d messages.", intval);
+            } else {
+                cons_show(err_msg);
+            }
+            return TRUE;
+        } else if (g_strcmp0(args[1], "interval") == 0) {
+            if (strtoi_range(args[2], &intval, 0, 60000, &err_msg)) {
+                prefs_set_dblog_batch_interval(intval);
+                cons_show("Database logging batch interval set to %d milliseconds.", intval);
+            } else {
+                cons_show(err_msg);
+            }
+            return TRUE;
+        } else if (g_strcmp0(args[1], "cache") == 0) {
+            if (strtoi_range(args[2], &intval, 0, 1024 * 1024, &err_msg)) {
+                prefs_set_dblog_cache_size(intval);
+                log_database_trim_cache();
+                if (intval == 0) {
+                    cons_show("Database history cache disabled.");
+                } else {
+                    cons_show("Database history cache set to %d KiB.", intval);
+                }
+            } else {
+                cons_show(err_msg);
+            }
+            return TRUE;
+        } else if (g_strcmp0(args[1], "wal") == 0) {
+            _cmd_set_boolean_preference(args[2], "Database write-ahead log", PREF_DBLOG_WAL);
+            cons_show("Setting takes effect on the next connect.");
+            return TRUE;
+        } else if (g_strcmp0(args[1], "sync") == 0) {
+            if (g_strcmp0(args[2], "off") == 0 || g_strcmp0(args[2], "normal") == 0 || g_strcmp0(args[2], "full") == 0) {
+                prefs_set_string(PREF_DBLOG_SYNC, args[2]);
+                cons_show("Database synchronous level set to: %s. Setting takes effect on the next connect.", args[2]);
+                return TRUE;
+            }
+        } else if (g_strcmp0(args[1], "retention") == 0 && args[3] != NULL) {
+            preference_t pref;
+            if (g_strcmp0(args[2], "chat") == 0) {
+                pref = PREF_DBLOG_RETENTION_CHAT;
+            } else if (g_strcmp0(args[2], "muc") == 0) {
+                pref = PREF_DBLOG_RETENTION_MUC;
+            } else if (g_strcmp0(args[2], "mucpm") == 0) {
+                pref = PREF_DBLOG_RETENTION_MUCPM;
+            } else {
+                cons_bad_cmd_usage(command);
+                return TRUE;
+            }
+
+            gint days, messages;
+            if (!log_database_parse_retention(args[3], &days, &messages)) {
+                cons_show("Invalid retention policy '%s', use forever, <days>d or <messages>.", args[3]);
+                return TRUE;
+            }
+
+            prefs_set_string(pref, args[3]);
+            log_database_update_retention();
+            cons_show("Database retention for %s messages set to: %s.", args[2], args[3]);
+            return TRUE;
+        }
     }
 
     cons_bad_cmd_usage(command);
@@ -9826,8 +10066,8 @@ cmd_strophe(ProfWin* window, const char* const command, gchar** args)
         int verbosity;
         auto_gchar gchar* err_msg = NULL;
         if (string_to_verbosity(args[1], &verbosity, &err_msg)) {
-            xmpp_ctx_set_verbosity(connection_get_ctx(), verbosity);
             prefs_set_string(PREF_STROPHE_VERBOSITY, args[1]);
+            connection_reload_log_level();
             return TRUE;
         } else {
             cons_show(err_msg);
@@ -10795,3 +11035,272 @@ cmd_vcard_save(ProfWin* window, const char* const command, gchar** args)
     cons_show("User vCard uploaded");
     return TRUE;
 }
+
+// Results of the last /search, kept for /search open
+static GSList* search_results = NULL;
+// The search that is running, 0 if there is none
+static guint search_request = 0;
+// Terms and filters of the last /search, kept for /search more
+static gchar** search_words = NULL;
+static gchar* search_with_jid = NULL;
+static const char* search_type = NULL;
+static gint64 search_after = 0;
+static gint64 search_before = 0;
+// Whether the last page was full, so there may be more results
+static gboolean search_has_more = FALSE;
+
+// Split the search input at spaces, "quoted text" is kept together as a phrase
+static gchar**
+_search_split_terms(const char* const inp)
+{
+    GPtrArray* terms = g_ptr_array_new();
+    GString* term = g_string_new(NULL);
+    gboolean in_quotes = FALSE;
+
+    for (const char* c = inp;; c++) {
+        if (*c == '"') {
+            in_quotes = !in_quotes;
+            continue;
+        }
+        if (*c == '\0' || (*c == ' ' && !in_quotes)) {
+            if (term->len > 0) {
+                g_ptr_array_add(terms, g_strdup(term->str));
+                g_string_truncate(term, 0);
+            }
+            if (*c == '\0') {
+                break;
+            }
+            continue;
+        }
+        g_string_append_c(term, *c);
+    }
+
+    g_string_free(term, TRUE);
+    g_ptr_array_add(terms, NULL);
+
+    return (gchar**)g_ptr_array_free(terms, FALSE);
+}
+
+// Parse a YYYY-MM-DD date into the time its day starts in the local timezone
+static gboolean
+_search_parse_date(const char* const str, gint64* time)
+{
+    int year, month, day;
+    char trailing;
+
+    if (sscanf(str, "%4d-%2d-%2d%c", &year, &month, &day, &trailing) != 3 || !g_date_valid_dmy(day, month, year)) {
+        return FALSE;
+    }
+
+    GDateTime* midnight = g_date_time_new_local(year, month, day, 0, 0, 0);
+    if (!midnight) {
+        return FALSE;
+    }
+    *time = date_time_to_usec(midnight);
+    g_date_time_unref(midnight);
+
+    return TRUE;
+}
+
+static void
+_search_open(const char* const num)
+{
+    if (search_results == NULL) {
+        cons_show("No search results, use '/search <terms>' first.");
+        return;
+    }
+
+    int index;
+    auto_char char* err_msg = NULL;
+    if (!strtoi_range(num, &index, 1, g_slist_length(search_results), &err_msg)) {
+        cons_show(err_msg);
+        return;
+    }
+
+    ProfMessage* result = g_slist_nth_data(search_results, index - 1);
+    if ((result->type != PROF_MSG_TYPE_CHAT && result->type != PROF_MSG_TYPE_MUC) || result->timestamp == NULL) {
+        cons_show("Only results from chats and chat rooms can be opened.");
+        return;
+    }
+
+    auto_char char* mybarejid = connection_get_barejid();
+    const char* contact = g_strcmp0(result->from_jid->barejid, mybarejid) == 0 ? result->to_jid->barejid : result->from_jid->barejid;
+
+    if (result->type == PROF_MSG_TYPE_MUC) {
+        ProfMucWin* mucwin = wins_get_muc(contact);
+        if (!mucwin) {
+            cons_show("You are not in %s, join the room to open the result.", contact);
+            return;
+        }
+        ui_focus_win((ProfWin*)mucwin);
+        mucwin_db_history_from(mucwin, result->timestamp, result->db_id);
+        return;
+    }
+
+    ProfChatWin* chatwin = wins_get_chat(contact);
+    if (!chatwin) {
+        chatwin = chatwin_new(contact);
+    }
+    ui_focus_win((ProfWin*)chatwin);
+    chatwin_db_history_from(chatwin, result->timestamp, result->db_id);
+}
+
+// Print a page of search results, see cmd_search(). The numbering continues
+// after the results already shown.
+static void
+_search_show_results(GSList* results, gpointer user_data)
+{
+    search_request = 0;
+
+    if (results == NULL) {
+        search_has_more = FALSE;
+        cons_show(search_results ? "No more messages found." : "No messages found.");
+        return;
+    }
+
+    search_has_more = g_slist_length(results) == SEARCH_RESULTS_MAX;
+    int index = g_slist_length(search_results) + 1;
+    search_results = g_slist_concat(search_results, results);
+
+    cons_show("");
+    cons_show("Search results:");
+    for (GSList* curr = results; curr; curr = g_slist_next(curr), index++) {
+        ProfMessage* result = curr->data;
+        auto_gchar gchar* date = NULL;
+        if (result->timestamp) {
+            GDateTime* local = g_date_time_to_local(result->timestamp);
+            date = g_date_time_format(local, "%Y-%m-%d %H:%M");
+            g_date_time_unref(local);
+        }
+
+        // own messages in rooms have no nick
+        if (result->type == PROF_MSG_TYPE_MUC && result->from_jid->resourcepart) {
+            cons_show("  %2d. %s %s (%s): %s", index, date ? date : "", result->from_jid->barejid, result->from_jid->resourcepart, result->plain);
+        } else {
+            cons_show("  %2d. %s %s -> %s: %s", index, date ? date : "", result->from_jid->barejid, result->to_jid->barejid, result->plain);
+        }
+    }
+    cons_show("Use '/search open <n>' to open the chat at a result.");
+    if (search_has_more) {
+        cons_show("Use '/search more' for more results.");
+    }
+}
+
+// Fetch the page after the last result of the previous search
+static void
+_search_more(void)
+{
+    if (search_request) {
+        cons_show("The search is still running.");
+        return;
+    }
+    if (search_words == NULL) {
+        cons_show("No search results, use '/search <terms>' first.");
+        return;
+    }
+    if (!search_has_more) {
+        cons_show("There are no more results.");
+        return;
+    }
+
+    ProfMessage* last = g_slist_last(search_results)->data;
+    search_request = log_database_search_async(search_words, search_with_jid, search_type, search_after, search_before, last->db_id, _search_show_results, NULL);
+}
+
+gboolean
+cmd_search(ProfWin* window, const char* const command, gchar** args)
+{
+    if (connection_get_status() != JABBER_CONNECTED) {
+        cons_show("You are not currently connected.");
+        return TRUE;
+    }
+
+    auto_gcharv gchar** terms = _search_split_terms(args[0]);
+    if (terms[0] == NULL) {
+        cons_bad_cmd_usage(command);
+        return TRUE;
+    }
+
+    if (g_strcmp0(terms[0], "open") == 0 && terms[1] && !terms[2]) {
+        _search_open(terms[1]);
+        return TRUE;
+    }
+
+    if (g_strcmp0(terms[0], "more") == 0 && !terms[1]) {
+        _search_more();
+        return TRUE;
+    }
+
+    if (!log_database_search_available()) {
+        cons_show("Message search is not available, the chat log database has no search index.");
+        return TRUE;
+    }
+
+    auto_gchar gchar* with_jid = NULL;
+    gint64 after = 0;
+    gint64 before = 0;
+    const char* type = NULL;
+    GPtrArray* words = g_ptr_array_new();
+
+    // take the filters out, the remaining words are searched for
+    for (int i = 0; terms[i] != NULL; i++) {
+        const gchar* term = terms[i];
+        gint64* date = NULL;
+        const char* value = NULL;
+
+        if (g_str_has_prefix(term, "with:")) {
+            value = term + strlen("with:");
+            const char* barejid = roster_barejid_from_name(value);
+            g_free(with_jid);
+            with_jid = g_strdup(barejid ? barejid : value);
+            type = "chat";
+        } else if (g_str_has_prefix(term, "room:")) {
+            g_free(with_jid);
+            with_jid = g_strdup(term + strlen("room:"));
+            type = "muc";
+        } else if (g_str_has_prefix(term, "after:")) {
+            value = term + strlen("after:");
+            date = &after;
+        } else if (g_str_has_prefix(term, "before:")) {
+            value = term + strlen("before:");
+            date = &before;
+        } else {
+            g_ptr_array_add(words, (gpointer)term);
+        }
+
+        if (date) {
+            if (!_search_parse_date(value, date)) {
+                cons_show("Invalid date '%s', use YYYY-MM-DD.", value);
+                g_ptr_array_free(words, TRUE);
+                return TRUE;
+            }
+        }
+    }
+
+    if (words->len == 0) {
+        cons_bad_cmd_usage(command);
+        g_ptr_array_free(words, TRUE);
+        return TRUE;
+    }
+    g_ptr_array_add(words, NULL);
+
+    // a search still running is replaced
+    log_database_cancel_history(search_request);
+    g_slist_free_full(search_results, (GDestroyNotify)message_free);
+    search_results = NULL;
+    search_has_more = FALSE;
+
+    g_strfreev(search_words);
+    search_words = g_strdupv((gchar**)words->pdata);
+    g_free(search_with_jid);
+    search_with_jid = g_strdup(with_jid);
+    search_type = type;
+    search_after = after;
+    search_before = before;
+    g_ptr_array_free(words, TRUE);
+
+    search_request = log_database_search_async(search_words, search_with_jid, search_type, search_after, search_before, 0, _search_show_results, NULL);
+
+    return TRUE;
+}
+
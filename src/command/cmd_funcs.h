@@ -269,4 +269,6 @@ gboolean cmd_vcard_refresh(ProfWin* window, const char* const command, gchar** a
 gboolean cmd_vcard_set(ProfWin* window, const char* const command, gchar** args);
 gboolean cmd_vcard_save(ProfWin* window, const char* const command, gchar** args);
 
+gboolean cmd_search(ProfWin* window, const char* const command, gchar** args);
+
 #endif
@@ -63,6 +63,7 @@
 #include "log.h"
 #include "common.h"
 #include "config/files.h"
+#include "tools/textwidth.h"
 
 #ifdef HAVE_GIT_VERSION
 #include "gitversion.h"
@@ -330,19 +331,7 @@ utf8_display_len(const char* const str)
         return 0;
     }
 
-    int len = 0;
-    gchar* curr = g_utf8_offset_to_pointer(str, 0);
-    while (*curr != '\0') {
-        gunichar curru = g_utf8_get_char(curr);
-        if (g_unichar_iswide(curru)) {
-            len += 2;
-        } else {
-            len++;
-        }
-        curr = g_utf8_next_char(curr);
-    }
-
-    return len;
+    return textwidth_str(str);
 }
 
 char*
@@ -774,6 +763,48 @@ unique_filename_from_url(const char* url, const char* path)
     return unique_filename;
 }
 
+/**
+ * Converts a date and time to microseconds since the Unix epoch.
+ *
+ * @param dt The date and time to convert.
+ * @return The microseconds since 1970-01-01 00:00:00 UTC.
+ */
+gint64
+date_time_to_usec(GDateTime* dt)
+{
+    return g_date_time_to_unix(dt) * G_USEC_PER_SEC + g_date_time_get_microsecond(dt);
+}
+
+/**
+ * Creates a date and time in the local timezone from microseconds since the
+ * Unix epoch, the inverse of `date_time_to_usec()`.
+ *
+ * @param usec The microseconds since 1970-01-01 00:00:00 UTC.
+ * @return The date and time, or NULL if it is out of range.
+ *
+ * @note Remember to free the returned value using `g_date_time_unref()`.
+ */
+GDateTime*
+date_time_new_from_usec(gint64 usec)
+{
+    gint64 secs = usec / G_USEC_PER_SEC;
+    gint64 rest = usec % G_USEC_PER_SEC;
+    if (rest < 0) {
+        secs--;
+        rest += G_USEC_PER_SEC;
+    }
+
+    GDateTime* local = g_date_time_new_from_unix_local(secs);
+    if (!local) {
+        return NULL;
+    }
+
+    GDateTime* dt = g_date_time_add(local, rest);
+    g_date_time_unref(local);
+
+    return dt;
+}
+
 void
 glib_hash_table_free(GHashTable* hash_table)
 {
@@ -193,6 +193,9 @@ gchar** format_call_external_argv(const char* template, const char* url, const c
 gchar* unique_filename_from_url(const char* url, const char* path);
 gchar* get_expanded_path(const char* path);
 
+gint64 date_time_to_usec(GDateTime* dt);
+GDateTime* date_time_new_from_usec(gint64 usec);
+
 void glib_hash_table_free(GHashTable* hash_table);
 char* basename_from_url(const char* url);
 
@@ -552,6 +552,14 @@ accounts_set_max_sessions(const char* const account_name, const int value)
     _accounts_set_int_option(account_name, "max.sessions", value);
 }
 
+// Retention policy of the chat log for a message type (chat, muc, mucpm)
+void
+accounts_set_retention(const char* const account_name, const char* const type, const char* const value)
+{
+    auto_gchar gchar* option = g_strdup_printf("retention.%s", type);
+    _accounts_set_string_option(account_name, option, value);
+}
+
 void
 accounts_clear_password(const char* const account_name)
 {
@@ -624,6 +632,13 @@ accounts_clear_max_sessions(const char* const account_name)
     _accounts_clear_string_option(account_name, "max.sessions");
 }
 
+void
+accounts_clear_retention(const char* const account_name, const char* const type)
+{
+    auto_gchar gchar* option = g_strdup_printf("retention.%s", type);
+    _accounts_clear_string_option(account_name, option);
+}
+
 void
 accounts_add_otr_policy(const char* const account_name, const char* const contact_jid, const char* const policy)
 {
@@ -872,6 +887,16 @@ accounts_get_max_sessions(const char* const account_name)
     return g_key_file_get_integer(accounts, account_name, "max.sessions", 0);
 }
 
+gchar*
+accounts_get_retention(const char* const account_name, const char* const type)
+{
+    if (!accounts_account_exists(account_name)) {
+        return NULL;
+    }
+    auto_gchar gchar* option = g_strdup_printf("retention.%s", type);
+    return g_key_file_get_string(accounts, account_name, option, NULL);
+}
+
 void
 accounts_set_login_presence(const char* const account_name, const char* const value)
 {
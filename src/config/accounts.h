@@ -92,6 +92,8 @@ void accounts_set_client(const char* const account_name, const char* const value
 void accounts_set_theme(const char* const account_name, const char* const value);
 void accounts_set_max_sessions(const char* const account_name, const int value);
 int accounts_get_max_sessions(const char* const account_name);
+void accounts_set_retention(const char* const account_name, const char* const type, const char* const value);
+gchar* accounts_get_retention(const char* const account_name, const char* const type);
 void accounts_clear_password(const char* const account_name);
 void accounts_clear_eval_password(const char* const account_name);
 void accounts_clear_server(const char* const account_name);
@@ -104,6 +106,7 @@ void accounts_clear_theme(const char* const account_name);
 void accounts_clear_muc(const char* const account_name);
 void accounts_clear_resource(const char* const account_name);
 void accounts_clear_max_sessions(const char* const account_name);
+void accounts_clear_retention(const char* const account_name, const char* const type);
 void accounts_add_otr_policy(const char* const account_name, const char* const contact_jid, const char* const policy);
 void accounts_add_omemo_state(const char* const account_name, const char* const contact_jid, gboolean enabled);
 void accounts_add_ox_state(const char* const account_name, const char* const contact_jid, gboolean enabled);
@@ -724,6 +724,86 @@ prefs_set_max_log_size(gint value)
     g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "maxsize", value);
 }
 
+gint
+prefs_get_log_segments(void)
+{
+    if (!g_key_file_has_key(prefs, PREF_GROUP_LOGGING, "segments", NULL)) {
+        return PREFS_LOG_SEGMENTS_DEFAULT;
+    } else {
+        return g_key_file_get_integer(prefs, PREF_GROUP_LOGGING, "segments", NULL);
+    }
+}
+
+void
+prefs_set_log_segments(gint value)
+{
+    g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "segments", value);
+}
+
+gint
+prefs_get_log_segments_size(void)
+{
+    if (!g_key_file_has_key(prefs, PREF_GROUP_LOGGING, "segments.maxsize", NULL)) {
+        return PREFS_LOG_SEGMENTS_SIZE_DEFAULT;
+    } else {
+        return g_key_file_get_integer(prefs, PREF_GROUP_LOGGING, "segments.maxsize", NULL);
+    }
+}
+
+void
+prefs_set_log_segments_size(gint value)
+{
+    g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "segments.maxsize", value);
+}
+
+gint
+prefs_get_dblog_batch_size(void)
+{
+    if (!g_key_file_has_key(prefs, PREF_GROUP_LOGGING, "dblog.batch", NULL)) {
+        return PREFS_DBLOG_BATCH_DEFAULT;
+    } else {
+        return g_key_file_get_integer(prefs, PREF_GROUP_LOGGING, "dblog.batch", NULL);
+    }
+}
+
+void
+prefs_set_dblog_batch_size(gint value)
+{
+    g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "dblog.batch", value);
+}
+
+gint
+prefs_get_dblog_batch_interval(void)
+{
+    if (!g_key_file_has_key(prefs, PREF_GROUP_LOGGING, "dblog.batch.interval", NULL)) {
+        return PREFS_DBLOG_BATCH_INTERVAL_DEFAULT;
+    } else {
+        return g_key_file_get_integer(prefs, PREF_GROUP_LOGGING, "dblog.batch.interval", NULL);
+    }
+}
+
+void
+prefs_set_dblog_batch_interval(gint value)
+{
+    g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "dblog.batch.interval", value);
+}
+
+gint
+prefs_get_dblog_cache_size(void)
+{
+    if (!g_key_file_has_key(prefs, PREF_GROUP_LOGGING, "dblog.cache", NULL)) {
+        return PREFS_DBLOG_CACHE_DEFAULT;
+    } else {
+        return g_key_file_get_integer(prefs, PREF_GROUP_LOGGING, "dblog.cache", NULL);
+    }
+}
+
+void
+prefs_set_dblog_cache_size(gint value)
+{
+    g_key_file_set_integer(prefs, PREF_GROUP_LOGGING, "dblog.cache", value);
+}
+
 gint
 prefs_get_inpblock(void)
 {
@@ -1816,6 +1896,11 @@ _get_group(preference_t pref)
     case PREF_ADV_NOTIFY_DISCO_OR_VERSION:
         return PREF_GROUP_NOTIFICATIONS;
     case PREF_DBLOG:
+    case PREF_DBLOG_WAL:
+    case PREF_DBLOG_SYNC:
+    case PREF_DBLOG_RETENTION_CHAT:
+    case PREF_DBLOG_RETENTION_MUC:
+    case PREF_DBLOG_RETENTION_MUCPM:
     case PREF_CHLOG:
     case PREF_GRLOG:
     case PREF_LOG_ROTATE:
@@ -1966,6 +2051,16 @@ _get_key(preference_t pref)
         return "chlog";
     case PREF_DBLOG:
         return "dblog";
+    case PREF_DBLOG_WAL:
+        return "dblog.wal";
+    case PREF_DBLOG_SYNC:
+        return "dblog.sync";
+    case PREF_DBLOG_RETENTION_CHAT:
+        return "dblog.retention.chat";
+    case PREF_DBLOG_RETENTION_MUC:
+        return "dblog.retention.muc";
+    case PREF_DBLOG_RETENTION_MUCPM:
+        return "dblog.retention.mucpm";
     case PREF_GRLOG:
         return "grlog";
     case PREF_AUTOAWAY_CHECK:
@@ -2202,6 +2297,7 @@ _get_default_boolean(preference_t pref)
     case PREF_MOOD:
     case PREF_STROPHE_SM_ENABLED:
     case PREF_STROPHE_SM_RESEND:
+    case PREF_DBLOG_WAL:
         return TRUE;
     case PREF_PGP_PUBKEY_AUTOIMPORT:
     default:
@@ -2310,6 +2406,12 @@ _get_default_string(preference_t pref)
         return "0";
     case PREF_DBLOG:
         return "on";
+    case PREF_DBLOG_SYNC:
+        return "normal";
+    case PREF_DBLOG_RETENTION_CHAT:
+    case PREF_DBLOG_RETENTION_MUC:
+    case PREF_DBLOG_RETENTION_MUCPM:
+        return "forever";
     default:
         return NULL;
     }
@@ -43,6 +43,12 @@
 
 #define PREFS_MIN_LOG_SIZE 64
 #define PREFS_MAX_LOG_SIZE (10 * 1024 * 1024)
+#define PREFS_LOG_SEGMENTS_DEFAULT      20
+#define PREFS_LOG_SEGMENTS_SIZE_DEFAULT (100 * 1024 * 1024)
+
+#define PREFS_DBLOG_BATCH_DEFAULT          50
+#define PREFS_DBLOG_BATCH_INTERVAL_DEFAULT 1000
+#define PREFS_DBLOG_CACHE_DEFAULT          4096
 
 // represents all settings in .profrc
 // each enum value is mapped to a group and key in .profrc (see preferences.c)
@@ -127,6 +133,11 @@ typedef enum {
     PREF_NOTIFY_MENTION_WHOLE_WORD,
     PREF_CHLOG,
     PREF_DBLOG,
+    PREF_DBLOG_WAL,
+    PREF_DBLOG_SYNC,
+    PREF_DBLOG_RETENTION_CHAT,
+    PREF_DBLOG_RETENTION_MUC,
+    PREF_DBLOG_RETENTION_MUCPM,
     PREF_GRLOG,
     PREF_AUTOAWAY_CHECK,
     PREF_AUTOAWAY_MODE,
@@ -222,6 +233,16 @@ gint prefs_get_notify_remind(void);
 
 void prefs_set_max_log_size(gint value);
 gint prefs_get_max_log_size(void);
+void prefs_set_log_segments(gint value);
+gint prefs_get_log_segments(void);
+void prefs_set_log_segments_size(gint value);
+gint prefs_get_log_segments_size(void);
+void prefs_set_dblog_batch_size(gint value);
+gint prefs_get_dblog_batch_size(void);
+void prefs_set_dblog_batch_interval(gint value);
+gint prefs_get_dblog_batch_interval(void);
+void prefs_set_dblog_cache_size(gint value);
+gint prefs_get_dblog_cache_size(void);
 gint prefs_get_priority(void);
 void prefs_set_reconnect(gint value);
 gint prefs_get_reconnect(void);
@@ -38,6 +38,7 @@
 #include <sys/stat.h>
 #include <sqlite3.h>
 #include <glib.h>
+#include <gio/gio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,30 +49,483 @@
 #include "config/files.h"
 #include "database.h"
 #include "config/preferences.h"
+#include "config/accounts.h"
 #include "xmpp/xmpp.h"
 #include "xmpp/message.h"
 
-static sqlite3* g_chatlog_database;
+// Statements used on the hot paths. They are compiled once per connection on
+// first use and kept until log_database_close().
+typedef enum {
+    DB_STMT_INSERT_MESSAGE,
+    DB_STMT_APPLY_CORRECTION,
+    DB_STMT_SELECT_JID,
+    DB_STMT_INSERT_JID,
+    DB_STMT_FIRST_MESSAGE,
+    DB_STMT_LAST_MESSAGE,
+    DB_STMT_PREVIOUS_CHAT_LAST_ASC,
+    DB_STMT_PREVIOUS_CHAT_LAST_DESC,
+    DB_STMT_PREVIOUS_CHAT_FIRST_ASC,
+    DB_STMT_PREVIOUS_CHAT_FIRST_DESC,
+    DB_STMT_SEARCH,
+    DB_STMT_RETENTION_DELETE_OLD,
+    DB_STMT_RETENTION_NEXT_CONVERSATION,
+    DB_STMT_RETENTION_CUTOFF,
+    DB_STMT_RETENTION_DELETE_SURPLUS,
+    DB_STMT_IMPORT_DUPLICATE,
+    DB_STMT_EXPORT,
+    DB_STMT_COUNT
+} db_stmt_t;
+
+// JIDs and resources are stored once in `Jids` and referenced by id
+#define JID_ID(jid) "(SELECT J.`id` FROM `Jids` AS J WHERE J.`jid` = " jid ")"
+#define JID_STR(id) "(SELECT J.`jid` FROM `Jids` AS J WHERE J.`id` = " id ")"
+
+// The conversation is split into both directions so that each half is read in
+// index order and only as far as needed, independent of the conversation length.
+#define LIMITS_INFO_QUERY(order) "SELECT `archive_id`, `timestamp`, `id` FROM (SELECT * FROM (SELECT `archive_id`, `timestamp`, `id` FROM `ChatLogs` WHERE `from_jid_id` = " JID_ID("?1") " AND `to_jid_id` = " JID_ID("?2") " ORDER BY `timestamp` " order ", `id` " order " LIMIT 1) UNION ALL SELECT * FROM (SELECT `archive_id`, `timestamp`, `id` FROM `ChatLogs` WHERE `from_jid_id` = " JID_ID("?2") " AND `to_jid_id` = " JID_ID("?1") " ORDER BY `timestamp` " order ", `id` " order " LIMIT 1)) ORDER BY `timestamp` " order ", `id` " order " LIMIT 1;"
+
+// ?1 contact, ?2 own barejid, ?3 and ?6 end time and id, ?4 and ?7 start time and id, ?5 limit
+// Paging uses the (`timestamp`, `id`) keyset, so messages sharing a timestamp
+// are neither skipped nor repeated. Corrections are already resolved into
+// `corrected_message` of the original message when they are written.
+#define PREVIOUS_CHAT_HALF(direction, order) "SELECT * FROM (SELECT COALESCE(`corrected_message`, `message`) AS `message`, `timestamp`, " JID_STR("`from_jid_id`") ", `type`, `encryption`, `id`, `stanza_id`, " JID_STR("`from_resource_id`") " FROM `ChatLogs` WHERE " direction " AND `replace_id` = '' AND (`timestamp`, `id`) < (?3, ?6) AND (`timestamp`, `id`) > (?4, ?7) ORDER BY `timestamp` " order ", `id` " order " LIMIT ?5)"
+#define PREVIOUS_CHAT_QUERY(inner_order, outer_order) "SELECT * FROM (SELECT * FROM (" PREVIOUS_CHAT_HALF("`from_jid_id` = " JID_ID("?1") " AND `to_jid_id` = " JID_ID("?2"), inner_order) " UNION ALL " PREVIOUS_CHAT_HALF("`from_jid_id` = " JID_ID("?2") " AND `to_jid_id` = " JID_ID("?1") " AND ?1 != ?2", inner_order) ") ORDER BY `timestamp` " inner_order ", `id` " inner_order " LIMIT ?5) ORDER BY `timestamp` " outer_order ", `id` " outer_order ";"
+
+// ?1 and ?2 conversation, ?3 type, ?4 and ?5 newest time and id to delete, ?6 limit
+#define RETENTION_SURPLUS_HALF(direction) "SELECT `id` FROM (SELECT `id` FROM `ChatLogs` WHERE " direction " AND +`type` = ?3 AND (`timestamp`, `id`) < (?4, ?5) LIMIT ?6)"
+
+// Relevance of the search match with the given rowid, lower is better
+#define SEARCH_RANK(rowid) "(SELECT R.`rank` FROM `ChatLogsFTS` AS R WHERE R.`ChatLogsFTS` MATCH ?1 AND R.rowid = " rowid ")"
+
+// Text of the most recent correction (XEP-0308) of the message with stanza id
+#define LATEST_CORRECTION(stanza_id) "(SELECT C.`message` FROM `ChatLogs` AS C WHERE C.`replace_id` = " stanza_id " AND C.`replace_id` != '' ORDER BY C.`timestamp` DESC, C.`id` DESC LIMIT 1)"
+
+static const char* const db_stmt_sql[DB_STMT_COUNT] = {
+    // a correction might have arrived before the message it corrects, e.g. from MAM
+    // Messages already stored with the same stanza-id or archive-id are skipped
+    // by the unique indexes. ON CONFLICT DO NOTHING needs SQLite 3.24.
+    [DB_STMT_INSERT_MESSAGE] = "INSERT OR IGNORE INTO `ChatLogs` (`from_jid_id`, `from_resource_id`, `to_jid_id`, `to_resource_id`, `message`, `timestamp`, `stanza_id`, `archive_id`, `replace_id`, `type`, `encryption`, `corrected_message`) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, " LATEST_CORRECTION("?7") ")",
+    [DB_STMT_APPLY_CORRECTION] = "UPDATE `ChatLogs` SET `corrected_message` = " LATEST_CORRECTION("?1") " WHERE `stanza_id` = ?1 AND `stanza_id` != '' AND `replace_id` = ''",
+    [DB_STMT_SELECT_JID] = "SELECT `id` FROM `Jids` WHERE `jid` = ?1",
+    [DB_STMT_INSERT_JID] = "INSERT INTO `Jids` (`jid`) VALUES (?1)",
+    [DB_STMT_FIRST_MESSAGE] = LIMITS_INFO_QUERY("ASC"),
+    [DB_STMT_LAST_MESSAGE] = LIMITS_INFO_QUERY("DESC"),
+    [DB_STMT_PREVIOUS_CHAT_LAST_ASC] = PREVIOUS_CHAT_QUERY("DESC", "ASC"),
+    [DB_STMT_PREVIOUS_CHAT_LAST_DESC] = PREVIOUS_CHAT_QUERY("DESC", "DESC"),
+    [DB_STMT_PREVIOUS_CHAT_FIRST_ASC] = PREVIOUS_CHAT_QUERY("ASC", "ASC"),
+    [DB_STMT_PREVIOUS_CHAT_FIRST_DESC] = PREVIOUS_CHAT_QUERY("ASC", "DESC"),
+    // ?1 fts5 query, ?2 contact or room (may be NULL), ?3 type (may be NULL), ?4 and ?5 time range (may be NULL), ?6 limit,
+    // ?7 continue after this match (may be NULL). Best matches first, the (rank, rowid) keyset pages through them.
+    [DB_STMT_SEARCH] = "SELECT C.`timestamp`, " JID_STR("C.`from_jid_id`") ", " JID_STR("C.`from_resource_id`") ", " JID_STR("C.`to_jid_id`") ", C.`type`, C.`encryption`, snippet(`ChatLogsFTS`, 0, '*', '*', '...', 16), C.`id` FROM `ChatLogsFTS` JOIN `ChatLogs` AS C ON C.`id` = `ChatLogsFTS`.rowid WHERE `ChatLogsFTS` MATCH ?1 AND (?2 IS NULL OR C.`from_jid_id` = " JID_ID("?2") " OR C.`to_jid_id` = " JID_ID("?2") ") AND (?3 IS NULL OR C.`type` = ?3) AND (?4 IS NULL OR C.`timestamp` >= ?4) AND (?5 IS NULL OR C.`timestamp` < ?5) AND (?7 IS NULL OR `ChatLogsFTS`.`rank` > " SEARCH_RANK("?7") " OR (`ChatLogsFTS`.`rank` = " SEARCH_RANK("?7") " AND `ChatLogsFTS`.rowid < ?7)) ORDER BY `ChatLogsFTS`.`rank`, `ChatLogsFTS`.rowid DESC LIMIT ?6",
+    // ?1 type, ?2 delete messages before this time, ?3 limit
+    [DB_STMT_RETENTION_DELETE_OLD] = "DELETE FROM `ChatLogs` WHERE `id` IN (SELECT `id` FROM `ChatLogs` WHERE `type` = ?1 AND `timestamp` < ?2 LIMIT ?3)",
+    // ?1 and ?2 the previous pair of JID ids, both directions of a conversation are visited
+    [DB_STMT_RETENTION_NEXT_CONVERSATION] = "SELECT `from_jid_id`, `to_jid_id` FROM `ChatLogs` WHERE (`from_jid_id`, `to_jid_id`) > (?1, ?2) ORDER BY `from_jid_id`, `to_jid_id` LIMIT 1",
+    // ?1 and ?2 conversation, ?3 type, ?4 messages to keep, ?5 the same minus one.
+    // Returns the oldest message to keep, nothing if there are not more.
+    [DB_STMT_RETENTION_CUTOFF] = "SELECT `timestamp`, `id` FROM (SELECT * FROM (SELECT `timestamp`, `id` FROM `ChatLogs` WHERE `from_jid_id` = ?1 AND `to_jid_id` = ?2 AND `type` = ?3 ORDER BY `timestamp` DESC, `id` DESC LIMIT ?4) UNION ALL SELECT * FROM (SELECT `timestamp`, `id` FROM `ChatLogs` WHERE `from_jid_id` = ?2 AND `to_jid_id` = ?1 AND ?1 != ?2 AND `type` = ?3 ORDER BY `timestamp` DESC, `id` DESC LIMIT ?4)) ORDER BY `timestamp` DESC, `id` DESC LIMIT 1 OFFSET ?5",
+    [DB_STMT_RETENTION_DELETE_SURPLUS] = "DELETE FROM `ChatLogs` WHERE `id` IN (" RETENTION_SURPLUS_HALF("`from_jid_id` = ?1 AND `to_jid_id` = ?2") " UNION ALL " RETENTION_SURPLUS_HALF("`from_jid_id` = ?2 AND `to_jid_id` = ?1 AND ?1 != ?2") ")",
+    // ?1 and ?2 sender and recipient, ?3 and ?4 time range, ?5 newest id to compare with, ?6 message
+    [DB_STMT_IMPORT_DUPLICATE] = "SELECT 1 FROM `ChatLogs` WHERE `from_jid_id` = ?1 AND `to_jid_id` = ?2 AND `timestamp` BETWEEN ?3 AND ?4 AND `id` <= ?5 AND `message` = ?6 LIMIT 1",
+    // ?1 contact or room (may be NULL), ?2 type (may be NULL), ?3 and ?4 time range (may be NULL).
+    // Large results are ordered by SQLite's external sorter, which spills to temporary files.
+    [DB_STMT_EXPORT] = "SELECT C.`timestamp`, C.`type`, C.`encryption`, " JID_STR("C.`from_jid_id`") ", " JID_STR("C.`from_resource_id`") ", " JID_STR("C.`to_jid_id`") ", " JID_STR("C.`to_resource_id`") ", C.`stanza_id`, C.`archive_id`, C.`replace_id`, C.`message` FROM `ChatLogs` AS C WHERE (?1 IS NULL OR C.`from_jid_id` = " JID_ID("?1") " OR C.`to_jid_id` = " JID_ID("?1") ") AND (?2 IS NULL OR C.`type` = ?2) AND (?3 IS NULL OR C.`timestamp` >= ?3) AND (?4 IS NULL OR C.`timestamp` < ?4) ORDER BY C.`timestamp`, C.`id`",
+};
+
+// A connection together with its statement cache. The writer connection is
+// owned by the writer thread once log_database_init() returns, the read-only
+// reader connection is only used from the main thread.
+typedef struct db_connection_t
+{
+    sqlite3* db;
+    sqlite3_stmt* stmts[DB_STMT_COUNT];
+} DbConnection;
+
+static DbConnection g_db_writer;
+static DbConnection g_db_reader;
+
+// A message waiting in the write-behind queue. It holds copies of everything
+// needed for the insert so that the original ProfMessage can be freed.
+typedef struct db_pending_message_t
+{
+    gchar* from_jid;
+    gchar* from_resource;
+    gchar* to_jid;
+    gchar* to_resource;
+    gchar* message;
+    gint64 timestamp;
+    gchar* stanza_id;
+    gchar* archive_id;
+    gchar* replace_id;
+    const char* type;
+    const char* encryption;
+    gboolean imported;
+    guint64 seq;
+} DbPendingMessage;
+
+// Row id given to queued messages read with the history, they sort after the
+// stored messages with the same timestamp
+#define DB_PENDING_ID G_MAXINT64
+
+// Log lines produced on the writer thread. They are handed to the main thread
+// since the logger is not thread safe.
+typedef struct db_report_t
+{
+    log_level_t level;
+    gchar* msg;
+} DbReport;
+
+// Maximum number of messages waiting for the writer thread. Producers block
+// once it is reached.
+#define DB_WRITE_QUEUE_MAX 10000
+
+// Incoming and outgoing messages are queued for the writer thread, which
+// writes them in one transaction once the batch size is reached or the oldest
+// one waited for the batch interval. The batch being written stays in
+// g_db_inflight until it is committed. History readers add the queued and
+// in-flight messages of a conversation to what they read, so they see their
+// own writes without waiting for the writer. Messages are numbered in the
+// order they are queued. Everything below is protected by g_db_mutex.
+static GThread* g_db_thread;
+static GMutex g_db_mutex;
+static GCond g_db_work_cond;
+static GCond g_db_idle_cond;
+static GQueue g_pending_messages = G_QUEUE_INIT;
+static GQueue g_db_inflight = G_QUEUE_INIT;
+static guint64 g_db_pending_seq;
+static gint64 g_pending_since;
+static guint g_db_batch_size = PREFS_DBLOG_BATCH_DEFAULT;
+static gint64 g_db_batch_interval = PREFS_DBLOG_BATCH_INTERVAL_DEFAULT * G_TIME_SPAN_MILLISECOND;
+static gboolean g_db_flush_requested;
+static gboolean g_db_shutdown;
+static GQueue g_db_reports = G_QUEUE_INIT;
+
+// Messages read from flat-file logs wait in their own queue and are only
+// written while no other messages are queued, in larger transactions. Readers
+// never wait for them. Producers block once DB_IMPORT_QUEUE_MAX is reached.
+#define DB_IMPORT_BATCH 2000
+#define DB_IMPORT_QUEUE_MAX 20000
+// An imported message is a duplicate of a stored one with the same sender,
+// recipient and text that is at most this far apart. The flat-file log and
+// the database do not always take the timestamp at the same moment.
+#define DB_IMPORT_DUPLICATE_WINDOW (60 * G_TIME_SPAN_SECOND)
+
+// State of the running import, protected by g_db_mutex
+static GQueue g_db_import_messages = G_QUEUE_INIT;
+static GCond g_db_import_cond;
+static guint g_db_import_inflight;
+static gboolean g_db_importing;
+static gboolean g_db_import_started;
+static DbImportStats g_db_import_stats;
+
+// Imported messages are only compared with rows up to this id, so repeated
+// messages within the imported logs are kept. Only used by the writer thread.
+static gint64 g_db_import_max_id;
+
+// Ids of the rows in `Jids` by JID or resource, so that writing a message does
+// not need to look them up. Only used by the writer thread.
+static GHashTable* g_db_jid_ids;
+
+// Maximum number of ids remembered by the recent-id filter
+#define DB_RECENT_IDS_MAX 1000
+
+// Stanza-ids and archive-ids of the latest queued messages. Carbons and MAM
+// often deliver a message again shortly after it arrived, such copies are
+// dropped before they reach the writer thread. The unique indexes catch the
+// rest. Only used on the main thread, the oldest ids are forgotten first.
+static GHashTable* g_db_recent_ids;
+static GQueue g_db_recent_ids_order = G_QUEUE_INIT;
+
+// A page of history as returned by log_database_get_previous_chat(). The
+// messages are handed out as copies that share the JID and timestamp.
+typedef struct db_history_page_t
+{
+    gchar* conversation;
+    gchar* cursor;
+    GSList* messages;
+    gsize size;
+    GList lru_link;
+} DbHistoryPage;
+
+// Decoded history pages by conversation and then by cursor, so that opening
+// windows and paging back and forth does not query the database again. When
+// the pages exceed the configured size the least recently used are dropped,
+// all pages of a conversation are dropped when a message is queued for it.
+// Only used on the main thread.
+static GHashTable* g_db_history_cache;
+static GQueue g_db_history_lru = G_QUEUE_INIT;
+static DbCacheStats g_db_cache_stats;
+// Bumped whenever cached pages are dropped. A page read by the history thread
+// before that may be outdated and is not cached.
+static guint64 g_db_history_generation;
+
+typedef enum {
+    DB_REQUEST_HISTORY,
+    DB_REQUEST_SEARCH,
+    DB_REQUEST_EXPORT
+} db_request_kind_t;
+
+// A history page requested with log_database_get_previous_chat_async(), a
+// search started with log_database_search_async() or an export started with
+// log_database_export_async(). Searches use query, with_jid, type, after and
+// before, continue after the match start_id if it is set and hand their
+// results to callback like a page. Exports use the same filters and report to
+// export_callback.
+typedef struct db_history_request_t
+{
+    guint id;
+    db_request_kind_t kind;
+    gchar* contact_barejid;
+    gchar* my_barejid;
+    gint64 start_time;
+    gint64 start_id;
+    gint64 end_time;
+    gint64 end_id;
+    gboolean from_start;
+    gboolean flip;
+    guint64 pending_seq;
+    guint64 generation;
+    gboolean cancelled;
+    gboolean complete;
+    gchar* query;
+    gchar* with_jid;
+    gchar* type;
+    gint64 after;
+    gint64 before;
+    gchar* path;
+    db_export_format_t format;
+    GCancellable* cancellable;
+    guint64 count;
+    GError* error;
+    GSList* history;
+    DbHistoryCallback callback;
+    DbExportCallback export_callback;
+    gpointer user_data;
+} DbHistoryRequest;
+
+// History pages are read by the history thread on its own read-only
+// connection, so that opening and scrolling windows never waits for the
+// database. Searches and exports run there as well, after the writer
+// committed the queued messages. Finished requests are handed back to the main thread, which runs
+// their callbacks from log_database_process_events(). Everything below is
+// protected by g_db_history_mutex.
+static DbConnection g_db_history_reader;
+static GThread* g_db_history_thread;
+static GMutex g_db_history_mutex;
+static GCond g_db_history_cond;
+static GQueue g_db_history_requests = G_QUEUE_INIT;
+static GQueue g_db_history_done = G_QUEUE_INIT;
+static DbHistoryRequest* g_db_history_current;
+static gboolean g_db_history_shutdown;
+static guint g_db_history_last_id;
+
+// Messages deleted by the retention job per statement, kept small so that
+// queued messages and readers never wait long
+#define DB_RETENTION_BATCH 500
+// Pages given back per incremental vacuum step
+#define DB_RETENTION_VACUUM_PAGES 256
+// The job first runs a minute after connecting and then every 6 hours
+#define DB_RETENTION_DELAY (60 * G_TIME_SPAN_SECOND)
+#define DB_RETENTION_INTERVAL (6 * G_TIME_SPAN_HOUR)
+
+// Message types with a retention policy, see log_database_parse_retention()
+static const char* const db_retention_types[] = { "chat", "muc", "mucpm" };
+#define DB_RETENTION_TYPES ARRAY_SIZE(db_retention_types)
+
+// A run of the retention job. Every step does one small delete or vacuum, the
+// writer thread runs them while it has nothing else to do. Only used by the
+// writer thread.
+typedef struct db_retention_job_t
+{
+    gint days[DB_RETENTION_TYPES];
+    gint messages[DB_RETENTION_TYPES];
+    guint type;
+    gboolean in_conversation;
+    gint64 from_jid_id;
+    gint64 to_jid_id;
+    gint64 cutoff_time;
+    gint64 cutoff_id;
+    gint64 page_count;
+    gint64 start_page_count;
+    gint64 scheduled;
+    guint64 deleted;
+    gint64 reclaimed;
+} DbRetentionJob;
+
+static DbRetentionJob* g_db_retention_job;
+
+// Effective policies of the connected account, the time of the next run and
+// the result of the last one. Protected by g_db_mutex.
+static gchar* g_db_retention_policies[DB_RETENTION_TYPES];
+static gint64 g_db_retention_next;
+static DbRetentionStats g_db_retention_stats;
+
+// Set when the retention job or an import changed stored conversations, the
+// main thread drops the history cache then. Protected by g_db_mutex.
+static gboolean g_db_history_stale;
+
+static gchar* g_db_account_name;
+
+// Schema upgrades, applied in order on top of the version 1 layout. Every
+// migration runs in its own transaction together with the `DbVersion` bump,
+// so an interrupted upgrade is simply retried on the next start. Migrations
+// that rewrite a lot of data ask for a VACUUM afterwards to give the space back.
+typedef struct db_migration_t
+{
+    int version;
+    const char* description;
+    const char* sql;
+    gboolean vacuum;
+} DbMigration;
+
+static const DbMigration db_migrations[] = {
+    { 2, "add indexes for conversation, stanza-id, archive-id and correction lookups",
+      "CREATE INDEX IF NOT EXISTS `ChatLogs_conversation_idx` ON `ChatLogs` (`from_jid`, `to_jid`, `timestamp`, `archive_id`);"
+      "CREATE INDEX IF NOT EXISTS `ChatLogs_stanza_id_idx` ON `ChatLogs` (`stanza_id`);"
+      "CREATE INDEX IF NOT EXISTS `ChatLogs_archive_id_idx` ON `ChatLogs` (`archive_id`);"
+      "CREATE INDEX IF NOT EXISTS `ChatLogs_replace_id_idx` ON `ChatLogs` (`replace_id`);" },
+    { 3, "resolve corrections on write and index conversations for keyset paging",
+      "ALTER TABLE `ChatLogs` ADD COLUMN `corrected_message` TEXT;"
+      "UPDATE `ChatLogs` SET `corrected_message` = " LATEST_CORRECTION("`ChatLogs`.`stanza_id`") " WHERE `replace_id` = '' AND `stanza_id` IN (SELECT `replace_id` FROM `ChatLogs` WHERE `replace_id` != '');"
+      "DROP INDEX IF EXISTS `ChatLogs_conversation_idx`;"
+      "CREATE INDEX IF NOT EXISTS `ChatLogs_history_idx` ON `ChatLogs` (`from_jid`, `to_jid`, `timestamp`, `id`);" },
+    // SQLite before 3.35 cannot drop columns, so the table is rebuilt. Row ids
+    // are kept, which keeps the search index valid, its triggers are recreated
+    // by _init_search_index().
+    { 4, "move JIDs and resources into a dictionary table",
+      "CREATE TABLE `Jids` (`id` INTEGER PRIMARY KEY, `jid` TEXT NOT NULL UNIQUE);"
+      "INSERT INTO `Jids` (`jid`) SELECT `from_jid` FROM `ChatLogs` UNION SELECT `to_jid` FROM `ChatLogs` UNION SELECT `from_resource` FROM `ChatLogs` WHERE `from_resource` != '' UNION SELECT `to_resource` FROM `ChatLogs` WHERE `to_resource` != '';"
+      "CREATE TABLE `ChatLogs_new` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `from_jid_id` INTEGER NOT NULL, `to_jid_id` INTEGER NOT NULL, `from_resource_id` INTEGER, `to_resource_id` INTEGER, `message` TEXT, `timestamp` TEXT, `type` TEXT, `stanza_id` TEXT, `archive_id` TEXT, `replace_id` TEXT, `encryption` TEXT, `marked_read` INTEGER, `corrected_message` TEXT);"
+      "INSERT INTO `ChatLogs_new` SELECT C.`id`, F.`id`, T.`id`, FR.`id`, TR.`id`, C.`message`, C.`timestamp`, C.`type`, C.`stanza_id`, C.`archive_id`, C.`replace_id`, C.`encryption`, C.`marked_read`, C.`corrected_message` FROM `ChatLogs` AS C "
+      "JOIN `Jids` AS F ON F.`jid` = C.`from_jid` JOIN `Jids` AS T ON T.`jid` = C.`to_jid` LEFT JOIN `Jids` AS FR ON FR.`jid` = C.`from_resource` LEFT JOIN `Jids` AS TR ON TR.`jid` = C.`to_resource`;"
+      "DROP TABLE `ChatLogs`;"
+      "ALTER TABLE `ChatLogs_new` RENAME TO `ChatLogs`;"
+      "CREATE INDEX `ChatLogs_history_idx` ON `ChatLogs` (`from_jid_id`, `to_jid_id`, `timestamp`, `id`);"
+      "CREATE INDEX `ChatLogs_stanza_id_idx` ON `ChatLogs` (`stanza_id`);"
+      "CREATE INDEX `ChatLogs_archive_id_idx` ON `ChatLogs` (`archive_id`);"
+      "CREATE INDEX `ChatLogs_replace_id_idx` ON `ChatLogs` (`replace_id`);",
+      TRUE },
+    // The column is declared INTEGER since TEXT affinity would store the
+    // numbers as strings again. prof_iso8601_to_usec() is registered by
+    // _migrate_database().
+    { 5, "store timestamps as microseconds since the epoch",
+      "CREATE TABLE `ChatLogs_new` (`id` INTEGER PRIMARY KEY AUTOINCREMENT, `from_jid_id` INTEGER NOT NULL, `to_jid_id` INTEGER NOT NULL, `from_resource_id` INTEGER, `to_resource_id` INTEGER, `message` TEXT, `timestamp` INTEGER, `type` TEXT, `stanza_id` TEXT, `archive_id` TEXT, `replace_id` TEXT, `encryption` TEXT, `marked_read` INTEGER, `corrected_message` TEXT);"
+      "INSERT INTO `ChatLogs_new` SELECT `id`, `from_jid_id`, `to_jid_id`, `from_resource_id`, `to_resource_id`, `message`, prof_iso8601_to_usec(`timestamp`), `type`, `stanza_id`, `archive_id`, `replace_id`, `encryption`, `marked_read`, `corrected_message` FROM `ChatLogs`;"
+      "DROP TABLE `ChatLogs`;"
+      "ALTER TABLE `ChatLogs_new` RENAME TO `ChatLogs`;"
+      "CREATE INDEX `ChatLogs_history_idx` ON `ChatLogs` (`from_jid_id`, `to_jid_id`, `timestamp`, `id`);"
+      "CREATE INDEX `ChatLogs_stanza_id_idx` ON `ChatLogs` (`stanza_id`);"
+      "CREATE INDEX `ChatLogs_archive_id_idx` ON `ChatLogs` (`archive_id`);"
+      "CREATE INDEX `ChatLogs_replace_id_idx` ON `ChatLogs` (`replace_id`);",
+      TRUE },
+    // Duplicates could slip past the old check when it raced with an insert,
+    // the first copy is kept.
+    { 6, "enforce unique stanza-ids and archive-ids",
+      "DELETE FROM `ChatLogs` WHERE `archive_id` != '' AND `id` NOT IN (SELECT MIN(`id`) FROM `ChatLogs` WHERE `archive_id` != '' GROUP BY `archive_id`);"
+      "DELETE FROM `ChatLogs` WHERE `stanza_id` != '' AND `id` NOT IN (SELECT MIN(`id`) FROM `ChatLogs` WHERE `stanza_id` != '' GROUP BY `stanza_id`);"
+      "DROP INDEX IF EXISTS `ChatLogs_stanza_id_idx`;"
+      "DROP INDEX IF EXISTS `ChatLogs_archive_id_idx`;"
+      "CREATE UNIQUE INDEX `ChatLogs_stanza_id_idx` ON `ChatLogs` (`stanza_id`) WHERE `stanza_id` != '';"
+      "CREATE UNIQUE INDEX `ChatLogs_archive_id_idx` ON `ChatLogs` (`archive_id`) WHERE `archive_id` != '';" },
+    // The auto_vacuum mode only changes with the VACUUM, it lets the retention
+    // job give space back in small steps afterwards.
+    { 7, "prepare for retention policies",
+      "PRAGMA auto_vacuum = INCREMENTAL;"
+      "CREATE INDEX `ChatLogs_type_timestamp_idx` ON `ChatLogs` (`type`, `timestamp`);",
+      TRUE },
+};
+
+// Full-text index over the message bodies. It is kept in sync by triggers, so
+// every row written by _add_to_db() is indexed in the same transaction. FTS5 is
+// an optional part of SQLite, therefore the index is not one of the versioned
+// migrations: it is (re)built on start whenever its triggers are missing and
+// search is simply unavailable when the library lacks the module.
+static const char* const db_search_triggers_sql = "CREATE TRIGGER IF NOT EXISTS `ChatLogs_fts_insert` AFTER INSERT ON `ChatLogs` BEGIN "
+                                                  "INSERT INTO `ChatLogsFTS` (rowid, `message`) VALUES (new.`id`, new.`message`); END;"
+                                                  "CREATE TRIGGER IF NOT EXISTS `ChatLogs_fts_delete` AFTER DELETE ON `ChatLogs` BEGIN "
+                                                  "INSERT INTO `ChatLogsFTS` (`ChatLogsFTS`, rowid, `message`) VALUES ('delete', old.`id`, old.`message`); END;"
+                                                  "CREATE TRIGGER IF NOT EXISTS `ChatLogs_fts_update` AFTER UPDATE OF `message` ON `ChatLogs` BEGIN "
+                                                  "INSERT INTO `ChatLogsFTS` (`ChatLogsFTS`, rowid, `message`) VALUES ('delete', old.`id`, old.`message`); "
+                                                  "INSERT INTO `ChatLogsFTS` (rowid, `message`) VALUES (new.`id`, new.`message`); END;";
+
+static gboolean g_db_search_available;
 
 static void _add_to_db(ProfMessage* message, char* type, const Jid* const from_jid, const Jid* const to_jid);
+static void _db_writer_sync(void);
+static gpointer _db_writer_thread(gpointer data);
+static gpointer _db_history_thread(gpointer data);
+static void _db_history_stop(void);
+static void _db_report(log_level_t level, const char* const fmt, ...);
 static char* _get_db_filename(ProfAccount* account);
+static gboolean _migrate_database(sqlite3* db);
+static gboolean _check_search_index(sqlite3* db);
+static gboolean _init_search_index(sqlite3* db);
+static void _retention_load_policies(void);
+static void _history_cache_clear(void);
+static void _pending_message_free(DbPendingMessage* pending);
+static GSList* _pending_conversation(const char* const contact_barejid, const char* const my_barejid, guint64 max_seq);
+static gint _history_message_cmp(gconstpointer a, gconstpointer b);
+static gboolean _search_read(DbConnection* conn, const char* const query, const char* const with_jid, const char* const type, gint64 after, gint64 before, gint64 after_id, GSList** results);
+static gboolean _export_write(DbConnection* conn, const char* const path, db_export_format_t format, const char* const with_jid, const char* const type, gint64 after, gint64 before, GCancellable* cancellable, guint64* count, GError** error);
 static prof_msg_type_t _get_message_type_type(const char* const type);
 static prof_enc_t _get_message_enc_type(const char* const encstr);
 
-#define auto_sqlite __attribute__((__cleanup__(auto_free_sqlite)))
+static char*
+_get_db_filename(ProfAccount* account)
+{
+    return files_file_in_account_data_path(DIR_DATABASE, account->jid, "chatlog.db");
+}
+
+// Get the cached statement of the connection, compiling it on first use. The
+// caller has to hand it back with _db_stmt_release() once done stepping.
+static sqlite3_stmt*
+_db_stmt(DbConnection* conn, db_stmt_t id)
+{
+    if (!conn->stmts[id]) {
+        if (sqlite3_prepare_v3(conn->db, db_stmt_sql[id], -1, SQLITE_PREPARE_PERSISTENT, &conn->stmts[id], NULL) != SQLITE_OK) {
+            conn->stmts[id] = NULL;
+            return NULL;
+        }
+    }
+
+    return conn->stmts[id];
+}
 
 static void
-auto_free_sqlite(gchar** str)
+_db_stmt_release(sqlite3_stmt* stmt)
 {
-    if (str == NULL)
-        return;
-    sqlite3_free(*str);
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
 }
 
-static char*
-_get_db_filename(ProfAccount* account)
+static void
+_db_connection_close(DbConnection* conn)
 {
-    return files_file_in_account_data_path(DIR_DATABASE, account->jid, "chatlog.db");
+    for (int i = 0; i < DB_STMT_COUNT; i++) {
+        if (conn->stmts[i]) {
+            sqlite3_finalize(conn->stmts[i]);
+            conn->stmts[i] = NULL;
+        }
+    }
+
+    if (conn->db) {
+        sqlite3_close(conn->db);
+        conn->db = NULL;
+    }
+}
+
+static const char*
+_get_synchronous_pragma(void)
+{
+    auto_gchar gchar* sync = prefs_get_string(PREF_DBLOG_SYNC);
+
+    if (g_strcmp0(sync, "off") == 0) {
+        return "PRAGMA synchronous=OFF";
+    } else if (g_strcmp0(sync, "full") == 0) {
+        return "PRAGMA synchronous=FULL";
+    } else {
+        return "PRAGMA synchronous=NORMAL";
+    }
 }
 
 gboolean
@@ -88,14 +542,28 @@ log_database_init(ProfAccount* account)
         return FALSE;
     }
 
-    ret = sqlite3_open(filename, &g_chatlog_database);
+    ret = sqlite3_open(filename, &g_db_writer.db);
     if (ret != SQLITE_OK) {
-        const char* err_msg = sqlite3_errmsg(g_chatlog_database);
+        const char* err_msg = sqlite3_errmsg(g_db_writer.db);
         log_error("Error opening SQLite database: %s", err_msg);
+        _db_connection_close(&g_db_writer);
         return FALSE;
     }
 
     char* err_msg;
+    const char* query = prefs_get_boolean(PREF_DBLOG_WAL) ? "PRAGMA journal_mode=WAL" : "PRAGMA journal_mode=DELETE";
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, query, NULL, 0, &err_msg)) {
+        goto out;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, _get_synchronous_pragma(), NULL, 0, &err_msg)) {
+        goto out;
+    }
+
+    // The version 1 layout, db_migrations brings it up to date. Since version 4
+    // JIDs and resources are stored in `Jids` and referenced by their id, since
+    // version 5 timestamp holds microseconds since the epoch.
+    //
     // id is the ID of DB the entry
     // from_jid is the senders jid
     // to_jid is the receivers jid
@@ -109,21 +577,58 @@ log_database_init(ProfAccount* account)
     // replace_id is the ID from XEP-0308: Last Message Correction
     // encryption is to distinguish: none, omemo, otr, pgp
     // marked_read is 0/1 whether a message has been marked as read via XEP-0333: Chat Markers
-    char* query = "CREATE TABLE IF NOT EXISTS `ChatLogs` ( `id` INTEGER PRIMARY KEY AUTOINCREMENT, `from_jid` TEXT NOT NULL, `to_jid` TEXT NOT NULL, `from_resource` TEXT, `to_resource` TEXT, `message` TEXT, `timestamp` TEXT, `type` TEXT, `stanza_id` TEXT, `archive_id` TEXT, `replace_id` TEXT, `encryption` TEXT, `marked_read` INTEGER)";
-    if (SQLITE_OK != sqlite3_exec(g_chatlog_database, query, NULL, 0, &err_msg)) {
+    query = "CREATE TABLE IF NOT EXISTS `ChatLogs` ( `id` INTEGER PRIMARY KEY AUTOINCREMENT, `from_jid` TEXT NOT NULL, `to_jid` TEXT NOT NULL, `from_resource` TEXT, `to_resource` TEXT, `message` TEXT, `timestamp` TEXT, `type` TEXT, `stanza_id` TEXT, `archive_id` TEXT, `replace_id` TEXT, `encryption` TEXT, `marked_read` INTEGER)";
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, query, NULL, 0, &err_msg)) {
         goto out;
     }
 
     query = "CREATE TABLE IF NOT EXISTS `DbVersion` ( `dv_id` INTEGER PRIMARY KEY, `version` INTEGER UNIQUE)";
-    if (SQLITE_OK != sqlite3_exec(g_chatlog_database, query, NULL, 0, &err_msg)) {
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, query, NULL, 0, &err_msg)) {
         goto out;
     }
 
     query = "INSERT OR IGNORE INTO `DbVersion` (`version`) VALUES('1')";
-    if (SQLITE_OK != sqlite3_exec(g_chatlog_database, query, NULL, 0, &err_msg)) {
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, query, NULL, 0, &err_msg)) {
         goto out;
     }
 
+    gboolean search_usable = _check_search_index(g_db_writer.db);
+
+    if (!_migrate_database(g_db_writer.db)) {
+        _db_connection_close(&g_db_writer);
+        return FALSE;
+    }
+
+    g_db_search_available = search_usable && _init_search_index(g_db_writer.db);
+
+    ret = sqlite3_open_v2(filename, &g_db_reader.db, SQLITE_OPEN_READONLY, NULL);
+    if (ret != SQLITE_OK) {
+        log_error("Error opening read-only SQLite connection: %s", sqlite3_errmsg(g_db_reader.db));
+        _db_connection_close(&g_db_reader);
+        _db_connection_close(&g_db_writer);
+        return FALSE;
+    }
+    // without WAL readers and the writer lock each other out for short periods
+    sqlite3_busy_timeout(g_db_reader.db, 1000);
+
+    // history is read on the main thread if the connection is not available
+    ret = sqlite3_open_v2(filename, &g_db_history_reader.db, SQLITE_OPEN_READONLY, NULL);
+    if (ret == SQLITE_OK) {
+        sqlite3_busy_timeout(g_db_history_reader.db, 1000);
+        g_db_history_shutdown = FALSE;
+        g_db_history_thread = g_thread_new("chatlog-history", _db_history_thread, NULL);
+    } else {
+        log_error("Error opening SQLite connection for reading history: %s", sqlite3_errmsg(g_db_history_reader.db));
+        _db_connection_close(&g_db_history_reader);
+    }
+
+    g_db_jid_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_db_account_name = g_strdup(account->name);
+    _retention_load_policies();
+    g_db_retention_next = g_get_monotonic_time() + DB_RETENTION_DELAY;
+    g_db_shutdown = FALSE;
+    g_db_thread = g_thread_new("chatlog-db", _db_writer_thread, NULL);
+
     log_debug("Initialized SQLite database: %s", filename);
     return TRUE;
 
@@ -134,16 +639,264 @@ out:
     } else {
         log_error("Unknown SQLite error");
     }
+    _db_connection_close(&g_db_writer);
+    return FALSE;
+}
+
+static int
+_get_db_version(sqlite3* db)
+{
+    sqlite3_stmt* stmt = NULL;
+    int version = -1;
+
+    if (sqlite3_prepare_v2(db, "SELECT MAX(`version`) FROM `DbVersion`", -1, &stmt, NULL) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    return version;
+}
+
+static gboolean
+_apply_migration(sqlite3* db, const DbMigration* migration)
+{
+    char* err_msg = NULL;
+
+    if (SQLITE_OK != sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION", NULL, 0, &err_msg)) {
+        goto out;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(db, migration->sql, NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    auto_gchar gchar* bump = g_strdup_printf("INSERT OR IGNORE INTO `DbVersion` (`version`) VALUES('%d')", migration->version);
+    if (SQLITE_OK != sqlite3_exec(db, bump, NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(db, "END TRANSACTION", NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    return TRUE;
+
+rollback:
+    sqlite3_exec(db, "ROLLBACK TRANSACTION", NULL, 0, NULL);
+out:
+    log_error("SQLite error in migration to version %d: %s", migration->version, err_msg ? err_msg : "unknown");
+    sqlite3_free(err_msg);
+    return FALSE;
+}
+
+// Convert the ISO 8601 timestamps of versions before 5. SQLite's own date
+// functions only know about 3 fractional digits and "+HH:MM" offsets, while
+// glib also writes "+HH". Unparsable values become 0.
+static void
+_sql_iso8601_to_usec(sqlite3_context* ctx, int argc, sqlite3_value** argv)
+{
+    const char* text = (const char*)sqlite3_value_text(argv[0]);
+    GDateTime* dt = NULL;
+
+    if (text) {
+        GTimeZone* local = g_time_zone_new_local();
+        dt = g_date_time_new_from_iso8601(text, local);
+        g_time_zone_unref(local);
+    }
+
+    if (dt) {
+        sqlite3_result_int64(ctx, date_time_to_usec(dt));
+        g_date_time_unref(dt);
+    } else {
+        sqlite3_result_int64(ctx, 0);
+    }
+}
+
+static gboolean
+_migrate_database(sqlite3* db)
+{
+    int version = _get_db_version(db);
+    gboolean vacuum = FALSE;
+
+    if (version < 1) {
+        log_error("Unable to determine chat log database version");
+        return FALSE;
+    }
+
+    if (sqlite3_create_function(db, "prof_iso8601_to_usec", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, _sql_iso8601_to_usec, NULL, NULL) != SQLITE_OK) {
+        log_error("Unable to register chat log migration functions: %s", sqlite3_errmsg(db));
+        return FALSE;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(db_migrations); i++) {
+        const DbMigration* migration = &db_migrations[i];
+        if (migration->version <= version) {
+            continue;
+        }
+
+        log_info("Migrating chat log database from version %d to %d: %s", version, migration->version, migration->description);
+        gint64 start = g_get_monotonic_time();
+
+        if (!_apply_migration(db, migration)) {
+            return FALSE;
+        }
+
+        log_info("Migration to database version %d took %.3f seconds", migration->version, (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+        version = migration->version;
+        vacuum = vacuum || migration->vacuum;
+    }
+
+    if (vacuum) {
+        log_info("Compacting chat log database");
+        gint64 start = g_get_monotonic_time();
+        char* err_msg = NULL;
+
+        // not fatal, the database is just larger than needed
+        if (SQLITE_OK != sqlite3_exec(db, "VACUUM", NULL, 0, &err_msg)) {
+            log_warning("Could not compact chat log database: %s", err_msg ? err_msg : "unknown");
+            sqlite3_free(err_msg);
+        } else {
+            log_info("Compacting chat log database took %.3f seconds", (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+_db_has_trigger(sqlite3* db, const char* const name)
+{
+    sqlite3_stmt* stmt = NULL;
+    gboolean exists = FALSE;
+
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM `sqlite_master` WHERE `type` = 'trigger' AND `name` = ?", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+
+    return exists;
+}
+
+// Runs before the migrations, which would fail on the triggers otherwise
+static gboolean
+_check_search_index(sqlite3* db)
+{
+    char* err_msg = NULL;
+
+    if (!_db_has_trigger(db, "ChatLogs_fts_insert")) {
+        return TRUE;
+    }
+
+    if (SQLITE_OK == sqlite3_exec(db, "SELECT rowid FROM `ChatLogsFTS` LIMIT 0", NULL, 0, &err_msg)) {
+        return TRUE;
+    }
+
+    // the index was built by a SQLite with FTS5, drop the triggers so that
+    // this one can still write. The index is rebuilt once FTS5 is back.
+    log_warning("Message search disabled, the search index is unusable: %s", err_msg ? err_msg : "unknown");
+    sqlite3_free(err_msg);
+    sqlite3_exec(db, "DROP TRIGGER IF EXISTS `ChatLogs_fts_insert`; DROP TRIGGER IF EXISTS `ChatLogs_fts_delete`; DROP TRIGGER IF EXISTS `ChatLogs_fts_update`", NULL, 0, NULL);
+    return FALSE;
+}
+
+static gboolean
+_init_search_index(sqlite3* db)
+{
+    char* err_msg = NULL;
+
+    if (_db_has_trigger(db, "ChatLogs_fts_insert")) {
+        return TRUE;
+    }
+
+    log_info("Building the chat log search index");
+    gint64 start = g_get_monotonic_time();
+
+    if (SQLITE_OK != sqlite3_exec(db, "BEGIN IMMEDIATE TRANSACTION", NULL, 0, &err_msg)) {
+        goto out;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(db, "CREATE VIRTUAL TABLE IF NOT EXISTS `ChatLogsFTS` USING fts5(`message`, content='ChatLogs', content_rowid='id')", NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(db, db_search_triggers_sql, NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    // backfill everything written while the triggers were missing
+    if (SQLITE_OK != sqlite3_exec(db, "INSERT INTO `ChatLogsFTS` (`ChatLogsFTS`) VALUES ('rebuild')", NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(db, "END TRANSACTION", NULL, 0, &err_msg)) {
+        goto rollback;
+    }
+
+    log_info("Building the chat log search index took %.3f seconds", (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+    return TRUE;
+
+rollback:
+    sqlite3_exec(db, "ROLLBACK TRANSACTION", NULL, 0, NULL);
+out:
+    log_warning("Message search disabled, could not build the search index: %s", err_msg ? err_msg : "unknown");
+    sqlite3_free(err_msg);
     return FALSE;
 }
 
 void
 log_database_close(void)
 {
-    if (g_chatlog_database) {
-        sqlite3_close(g_chatlog_database);
+    // the history thread waits for the writer thread, stop it first
+    _db_history_stop();
+
+    if (g_db_thread) {
+        // the writer thread drains the queue before it exits, a running
+        // import is cancelled
+        g_mutex_lock(&g_db_mutex);
+        g_db_shutdown = TRUE;
+        g_queue_clear_full(&g_db_import_messages, (GDestroyNotify)_pending_message_free);
+        g_cond_signal(&g_db_work_cond);
+        g_cond_broadcast(&g_db_import_cond);
+        while (g_db_importing) {
+            g_cond_wait(&g_db_import_cond, &g_db_mutex);
+        }
+        g_mutex_unlock(&g_db_mutex);
+
+        g_thread_join(g_db_thread);
+        g_db_thread = NULL;
+    }
+
+    if (g_db_jid_ids) {
+        g_hash_table_destroy(g_db_jid_ids);
+        g_db_jid_ids = NULL;
+    }
+
+    // an unfinished retention run starts over on the next connect
+    g_clear_pointer(&g_db_retention_job, g_free);
+    for (int i = 0; i < DB_RETENTION_TYPES; i++) {
+        g_clear_pointer(&g_db_retention_policies[i], g_free);
+    }
+    g_clear_pointer(&g_db_account_name, g_free);
+    memset(&g_db_retention_stats, 0, sizeof(g_db_retention_stats));
+
+    log_database_process_events();
+    g_db_search_available = FALSE;
+
+    _history_cache_clear();
+
+    if (g_db_recent_ids) {
+        g_queue_clear(&g_db_recent_ids_order);
+        g_hash_table_destroy(g_db_recent_ids);
+        g_db_recent_ids = NULL;
+    }
+
+    if (g_db_writer.db || g_db_reader.db) {
+        _db_connection_close(&g_db_reader);
+        _db_connection_close(&g_db_writer);
         sqlite3_shutdown();
-        g_chatlog_database = NULL;
     }
 }
 
@@ -196,260 +949,2082 @@ log_database_add_outgoing_muc_pm(const char* const id, const char* const barejid
     _log_database_add_outgoing("mucpm", id, barejid, message, replace_id, enc);
 }
 
-// Get info (timestamp and stanza_id) of the first or last message in db
+// Get info (timestamp, stanza_id and id) of the first or last message in db.
+// The id orders messages sharing a timestamp, it is DB_PENDING_ID for a
+// message that is still queued like in the history pages.
 ProfMessage*
 log_database_get_limits_info(const gchar* const contact_barejid, gboolean is_last)
 {
-    sqlite3_stmt* stmt = NULL;
-    gchar* query;
     const char* jid = connection_get_fulljid();
     auto_jid Jid* myjid = jid_create(jid);
     if (!myjid)
         return NULL;
 
-    if (is_last) {
-        query = sqlite3_mprintf("SELECT * FROM (SELECT `archive_id`, `timestamp` from `ChatLogs` WHERE (`from_jid` = '%q' AND `to_jid` = '%q') OR (`from_jid` = '%q' AND `to_jid` = '%q') ORDER BY `timestamp` DESC LIMIT 1) ORDER BY `timestamp` ASC;", contact_barejid, myjid->barejid, myjid->barejid, contact_barejid);
-    } else {
-        query = sqlite3_mprintf("SELECT * FROM (SELECT `archive_id`, `timestamp` from `ChatLogs` WHERE (`from_jid` = '%q' AND `to_jid` = '%q') OR (`from_jid` = '%q' AND `to_jid` = '%q') ORDER BY `timestamp` ASC LIMIT 1) ORDER BY `timestamp` ASC;", contact_barejid, myjid->barejid, myjid->barejid, contact_barejid);
-    }
-
-    if (!query) {
-        log_error("log_database_get_last_info(): SQL query. could not allocate memory");
+    if (!g_db_reader.db) {
         return NULL;
     }
 
-    int rc = sqlite3_prepare_v2(g_chatlog_database, query, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_error("log_database_get_last_info(): unknown SQLite error");
+    // queued messages count as well, see _history_read()
+    GSList* pending = _pending_conversation(contact_barejid, myjid->barejid, G_MAXUINT64);
+
+    sqlite3_stmt* stmt = _db_stmt(&g_db_reader, is_last ? DB_STMT_LAST_MESSAGE : DB_STMT_FIRST_MESSAGE);
+    if (!stmt) {
+        log_error("log_database_get_last_info(): %s", sqlite3_errmsg(g_db_reader.db));
+        g_slist_free_full(pending, (GDestroyNotify)message_free);
         return NULL;
     }
 
+    sqlite3_bind_text(stmt, 1, contact_barejid, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, myjid->barejid, -1, SQLITE_STATIC);
+
     ProfMessage* msg = message_init();
 
     if (sqlite3_step(stmt) == SQLITE_ROW) {
         char* archive_id = (char*)sqlite3_column_text(stmt, 0);
-        char* date = (char*)sqlite3_column_text(stmt, 1);
 
-        msg->stanzaid = strdup(archive_id);
-        msg->timestamp = g_date_time_new_from_iso8601(date, NULL);
+        msg->stanzaid = archive_id ? strdup(archive_id) : NULL;
+        msg->timestamp = date_time_new_from_usec(sqlite3_column_int64(stmt, 1));
+        msg->db_id = sqlite3_column_int64(stmt, 2);
     }
-    sqlite3_finalize(stmt);
-    sqlite3_free(query);
+    _db_stmt_release(stmt);
+
+    for (GSList* curr = pending; curr; curr = g_slist_next(curr)) {
+        ProfMessage* queued = curr->data;
+        int cmp = msg->timestamp ? _history_message_cmp(queued, msg) : 0;
+
+        if (!msg->timestamp || (is_last ? cmp > 0 : cmp < 0)) {
+            free(msg->stanzaid);
+            msg->stanzaid = g_steal_pointer(&queued->stanzaid);
+            if (msg->timestamp) {
+                g_date_time_unref(msg->timestamp);
+            }
+            msg->timestamp = g_steal_pointer(&queued->timestamp);
+            msg->db_id = queued->db_id;
+        }
+    }
+    g_slist_free_full(pending, (GDestroyNotify)message_free);
 
     return msg;
 }
 
-// Query previous chats, constraints start_time and end_time. If end_time is
-// null the current time is used. from_start gets first few messages if true
-// otherwise the last ones. Flip flips the order of the results
-GSList*
-log_database_get_previous_chat(const gchar* const contact_barejid, const char* start_time, char* end_time, gboolean from_start, gboolean flip)
+static void
+_history_page_free(DbHistoryPage* page)
 {
-    sqlite3_stmt* stmt = NULL;
-    const char* jid = connection_get_fulljid();
-    auto_jid Jid* myjid = jid_create(jid);
-    if (!myjid)
-        return NULL;
-
-    // Flip order when querying older pages
-    gchar* sort1 = from_start ? "ASC" : "DESC";
-    gchar* sort2 = !flip ? "ASC" : "DESC";
-    GDateTime* now = g_date_time_new_now_local();
-    auto_gchar gchar* end_date_fmt = end_time ? end_time : g_date_time_format_iso8601(now);
-    auto_sqlite gchar* query = sqlite3_mprintf("SELECT * FROM (SELECT COALESCE(B.`message`, A.`message`) AS message, A.`timestamp`, A.`from_jid`, A.`type`, A.`encryption` from `ChatLogs` AS A LEFT JOIN `ChatLogs` AS B ON A.`stanza_id` = B.`replace_id` WHERE A.`replace_id` = '' AND ((A.`from_jid` = '%q' AND A.`to_jid` = '%q') OR (A.`from_jid` = '%q' AND A.`to_jid` = '%q')) AND A.`timestamp` < '%q' AND (%Q IS NULL OR A.`timestamp` > %Q) ORDER BY A.`timestamp` %s LIMIT %d) ORDER BY `timestamp` %s;", contact_barejid, myjid->barejid, myjid->barejid, contact_barejid, end_date_fmt, start_time, start_time, sort1, MESSAGES_TO_RETRIEVE, sort2);
-
-    g_date_time_unref(now);
+    g_queue_unlink(&g_db_history_lru, &page->lru_link);
+    g_db_cache_stats.pages--;
+    g_db_cache_stats.size -= page->size;
+
+    g_slist_free_full(page->messages, (GDestroyNotify)message_free);
+    g_free(page->conversation);
+    g_free(page->cursor);
+    g_free(page);
+}
 
-    if (!query) {
-        log_error("log_database_get_previous_chat(): SQL query. could not allocate memory");
-        return NULL;
+// Both directions of a conversation share their pages
+static gchar*
+_history_conversation(const char* const jid_a, const char* const jid_b)
+{
+    if (g_strcmp0(jid_a, jid_b) <= 0) {
+        return g_strdup_printf("%s\n%s", jid_a, jid_b);
+    } else {
+        return g_strdup_printf("%s\n%s", jid_b, jid_a);
     }
+}
 
-    int rc = sqlite3_prepare_v2(g_chatlog_database, query, -1, &stmt, NULL);
-    if (rc != SQLITE_OK) {
-        log_error("log_database_get_previous_chat(): unknown SQLite error");
-        return NULL;
-    }
+static ProfMessage*
+_history_message_copy(const ProfMessage* const message)
+{
+    ProfMessage* copy = message_init();
 
-    GSList* history = NULL;
+    if (message->from_jid) {
+        jid_ref(message->from_jid);
+        copy->from_jid = message->from_jid;
+    }
+    copy->plain = message->plain ? strdup(message->plain) : NULL;
+    copy->timestamp = message->timestamp ? g_date_time_ref(message->timestamp) : NULL;
+    copy->type = message->type;
+    copy->enc = message->enc;
+    copy->db_id = message->db_id;
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        // TODO: also save to jid. since now part of profmessage
-        char* message = (char*)sqlite3_column_text(stmt, 0);
-        char* date = (char*)sqlite3_column_text(stmt, 1);
-        char* from = (char*)sqlite3_column_text(stmt, 2);
-        char* type = (char*)sqlite3_column_text(stmt, 3);
-        char* encryption = (char*)sqlite3_column_text(stmt, 3);
+    return copy;
+}
 
-        ProfMessage* msg = message_init();
-        msg->from_jid = jid_create(from);
-        msg->plain = strdup(message);
-        msg->timestamp = g_date_time_new_from_iso8601(date, NULL);
-        msg->type = _get_message_type_type(type);
-        msg->enc = _get_message_enc_type(encryption);
+// Rough memory used by a cached message, the GDateTime is opaque
+static gsize
+_history_message_size(const ProfMessage* const message)
+{
+    gsize size = sizeof(GSList) + sizeof(ProfMessage) + 64;
 
-        history = g_slist_append(history, msg);
+    if (message->plain) {
+        size += strlen(message->plain) + 1;
+    }
+    if (message->from_jid) {
+        // the JID is stored in several parts
+        size += sizeof(Jid) + 3 * (strlen(message->from_jid->str) + 1);
     }
-    sqlite3_finalize(stmt);
 
-    return history;
+    return size;
 }
 
-static const char*
-_get_message_type_str(prof_msg_type_t type)
+static void
+_history_cache_remove(DbHistoryPage* page)
 {
-    switch (type) {
-    case PROF_MSG_TYPE_CHAT:
-        return "chat";
-    case PROF_MSG_TYPE_MUC:
-        return "muc";
-    case PROF_MSG_TYPE_MUCPM:
-        return "mucpm";
-    case PROF_MSG_TYPE_UNINITIALIZED:
-        return NULL;
+    gpointer conversation;
+    gpointer pages;
+
+    if (!g_hash_table_lookup_extended(g_db_history_cache, page->conversation, &conversation, &pages)) {
+        return;
+    }
+
+    g_hash_table_remove(pages, page->cursor);
+    if (g_hash_table_size(pages) == 0) {
+        g_hash_table_remove(g_db_history_cache, conversation);
     }
-    return NULL;
 }
 
-static prof_msg_type_t
-_get_message_type_type(const char* const type)
+// Drop the least recently used pages until the cache fits into budget bytes
+static void
+_history_cache_evict(gsize budget)
 {
-    if (g_strcmp0(type, "chat") == 0) {
-        return PROF_MSG_TYPE_CHAT;
-    } else if (g_strcmp0(type, "muc") == 0) {
-        return PROF_MSG_TYPE_MUC;
-    } else if (g_strcmp0(type, "mucpm") == 0) {
-        return PROF_MSG_TYPE_MUCPM;
-    } else {
-        return PROF_MSG_TYPE_UNINITIALIZED;
+    while (g_db_cache_stats.size > budget && g_db_history_lru.tail) {
+        _history_cache_remove(g_db_history_lru.tail->data);
+        g_db_cache_stats.evictions++;
     }
 }
 
-static const char*
-_get_message_enc_str(prof_enc_t enc)
+static gboolean
+_history_cache_lookup(const char* const conversation, const char* const cursor, GSList** history)
 {
-    switch (enc) {
-    case PROF_MSG_ENC_OX:
-        return "ox";
-    case PROF_MSG_ENC_PGP:
-        return "pgp";
-    case PROF_MSG_ENC_OTR:
-        return "otr";
-    case PROF_MSG_ENC_OMEMO:
-        return "omemo";
-    case PROF_MSG_ENC_NONE:
-        return "none";
+    GHashTable* pages = g_db_history_cache ? g_hash_table_lookup(g_db_history_cache, conversation) : NULL;
+    DbHistoryPage* page = pages ? g_hash_table_lookup(pages, cursor) : NULL;
+
+    if (!page) {
+        g_db_cache_stats.misses++;
+        return FALSE;
     }
 
-    return "none";
-}
+    g_db_cache_stats.hits++;
+    g_queue_unlink(&g_db_history_lru, &page->lru_link);
+    g_queue_push_head_link(&g_db_history_lru, &page->lru_link);
 
-static prof_enc_t
-_get_message_enc_type(const char* const encstr)
-{
-    if (g_strcmp0(encstr, "ox") == 0) {
-        return PROF_MSG_ENC_OX;
-    } else if (g_strcmp0(encstr, "pgp") == 0) {
-        return PROF_MSG_ENC_PGP;
-    } else if (g_strcmp0(encstr, "otr") == 0) {
-        return PROF_MSG_ENC_OTR;
-    } else if (g_strcmp0(encstr, "omemo") == 0) {
-        return PROF_MSG_ENC_OMEMO;
+    *history = NULL;
+    for (GSList* curr = page->messages; curr; curr = g_slist_next(curr)) {
+        *history = g_slist_prepend(*history, _history_message_copy(curr->data));
     }
+    *history = g_slist_reverse(*history);
 
-    return PROF_MSG_ENC_NONE;
+    return TRUE;
 }
 
 static void
-_add_to_db(ProfMessage* message, char* type, const Jid* const from_jid, const Jid* const to_jid)
+_history_cache_store(const char* const conversation, const char* const cursor, GSList* history)
 {
-    auto_gchar gchar* pref_dblog = prefs_get_string(PREF_DBLOG);
+    gsize budget = (gsize)prefs_get_dblog_cache_size() * 1024;
+    gsize size = sizeof(DbHistoryPage) + strlen(conversation) + strlen(cursor) + 2;
 
-    if (g_strcmp0(pref_dblog, "off") == 0) {
-        return;
-    } else if (g_strcmp0(pref_dblog, "redact") == 0) {
-        if (message->plain) {
-            free(message->plain);
+    for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
+        // the page changes once its queued messages are written
+        if (((ProfMessage*)curr->data)->db_id == DB_PENDING_ID) {
+            return;
         }
-        message->plain = strdup("[REDACTED]");
+        size += _history_message_size(curr->data);
     }
 
-    if (!g_chatlog_database) {
-        log_debug("log_database_add() called but db is not initialized");
+    if (size > budget) {
+        _history_cache_evict(budget);
         return;
     }
 
-    char* err_msg;
-    auto_gchar gchar* date_fmt;
+    if (!g_db_history_cache) {
+        g_db_history_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+    }
+
+    GHashTable* pages = g_hash_table_lookup(g_db_history_cache, conversation);
+    if (!pages) {
+        pages = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)_history_page_free);
+        g_hash_table_insert(g_db_history_cache, g_strdup(conversation), pages);
+    }
+
+    DbHistoryPage* page = g_new0(DbHistoryPage, 1);
+    page->conversation = g_strdup(conversation);
+    page->cursor = g_strdup(cursor);
+    for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
+        page->messages = g_slist_prepend(page->messages, _history_message_copy(curr->data));
+    }
+    page->messages = g_slist_reverse(page->messages);
+    page->size = size;
+    page->lru_link.data = page;
+
+    // replaces a page stored for the same cursor
+    g_hash_table_replace(pages, page->cursor, page);
+    g_queue_push_head_link(&g_db_history_lru, &page->lru_link);
+    g_db_cache_stats.pages++;
+    g_db_cache_stats.size += size;
+
+    _history_cache_evict(budget);
+}
+
+static void
+_history_cache_invalidate(const char* const jid_a, const char* const jid_b)
+{
+    g_db_history_generation++;
+    if (!g_db_history_cache) {
+        return;
+    }
+
+    auto_gchar gchar* conversation = _history_conversation(jid_a, jid_b);
+    GHashTable* pages = g_hash_table_lookup(g_db_history_cache, conversation);
+    if (pages) {
+        g_db_cache_stats.invalidations += g_hash_table_size(pages);
+        g_hash_table_remove(g_db_history_cache, conversation);
+    }
+}
+
+static void
+_history_cache_clear(void)
+{
+    g_db_history_generation++;
+    if (g_db_history_cache) {
+        g_hash_table_destroy(g_db_history_cache);
+        g_db_history_cache = NULL;
+    }
+}
+
+void
+log_database_get_cache_stats(DbCacheStats* stats)
+{
+    *stats = g_db_cache_stats;
+}
+
+// Apply a changed cache size right away instead of on the next store
+void
+log_database_trim_cache(void)
+{
+    _history_cache_evict((gsize)prefs_get_dblog_cache_size() * 1024);
+}
+
+// Parse a retention policy: "forever", "<days>d" to keep messages that many
+// days or "<messages>" to keep that many messages per conversation
+gboolean
+log_database_parse_retention(const char* const policy, gint* days, gint* messages)
+{
+    guint64 value = 0;
+
+    *days = 0;
+    *messages = 0;
+
+    if (g_strcmp0(policy, "forever") == 0) {
+        return TRUE;
+    }
+
+    if (policy == NULL || policy[0] == '\0') {
+        return FALSE;
+    }
+
+    size_t len = strlen(policy);
+    gboolean in_days = policy[len - 1] == 'd';
+    auto_gchar gchar* number = g_strndup(policy, in_days ? len - 1 : len);
+
+    // about 270 years, the cutoff has to fit into microseconds
+    if (!g_ascii_string_to_unsigned(number, 10, 1, in_days ? 100000 : G_MAXINT, &value, NULL)) {
+        return FALSE;
+    }
 
-    if (message->timestamp) {
-        date_fmt = g_date_time_format_iso8601(message->timestamp);
+    if (in_days) {
+        *days = value;
     } else {
-        GDateTime* dt = g_date_time_new_now_local();
-        date_fmt = g_date_time_format_iso8601(dt);
-        g_date_time_unref(dt);
+        *messages = value;
     }
 
-    const char* enc = _get_message_enc_str(message->enc);
+    return TRUE;
+}
 
-    if (!type) {
-        type = (char*)_get_message_type_str(message->type);
+// A policy set for the account overrides the global one
+static void
+_retention_load_policies(void)
+{
+    static const preference_t prefs[] = { PREF_DBLOG_RETENTION_CHAT, PREF_DBLOG_RETENTION_MUC, PREF_DBLOG_RETENTION_MUCPM };
+    gchar* policies[DB_RETENTION_TYPES];
+
+    for (int i = 0; i < DB_RETENTION_TYPES; i++) {
+        policies[i] = accounts_get_retention(g_db_account_name, db_retention_types[i]);
+        if (!policies[i]) {
+            policies[i] = prefs_get_string(prefs[i]);
+        }
     }
 
-    auto_sqlite char* duplicate_check_query = sqlite3_mprintf("SELECT 1 FROM `ChatLogs` WHERE (`archive_id` = '%q' AND `archive_id` != '') OR (`stanza_id` = '%q' AND `stanza_id` != '')",
-                                                              message->stanzaid ? message->stanzaid : "",
-                                                              message->id ? message->id : "");
+    g_mutex_lock(&g_db_mutex);
+    for (int i = 0; i < DB_RETENTION_TYPES; i++) {
+        g_free(g_db_retention_policies[i]);
+        g_db_retention_policies[i] = policies[i];
+    }
+    g_mutex_unlock(&g_db_mutex);
+}
 
-    if (!duplicate_check_query) {
-        log_error("log_database_add(): SQL query for duplicate check. could not allocate memory");
+// Apply changed retention policies right away
+void
+log_database_update_retention(void)
+{
+    if (!g_db_thread) {
         return;
     }
 
-    int duplicate_exists = 0;
-    sqlite3_stmt* stmt;
+    _retention_load_policies();
 
-    if (SQLITE_OK == sqlite3_prepare_v2(g_chatlog_database, duplicate_check_query, -1, &stmt, NULL)) {
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-            duplicate_exists = 1;
+    g_mutex_lock(&g_db_mutex);
+    g_db_retention_next = g_get_monotonic_time();
+    g_cond_signal(&g_db_work_cond);
+    g_mutex_unlock(&g_db_mutex);
+}
+
+void
+log_database_get_retention_stats(DbRetentionStats* stats)
+{
+    g_mutex_lock(&g_db_mutex);
+    *stats = g_db_retention_stats;
+    g_mutex_unlock(&g_db_mutex);
+}
+
+static gchar*
+_history_cursor(gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip)
+{
+    return g_strdup_printf("%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT ":%d:%d", start_time, start_id, end_time, end_id, from_start, flip);
+}
+
+static ProfMessage*
+_pending_message_to_message(const DbPendingMessage* const pending)
+{
+    ProfMessage* msg = message_init();
+
+    msg->from_jid = pending->from_resource && pending->from_resource[0] ? jid_create_from_bare_and_resource(pending->from_jid, pending->from_resource) : jid_create(pending->from_jid);
+    msg->id = pending->stanza_id[0] ? strdup(pending->stanza_id) : NULL;
+    msg->stanzaid = pending->archive_id[0] ? strdup(pending->archive_id) : NULL;
+    msg->replace_id = pending->replace_id[0] ? strdup(pending->replace_id) : NULL;
+    msg->plain = strdup(pending->message);
+    msg->timestamp = date_time_new_from_usec(pending->timestamp);
+    msg->type = _get_message_type_type(pending->type);
+    msg->enc = _get_message_enc_type(pending->encryption);
+    msg->db_id = DB_PENDING_ID;
+
+    return msg;
+}
+
+// Copies of the messages of a conversation that are queued or being written,
+// in the order they were queued. Messages queued after max_seq are left out.
+static GSList*
+_pending_conversation(const char* const contact_barejid, const char* const my_barejid, guint64 max_seq)
+{
+    GQueue* queues[] = { &g_db_inflight, &g_pending_messages };
+    GSList* messages = NULL;
+
+    g_mutex_lock(&g_db_mutex);
+    for (int i = 0; i < ARRAY_SIZE(queues); i++) {
+        for (GList* curr = queues[i]->head; curr; curr = g_list_next(curr)) {
+            DbPendingMessage* pending = curr->data;
+            if (pending->seq > max_seq) {
+                continue;
+            }
+            if ((g_strcmp0(pending->from_jid, contact_barejid) == 0 && g_strcmp0(pending->to_jid, my_barejid) == 0)
+                || (g_strcmp0(pending->from_jid, my_barejid) == 0 && g_strcmp0(pending->to_jid, contact_barejid) == 0)) {
+                messages = g_slist_prepend(messages, _pending_message_to_message(pending));
+            }
         }
-        sqlite3_finalize(stmt);
     }
+    g_mutex_unlock(&g_db_mutex);
 
-    if (duplicate_exists) {
-        log_warning("Duplicate stanza-id found for the message. stanza_id: %s; archive_id: %s; sender: %s; content: %s", message->id, message->stanzaid, from_jid->barejid, message->plain);
-        return;
+    return g_slist_reverse(messages);
+}
+
+// The number of the last queued message, see _pending_conversation()
+static guint64
+_pending_last_seq(void)
+{
+    g_mutex_lock(&g_db_mutex);
+    guint64 seq = g_db_pending_seq;
+    g_mutex_unlock(&g_db_mutex);
+
+    return seq;
+}
+
+static gint64
+_message_usec(const ProfMessage* const message)
+{
+    return message->timestamp ? date_time_to_usec(message->timestamp) : 0;
+}
+
+// Order of the (`timestamp`, `id`) keyset
+static gint
+_history_message_cmp(gconstpointer a, gconstpointer b)
+{
+    const ProfMessage* msg_a = a;
+    const ProfMessage* msg_b = b;
+    gint64 time_a = _message_usec(msg_a);
+    gint64 time_b = _message_usec(msg_b);
+
+    if (time_a != time_b) {
+        return time_a < time_b ? -1 : 1;
     }
+    if (msg_a->db_id != msg_b->db_id) {
+        return msg_a->db_id < msg_b->db_id ? -1 : 1;
+    }
+    return 0;
+}
 
-    auto_sqlite char* query = sqlite3_mprintf("INSERT INTO `ChatLogs` (`from_jid`, `from_resource`, `to_jid`, `to_resource`, `message`, `timestamp`, `stanza_id`, `archive_id`, `replace_id`, `type`, `encryption`) VALUES ('%q', '%q', '%q', '%q', '%q', '%q', '%q', '%q', '%q', '%q', '%q')",
-                                              from_jid->barejid,
-                                              from_jid->resourcepart ? from_jid->resourcepart : "",
-                                              to_jid->barejid,
-                                              to_jid->resourcepart ? to_jid->resourcepart : "",
-                                              message->plain ? message->plain : "",
-                                              date_fmt ? date_fmt : "",
-                                              message->id ? message->id : "",
-                                              message->stanzaid ? message->stanzaid : "",
-                                              message->replace_id ? message->replace_id : "",
-                                              type ? type : "",
-                                              enc ? enc : "");
-    if (!query) {
-        log_error("log_database_add(): SQL query. could not allocate memory");
-        return;
+// A queued message is already in the page if the writer committed it while
+// the page was read
+static gboolean
+_history_contains_stored(GSList* history, const ProfMessage* const pending)
+{
+    gint64 time = _message_usec(pending);
+
+    for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
+        ProfMessage* msg = curr->data;
+        if (msg->db_id != DB_PENDING_ID && _message_usec(msg) == time && msg->from_jid && pending->from_jid && g_strcmp0(msg->from_jid->barejid, pending->from_jid->barejid) == 0) {
+            return TRUE;
+        }
     }
 
-    log_debug("Writing to DB. Query: %s", query);
+    return FALSE;
+}
 
-    if (SQLITE_OK != sqlite3_exec(g_chatlog_database, query, NULL, 0, &err_msg)) {
-        if (err_msg) {
-            log_error("SQLite error: %s", err_msg);
-            sqlite3_free(err_msg);
+static void
+_history_apply_correction(GSList* history, const ProfMessage* const correction)
+{
+    for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
+        ProfMessage* msg = curr->data;
+        if (g_strcmp0(msg->id, correction->replace_id) == 0) {
+            free(msg->plain);
+            msg->plain = strdup(correction->plain);
+        }
+    }
+}
+
+// Add the queued messages of the conversation to a page read from the
+// database, both in ascending order. The cursors are those of the query,
+// queued messages sort after the stored ones with the same timestamp. Takes
+// ownership of pending.
+static GSList*
+_history_merge_pending(GSList* history, GSList* pending, gint64 start_time, gint64 start_id, gint64 end_time, gboolean from_start)
+{
+    // in reverse, so that messages with the same timestamp keep their order
+    GSList* corrections = NULL;
+    pending = g_slist_reverse(pending);
+    for (GSList* curr = pending; curr; curr = g_slist_next(curr)) {
+        ProfMessage* msg = curr->data;
+        gint64 time = _message_usec(msg);
+
+        if (msg->replace_id) {
+            corrections = g_slist_prepend(corrections, msg);
+        } else if ((time > start_time || (time == start_time && start_id != DB_PENDING_ID)) && time < end_time && !_history_contains_stored(history, msg)) {
+            history = g_slist_insert_sorted(history, msg, _history_message_cmp);
+        } else {
+            message_free(msg);
+        }
+    }
+    g_slist_free(pending);
+
+    guint length = g_slist_length(history);
+    if (length > MESSAGES_TO_RETRIEVE) {
+        if (from_start) {
+            GSList* last = g_slist_nth(history, MESSAGES_TO_RETRIEVE - 1);
+            g_slist_free_full(last->next, (GDestroyNotify)message_free);
+            last->next = NULL;
         } else {
-            log_error("Unknown SQLite error");
+            for (; length > MESSAGES_TO_RETRIEVE; length--) {
+                message_free(history->data);
+                history = g_slist_delete_link(history, history);
+            }
+        }
+    }
+
+    // the latest correction wins, like in _apply_correction()
+    for (GSList* curr = corrections; curr; curr = g_slist_next(curr)) {
+        _history_apply_correction(history, curr->data);
+    }
+    g_slist_free_full(corrections, (GDestroyNotify)message_free);
+
+    return history;
+}
+
+// Read a history page on the given connection, the main thread uses the
+// reader connection and the history thread its own. Messages that are still
+// queued for the writer are added up to the one numbered max_seq. Returns
+// FALSE if the page could not be read completely, history is set to NULL
+// then.
+static gboolean
+_history_read(DbConnection* conn, const char* const contact_barejid, const char* const my_barejid, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip, guint64 max_seq, GSList** history)
+{
+    *history = NULL;
+
+    // taken first, a message committed in the meantime is read from the
+    // database and dropped from the queued ones
+    GSList* pending = _pending_conversation(contact_barejid, my_barejid, max_seq);
+
+    // Flip order when querying older pages
+    db_stmt_t stmt_id;
+    if (from_start) {
+        stmt_id = flip ? DB_STMT_PREVIOUS_CHAT_FIRST_DESC : DB_STMT_PREVIOUS_CHAT_FIRST_ASC;
+    } else {
+        stmt_id = flip ? DB_STMT_PREVIOUS_CHAT_LAST_DESC : DB_STMT_PREVIOUS_CHAT_LAST_ASC;
+    }
+
+    sqlite3_stmt* stmt = _db_stmt(conn, stmt_id);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_get_previous_chat(): %s", sqlite3_errmsg(conn->db));
+        g_slist_free_full(pending, (GDestroyNotify)message_free);
+        return FALSE;
+    }
+
+    // the cursor is at a queued message, which may be stored by now
+    if (end_id == DB_PENDING_ID) {
+        end_id = 0;
+    }
+    // unlike NULL the extremes keep the range usable for the index
+    if (!end_time) {
+        end_time = G_MAXINT64;
+        end_id = G_MAXINT64;
+    }
+    if (!start_time) {
+        start_time = G_MININT64;
+        start_id = 0;
+    }
+
+    sqlite3_bind_text(stmt, 1, contact_barejid, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, my_barejid, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, end_time);
+    sqlite3_bind_int64(stmt, 4, start_time);
+    sqlite3_bind_int(stmt, 5, MESSAGES_TO_RETRIEVE);
+    sqlite3_bind_int64(stmt, 6, end_id);
+    sqlite3_bind_int64(stmt, 7, start_id);
+
+    GSList* messages = NULL;
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        // TODO: also save to jid. since now part of profmessage
+        char* message = (char*)sqlite3_column_text(stmt, 0);
+        gint64 date = sqlite3_column_int64(stmt, 1);
+        char* from = (char*)sqlite3_column_text(stmt, 2);
+        char* type = (char*)sqlite3_column_text(stmt, 3);
+        char* encryption = (char*)sqlite3_column_text(stmt, 4);
+        char* stanza_id = (char*)sqlite3_column_text(stmt, 6);
+        char* from_resource = (char*)sqlite3_column_text(stmt, 7);
+
+        // the resource is the nick in rooms
+        ProfMessage* msg = message_init();
+        msg->from_jid = from_resource && from_resource[0] ? jid_create_from_bare_and_resource(from, from_resource) : jid_create(from);
+        msg->plain = strdup(message ? message : "");
+        msg->timestamp = date_time_new_from_usec(date);
+        msg->type = _get_message_type_type(type);
+        msg->enc = _get_message_enc_type(encryption);
+        msg->db_id = sqlite3_column_int64(stmt, 5);
+        msg->id = stanza_id && stanza_id[0] ? strdup(stanza_id) : NULL;
+
+        messages = g_slist_prepend(messages, msg);
+    }
+
+    // a busy or interrupted query ends early, the page would look shorter
+    // than it is
+    if (ret != SQLITE_DONE) {
+        if (ret != SQLITE_INTERRUPT) {
+            _db_report(PROF_LEVEL_ERROR, "log_database_get_previous_chat(): could not read history with %s: %s", contact_barejid, sqlite3_errmsg(conn->db));
         }
+        _db_stmt_release(stmt);
+        g_slist_free_full(messages, (GDestroyNotify)message_free);
+        g_slist_free_full(pending, (GDestroyNotify)message_free);
+        return FALSE;
+    }
+    _db_stmt_release(stmt);
+
+    // the rows were prepended, they are in ascending order if flipped
+    if (!pending) {
+        *history = g_slist_reverse(messages);
+    } else if (flip) {
+        *history = g_slist_reverse(_history_merge_pending(messages, pending, start_time, start_id, end_time, from_start));
     } else {
-        int inserted_rows_count = sqlite3_changes(g_chatlog_database);
-        if (inserted_rows_count < 1) {
-            log_error("SQLite did not insert message (rows: %d, id: %s, content: %s)", inserted_rows_count, message->id, message->plain);
+        *history = _history_merge_pending(g_slist_reverse(messages), pending, start_time, start_id, end_time, from_start);
+    }
+    return TRUE;
+}
+
+// Query previous chats between the keyset cursors (start_time, start_id) and
+// (end_time, end_id), both exclusive. Times are microseconds since the epoch.
+// Pass an id of G_MAXINT64 with start_time and 0 with end_time to bound by time
+// only. If start_time is 0 the history is read from the beginning, if end_time
+// is 0 up to the latest message. from_start gets first few messages if true
+// otherwise the last ones. Flip flips the order of the results
+GSList*
+log_database_get_previous_chat(const gchar* const contact_barejid, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip)
+{
+    const char* jid = connection_get_fulljid();
+    auto_jid Jid* myjid = jid_create(jid);
+    if (!myjid)
+        return NULL;
+
+    if (!g_db_reader.db) {
+        return NULL;
+    }
+
+    // queued messages already dropped the pages they change
+    auto_gchar gchar* conversation = _history_conversation(contact_barejid, myjid->barejid);
+    auto_gchar gchar* cursor = _history_cursor(start_time, start_id, end_time, end_id, from_start, flip);
+    GSList* history = NULL;
+    if (_history_cache_lookup(conversation, cursor, &history)) {
+        return history;
+    }
+
+    if (_history_read(&g_db_reader, contact_barejid, myjid->barejid, start_time, start_id, end_time, end_id, from_start, flip, G_MAXUINT64, &history)) {
+        _history_cache_store(conversation, cursor, history);
+    }
+
+    return history;
+}
+
+// Queue a request for the history thread, returns its id
+static guint
+_history_request_submit(DbHistoryRequest* request)
+{
+    g_mutex_lock(&g_db_history_mutex);
+    if (++g_db_history_last_id == 0) {
+        g_db_history_last_id++;
+    }
+    request->id = g_db_history_last_id;
+    g_queue_push_tail(&g_db_history_requests, request);
+    g_cond_signal(&g_db_history_cond);
+    g_mutex_unlock(&g_db_history_mutex);
+
+    return request->id;
+}
+
+static void
+_history_request_free(DbHistoryRequest* request)
+{
+    g_free(request->contact_barejid);
+    g_free(request->my_barejid);
+    g_free(request->query);
+    g_free(request->with_jid);
+    g_free(request->type);
+    g_free(request->path);
+    g_clear_object(&request->cancellable);
+    g_clear_error(&request->error);
+    g_slist_free_full(request->history, (GDestroyNotify)message_free);
+    g_free(request);
+}
+
+// Like log_database_get_previous_chat(), but the page is read on the history
+// thread and handed to callback from log_database_process_events(). The
+// callback takes ownership of the list. Returns the id of the request to
+// cancel it with, or 0 if the callback already ran because the page was
+// cached or there is no history thread.
+guint
+log_database_get_previous_chat_async(const gchar* const contact_barejid, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip, DbHistoryCallback callback, gpointer user_data)
+{
+    auto_jid Jid* myjid = jid_create(connection_get_fulljid());
+    if (!myjid || !g_db_history_thread) {
+        callback(log_database_get_previous_chat(contact_barejid, start_time, start_id, end_time, end_id, from_start, flip), user_data);
+        return 0;
+    }
+
+    auto_gchar gchar* conversation = _history_conversation(contact_barejid, myjid->barejid);
+    auto_gchar gchar* cursor = _history_cursor(start_time, start_id, end_time, end_id, from_start, flip);
+    GSList* history = NULL;
+    if (_history_cache_lookup(conversation, cursor, &history)) {
+        callback(history, user_data);
+        return 0;
+    }
+
+    DbHistoryRequest* request = g_new0(DbHistoryRequest, 1);
+    request->contact_barejid = g_strdup(contact_barejid);
+    request->my_barejid = g_strdup(myjid->barejid);
+    request->start_time = start_time;
+    request->start_id = start_id;
+    request->end_time = end_time;
+    request->end_id = end_id;
+    request->from_start = from_start;
+    request->flip = flip;
+    // messages queued later are shown by the window already
+    request->pending_seq = _pending_last_seq();
+    request->generation = g_db_history_generation;
+    request->callback = callback;
+    request->user_data = user_data;
+
+    return _history_request_submit(request);
+}
+
+static gint
+_history_request_cmp_id(gconstpointer request, gconstpointer id)
+{
+    return ((const DbHistoryRequest*)request)->id == GPOINTER_TO_UINT(id) ? 0 : 1;
+}
+
+static gboolean
+_history_request_remove(GQueue* queue, guint id)
+{
+    GList* link = g_queue_find_custom(queue, GUINT_TO_POINTER(id), _history_request_cmp_id);
+    if (!link) {
+        return FALSE;
+    }
+
+    _history_request_free(link->data);
+    g_queue_delete_link(queue, link);
+    return TRUE;
+}
+
+// Drop a request, its callback is not called. A query that is running is
+// interrupted. Unknown ids are ignored.
+void
+log_database_cancel_history(guint request_id)
+{
+    if (request_id == 0) {
+        return;
+    }
+
+    g_mutex_lock(&g_db_history_mutex);
+    if (!_history_request_remove(&g_db_history_requests, request_id)
+        && !_history_request_remove(&g_db_history_done, request_id)
+        && g_db_history_current && g_db_history_current->id == request_id) {
+        g_db_history_current->cancelled = TRUE;
+        if (g_db_history_current->cancellable) {
+            g_cancellable_cancel(g_db_history_current->cancellable);
+        }
+        sqlite3_interrupt(g_db_history_reader.db);
+    }
+    g_mutex_unlock(&g_db_history_mutex);
+}
+
+static gpointer
+_db_history_thread(gpointer data)
+{
+    g_mutex_lock(&g_db_history_mutex);
+    while (!g_db_history_shutdown) {
+        DbHistoryRequest* request = g_queue_pop_head(&g_db_history_requests);
+        if (!request) {
+            g_cond_wait(&g_db_history_cond, &g_db_history_mutex);
+            continue;
+        }
+
+        g_db_history_current = request;
+        g_mutex_unlock(&g_db_history_mutex);
+
+        switch (request->kind) {
+        case DB_REQUEST_HISTORY:
+            request->complete = _history_read(&g_db_history_reader, request->contact_barejid, request->my_barejid, request->start_time, request->start_id, request->end_time, request->end_id, request->from_start, request->flip, request->pending_seq, &request->history);
+            break;
+        case DB_REQUEST_SEARCH:
+            // the index only knows committed messages
+            _db_writer_sync();
+            request->complete = _search_read(&g_db_history_reader, request->query, request->with_jid, request->type, request->after, request->before, request->start_id, &request->history);
+            break;
+        case DB_REQUEST_EXPORT:
+            _db_writer_sync();
+            request->complete = _export_write(&g_db_history_reader, request->path, request->format, request->with_jid, request->type, request->after, request->before, request->cancellable, &request->count, &request->error);
+            break;
+        }
+
+        g_mutex_lock(&g_db_history_mutex);
+        g_db_history_current = NULL;
+        g_queue_push_tail(&g_db_history_done, request);
+    }
+    g_mutex_unlock(&g_db_history_mutex);
+
+    return NULL;
+}
+
+// Pop the oldest finished request, NULL if there is none
+static DbHistoryRequest*
+_history_request_pop_done(void)
+{
+    g_mutex_lock(&g_db_history_mutex);
+    DbHistoryRequest* request = g_queue_pop_head(&g_db_history_done);
+    g_mutex_unlock(&g_db_history_mutex);
+
+    return request;
+}
+
+// Run the callbacks of finished requests. Complete pages read since the last
+// cache invalidation are cached like synchronously read ones. Requests are
+// taken one at a time, a callback may close windows and cancel requests that
+// are still in the queue.
+static void
+_history_requests_complete(void)
+{
+    DbHistoryRequest* request;
+    while ((request = _history_request_pop_done())) {
+        if (!request->cancelled && request->kind == DB_REQUEST_EXPORT) {
+            request->export_callback(request->complete, request->count, request->error, request->user_data);
+        } else if (!request->cancelled) {
+            if (request->kind == DB_REQUEST_HISTORY && request->complete && request->generation == g_db_history_generation) {
+                auto_gchar gchar* conversation = _history_conversation(request->contact_barejid, request->my_barejid);
+                auto_gchar gchar* cursor = _history_cursor(request->start_time, request->start_id, request->end_time, request->end_id, request->from_start, request->flip);
+                _history_cache_store(conversation, cursor, request->history);
+            }
+            request->callback(g_steal_pointer(&request->history), request->user_data);
         }
+        _history_request_free(request);
+    }
+}
+
+static void
+_history_request_abort(gpointer data, gpointer user_data)
+{
+    DbHistoryRequest* request = data;
+    if (request->complete) {
+        return;
+    }
+
+    if (request->kind == DB_REQUEST_SEARCH) {
+        request->cancelled = TRUE;
+    } else if (request->kind == DB_REQUEST_EXPORT && !request->error) {
+        request->error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CLOSED, "The chat log database was closed");
+    }
+}
+
+// Stop the history thread. History requests that did not finish are completed
+// without messages so that windows do not keep waiting for them, unfinished
+// searches are dropped and unfinished exports fail.
+static void
+_db_history_stop(void)
+{
+    if (!g_db_history_thread) {
+        return;
     }
+
+    g_mutex_lock(&g_db_history_mutex);
+    g_db_history_shutdown = TRUE;
+    if (g_db_history_current) {
+        if (g_db_history_current->cancellable) {
+            g_cancellable_cancel(g_db_history_current->cancellable);
+        }
+        sqlite3_interrupt(g_db_history_reader.db);
+    }
+    g_cond_signal(&g_db_history_cond);
+    g_mutex_unlock(&g_db_history_mutex);
+
+    g_thread_join(g_db_history_thread);
+    g_db_history_thread = NULL;
+    _db_connection_close(&g_db_history_reader);
+
+    // nothing runs any more, the queues can be moved without the lock
+    DbHistoryRequest* request;
+    while ((request = g_queue_pop_head(&g_db_history_requests))) {
+        g_queue_push_tail(&g_db_history_done, request);
+    }
+    g_queue_foreach(&g_db_history_done, _history_request_abort, NULL);
+    _history_requests_complete();
+}
+
+// Turn the search terms into an fts5 query. Every term is quoted so that
+// punctuation is not taken for query syntax, a trailing '*' makes it a prefix
+// query. Terms are implicitly combined with AND.
+static gchar*
+_get_search_query(gchar** terms)
+{
+    GString* query = g_string_new(NULL);
+
+    for (int i = 0; terms[i] != NULL; i++) {
+        const gchar* term = terms[i];
+        size_t len = strlen(term);
+        gboolean prefix = len > 1 && term[len - 1] == '*';
+        if (prefix) {
+            len--;
+        }
+        if (len == 0) {
+            continue;
+        }
+
+        if (query->len > 0) {
+            g_string_append_c(query, ' ');
+        }
+        g_string_append_c(query, '"');
+        for (size_t j = 0; j < len; j++) {
+            if (term[j] == '"') {
+                g_string_append_c(query, '"');
+            }
+            g_string_append_c(query, term[j]);
+        }
+        g_string_append_c(query, '"');
+        if (prefix) {
+            g_string_append_c(query, '*');
+        }
+    }
+
+    return g_string_free(query, query->len == 0);
+}
+
+gboolean
+log_database_search_available(void)
+{
+    return g_db_search_available;
+}
+
+// Run a search on the given connection, see log_database_search_async().
+// Returns FALSE if the search failed or was interrupted.
+static gboolean
+_search_read(DbConnection* conn, const char* const query, const char* const with_jid, const char* const type, gint64 after, gint64 before, gint64 after_id, GSList** results)
+{
+    *results = NULL;
+
+    sqlite3_stmt* stmt = _db_stmt(conn, DB_STMT_SEARCH);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_search(): %s", sqlite3_errmsg(conn->db));
+        return FALSE;
+    }
+
+    sqlite3_bind_text(stmt, 1, query, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, with_jid, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+    if (after) {
+        sqlite3_bind_int64(stmt, 4, after);
+    }
+    if (before) {
+        sqlite3_bind_int64(stmt, 5, before);
+    }
+    sqlite3_bind_int(stmt, 6, SEARCH_RESULTS_MAX);
+    if (after_id) {
+        sqlite3_bind_int64(stmt, 7, after_id);
+    }
+
+    int ret;
+    while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        gint64 date = sqlite3_column_int64(stmt, 0);
+        char* from = (char*)sqlite3_column_text(stmt, 1);
+        char* from_resource = (char*)sqlite3_column_text(stmt, 2);
+        char* to = (char*)sqlite3_column_text(stmt, 3);
+        char* msg_type = (char*)sqlite3_column_text(stmt, 4);
+        char* encryption = (char*)sqlite3_column_text(stmt, 5);
+        char* snippet = (char*)sqlite3_column_text(stmt, 6);
+        gint64 db_id = sqlite3_column_int64(stmt, 7);
+
+        ProfMessage* msg = message_init();
+        msg->from_jid = from_resource && from_resource[0] ? jid_create_from_bare_and_resource(from, from_resource) : jid_create(from);
+        msg->to_jid = jid_create(to);
+        msg->plain = strdup(snippet ? snippet : "");
+        msg->timestamp = date_time_new_from_usec(date);
+        msg->type = _get_message_type_type(msg_type);
+        msg->enc = _get_message_enc_type(encryption);
+        msg->db_id = db_id;
+
+        *results = g_slist_prepend(*results, msg);
+    }
+    if (ret != SQLITE_DONE && ret != SQLITE_INTERRUPT) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_search(): %s", sqlite3_errmsg(conn->db));
+    }
+    _db_stmt_release(stmt);
+
+    if (ret != SQLITE_DONE) {
+        g_slist_free_full(*results, (GDestroyNotify)message_free);
+        *results = NULL;
+        return FALSE;
+    }
+
+    *results = g_slist_reverse(*results);
+    return TRUE;
+}
+
+// Full-text search over the chat logs, the best matches by bm25 first and
+// the newest first among equally good ones. Results can be limited to a
+// contact or room and a message type, each may be NULL, and a time range
+// [after, before) in microseconds since the epoch, 0 for no bound. For the
+// next page pass the db_id of the last result as after_id, 0 starts with the
+// best match. The plain text of the returned messages is a snippet around the
+// match.
+// The search runs on the history thread once the queued messages are written
+// and callback gets the results from log_database_process_events(), or NULL
+// if there are none. Returns the id of the request to cancel it with
+// log_database_cancel_history(), or 0 if callback already ran. Without the
+// history thread messages that are still queued are not found.
+guint
+log_database_search_async(gchar** terms, const char* const with_jid, const char* const type, gint64 after, gint64 before, gint64 after_id, DbHistoryCallback callback, gpointer user_data)
+{
+    auto_gchar gchar* query = g_db_search_available ? _get_search_query(terms) : NULL;
+    if (!query) {
+        callback(NULL, user_data);
+        return 0;
+    }
+
+    if (!g_db_history_thread) {
+        GSList* results = NULL;
+        _search_read(&g_db_reader, query, with_jid, type, after, before, after_id, &results);
+        callback(results, user_data);
+        return 0;
+    }
+
+    DbHistoryRequest* request = g_new0(DbHistoryRequest, 1);
+    request->kind = DB_REQUEST_SEARCH;
+    request->query = g_steal_pointer(&query);
+    request->with_jid = g_strdup(with_jid);
+    request->type = g_strdup(type);
+    request->after = after;
+    request->before = before;
+    request->start_id = after_id;
+    request->callback = callback;
+    request->user_data = user_data;
+
+    return _history_request_submit(request);
+}
+
+// Size of the output buffer of exports, rows are formatted one at a time
+#define DB_EXPORT_BUFFER_SIZE (256 * 1024)
+
+static const char* const db_export_columns[] = { "timestamp", "type", "encryption", "from", "from_resource", "to", "to_resource", "stanza_id", "archive_id", "replace_id", "message" };
+
+static void
+_export_append_json_string(GString* row, const char* str)
+{
+    g_string_append_c(row, '"');
+    for (const char* c = str; *c; c++) {
+        switch (*c) {
+        case '"':
+            g_string_append(row, "\\\"");
+            break;
+        case '\\':
+            g_string_append(row, "\\\\");
+            break;
+        case '\n':
+            g_string_append(row, "\\n");
+            break;
+        case '\r':
+            g_string_append(row, "\\r");
+            break;
+        case '\t':
+            g_string_append(row, "\\t");
+            break;
+        default:
+            if ((guchar)*c < 0x20) {
+                g_string_append_printf(row, "\\u%04x", (guchar)*c);
+            } else {
+                g_string_append_c(row, *c);
+            }
+        }
+    }
+    g_string_append_c(row, '"');
+}
+
+static void
+_export_append_csv_field(GString* row, const char* str)
+{
+    g_string_append_c(row, '"');
+    for (const char* c = str; *c; c++) {
+        if (*c == '"') {
+            g_string_append_c(row, '"');
+        }
+        g_string_append_c(row, *c);
+    }
+    g_string_append_c(row, '"');
+}
+
+// Format the current row of the export statement as one line
+static void
+_export_format_row(GString* row, sqlite3_stmt* stmt, db_export_format_t format)
+{
+    GDateTime* dt = date_time_new_from_usec(sqlite3_column_int64(stmt, 0));
+    auto_gchar gchar* timestamp = dt ? g_date_time_format_iso8601(dt) : NULL;
+    if (dt) {
+        g_date_time_unref(dt);
+    }
+
+    g_string_truncate(row, 0);
+    if (format == DB_EXPORT_JSONL) {
+        g_string_append_c(row, '{');
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(db_export_columns); i++) {
+        const char* value = i == 0 ? timestamp : (const char*)sqlite3_column_text(stmt, i);
+
+        if (format == DB_EXPORT_JSONL) {
+            if (!value || !value[0]) {
+                continue;
+            }
+            if (row->len > 1) {
+                g_string_append_c(row, ',');
+            }
+            _export_append_json_string(row, db_export_columns[i]);
+            g_string_append_c(row, ':');
+            _export_append_json_string(row, value);
+        } else {
+            if (i > 0) {
+                g_string_append_c(row, ',');
+            }
+            _export_append_csv_field(row, value ? value : "");
+        }
+    }
+
+    g_string_append(row, format == DB_EXPORT_JSONL ? "}\n" : "\r\n");
+}
+
+// Write the chat logs to a file on the given connection, see
+// log_database_export_async(). Rows are formatted one at a time while
+// stepping the statement and written through a buffered stream, so memory use
+// does not depend on the size of the export.
+static gboolean
+_export_write(DbConnection* conn, const char* const path, db_export_format_t format, const char* const with_jid, const char* const type, gint64 after, gint64 before, GCancellable* cancellable, guint64* count, GError** error)
+{
+    *count = 0;
+
+    GFile* file = g_file_new_for_path(path);
+    GFileOutputStream* file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, error);
+    g_object_unref(file);
+    if (!file_stream) {
+        return FALSE;
+    }
+    GOutputStream* out = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(file_stream), DB_EXPORT_BUFFER_SIZE);
+    g_object_unref(file_stream);
+
+    sqlite3_stmt* stmt = _db_stmt(conn, DB_STMT_EXPORT);
+    if (!stmt) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not query the chat log database: %s", sqlite3_errmsg(conn->db));
+        g_object_unref(out);
+        return FALSE;
+    }
+
+    sqlite3_bind_text(stmt, 1, with_jid, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, type, -1, SQLITE_STATIC);
+    if (after) {
+        sqlite3_bind_int64(stmt, 3, after);
+    }
+    if (before) {
+        sqlite3_bind_int64(stmt, 4, before);
+    }
+
+    GString* row = g_string_sized_new(1024);
+    gboolean success = TRUE;
+    int ret = SQLITE_DONE;
+
+    if (format == DB_EXPORT_CSV) {
+        for (int i = 0; i < ARRAY_SIZE(db_export_columns); i++) {
+            g_string_append_printf(row, "%s%s", i > 0 ? "," : "", db_export_columns[i]);
+        }
+        g_string_append(row, "\r\n");
+        success = g_output_stream_write_all(out, row->str, row->len, NULL, cancellable, error);
+    }
+
+    while (success && (ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+        _export_format_row(row, stmt, format);
+        success = g_output_stream_write_all(out, row->str, row->len, NULL, cancellable, error);
+        if (success) {
+            (*count)++;
+        }
+    }
+    if (success && ret != SQLITE_DONE) {
+        if (ret == SQLITE_INTERRUPT) {
+            g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "The export was cancelled");
+        } else {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not read the chat log database: %s", sqlite3_errmsg(conn->db));
+        }
+        success = FALSE;
+    }
+    _db_stmt_release(stmt);
+    g_string_free(row, TRUE);
+
+    // closing flushes the buffer and moves the file into place, a cancelled
+    // close leaves an existing file untouched
+    if (success) {
+        success = g_output_stream_close(out, cancellable, error);
+    } else {
+        GCancellable* abort = g_cancellable_new();
+        g_cancellable_cancel(abort);
+        g_output_stream_close(out, abort, NULL);
+        g_object_unref(abort);
+    }
+    g_object_unref(out);
+
+    return success;
+}
+
+// Write the chat logs to a file in timestamp order, one message per line.
+// Filters are the same as for log_database_search_async(). The export runs on
+// the history thread once the queued messages are written, callback gets the
+// result from log_database_process_events(). Returns the id of the request to
+// cancel it with log_database_cancel_history(), an existing file is left
+// untouched then. Returns 0 if callback already ran.
+guint
+log_database_export_async(const char* const path, db_export_format_t format, const char* const with_jid, const char* const type, gint64 after, gint64 before, DbExportCallback callback, gpointer user_data)
+{
+    if (!g_db_reader.db) {
+        GError* error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED, "The chat log database is not open");
+        callback(FALSE, 0, error, user_data);
+        g_error_free(error);
+        return 0;
+    }
+
+    // messages that are still queued are missing then
+    if (!g_db_history_thread) {
+        guint64 count = 0;
+        GError* error = NULL;
+        gboolean success = _export_write(&g_db_reader, path, format, with_jid, type, after, before, NULL, &count, &error);
+        callback(success, count, error, user_data);
+        g_clear_error(&error);
+        return 0;
+    }
+
+    DbHistoryRequest* request = g_new0(DbHistoryRequest, 1);
+    request->kind = DB_REQUEST_EXPORT;
+    request->path = g_strdup(path);
+    request->format = format;
+    request->with_jid = g_strdup(with_jid);
+    request->type = g_strdup(type);
+    request->after = after;
+    request->before = before;
+    request->cancellable = g_cancellable_new();
+    request->export_callback = callback;
+    request->user_data = user_data;
+
+    return _history_request_submit(request);
+}
+
+static const char*
+_get_message_type_str(prof_msg_type_t type)
+{
+    switch (type) {
+    case PROF_MSG_TYPE_CHAT:
+        return "chat";
+    case PROF_MSG_TYPE_MUC:
+        return "muc";
+    case PROF_MSG_TYPE_MUCPM:
+        return "mucpm";
+    case PROF_MSG_TYPE_UNINITIALIZED:
+        return NULL;
+    }
+    return NULL;
+}
+
+static prof_msg_type_t
+_get_message_type_type(const char* const type)
+{
+    if (g_strcmp0(type, "chat") == 0) {
+        return PROF_MSG_TYPE_CHAT;
+    } else if (g_strcmp0(type, "muc") == 0) {
+        return PROF_MSG_TYPE_MUC;
+    } else if (g_strcmp0(type, "mucpm") == 0) {
+        return PROF_MSG_TYPE_MUCPM;
+    } else {
+        return PROF_MSG_TYPE_UNINITIALIZED;
+    }
+}
+
+static const char*
+_get_message_enc_str(prof_enc_t enc)
+{
+    switch (enc) {
+    case PROF_MSG_ENC_OX:
+        return "ox";
+    case PROF_MSG_ENC_PGP:
+        return "pgp";
+    case PROF_MSG_ENC_OTR:
+        return "otr";
+    case PROF_MSG_ENC_OMEMO:
+        return "omemo";
+    case PROF_MSG_ENC_NONE:
+        return "none";
+    }
+
+    return "none";
+}
+
+static prof_enc_t
+_get_message_enc_type(const char* const encstr)
+{
+    if (g_strcmp0(encstr, "ox") == 0) {
+        return PROF_MSG_ENC_OX;
+    } else if (g_strcmp0(encstr, "pgp") == 0) {
+        return PROF_MSG_ENC_PGP;
+    } else if (g_strcmp0(encstr, "otr") == 0) {
+        return PROF_MSG_ENC_OTR;
+    } else if (g_strcmp0(encstr, "omemo") == 0) {
+        return PROF_MSG_ENC_OMEMO;
+    }
+
+    return PROF_MSG_ENC_NONE;
+}
+
+static void
+_pending_message_free(DbPendingMessage* pending)
+{
+    if (pending == NULL) {
+        return;
+    }
+
+    g_free(pending->from_jid);
+    g_free(pending->from_resource);
+    g_free(pending->to_jid);
+    g_free(pending->to_resource);
+    g_free(pending->message);
+    g_free(pending->stanza_id);
+    g_free(pending->archive_id);
+    g_free(pending->replace_id);
+    g_free(pending);
+}
+
+// Queue a log line for the main thread, the logger is not thread safe
+static void
+_db_report(log_level_t level, const char* const fmt, ...)
+{
+    va_list arg;
+    va_start(arg, fmt);
+    DbReport* report = g_new0(DbReport, 1);
+    report->level = level;
+    report->msg = g_strdup_vprintf(fmt, arg);
+    va_end(arg);
+
+    g_mutex_lock(&g_db_mutex);
+    g_queue_push_tail(&g_db_reports, report);
+    g_mutex_unlock(&g_db_mutex);
+}
+
+// Wait until the messages queued so far are written. This blocks the caller
+// for as long as the writer needs, it is meant for runs without a UI such as
+// --replay and not for the main loop.
+void
+log_database_flush(void)
+{
+    _db_writer_sync();
+}
+
+void
+log_database_process_events(void)
+{
+    GQueue reports = G_QUEUE_INIT;
+
+    if (g_db_history_thread) {
+        _history_requests_complete();
+    }
+
+    g_mutex_lock(&g_db_mutex);
+    gboolean history_stale = g_db_history_stale;
+    if (g_queue_is_empty(&g_db_reports) && !history_stale) {
+        g_mutex_unlock(&g_db_mutex);
+        return;
+    }
+    reports = g_db_reports;
+    g_queue_init(&g_db_reports);
+    g_db_history_stale = FALSE;
+    g_mutex_unlock(&g_db_mutex);
+
+    // cached pages may still show deleted messages or miss imported ones
+    if (history_stale) {
+        _history_cache_clear();
+    }
+
+    DbReport* report;
+    while ((report = g_queue_pop_head(&reports))) {
+        log_msg(report->level, "db", report->msg);
+        g_free(report->msg);
+        g_free(report);
+    }
+}
+
+// Store the latest correction with the message it corrects, so reading the
+// history does not need to look corrections up
+static void
+_apply_correction(const char* const replace_id)
+{
+    sqlite3_stmt* stmt = _db_stmt(&g_db_writer, DB_STMT_APPLY_CORRECTION);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_add(): could not prepare correction update: %s", sqlite3_errmsg(g_db_writer.db));
+        return;
+    }
+
+    sqlite3_bind_text(stmt, 1, replace_id, -1, SQLITE_STATIC);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        _db_report(PROF_LEVEL_ERROR, "SQLite error while applying correction of %s: %s", replace_id, sqlite3_errmsg(g_db_writer.db));
+    }
+    _db_stmt_release(stmt);
+}
+
+// Get the id of a JID or resource in `Jids`, adding it if needed. Returns 0
+// for an empty string or on error.
+static gint64
+_get_jid_id(const char* const jid)
+{
+    if (jid == NULL || jid[0] == '\0') {
+        return 0;
+    }
+
+    gint64* cached = g_hash_table_lookup(g_db_jid_ids, jid);
+    if (cached) {
+        return *cached;
+    }
+
+    gint64 id = 0;
+    sqlite3_stmt* stmt = _db_stmt(&g_db_writer, DB_STMT_SELECT_JID);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_add(): could not prepare JID lookup: %s", sqlite3_errmsg(g_db_writer.db));
+        return 0;
+    }
+
+    sqlite3_bind_text(stmt, 1, jid, -1, SQLITE_STATIC);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    _db_stmt_release(stmt);
+
+    if (id == 0) {
+        stmt = _db_stmt(&g_db_writer, DB_STMT_INSERT_JID);
+        if (!stmt) {
+            _db_report(PROF_LEVEL_ERROR, "log_database_add(): could not prepare JID insert: %s", sqlite3_errmsg(g_db_writer.db));
+            return 0;
+        }
+
+        sqlite3_bind_text(stmt, 1, jid, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_DONE) {
+            id = sqlite3_last_insert_rowid(g_db_writer.db);
+        } else {
+            _db_report(PROF_LEVEL_ERROR, "SQLite error while adding JID %s: %s", jid, sqlite3_errmsg(g_db_writer.db));
+        }
+        _db_stmt_release(stmt);
+    }
+
+    if (id != 0) {
+        gint64* value = g_new(gint64, 1);
+        *value = id;
+        g_hash_table_insert(g_db_jid_ids, g_strdup(jid), value);
+    }
+
+    return id;
+}
+
+// Flat-file logs have no stanza-ids, an imported message is compared with
+// the stored messages around its time instead
+static gboolean
+_is_imported_duplicate(DbPendingMessage* pending, gint64 from_jid_id, gint64 to_jid_id)
+{
+    sqlite3_stmt* stmt = _db_stmt(&g_db_writer, DB_STMT_IMPORT_DUPLICATE);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_import_add(): could not prepare duplicate check: %s", sqlite3_errmsg(g_db_writer.db));
+        return TRUE;
+    }
+
+    sqlite3_bind_int64(stmt, 1, from_jid_id);
+    sqlite3_bind_int64(stmt, 2, to_jid_id);
+    sqlite3_bind_int64(stmt, 3, pending->timestamp - DB_IMPORT_DUPLICATE_WINDOW);
+    sqlite3_bind_int64(stmt, 4, pending->timestamp + DB_IMPORT_DUPLICATE_WINDOW);
+    sqlite3_bind_int64(stmt, 5, g_db_import_max_id);
+    sqlite3_bind_text(stmt, 6, pending->message, -1, SQLITE_STATIC);
+
+    gboolean duplicate = sqlite3_step(stmt) == SQLITE_ROW;
+    _db_stmt_release(stmt);
+
+    return duplicate;
+}
+
+// Returns FALSE if the message was a duplicate or could not be written
+static gboolean
+_insert_pending_message(DbPendingMessage* pending)
+{
+    gint64 from_jid_id = _get_jid_id(pending->from_jid);
+    gint64 to_jid_id = _get_jid_id(pending->to_jid);
+    gint64 from_resource_id = _get_jid_id(pending->from_resource);
+    gint64 to_resource_id = _get_jid_id(pending->to_resource);
+    if (from_jid_id == 0 || to_jid_id == 0) {
+        return FALSE;
+    }
+
+    if (pending->imported && _is_imported_duplicate(pending, from_jid_id, to_jid_id)) {
+        return FALSE;
+    }
+
+    sqlite3_stmt* stmt = _db_stmt(&g_db_writer, DB_STMT_INSERT_MESSAGE);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "log_database_add(): could not prepare insert: %s", sqlite3_errmsg(g_db_writer.db));
+        return FALSE;
+    }
+
+    sqlite3_bind_int64(stmt, 1, from_jid_id);
+    if (from_resource_id != 0) {
+        sqlite3_bind_int64(stmt, 2, from_resource_id);
+    }
+    sqlite3_bind_int64(stmt, 3, to_jid_id);
+    if (to_resource_id != 0) {
+        sqlite3_bind_int64(stmt, 4, to_resource_id);
+    }
+    sqlite3_bind_text(stmt, 5, pending->message, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 6, pending->timestamp);
+    sqlite3_bind_text(stmt, 7, pending->stanza_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 8, pending->archive_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 9, pending->replace_id, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 10, pending->type, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 11, pending->encryption, -1, SQLITE_STATIC);
+
+    gboolean inserted = FALSE;
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        _db_report(PROF_LEVEL_ERROR, "SQLite error: %s", sqlite3_errmsg(g_db_writer.db));
+    } else if (sqlite3_changes(g_db_writer.db) < 1) {
+        _db_report(PROF_LEVEL_WARN, "Duplicate stanza-id found for the message. stanza_id: %s; archive_id: %s; sender: %s; content: %s", pending->stanza_id, pending->archive_id, pending->from_jid, pending->message);
+    } else {
+        inserted = TRUE;
+    }
+    _db_stmt_release(stmt);
+
+    if (inserted && pending->replace_id[0] != '\0') {
+        _apply_correction(pending->replace_id);
+    }
+
+    return inserted;
+}
+
+// Write a batch of queued messages in a single transaction. Returns the
+// number of messages written. The messages are left in the queue.
+static guint
+_write_batch(GQueue* batch)
+{
+    guint count = g_queue_get_length(batch);
+    char* err_msg = NULL;
+
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, "BEGIN TRANSACTION", NULL, 0, &err_msg)) {
+        _db_report(PROF_LEVEL_ERROR, "SQLite error while starting batch of %u messages: %s", count, err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        err_msg = NULL;
+    }
+
+    guint written = 0;
+    for (GList* curr = batch->head; curr; curr = g_list_next(curr)) {
+        if (_insert_pending_message(curr->data)) {
+            written++;
+        }
+    }
+
+    if (sqlite3_get_autocommit(g_db_writer.db) == 0) {
+        if (SQLITE_OK != sqlite3_exec(g_db_writer.db, "END TRANSACTION", NULL, 0, &err_msg)) {
+            _db_report(PROF_LEVEL_ERROR, "SQLite error while committing batch of %u messages: %s", count, err_msg ? err_msg : "unknown");
+            sqlite3_free(err_msg);
+            sqlite3_exec(g_db_writer.db, "ROLLBACK TRANSACTION", NULL, 0, NULL);
+            // JIDs added in the batch are gone as well
+            g_hash_table_remove_all(g_db_jid_ids);
+            return 0;
+        }
+    }
+
+    _db_report(PROF_LEVEL_DEBUG, "Wrote batch of %u messages to the chat log database, %u skipped", count, count - written);
+    return written;
+}
+
+static gint64
+_db_max_message_id(void)
+{
+    sqlite3_stmt* stmt = NULL;
+    gint64 id = 0;
+
+    if (sqlite3_prepare_v2(g_db_writer.db, "SELECT MAX(`id`) FROM `ChatLogs`", -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    return id;
+}
+
+// Write a batch of imported messages. Called with g_db_mutex held, it is
+// released while the database is busy.
+static void
+_write_import_batch(void)
+{
+    GQueue batch = G_QUEUE_INIT;
+    while (batch.length < DB_IMPORT_BATCH && !g_queue_is_empty(&g_db_import_messages)) {
+        g_queue_push_tail(&batch, g_queue_pop_head(&g_db_import_messages));
+    }
+
+    guint count = batch.length;
+    gboolean started = g_db_import_started;
+    g_db_import_started = FALSE;
+    g_db_import_inflight = count;
+    g_cond_broadcast(&g_db_import_cond);
+    g_mutex_unlock(&g_db_mutex);
+
+    if (started) {
+        g_db_import_max_id = _db_max_message_id();
+    }
+    guint written = _write_batch(&batch);
+    g_queue_clear_full(&batch, (GDestroyNotify)_pending_message_free);
+
+    g_mutex_lock(&g_db_mutex);
+    g_db_import_stats.written += written;
+    g_db_import_stats.skipped += count - written;
+    g_db_import_inflight = 0;
+    g_cond_broadcast(&g_db_import_cond);
+}
+
+static gint64
+_db_pragma_int64(const char* const pragma)
+{
+    sqlite3_stmt* stmt = NULL;
+    gint64 value = 0;
+
+    if (sqlite3_prepare_v2(g_db_writer.db, pragma, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    return value;
+}
+
+static sqlite3_stmt*
+_retention_stmt(db_stmt_t id)
+{
+    sqlite3_stmt* stmt = _db_stmt(&g_db_writer, id);
+    if (!stmt) {
+        _db_report(PROF_LEVEL_ERROR, "Could not prepare retention statement: %s", sqlite3_errmsg(g_db_writer.db));
+    }
+
+    return stmt;
+}
+
+// Step a bound delete statement, returns the number of deleted messages or -1
+static int
+_retention_exec(DbRetentionJob* job, sqlite3_stmt* stmt)
+{
+    int deleted = -1;
+
+    if (sqlite3_step(stmt) == SQLITE_DONE) {
+        deleted = sqlite3_changes(g_db_writer.db);
+        job->deleted += deleted;
+    } else {
+        _db_report(PROF_LEVEL_ERROR, "SQLite error while applying the retention policy: %s", sqlite3_errmsg(g_db_writer.db));
+    }
+    _db_stmt_release(stmt);
+
+    return deleted;
+}
+
+// Keep the newest messages of each conversation. A call either moves on to the
+// next conversation and finds the oldest message to keep in it, or deletes a
+// batch of older ones. Returns FALSE once all conversations are done.
+static gboolean
+_retention_delete_surplus(DbRetentionJob* job, const char* const type, gint messages)
+{
+    sqlite3_stmt* stmt;
+
+    if (job->in_conversation) {
+        stmt = _retention_stmt(DB_STMT_RETENTION_DELETE_SURPLUS);
+        if (!stmt) {
+            return FALSE;
+        }
+
+        sqlite3_bind_int64(stmt, 1, job->from_jid_id);
+        sqlite3_bind_int64(stmt, 2, job->to_jid_id);
+        sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 4, job->cutoff_time);
+        sqlite3_bind_int64(stmt, 5, job->cutoff_id);
+        sqlite3_bind_int(stmt, 6, DB_RETENTION_BATCH);
+        job->in_conversation = _retention_exec(job, stmt) > 0;
+
+        return TRUE;
+    }
+
+    stmt = _retention_stmt(DB_STMT_RETENTION_NEXT_CONVERSATION);
+    if (!stmt) {
+        return FALSE;
+    }
+
+    gboolean found = FALSE;
+    sqlite3_bind_int64(stmt, 1, job->from_jid_id);
+    sqlite3_bind_int64(stmt, 2, job->to_jid_id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        job->from_jid_id = sqlite3_column_int64(stmt, 0);
+        job->to_jid_id = sqlite3_column_int64(stmt, 1);
+        found = TRUE;
+    }
+    _db_stmt_release(stmt);
+
+    if (!found) {
+        return FALSE;
+    }
+
+    // the reverse direction is visited as a conversation of its own later, by
+    // then there is nothing left to delete for it
+    stmt = _retention_stmt(DB_STMT_RETENTION_CUTOFF);
+    if (!stmt) {
+        return FALSE;
+    }
+
+    sqlite3_bind_int64(stmt, 1, job->from_jid_id);
+    sqlite3_bind_int64(stmt, 2, job->to_jid_id);
+    sqlite3_bind_text(stmt, 3, type, -1, SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 4, messages);
+    sqlite3_bind_int(stmt, 5, messages - 1);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        job->cutoff_time = sqlite3_column_int64(stmt, 0);
+        job->cutoff_id = sqlite3_column_int64(stmt, 1);
+        job->in_conversation = TRUE;
+    }
+    _db_stmt_release(stmt);
+
+    return TRUE;
+}
+
+// Delete a batch of messages of the current type, returns FALSE once there is
+// nothing left to delete for it
+static gboolean
+_retention_delete(DbRetentionJob* job)
+{
+    const char* type = db_retention_types[job->type];
+    gint days = job->days[job->type];
+    gint messages = job->messages[job->type];
+
+    if (messages > 0) {
+        return _retention_delete_surplus(job, type, messages);
+    } else if (days == 0) {
+        return FALSE;
+    }
+
+    sqlite3_stmt* stmt = _retention_stmt(DB_STMT_RETENTION_DELETE_OLD);
+    if (!stmt) {
+        return FALSE;
+    }
+
+    sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, g_get_real_time() - days * G_TIME_SPAN_DAY);
+    sqlite3_bind_int(stmt, 3, DB_RETENTION_BATCH);
+
+    return _retention_exec(job, stmt) == DB_RETENTION_BATCH;
+}
+
+// Give free pages back to the file system, returns FALSE once there are none
+// left. Databases created before version 7 was vacuumed keep their free pages.
+static gboolean
+_retention_vacuum(DbRetentionJob* job)
+{
+    char* err_msg = NULL;
+
+    if (_db_pragma_int64("PRAGMA freelist_count") == 0) {
+        return FALSE;
+    }
+
+    if (SQLITE_OK != sqlite3_exec(g_db_writer.db, "PRAGMA incremental_vacuum(" G_STRINGIFY(DB_RETENTION_VACUUM_PAGES) ")", NULL, 0, &err_msg)) {
+        _db_report(PROF_LEVEL_WARN, "Could not compact chat log database: %s", err_msg ? err_msg : "unknown");
+        sqlite3_free(err_msg);
+        return FALSE;
+    }
+
+    gint64 page_count = _db_pragma_int64("PRAGMA page_count");
+    if (page_count >= job->page_count) {
+        return FALSE;
+    }
+    job->page_count = page_count;
+
+    return TRUE;
+}
+
+// Run one step of the retention job, returns FALSE once it is done
+static gboolean
+_retention_step(DbRetentionJob* job)
+{
+    if (job->start_page_count == 0) {
+        job->start_page_count = job->page_count = _db_pragma_int64("PRAGMA page_count");
+    }
+
+    if (job->type < DB_RETENTION_TYPES) {
+        if (!_retention_delete(job)) {
+            job->type++;
+            job->in_conversation = FALSE;
+            job->from_jid_id = 0;
+            job->to_jid_id = 0;
+        }
+        return TRUE;
+    }
+
+    return _retention_vacuum(job);
+}
+
+// Called with g_db_mutex held
+static DbRetentionJob*
+_retention_job_new(void)
+{
+    DbRetentionJob* job = g_new0(DbRetentionJob, 1);
+
+    // an invalid policy keeps everything
+    for (int i = 0; i < DB_RETENTION_TYPES; i++) {
+        log_database_parse_retention(g_db_retention_policies[i], &job->days[i], &job->messages[i]);
+    }
+    job->scheduled = g_db_retention_next;
+
+    return job;
+}
+
+// Run a step of the retention job and wrap it up once it is done. Called with
+// g_db_mutex held, it is released while the database is busy.
+static void
+_retention_job_run(void)
+{
+    DbRetentionJob* job = g_db_retention_job;
+
+    g_mutex_unlock(&g_db_mutex);
+    gboolean done = !_retention_step(job);
+    if (done) {
+        job->reclaimed = (job->start_page_count - job->page_count) * _db_pragma_int64("PRAGMA page_size");
+        _db_report(job->deleted > 0 || job->reclaimed > 0 ? PROF_LEVEL_INFO : PROF_LEVEL_DEBUG,
+                   "Retention policy removed %" G_GUINT64_FORMAT " messages from the chat log database, %" G_GINT64_FORMAT " KiB reclaimed",
+                   job->deleted, job->reclaimed / 1024);
+    }
+    g_mutex_lock(&g_db_mutex);
+
+    if (!done) {
+        return;
+    }
+
+    g_db_retention_stats.last_run = g_get_real_time();
+    g_db_retention_stats.deleted = job->deleted;
+    g_db_retention_stats.reclaimed = job->reclaimed;
+    g_db_history_stale = g_db_history_stale || job->deleted > 0;
+    // unless the policies changed in the meantime
+    if (g_db_retention_next == job->scheduled) {
+        g_db_retention_next = g_get_monotonic_time() + DB_RETENTION_INTERVAL;
+    }
+    g_clear_pointer(&g_db_retention_job, g_free);
+}
+
+static gpointer
+_db_writer_thread(gpointer data)
+{
+    g_mutex_lock(&g_db_mutex);
+
+    while (TRUE) {
+        // the retention job runs in small steps while there is nothing to write
+        while (g_queue_is_empty(&g_pending_messages) && g_queue_is_empty(&g_db_import_messages) && !g_db_shutdown) {
+            if (!g_db_retention_job && g_get_monotonic_time() >= g_db_retention_next) {
+                g_db_retention_job = _retention_job_new();
+            }
+
+            if (g_db_retention_job) {
+                _retention_job_run();
+            } else {
+                g_cond_wait_until(&g_db_work_cond, &g_db_mutex, g_db_retention_next);
+            }
+        }
+
+        if (g_queue_is_empty(&g_pending_messages)) {
+            if (g_queue_is_empty(&g_db_import_messages)) {
+                break;
+            }
+            _write_import_batch();
+            continue;
+        }
+
+        // wait until the batch is full, the oldest message is due, someone wants
+        // to read or an import waits
+        gint64 deadline = g_pending_since + g_db_batch_interval;
+        while (g_queue_get_length(&g_pending_messages) < g_db_batch_size && !g_db_flush_requested && !g_db_shutdown && g_queue_is_empty(&g_db_import_messages)) {
+            if (!g_cond_wait_until(&g_db_work_cond, &g_db_mutex, deadline)) {
+                break;
+            }
+        }
+
+        // readers only look at the in-flight batch, it is not changed until
+        // it is committed
+        g_db_inflight = g_pending_messages;
+        g_queue_init(&g_pending_messages);
+        g_db_flush_requested = FALSE;
+        g_cond_broadcast(&g_db_idle_cond);
+        g_mutex_unlock(&g_db_mutex);
+
+        _write_batch(&g_db_inflight);
+
+        g_mutex_lock(&g_db_mutex);
+        g_queue_clear_full(&g_db_inflight, (GDestroyNotify)_pending_message_free);
+        g_cond_broadcast(&g_db_idle_cond);
+    }
+
+    g_mutex_unlock(&g_db_mutex);
+
+    return NULL;
+}
+
+// Block until every queued message has been committed, only the history
+// thread and log_database_flush() wait for the writer
+static void
+_db_writer_sync(void)
+{
+    g_mutex_lock(&g_db_mutex);
+    if (g_db_thread && (!g_queue_is_empty(&g_pending_messages) || !g_queue_is_empty(&g_db_inflight))) {
+        g_db_flush_requested = TRUE;
+        g_cond_signal(&g_db_work_cond);
+        while (!g_queue_is_empty(&g_pending_messages) || !g_queue_is_empty(&g_db_inflight)) {
+            g_cond_wait(&g_db_idle_cond, &g_db_mutex);
+        }
+    }
+    g_mutex_unlock(&g_db_mutex);
+}
+
+static void
+_enqueue_pending_message(DbPendingMessage* pending)
+{
+    guint batch_size = prefs_get_dblog_batch_size();
+    gint64 batch_interval = prefs_get_dblog_batch_interval() * G_TIME_SPAN_MILLISECOND;
+
+    g_mutex_lock(&g_db_mutex);
+    while (g_queue_get_length(&g_pending_messages) >= DB_WRITE_QUEUE_MAX && !g_db_shutdown) {
+        g_cond_wait(&g_db_idle_cond, &g_db_mutex);
+    }
+
+    if (g_queue_is_empty(&g_pending_messages)) {
+        g_pending_since = g_get_monotonic_time();
+    }
+    pending->seq = ++g_db_pending_seq;
+    g_queue_push_tail(&g_pending_messages, pending);
+    g_db_batch_size = batch_size;
+    g_db_batch_interval = batch_interval;
+    g_cond_signal(&g_db_work_cond);
+    g_mutex_unlock(&g_db_mutex);
+}
+
+// Start an import of flat-file logs, see chatlog_import.c. Returns FALSE if
+// the database is not open or another import is running.
+gboolean
+log_database_import_begin(void)
+{
+    gboolean started = FALSE;
+
+    g_mutex_lock(&g_db_mutex);
+    if (g_db_thread && !g_db_shutdown && !g_db_importing) {
+        g_db_importing = TRUE;
+        g_db_import_started = TRUE;
+        memset(&g_db_import_stats, 0, sizeof(g_db_import_stats));
+        started = TRUE;
+    }
+    g_mutex_unlock(&g_db_mutex);
+
+    return started;
+}
+
+// Queue a message of the import. May be called from any thread, blocks while
+// the import queue is full. Returns FALSE once the import was cancelled.
+gboolean
+log_database_import_add(const char* const from_jid, const char* const from_resource, const char* const to_jid, const char* const to_resource, const char* const message, gint64 timestamp, prof_msg_type_t type)
+{
+    DbPendingMessage* pending = g_new0(DbPendingMessage, 1);
+
+    pending->from_jid = g_strdup(from_jid);
+    pending->from_resource = g_strdup(from_resource ? from_resource : "");
+    pending->to_jid = g_strdup(to_jid);
+    pending->to_resource = g_strdup(to_resource ? to_resource : "");
+    pending->message = g_strdup(message);
+    pending->timestamp = timestamp;
+    pending->stanza_id = g_strdup("");
+    pending->archive_id = g_strdup("");
+    pending->replace_id = g_strdup("");
+    pending->type = _get_message_type_str(type);
+    pending->encryption = _get_message_enc_str(PROF_MSG_ENC_NONE);
+    pending->imported = TRUE;
+
+    g_mutex_lock(&g_db_mutex);
+    while (g_queue_get_length(&g_db_import_messages) >= DB_IMPORT_QUEUE_MAX && g_db_importing && !g_db_shutdown) {
+        g_cond_wait(&g_db_import_cond, &g_db_mutex);
+    }
+
+    if (!g_db_importing || g_db_shutdown) {
+        g_mutex_unlock(&g_db_mutex);
+        _pending_message_free(pending);
+        return FALSE;
+    }
+
+    g_queue_push_tail(&g_db_import_messages, pending);
+    g_cond_signal(&g_db_work_cond);
+    g_mutex_unlock(&g_db_mutex);
+
+    return TRUE;
+}
+
+// Wait until every queued message of the import is written and finish it
+void
+log_database_import_end(DbImportStats* stats)
+{
+    g_mutex_lock(&g_db_mutex);
+    while ((!g_queue_is_empty(&g_db_import_messages) || g_db_import_inflight > 0) && !g_db_shutdown) {
+        g_cond_wait(&g_db_import_cond, &g_db_mutex);
+    }
+
+    *stats = g_db_import_stats;
+    g_db_importing = FALSE;
+    g_db_history_stale = TRUE;
+    g_cond_broadcast(&g_db_import_cond);
+    g_mutex_unlock(&g_db_mutex);
+}
+
+// Takes ownership of key
+static void
+_recent_ids_add(gchar* key)
+{
+    g_hash_table_add(g_db_recent_ids, key);
+    g_queue_push_tail(&g_db_recent_ids_order, key);
+
+    while (g_queue_get_length(&g_db_recent_ids_order) > DB_RECENT_IDS_MAX) {
+        g_hash_table_remove(g_db_recent_ids, g_queue_pop_head(&g_db_recent_ids_order));
+    }
+}
+
+// Check a message against the recent-id filter and add its ids if it is new.
+// Ids are compared like the unique indexes do, stanza-ids and archive-ids
+// separately.
+static gboolean
+_recent_ids_is_duplicate(const char* const stanza_id, const char* const archive_id)
+{
+    auto_gchar gchar* stanza_key = stanza_id && stanza_id[0] ? g_strconcat("s:", stanza_id, NULL) : NULL;
+    auto_gchar gchar* archive_key = archive_id && archive_id[0] ? g_strconcat("a:", archive_id, NULL) : NULL;
+
+    if (!g_db_recent_ids) {
+        g_db_recent_ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    if ((stanza_key && g_hash_table_contains(g_db_recent_ids, stanza_key))
+        || (archive_key && g_hash_table_contains(g_db_recent_ids, archive_key))) {
+        return TRUE;
+    }
+
+    if (stanza_key) {
+        _recent_ids_add(g_steal_pointer(&stanza_key));
+    }
+    if (archive_key) {
+        _recent_ids_add(g_steal_pointer(&archive_key));
+    }
+
+    return FALSE;
+}
+
+static void
+_add_to_db(ProfMessage* message, char* type, const Jid* const from_jid, const Jid* const to_jid)
+{
+    auto_gchar gchar* pref_dblog = prefs_get_string(PREF_DBLOG);
+
+    if (g_strcmp0(pref_dblog, "off") == 0) {
+        return;
+    } else if (g_strcmp0(pref_dblog, "redact") == 0) {
+        if (message->plain) {
+            free(message->plain);
+        }
+        message->plain = strdup("[REDACTED]");
+    }
+
+    if (!g_db_thread) {
+        log_debug("log_database_add() called but db is not initialized");
+        return;
+    }
+
+    if (_recent_ids_is_duplicate(message->id, message->stanzaid)) {
+        LOG_DEBUG("Skipping duplicate message. stanza_id: %s; archive_id: %s", message->id, message->stanzaid);
+        return;
+    }
+
+    DbPendingMessage* pending = g_new0(DbPendingMessage, 1);
+
+    pending->timestamp = message->timestamp ? date_time_to_usec(message->timestamp) : g_get_real_time();
+
+    if (!type) {
+        type = (char*)_get_message_type_str(message->type);
+    }
+
+    pending->from_jid = g_strdup(from_jid->barejid);
+    pending->from_resource = g_strdup(from_jid->resourcepart ? from_jid->resourcepart : "");
+    pending->to_jid = g_strdup(to_jid->barejid);
+    pending->to_resource = g_strdup(to_jid->resourcepart ? to_jid->resourcepart : "");
+    pending->message = g_strdup(message->plain ? message->plain : "");
+    pending->stanza_id = g_strdup(message->id ? message->id : "");
+    pending->archive_id = g_strdup(message->stanzaid ? message->stanzaid : "");
+    pending->replace_id = g_strdup(message->replace_id ? message->replace_id : "");
+    pending->type = type ? type : "";
+    pending->encryption = _get_message_enc_str(message->enc);
+
+    LOG_DEBUG("Queueing message for DB. from: %s, to: %s, stanza_id: %s, archive_id: %s, replace_id: %s", pending->from_jid, pending->to_jid, pending->stanza_id, pending->archive_id, pending->replace_id);
+
+    // a correction is written to the same conversation as the message it corrects
+    _history_cache_invalidate(pending->from_jid, pending->to_jid);
+
+    _enqueue_pending_message(pending);
 }
@@ -41,14 +41,71 @@
 #include "xmpp/xmpp.h"
 
 #define MESSAGES_TO_RETRIEVE 10
+#define SEARCH_RESULTS_MAX 20
+
+// Counters of the history page cache, size is in bytes
+typedef struct db_cache_stats_t
+{
+    guint64 hits;
+    guint64 misses;
+    guint64 evictions;
+    guint64 invalidations;
+    guint pages;
+    gsize size;
+} DbCacheStats;
+
+// Result of the last retention run. last_run is in microseconds since the
+// epoch and 0 before the first run, reclaimed is in bytes.
+typedef struct db_retention_stats_t
+{
+    gint64 last_run;
+    guint64 deleted;
+    gint64 reclaimed;
+} DbRetentionStats;
+
+// Messages written and skipped as duplicates by an import of flat-file logs
+typedef struct db_import_stats_t
+{
+    guint64 written;
+    guint64 skipped;
+} DbImportStats;
+
+// Output formats of log_database_export_async()
+typedef enum {
+    DB_EXPORT_JSONL,
+    DB_EXPORT_CSV
+} db_export_format_t;
+
+// Receives a history page read by log_database_get_previous_chat_async() or
+// the results of log_database_search_async() and owns the list
+typedef void (*DbHistoryCallback)(GSList* history, gpointer user_data);
+
+// Receives the result of log_database_export_async(), count is the number of
+// exported messages and error is set if it failed
+typedef void (*DbExportCallback)(gboolean success, guint64 count, const GError* error, gpointer user_data);
 
 gboolean log_database_init(ProfAccount* account);
 void log_database_add_incoming(ProfMessage* message);
 void log_database_add_outgoing_chat(const char* const id, const char* const barejid, const char* const message, const char* const replace_id, prof_enc_t enc);
 void log_database_add_outgoing_muc(const char* const id, const char* const barejid, const char* const message, const char* const replace_id, prof_enc_t enc);
 void log_database_add_outgoing_muc_pm(const char* const id, const char* const barejid, const char* const message, const char* const replace_id, prof_enc_t enc);
-GSList* log_database_get_previous_chat(const gchar* const contact_barejid, const char* start_time, char* end_time, gboolean from_start, gboolean flip);
+GSList* log_database_get_previous_chat(const gchar* const contact_barejid, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip);
+guint log_database_get_previous_chat_async(const gchar* const contact_barejid, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip, DbHistoryCallback callback, gpointer user_data);
+void log_database_cancel_history(guint request_id);
 ProfMessage* log_database_get_limits_info(const gchar* const contact_barejid, gboolean is_last);
+gboolean log_database_search_available(void);
+guint log_database_search_async(gchar** terms, const char* const with_jid, const char* const type, gint64 after, gint64 before, gint64 after_id, DbHistoryCallback callback, gpointer user_data);
+guint log_database_export_async(const char* const path, db_export_format_t format, const char* const with_jid, const char* const type, gint64 after, gint64 before, DbExportCallback callback, gpointer user_data);
+void log_database_flush(void);
+void log_database_process_events(void);
+void log_database_get_cache_stats(DbCacheStats* stats);
+void log_database_trim_cache(void);
+gboolean log_database_parse_retention(const char* const policy, gint* days, gint* messages);
+void log_database_update_retention(void);
+void log_database_get_retention_stats(DbRetentionStats* stats);
+gboolean log_database_import_begin(void);
+gboolean log_database_import_add(const char* const from_jid, const char* const from_resource, const char* const to_jid, const char* const to_resource, const char* const message, gint64 timestamp, prof_msg_type_t type);
+void log_database_import_end(DbImportStats* stats);
 void log_database_close(void);
 
 #endif // DATABASE_H
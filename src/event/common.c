@@ -43,6 +43,7 @@
 #include "xmpp/xmpp.h"
 #include "xmpp/vcard_funcs.h"
 #include "database.h"
+#include "chatlog_import.h"
 #include "tools/bookmark_ignore.h"
 
 #ifdef HAVE_LIBGPGME
@@ -72,6 +73,7 @@ ev_disconnect_cleanup(void)
 #ifdef HAVE_OMEMO
     omemo_on_disconnect();
 #endif
+    chat_log_import_close();
     log_database_close();
     bookmark_ignore_on_disconnect();
     vcard_user_free();
@@ -42,10 +42,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "glib.h"
 #include "glib/gstdio.h"
+#include "gio/gio.h"
 
 #include "log.h"
 #include "common.h"
@@ -54,11 +56,84 @@
 
 #define PROF "prof"
 
-static FILE* logp;
+// Records are copied into a byte ring by log_msg() on the thread that called
+// log_init() (the only producer of the ring) and formatted and written out in
+// batches by the log writer thread. Records from other threads are queued
+// under ring_lock instead.
+#define LOG_RING_SIZE     (1u << 20)
+#define LOG_RING_MASK     (LOG_RING_SIZE - 1)
+#define LOG_MSG_MAX       (LOG_RING_SIZE / 4)
+#define LOG_BATCH_BYTES   65536
+#define LOG_WRITER_WAKEUP (100 * G_TIME_SPAN_MILLISECOND)
+#define LOG_ALIGN(n)      (((n) + 7u) & ~7u)
+#define LOG_FOREIGN_MAX   4096
+
+// Rotated segments are gzipped in the background and listed oldest first in
+// "<log>.index", the oldest ones are removed once either of the limits set
+// with /log segments and /log segmentsize is exceeded.
+
+typedef struct log_record_t
+{
+    guint32 size; // 0 pads the rest of the ring, the next record starts at offset 0
+    guint32 level;
+    gint64 timestamp;
+    guint32 area_len;
+    guint32 msg_len;
+} log_record_t;
+
+// record logged by another thread than the ring's producer
+typedef struct log_foreign_record_t
+{
+    log_level_t level;
+    gint64 timestamp;
+    gchar* area;
+    gchar* msg;
+} log_foreign_record_t;
+
+typedef struct log_segment_t
+{
+    guint seq;
+    gchar* path;
+    gint64 size;
+} log_segment_t;
+
 static gchar* mainlogfile = NULL;
 static gboolean user_provided_log = FALSE;
 static log_level_t level_filter;
 
+static guint8* ring_buf = NULL;
+static guint ring_head;
+static guint ring_tail;
+static guint ring_dropped;
+static gint ring_writer_sleeping;
+static gint ring_producer_waiting;
+static gint ring_shutdown;
+static gint rotate_limit;
+static GMutex ring_lock;
+static GCond ring_data_cond;
+static GCond ring_space_cond;
+static GThread* log_writer = NULL;
+static GThread* log_owner = NULL;
+static GQueue foreign_records = G_QUEUE_INIT;
+static gint foreign_pending;
+
+// owned by the writer thread once it is running
+static int log_fd = -1;
+static gint64 log_size;
+static guint dropped_total;
+
+static GMutex segments_lock;
+static GQueue segments = G_QUEUE_INIT;
+static guint segments_next;
+static gchar* segments_index = NULL;
+static gchar* segments_error = NULL;
+static GQueue segments_removed = G_QUEUE_INIT;
+static gint segments_removed_pending;
+static gint segments_max;
+static gint segments_max_bytes;
+static GThreadPool* compress_pool = NULL;
+static GCancellable* compress_cancel = NULL;
+
 static int stderr_inited;
 static log_level_t stderr_level;
 static int stderr_pipe[2];
@@ -70,37 +145,471 @@ enum {
     STDERR_RETRY_NR = 5,
 };
 
+static char* _log_abbreviation_string_from_level(log_level_t level);
+
+static int
+_log_open(const char* const filename)
+{
+    int fd = open(filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd == -1) {
+        return -1;
+    }
+    g_chmod(filename, S_IRUSR | S_IWUSR);
+
+    struct stat st;
+    log_size = fstat(fd, &st) == 0 ? st.st_size : 0;
+
+    return fd;
+}
+
 static void
-_rotate_log_file(void)
+_log_write(const char* data, gsize len)
 {
-    auto_gchar gchar* log_file = g_strdup(mainlogfile);
-    size_t len = strlen(log_file);
-    auto_gchar gchar* log_file_new = malloc(len + 5);
+    while (len > 0 && log_fd != -1) {
+        ssize_t res = write(log_fd, data, len);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += res;
+        len -= res;
+        log_size += res;
+    }
+}
 
-    // the mainlog file should always end in '.log', lets remove this last part
-    // so that we can have profanity.001.log later
+static void
+_log_append_line(GString* batch, gint64 timestamp, log_level_t level, const char* area, gsize area_len, const char* msg, gsize msg_len)
+{
+    GDateTime* dt = date_time_new_from_usec(timestamp);
+    if (dt) {
+        auto_gchar gchar* date_fmt = g_date_time_format_iso8601(dt);
+        g_string_append(batch, date_fmt);
+        g_date_time_unref(dt);
+    }
+    g_string_append(batch, ": ");
+    g_string_append_len(batch, area, area_len);
+    g_string_append(batch, ": ");
+    g_string_append(batch, _log_abbreviation_string_from_level(level));
+    g_string_append(batch, ": ");
+    g_string_append_len(batch, msg, msg_len);
+    g_string_append_c(batch, '\n');
+}
+
+// the mainlog file should always end in '.log', segments are named
+// profanity.001.log, profanity.002.log.gz, ...
+static gchar*
+_log_stem(void)
+{
+    gsize len = strlen(mainlogfile);
     if (len > 4) {
-        log_file[len - 4] = '\0';
+        len -= 4;
     }
+    return g_strndup(mainlogfile, len);
+}
 
-    // find an empty name. from .log -> log.001 -> log.999
-    for (int i = 1; i < 1000; i++) {
-        g_sprintf(log_file_new, "%s.%03d.log", log_file, i);
-        if (!g_file_test(log_file_new, G_FILE_TEST_EXISTS))
-            break;
+static void
+_segment_free(log_segment_t* segment)
+{
+    if (segment) {
+        g_free(segment->path);
+        g_free(segment);
     }
+}
 
-    log_close();
+static log_segment_t*
+_segment_new(guint seq, const char* const path, gint64 size)
+{
+    log_segment_t* segment = g_new0(log_segment_t, 1);
+    segment->seq = seq;
+    segment->path = g_strdup(path);
+    segment->size = size;
+    return segment;
+}
 
-    if (len > 4) {
-        log_file[len - 4] = '.';
+static log_segment_t*
+_segments_find(guint seq)
+{
+    for (GList* curr = segments.head; curr; curr = g_list_next(curr)) {
+        log_segment_t* segment = curr->data;
+        if (segment->seq == seq) {
+            return segment;
+        }
     }
+    return NULL;
+}
 
-    rename(log_file, log_file_new);
+// must be called with segments_lock held
+static void
+_segments_save(void)
+{
+    GString* contents = g_string_new(NULL);
+    for (GList* curr = segments.head; curr; curr = g_list_next(curr)) {
+        log_segment_t* segment = curr->data;
+        auto_gchar gchar* name = g_path_get_basename(segment->path);
+        g_string_append_printf(contents, "%u %" G_GINT64_FORMAT " %s\n", segment->seq, segment->size, name);
+    }
+    g_file_set_contents(segments_index, contents->str, contents->len, NULL);
+    g_string_free(contents, TRUE);
+}
 
-    log_init(log_get_filter(), NULL);
+// must be called with segments_lock held
+static void
+_segments_prune(void)
+{
+    gint64 total = 0;
+    for (GList* curr = segments.head; curr; curr = g_list_next(curr)) {
+        total += ((log_segment_t*)curr->data)->size;
+    }
 
-    log_info("Log has been rotated");
+    guint max = g_atomic_int_get(&segments_max);
+    gint64 max_bytes = g_atomic_int_get(&segments_max_bytes);
+    while (segments.length > max || (total > max_bytes && segments.length > 0)) {
+        log_segment_t* segment = g_queue_pop_head(&segments);
+        total -= segment->size;
+        if (g_unlink(segment->path) == 0) {
+            // logged by the writer thread
+            g_queue_push_tail(&segments_removed, g_steal_pointer(&segment->path));
+            g_atomic_int_set(&segments_removed_pending, TRUE);
+        }
+        _segment_free(segment);
+    }
+}
+
+// Reads the segment index. Without one the log directory is only looked at
+// for the highest segment number in use, segments rotated by older versions
+// are left alone as they were never removed by them either.
+static void
+_segments_load(void)
+{
+    auto_gchar gchar* stem = _log_stem();
+    auto_gchar gchar* dir = g_path_get_dirname(stem);
+    segments_index = g_strdup_printf("%s.index", mainlogfile);
+    segments_next = 1;
+
+    auto_gchar gchar* contents = NULL;
+    if (g_file_get_contents(segments_index, &contents, NULL, NULL)) {
+        auto_gcharv gchar** lines = g_strsplit(contents, "\n", -1);
+        for (int i = 0; lines[i]; i++) {
+            guint seq;
+            gint64 size;
+            int name_start = 0;
+            if (sscanf(lines[i], "%u %" G_GINT64_FORMAT " %n", &seq, &size, &name_start) == 2 && name_start > 0 && lines[i][name_start]) {
+                auto_gchar gchar* path = g_build_filename(dir, lines[i] + name_start, NULL);
+                g_queue_push_tail(&segments, _segment_new(seq, path, size));
+            }
+        }
+    } else {
+        auto_gchar gchar* prefix = g_path_get_basename(stem);
+        gsize prefix_len = strlen(prefix);
+        GDir* logs = g_dir_open(dir, 0, NULL);
+        const gchar* name;
+        while (logs && (name = g_dir_read_name(logs))) {
+            guint seq;
+            int end = 0;
+            if (strncmp(name, prefix, prefix_len) != 0 || name[prefix_len] != '.') {
+                continue;
+            }
+            if (sscanf(name + prefix_len + 1, "%u.log%n", &seq, &end) != 1 || end == 0) {
+                continue;
+            }
+            const char* suffix = name + prefix_len + 1 + end;
+            if (suffix[0] != '\0' && g_strcmp0(suffix, ".gz") != 0) {
+                continue;
+            }
+            segments_next = MAX(segments_next, seq + 1);
+        }
+        if (logs) {
+            g_dir_close(logs);
+        }
+    }
+
+    if (segments.tail) {
+        segments_next = MAX(segments_next, ((log_segment_t*)segments.tail->data)->seq + 1);
+    }
+}
+
+static gboolean
+_segment_compress_file(const char* const path, const char* const gz_path, GError** error)
+{
+    GFile* file = g_file_new_for_path(path);
+    GFileInputStream* in = g_file_read(file, compress_cancel, error);
+    g_object_unref(file);
+    if (!in) {
+        return FALSE;
+    }
+
+    file = g_file_new_for_path(gz_path);
+    GFileOutputStream* file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, compress_cancel, error);
+    g_object_unref(file);
+    if (!file_stream) {
+        g_object_unref(in);
+        return FALSE;
+    }
+
+    GZlibCompressor* compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    GOutputStream* out = g_converter_output_stream_new(G_OUTPUT_STREAM(file_stream), G_CONVERTER(compressor));
+    g_object_unref(compressor);
+    g_object_unref(file_stream);
+
+    gboolean success = g_output_stream_splice(out, G_INPUT_STREAM(in), G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, compress_cancel, error) != -1;
+    g_object_unref(in);
+
+    // a cancelled close discards the temporary file instead of replacing gz_path
+    if (success) {
+        success = g_output_stream_close(out, compress_cancel, error);
+    } else {
+        GCancellable* cancellable = g_cancellable_new();
+        g_cancellable_cancel(cancellable);
+        g_output_stream_close(out, cancellable, NULL);
+        g_object_unref(cancellable);
+    }
+    g_object_unref(out);
+
+    return success;
+}
+
+static void
+_segment_compress(gpointer data, gpointer user_data)
+{
+    guint seq = GPOINTER_TO_UINT(data);
+
+    g_mutex_lock(&segments_lock);
+    log_segment_t* segment = _segments_find(seq);
+    auto_gchar gchar* path = segment ? g_strdup(segment->path) : NULL;
+    g_mutex_unlock(&segments_lock);
+
+    if (!path || g_str_has_suffix(path, ".gz")) {
+        return;
+    }
+
+    auto_gchar gchar* gz_path = g_strdup_printf("%s.gz", path);
+    GError* error = NULL;
+    gboolean success = _segment_compress_file(path, gz_path, &error);
+    struct stat st;
+    if (success && stat(gz_path, &st) != 0) {
+        success = FALSE;
+    }
+
+    g_mutex_lock(&segments_lock);
+    segment = _segments_find(seq);
+    if (success && segment) {
+        g_unlink(path);
+        g_free(segment->path);
+        segment->path = g_steal_pointer(&gz_path);
+        segment->size = st.st_size;
+    } else if (success) {
+        g_unlink(gz_path);
+    } else if (segment && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+        g_queue_remove(&segments, segment);
+        _segment_free(segment);
+    } else if (error && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) && !segments_error) {
+        // picked up by the writer thread, the logger is not thread safe
+        g_atomic_pointer_set(&segments_error, g_strdup_printf("Could not compress %s: %s", path, error->message));
+    }
+    _segments_prune();
+    _segments_save();
+    g_mutex_unlock(&segments_lock);
+
+    g_clear_error(&error);
+}
+
+// Runs on the writer thread, the old file is handed to the compression pool
+static void
+_rotate_log_file(GString* batch)
+{
+    auto_gchar gchar* stem = _log_stem();
+
+    g_mutex_lock(&segments_lock);
+    guint seq = segments_next++;
+    g_mutex_unlock(&segments_lock);
+
+    auto_gchar gchar* segment_path = g_strdup_printf("%s.%03u.log", stem, seq);
+
+    close(log_fd);
+
+    gboolean renamed = rename(mainlogfile, segment_path) == 0;
+    if (renamed) {
+        g_mutex_lock(&segments_lock);
+        g_queue_push_tail(&segments, _segment_new(seq, segment_path, log_size));
+        _segments_save();
+        g_mutex_unlock(&segments_lock);
+
+        g_thread_pool_push(compress_pool, GUINT_TO_POINTER(seq), NULL);
+    }
+
+    log_fd = _log_open(mainlogfile);
+    if (!renamed) {
+        // try again once another max log size has been written
+        log_size = 0;
+    }
+
+    auto_gchar gchar* msg = renamed ? g_strdup_printf("Log has been rotated to %s", segment_path)
+                                    : g_strdup_printf("Could not rotate log to %s: %s", segment_path, g_strerror(errno));
+    _log_append_line(batch, g_get_real_time(), renamed ? PROF_LEVEL_INFO : PROF_LEVEL_ERROR, PROF, strlen(PROF), msg, strlen(msg));
+}
+
+static void
+_foreign_record_free(log_foreign_record_t* record)
+{
+    g_free(record->area);
+    g_free(record->msg);
+    g_free(record);
+}
+
+static void
+_log_flush(GString* batch)
+{
+    if (g_atomic_int_get(&foreign_pending)) {
+        g_mutex_lock(&ring_lock);
+        g_atomic_int_set(&foreign_pending, FALSE);
+        log_foreign_record_t* record;
+        while ((record = g_queue_pop_head(&foreign_records))) {
+            _log_append_line(batch, record->timestamp, record->level, record->area, strlen(record->area), record->msg, strlen(record->msg));
+            _foreign_record_free(record);
+        }
+        g_mutex_unlock(&ring_lock);
+    }
+
+    guint dropped = g_atomic_int_and(&ring_dropped, 0);
+    if (dropped > 0) {
+        dropped_total += dropped;
+        auto_gchar gchar* msg = g_strdup_printf("Log buffer full, dropped %u records (%u in total)", dropped, dropped_total);
+        _log_append_line(batch, g_get_real_time(), PROF_LEVEL_WARN, PROF, strlen(PROF), msg, strlen(msg));
+    }
+
+    if (g_atomic_pointer_get(&segments_error)) {
+        g_mutex_lock(&segments_lock);
+        auto_gchar gchar* msg = g_steal_pointer(&segments_error);
+        g_mutex_unlock(&segments_lock);
+        _log_append_line(batch, g_get_real_time(), PROF_LEVEL_ERROR, PROF, strlen(PROF), msg, strlen(msg));
+    }
+
+    if (g_atomic_int_get(&segments_removed_pending)) {
+        g_mutex_lock(&segments_lock);
+        g_atomic_int_set(&segments_removed_pending, FALSE);
+        gchar* path;
+        while ((path = g_queue_pop_head(&segments_removed))) {
+            auto_gchar gchar* msg = g_strdup_printf("Removed old log segment %s", path);
+            _log_append_line(batch, g_get_real_time(), PROF_LEVEL_INFO, PROF, strlen(PROF), msg, strlen(msg));
+            g_free(path);
+        }
+        g_mutex_unlock(&segments_lock);
+    }
+
+    if (batch->len == 0) {
+        return;
+    }
+
+    _log_write(batch->str, batch->len);
+    g_string_truncate(batch, 0);
+
+    gint limit = g_atomic_int_get(&rotate_limit);
+    if (limit > 0 && log_size >= limit) {
+        _rotate_log_file(batch);
+        _log_write(batch->str, batch->len);
+        g_string_truncate(batch, 0);
+    }
+}
+
+static gpointer
+_log_writer_thread(gpointer data)
+{
+    GString* batch = g_string_sized_new(LOG_BATCH_BYTES * 2);
+
+    while (TRUE) {
+        guint head = g_atomic_int_get(&ring_head);
+        guint tail = ring_tail;
+
+        if (head == tail) {
+            _log_flush(batch);
+
+            if (g_atomic_int_get(&ring_shutdown) && g_atomic_int_get(&ring_head) == tail) {
+                break;
+            }
+
+            // log_msg() only takes the lock to wake us up when we announced
+            // that we are about to sleep, so check the ring once more after that
+            g_mutex_lock(&ring_lock);
+            g_atomic_int_set(&ring_writer_sleeping, TRUE);
+            if (g_atomic_int_get(&ring_head) == tail && !g_atomic_int_get(&ring_shutdown) && !g_atomic_int_get(&foreign_pending)) {
+                g_cond_wait_until(&ring_data_cond, &ring_lock, g_get_monotonic_time() + LOG_WRITER_WAKEUP);
+            }
+            g_atomic_int_set(&ring_writer_sleeping, FALSE);
+            g_mutex_unlock(&ring_lock);
+            continue;
+        }
+
+        while (tail != head) {
+            guint offset = tail & LOG_RING_MASK;
+            guint remaining = LOG_RING_SIZE - offset;
+            log_record_t* record = (log_record_t*)(ring_buf + offset);
+
+            if (remaining < sizeof(log_record_t) || record->size == 0) {
+                tail += remaining;
+                continue;
+            }
+
+            const char* area = (const char*)(record + 1);
+            const char* msg = area + record->area_len;
+            _log_append_line(batch, record->timestamp, record->level, area, record->area_len, msg, record->msg_len);
+
+            tail += record->size;
+            g_atomic_int_set(&ring_tail, tail);
+
+            if (batch->len >= LOG_BATCH_BYTES) {
+                _log_flush(batch);
+            }
+        }
+        g_atomic_int_set(&ring_tail, tail);
+
+        if (g_atomic_int_get(&ring_producer_waiting)) {
+            g_mutex_lock(&ring_lock);
+            g_cond_signal(&ring_space_cond);
+            g_mutex_unlock(&ring_lock);
+        }
+    }
+
+    g_string_free(batch, TRUE);
+
+    return NULL;
+}
+
+// Finds room for a record of size bytes, wrapping to the start of the ring if it
+// does not fit in front of the end. Warnings and errors wait for the writer to
+// free up space, everything else is dropped (and counted) when the ring is full.
+static gboolean
+_log_reserve(guint size, gboolean block, guint* offset)
+{
+    guint head = ring_head;
+    guint contiguous = LOG_RING_SIZE - (head & LOG_RING_MASK);
+    guint needed = size <= contiguous ? size : contiguous + size;
+
+    while (LOG_RING_SIZE - (head - g_atomic_int_get(&ring_tail)) < needed) {
+        if (!block || !log_writer) {
+            return FALSE;
+        }
+
+        g_mutex_lock(&ring_lock);
+        g_atomic_int_set(&ring_producer_waiting, TRUE);
+        if (LOG_RING_SIZE - (head - g_atomic_int_get(&ring_tail)) < needed) {
+            g_cond_wait_until(&ring_space_cond, &ring_lock, g_get_monotonic_time() + LOG_WRITER_WAKEUP);
+        }
+        g_atomic_int_set(&ring_producer_waiting, FALSE);
+        g_mutex_unlock(&ring_lock);
+    }
+
+    if (size > contiguous) {
+        if (contiguous >= sizeof(log_record_t)) {
+            ((log_record_t*)(ring_buf + (head & LOG_RING_MASK)))->size = 0;
+        }
+        *offset = 0;
+    } else {
+        *offset = head & LOG_RING_MASK;
+    }
+
+    return TRUE;
 }
 
 // abbreviation string is the prefix that's used in the log file
@@ -124,6 +633,10 @@ _log_abbreviation_string_from_level(log_level_t level)
 void
 log_debug(const char* const msg, ...)
 {
+    if (PROF_LEVEL_DEBUG < level_filter || !log_writer) {
+        return;
+    }
+
     va_list arg;
     va_start(arg, msg);
     GString* fmt_msg = g_string_new(NULL);
@@ -136,6 +649,10 @@ log_debug(const char* const msg, ...)
 void
 log_info(const char* const msg, ...)
 {
+    if (PROF_LEVEL_INFO < level_filter || !log_writer) {
+        return;
+    }
+
     va_list arg;
     va_start(arg, msg);
     GString* fmt_msg = g_string_new(NULL);
@@ -148,6 +665,10 @@ log_info(const char* const msg, ...)
 void
 log_warning(const char* const msg, ...)
 {
+    if (PROF_LEVEL_WARN < level_filter || !log_writer) {
+        return;
+    }
+
     va_list arg;
     va_start(arg, msg);
     GString* fmt_msg = g_string_new(NULL);
@@ -160,6 +681,10 @@ log_warning(const char* const msg, ...)
 void
 log_error(const char* const msg, ...)
 {
+    if (PROF_LEVEL_ERROR < level_filter || !log_writer) {
+        return;
+    }
+
     va_list arg;
     va_start(arg, msg);
     GString* fmt_msg = g_string_new(NULL);
@@ -180,8 +705,47 @@ log_init(log_level_t filter, char* log_file)
 
     mainlogfile = files_get_log_file(log_file);
 
-    logp = fopen(mainlogfile, "a");
-    g_chmod(mainlogfile, S_IRUSR | S_IWUSR);
+    log_fd = _log_open(mainlogfile);
+    if (log_fd == -1) {
+        return;
+    }
+
+    ring_buf = g_malloc(LOG_RING_SIZE);
+    ring_head = 0;
+    ring_tail = 0;
+    ring_dropped = 0;
+    ring_shutdown = FALSE;
+    dropped_total = 0;
+    log_reload_rotation();
+
+    if (!user_provided_log) {
+        _segments_load();
+        compress_cancel = g_cancellable_new();
+        compress_pool = g_thread_pool_new(_segment_compress, NULL, 1, FALSE, NULL);
+
+        // segments left uncompressed when we last quit
+        for (GList* curr = segments.head; curr; curr = g_list_next(curr)) {
+            log_segment_t* segment = curr->data;
+            if (!g_str_has_suffix(segment->path, ".gz")) {
+                g_thread_pool_push(compress_pool, GUINT_TO_POINTER(segment->seq), NULL);
+            }
+        }
+    }
+
+    log_owner = g_thread_self();
+    log_writer = g_thread_new("log-writer", _log_writer_thread, NULL);
+}
+
+void
+log_reload_rotation(void)
+{
+    gint limit = 0;
+    if (prefs_get_boolean(PREF_LOG_ROTATE) && !user_provided_log) {
+        limit = prefs_get_max_log_size();
+    }
+    g_atomic_int_set(&rotate_limit, limit);
+    g_atomic_int_set(&segments_max, prefs_get_log_segments());
+    g_atomic_int_set(&segments_max_bytes, prefs_get_log_segments_size());
 }
 
 const gchar*
@@ -199,34 +763,112 @@ log_get_filter(void)
 void
 log_close(void)
 {
+    if (log_writer) {
+        g_mutex_lock(&ring_lock);
+        g_atomic_int_set(&ring_shutdown, TRUE);
+        g_cond_signal(&ring_data_cond);
+        g_mutex_unlock(&ring_lock);
+
+        g_thread_join(log_writer);
+        log_writer = NULL;
+    }
+    log_owner = NULL;
+    g_queue_clear_full(&foreign_records, (GDestroyNotify)_foreign_record_free);
+    foreign_pending = FALSE;
+
+    // unfinished segments are compressed on the next start
+    if (compress_pool) {
+        g_cancellable_cancel(compress_cancel);
+        g_thread_pool_free(compress_pool, TRUE, TRUE);
+        compress_pool = NULL;
+        g_clear_object(&compress_cancel);
+    }
+    g_queue_clear_full(&segments, (GDestroyNotify)_segment_free);
+    g_free(segments_index);
+    segments_index = NULL;
+    g_free(segments_error);
+    segments_error = NULL;
+    g_queue_clear_full(&segments_removed, g_free);
+    segments_removed_pending = FALSE;
+
+    g_free(ring_buf);
+    ring_buf = NULL;
+
     g_free(mainlogfile);
     mainlogfile = NULL;
-    if (logp) {
-        fclose(logp);
+    if (log_fd != -1) {
+        close(log_fd);
+        log_fd = -1;
     }
 }
 
+// Only the thread that called log_init() may write to the ring, other threads
+// hand their records to the writer thread through a locked queue.
+static void
+_log_msg_foreign(log_level_t level, const char* const area, const char* const msg)
+{
+    g_mutex_lock(&ring_lock);
+    if (g_queue_get_length(&foreign_records) >= LOG_FOREIGN_MAX) {
+        g_mutex_unlock(&ring_lock);
+        g_atomic_int_inc(&ring_dropped);
+        return;
+    }
+
+    log_foreign_record_t* record = g_new0(log_foreign_record_t, 1);
+    record->level = level;
+    record->timestamp = g_get_real_time();
+    record->area = g_strdup(area);
+    record->msg = g_strndup(msg, LOG_MSG_MAX);
+    g_queue_push_tail(&foreign_records, record);
+    g_atomic_int_set(&foreign_pending, TRUE);
+    g_cond_signal(&ring_data_cond);
+    g_mutex_unlock(&ring_lock);
+}
+
 void
 log_msg(log_level_t level, const char* const area, const char* const msg)
 {
-    if (level >= level_filter && logp) {
-        GDateTime* dt = g_date_time_new_now_local();
+    if (level < level_filter || !log_writer) {
+        return;
+    }
 
-        char* level_str = _log_abbreviation_string_from_level(level);
+    if (g_thread_self() != log_owner) {
+        _log_msg_foreign(level, area, msg);
+        return;
+    }
 
-        auto_gchar gchar* date_fmt = g_date_time_format_iso8601(dt);
+    gsize area_len = strlen(area);
+    gsize msg_len = strlen(msg);
+    if (msg_len > LOG_MSG_MAX) {
+        msg_len = LOG_MSG_MAX;
+    }
+    guint size = LOG_ALIGN(sizeof(log_record_t) + area_len + msg_len);
 
-        fprintf(logp, "%s: %s: %s: %s\n", date_fmt, area, level_str, msg);
-        g_date_time_unref(dt);
+    guint offset;
+    if (!_log_reserve(size, level >= PROF_LEVEL_WARN, &offset)) {
+        g_atomic_int_inc(&ring_dropped);
+        return;
+    }
 
-        fflush(logp);
+    log_record_t* record = (log_record_t*)(ring_buf + offset);
+    record->size = size;
+    record->level = level;
+    record->timestamp = g_get_real_time();
+    record->area_len = area_len;
+    record->msg_len = msg_len;
+    memcpy(record + 1, area, area_len);
+    memcpy((char*)(record + 1) + area_len, msg, msg_len);
+
+    guint head = ring_head;
+    if (offset == 0 && (head & LOG_RING_MASK) != 0) {
+        head += LOG_RING_SIZE - (head & LOG_RING_MASK);
+    }
+    g_atomic_int_set(&ring_head, head + size);
 
-        if (prefs_get_boolean(PREF_LOG_ROTATE) && !user_provided_log) {
-            long result = ftell(logp);
-            if (result != -1 && result >= prefs_get_max_log_size()) {
-                _rotate_log_file();
-            }
-        }
+    if (g_atomic_int_get(&ring_writer_sleeping)) {
+        g_mutex_lock(&ring_lock);
+        g_cond_signal(&ring_data_cond);
+        g_mutex_unlock(&ring_lock);
     }
 }
 
@@ -49,6 +49,7 @@ typedef enum {
 void log_init(log_level_t filter, char* log_file);
 log_level_t log_get_filter(void);
 void log_close(void);
+void log_reload_rotation(void);
 const gchar* get_log_file_location(void);
 void log_debug(const char* const msg, ...);
 void log_info(const char* const msg, ...);
@@ -58,6 +59,30 @@ void log_msg(log_level_t level, const char* const area, const char* const msg);
 int log_level_from_string(char* log_level, log_level_t* level);
 const char* log_string_from_level(log_level_t level);
 
+// Like the functions above, but the level is checked before the arguments are
+// evaluated, so a filtered message costs a comparison instead of a format. Debug
+// messages are compiled out entirely when configured with --disable-debug-log.
+#define LOG_AT_LEVEL(level, func, ...)     \
+    do {                                   \
+        if ((level) >= log_get_filter()) { \
+            func(__VA_ARGS__);             \
+        }                                  \
+    } while (0)
+
+#ifdef PROF_DISABLE_DEBUG_LOG
+#define LOG_DEBUG(...)              \
+    do {                            \
+        if (0) {                    \
+            log_debug(__VA_ARGS__); \
+        }                           \
+    } while (0)
+#else
+#define LOG_DEBUG(...) LOG_AT_LEVEL(PROF_LEVEL_DEBUG, log_debug, __VA_ARGS__)
+#endif
+#define LOG_INFO(...)    LOG_AT_LEVEL(PROF_LEVEL_INFO, log_info, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT_LEVEL(PROF_LEVEL_WARN, log_warning, __VA_ARGS__)
+#define LOG_ERROR(...)   LOG_AT_LEVEL(PROF_LEVEL_ERROR, log_error, __VA_ARGS__)
+
 void log_stderr_init(log_level_t level);
 void log_stderr_close(void);
 void log_stderr_handler(void);
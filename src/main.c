@@ -54,6 +54,7 @@
 #include "profanity.h"
 #include "common.h"
 #include "command/cmd_defs.h"
+#include "xmpp/capture.h"
 
 static gboolean version = FALSE;
 static char* log = NULL;
@@ -61,6 +62,9 @@ static char* log_file = NULL;
 static char* account_name = NULL;
 static char* config_file = NULL;
 static char* theme_name = NULL;
+static char* import_account = NULL;
+static char* capture_file = NULL;
+static char* replay_file = NULL;
 
 int
 main(int argc, char** argv)
@@ -82,6 +86,9 @@ main(int argc, char** argv)
         { "config", 'c', 0, G_OPTION_ARG_STRING, &config_file, "Use an alternative configuration file", NULL },
         { "logfile", 'f', 0, G_OPTION_ARG_STRING, &log_file, "Specify log file", NULL },
         { "theme", 't', 0, G_OPTION_ARG_STRING, &theme_name, "Specify theme name", NULL },
+        { "import-logs", 'i', 0, G_OPTION_ARG_STRING, &import_account, "Import the flat-file chat logs of an account into the database and exit", "ACCOUNT" },
+        { "capture", 0, 0, G_OPTION_ARG_FILENAME, &capture_file, "Record the inbound stanzas of the session to a file", "FILE" },
+        { "replay", 0, 0, G_OPTION_ARG_FILENAME, &replay_file, "Replay a stanza capture as the account given with -a without connecting, print handler timings and exit", "FILE" },
         { NULL }
     };
 
@@ -170,6 +177,44 @@ main(int argc, char** argv)
         return 0;
     }
 
+    if (import_account) {
+        int ret = prof_import_logs(import_account, config_file, log ? log : "WARN", log_file);
+        g_free(import_account);
+        g_free(log);
+        g_free(account_name);
+        g_free(config_file);
+        g_free(log_file);
+        g_free(theme_name);
+        return ret;
+    }
+
+    if (replay_file) {
+        int ret = 1;
+        if (!account_name) {
+            g_printerr("--replay needs an account, use -a ACCOUNT\n");
+        } else {
+            ret = prof_replay(replay_file, account_name, config_file, log ? log : "WARN", log_file);
+        }
+        g_free(replay_file);
+        g_free(capture_file);
+        g_free(log);
+        g_free(account_name);
+        g_free(config_file);
+        g_free(log_file);
+        g_free(theme_name);
+        return ret;
+    }
+
+    if (capture_file) {
+        GError* capture_error = NULL;
+        if (!capture_open(capture_file, &capture_error)) {
+            g_printerr("Could not open %s for the stanza capture: %s\n", capture_file, capture_error->message);
+            g_error_free(capture_error);
+            return 1;
+        }
+        g_free(capture_file);
+    }
+
     /* Default logging WARN */
     prof_run(log ? log : "WARN", account_name, config_file, log_file, theme_name);
 
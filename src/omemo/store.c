@@ -81,15 +81,15 @@ load_session(signal_buffer** record, signal_buffer** user_record,
     GHashTable* session_store = (GHashTable*)user_data;
     GHashTable* device_store = NULL;
 
-    log_debug("[OMEMO][STORE] Looking for %s in session_store", address->name);
+    LOG_DEBUG("[OMEMO][STORE] Looking for %s in session_store", address->name);
     device_store = g_hash_table_lookup(session_store, address->name);
     if (!device_store) {
         *record = NULL;
-        log_info("[OMEMO][STORE] No device store for %s found", address->name);
+        LOG_INFO("[OMEMO][STORE] No device store for %s found", address->name);
         return 0;
     }
 
-    log_debug("[OMEMO][STORE] Looking for device %d of %s ", address->device_id, address->name);
+    LOG_DEBUG("[OMEMO][STORE] Looking for device %d of %s ", address->device_id, address->name);
     signal_buffer* original = g_hash_table_lookup(device_store, GINT_TO_POINTER(address->device_id));
     if (!original) {
         *record = NULL;
@@ -133,7 +133,7 @@ store_session(const signal_protocol_address* address,
     GHashTable* session_store = (GHashTable*)user_data;
     GHashTable* device_store = NULL;
 
-    log_debug("[OMEMO][STORE] Store session for %s (%d)", address->name, address->device_id);
+    LOG_DEBUG("[OMEMO][STORE] Store session for %s (%d)", address->name, address->device_id);
     device_store = g_hash_table_lookup(session_store, (void*)address->name);
     if (!device_store) {
         device_store = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)signal_buffer_free);
@@ -165,7 +165,7 @@ contains_session(const signal_protocol_address* address, void* user_data)
     }
 
     if (!g_hash_table_lookup(device_store, GINT_TO_POINTER(address->device_id))) {
-        log_debug("[OMEMO][STORE] No Session for %d ", address->device_id);
+        LOG_DEBUG("[OMEMO][STORE] No Session for %d ", address->device_id);
         return 0;
     }
 
@@ -399,7 +399,7 @@ is_trusted_identity(const signal_protocol_address* address, uint8_t* key_data,
 {
     int ret;
     identity_key_store_t* identity_key_store = (identity_key_store_t*)user_data;
-    log_debug("[OMEMO][STORE] Checking trust %s (%d)", address->name, address->device_id);
+    LOG_DEBUG("[OMEMO][STORE] Checking trust %s (%d)", address->name, address->device_id);
     GHashTable* trusted = g_hash_table_lookup(identity_key_store->trusted, address->name);
     if (!trusted) {
         if (identity_key_store->recv) {
@@ -415,7 +415,7 @@ is_trusted_identity(const signal_protocol_address* address, uint8_t* key_data,
     signal_buffer* original = g_hash_table_lookup(trusted, GINT_TO_POINTER(address->device_id));
 
     if (!original) {
-        log_debug("[OMEMO][STORE] original not found %s (%d)", address->name, address->device_id);
+        LOG_DEBUG("[OMEMO][STORE] original not found %s (%d)", address->name, address->device_id);
     }
     ret = original != NULL && signal_buffer_compare(buffer, original) == 0;
 
@@ -425,7 +425,7 @@ is_trusted_identity(const signal_protocol_address* address, uint8_t* key_data,
         log_debug("[OMEMO][STORE] 1 identity_key_store->recv");
         return 1;
     } else {
-        log_debug("[OMEMO][STORE] Checking trust %s (%d): %d", address->name, address->device_id, ret);
+        LOG_DEBUG("[OMEMO][STORE] Checking trust %s (%d): %d", address->name, address->device_id, ret);
         return ret;
     }
 }
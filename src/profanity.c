@@ -39,10 +39,12 @@
 #include "ui/tray.h"
 #endif
 
+#include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <glib.h>
 
@@ -50,6 +52,8 @@
 #include "common.h"
 #include "log.h"
 #include "chatlog.h"
+#include "chatlog_import.h"
+#include "database.h"
 #include "config/files.h"
 #include "config/tlscerts.h"
 #include "config/accounts.h"
@@ -70,6 +74,7 @@
 #include "xmpp/chat_state.h"
 #include "xmpp/contact.h"
 #include "xmpp/roster_list.h"
+#include "xmpp/capture.h"
 
 #ifdef HAVE_LIBOTR
 #include "otr/otr.h"
@@ -127,6 +132,9 @@ prof_run(char* log_level, char* account_name, char* config_file, char* log_file,
         notify_remind();
         session_process_events();
         iq_autoping_check();
+        log_database_process_events();
+        chat_log_process_events();
+        chat_log_import_process_events();
         ui_update();
 #ifdef HAVE_GTK
         tray_update();
@@ -134,6 +142,86 @@ prof_run(char* log_level, char* account_name, char* config_file, char* log_file,
     }
 }
 
+// Import the flat-file chat logs of an account into its database without
+// starting the UI, used by --import-logs
+int
+prof_import_logs(char* account_name, char* config_file, char* log_level, char* log_file)
+{
+    setlocale(LC_ALL, "");
+    files_create_directories();
+    log_level_t prof_log_level;
+    log_level_from_string(log_level, &prof_log_level);
+    prefs_load(config_file);
+    log_init(prof_log_level, log_file);
+    accounts_load();
+
+    int ret = 1;
+    ProfAccount* account = accounts_get_account(account_name);
+    if (!account) {
+        g_printerr("Account not found: %s\n", account_name);
+    } else if (!log_database_init(account)) {
+        g_printerr("Could not open the database of %s, see the log for details.\n", account->jid);
+    } else {
+        ChatLogImportStats stats;
+        g_print("Importing chat logs of %s…\n", account->jid);
+        if (chat_log_import_run(account->jid, account->muc_nick, &stats)) {
+            auto_gchar gchar* result = chat_log_import_stats_str(&stats);
+            g_print("%s\n", result);
+            log_info("%s", result);
+            ret = 0;
+        }
+        log_database_process_events();
+        log_database_close();
+    }
+
+    account_free(account);
+    accounts_close();
+    log_close();
+    prefs_close();
+
+    return ret;
+}
+
+// Replay a stanza capture without a terminal or a connection and print how
+// long the handlers took, used by --replay
+int
+prof_replay(char* capture_file, char* account_name, char* config_file, char* log_level, char* log_file)
+{
+    // the UI is drawn into /dev/null, the report goes to the real stdout
+    fflush(stdout);
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (report_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) {
+        g_printerr("Could not redirect the UI to /dev/null\n");
+        return 1;
+    }
+    close(null_fd);
+    FILE* report = fdopen(report_fd, "w");
+
+    const gchar* term = g_getenv("TERM");
+    if (!term || g_strcmp0(term, "dumb") == 0) {
+        g_setenv("TERM", "xterm", TRUE);
+    }
+
+    _init(log_level, config_file, log_file, NULL);
+
+    int ret = 1;
+    ProfAccount* account = accounts_get_account(account_name);
+    if (!account) {
+        fprintf(report, "Account not found: %s\n", account_name);
+    } else {
+        ret = capture_replay(capture_file, account_name, report);
+        account_free(account);
+    }
+    fclose(report);
+
+    // nothing disconnects the replayed session, close the database while the
+    // log is still open, _shutdown() closes the rest when we exit
+    log_database_close();
+
+    return ret;
+}
+
 void
 prof_set_quit(void)
 {
@@ -251,6 +339,8 @@ _shutdown(void)
 #ifdef HAVE_OMEMO
     omemo_close();
 #endif
+    capture_close();
+    chat_log_import_close();
     chat_log_close();
     theme_close();
     accounts_close();
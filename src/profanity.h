@@ -41,6 +41,8 @@
 #include <glib.h>
 
 void prof_run(char* log_level, char* account_name, char* config_file, char* log_file, char* theme_name);
+int prof_import_logs(char* account_name, char* config_file, char* log_level, char* log_file);
+int prof_replay(char* capture_file, char* account_name, char* config_file, char* log_level, char* log_file);
 void prof_set_quit(void);
 
 extern pthread_mutex_t lock;
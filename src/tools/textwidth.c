@@ -0,0 +1,221 @@
+/*
+ * textwidth.c
+ * vim: expandtab:ts=4:sts=4:sw=4
+ *
+ * Copyright (C) 2020 - 2023 Michael Vetter <jubalh@iodoru.org>
+ *
+ * This file is part of Profanity.
+ *
+ * Profanity is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Profanity is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Profanity.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give permission to
+ * link the code of portions of this program with the OpenSSL library under
+ * certain conditions as described in each individual source file, and
+ * distribute linked combinations including the two.
+ *
+ * You must obey the GNU General Public License in all respects for all of the
+ * code used other than OpenSSL. If you modify file(s) with this exception, you
+ * may extend this exception to your version of the file(s), but you are not
+ * obligated to do so. If you do not wish to do so, delete this exception
+ * statement from your version. If you delete this exception statement from all
+ * source files in the program, then also delete it here.
+ *
+ */
+
+// Display width of text as curses prints it. Most messages are plain ASCII,
+// so runs of it are found a block at a time and measured in bulk, only other
+// characters are decoded and looked up one by one.
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "tools/textwidth.h"
+
+#define ONES  UINT64_C(0x0101010101010101)
+#define HIGHS UINT64_C(0x8080808080808080)
+
+// high bit set in the bytes of block that are below n, n must be at most 128
+static inline guint64
+_below(guint64 block, guint8 n)
+{
+    return (block - ONES * n) & ~block & HIGHS;
+}
+
+// blocks are little endian on every host, so that the first byte is the least
+// significant one and the borrows in _below() only run past the first match
+static inline guint64
+_load(const char* const str)
+{
+    guint64 block;
+    memcpy(&block, str, sizeof(block));
+    return GUINT64_FROM_LE(block);
+}
+
+// index of the first flagged byte, flags are the high bits of a loaded block
+static inline gsize
+_first(guint64 flags)
+{
+    return __builtin_ctzll(flags) / 8;
+}
+
+/*
+ * Number of bytes at the start of str that are ASCII.
+ */
+gsize
+textwidth_ascii_len(const char* const str, gsize len)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(str + i));
+        int mask = _mm_movemask_epi8(block);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        guint64 flags = _load(str + i) & HIGHS;
+        if (flags) {
+            return i + _first(flags);
+        }
+    }
+
+    while (i < len && !(str[i] & 0x80)) {
+        i++;
+    }
+
+    return i;
+}
+
+// number of bytes at the start of str from lowest up to '~'
+static gsize
+_printable_len(const char* const str, gsize len, char lowest)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi8(lowest - 1);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(str + i));
+        // signed compare, bytes with the high bit set are negative
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(block, low), _mm_cmplt_epi8(block, del));
+        int mask = _mm_movemask_epi8(printable);
+        if (mask != 0xffff) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+#endif
+
+    for (; i + 8 <= len; i += 8) {
+        guint64 block = _load(str + i);
+        guint64 flags = (block & HIGHS) | _below(block, lowest) | _below(block ^ (ONES * 0x7f), 1);
+        if (flags) {
+            return i + _first(flags);
+        }
+    }
+
+    while (i < len && str[i] >= lowest && str[i] < 0x7f) {
+        i++;
+    }
+
+    return i;
+}
+
+/*
+ * Number of bytes at the start of str that are printable ASCII, each of them
+ * takes one column. Stops at control characters, DEL and anything non-ASCII.
+ */
+gsize
+textwidth_printable_len(const char* const str, gsize len)
+{
+    return _printable_len(str, len, ' ');
+}
+
+/*
+ * Length of the word at the start of str if it only has printable ASCII in
+ * it, so that its width is its length. A word ends at a space, a newline or
+ * after len bytes. Returns 0 if the word has to be measured character by
+ * character instead.
+ */
+gsize
+textwidth_ascii_word(const char* const str, gsize len)
+{
+    // printable ASCII without the space, so the scan ends with the word
+    gsize word = _printable_len(str, len, '!');
+
+    if (word == len || str[word] == ' ' || str[word] == '\n') {
+        return word;
+    }
+
+    return 0;
+}
+
+/*
+ * Columns the character at ch takes when printed at column x.
+ */
+int
+textwidth_char(const char* const ch, int x)
+{
+    gunichar c = g_utf8_get_char(ch);
+
+    if (c == '\t') {
+        return 8 - (x % 8);
+    }
+    // control characters are printed as ^X
+    if (c < 0x20 || c == 0x7f) {
+        return 2;
+    }
+    if (g_unichar_iszerowidth(c)) {
+        return 0;
+    }
+    return g_unichar_iswide(c) ? 2 : 1;
+}
+
+/*
+ * Width of str counting wide characters as two columns and everything else
+ * as one.
+ */
+int
+textwidth_str(const char* const str)
+{
+    gsize len = strlen(str);
+    const char* curr = str;
+    const char* end = str + len;
+    int width = 0;
+
+    while (curr < end) {
+        gsize ascii = textwidth_ascii_len(curr, end - curr);
+        width += ascii;
+        curr += ascii;
+
+        if (curr < end) {
+            width += g_unichar_iswide(g_utf8_get_char(curr)) ? 2 : 1;
+            curr = g_utf8_next_char(curr);
+        }
+    }
+
+    return width;
+}
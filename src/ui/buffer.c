@@ -55,150 +55,352 @@
 
 #define BUFF_SIZE 1200
 
+// Circular array of at most BUFF_SIZE entries, entry i is stored at
+// entries[(head + i) % capacity]. The array grows on demand so that windows
+// with little scrollback don't allocate the full size up front.
+//
+// ids maps a message id to the oldest entry carrying it, the keys are owned
+// by the entries. Entries with the same id are linked from oldest to newest
+// through next_dup.
+//
+// Entry i has the seq first_seq + i, so the position of an entry is known
+// without searching for it.
+//
+// Entries laid_from up to laid_to have a layout and each starts on the line
+// the one before it ends on. The window extends the range before it paints,
+// changes to the buffer shrink it so that the lines in it stay valid.
 struct prof_buff_t
 {
-    GSList* entries;
+    ProfBuffEntry** entries;
+    int capacity;
+    int head;
+    int size;
+    GHashTable* ids;
+    int first_seq;
+    int laid_from;
+    int laid_to;
 };
 
+static ProfBuffEntry* _new_entry(const char* show_char, int pad_indent, GDateTime* time, int flags, theme_item_t theme_item, const char* const display_from, const char* const from_jid, const char* const message, DeliveryReceipt* receipt, const char* const id);
 static void _free_entry(ProfBuffEntry* entry);
+static void _free_layout(ProfBuffEntry* entry);
+
+static inline int
+_slot(ProfBuff buffer, int entry)
+{
+    int slot = buffer->head + entry;
+    return slot >= buffer->capacity ? slot - buffer->capacity : slot;
+}
+
+static inline int
+_index_of(ProfBuff buffer, ProfBuffEntry* entry)
+{
+    return entry->seq - buffer->first_seq;
+}
+
+// links entry in after the entries with the same id that are older than it
+static void
+_index_add(ProfBuff buffer, ProfBuffEntry* entry)
+{
+    entry->next_dup = NULL;
+    if (!entry->id) {
+        return;
+    }
+
+    ProfBuffEntry* oldest = g_hash_table_lookup(buffer->ids, entry->id);
+    int position = _index_of(buffer, entry);
+    if (!oldest || position < _index_of(buffer, oldest)) {
+        entry->next_dup = oldest;
+        g_hash_table_replace(buffer->ids, entry->id, entry);
+        return;
+    }
+
+    ProfBuffEntry* prev = oldest;
+    while (prev->next_dup && _index_of(buffer, prev->next_dup) < position) {
+        prev = prev->next_dup;
+    }
+    entry->next_dup = prev->next_dup;
+    prev->next_dup = entry;
+}
+
+// must be called while the entry is still in the buffer
+static void
+_index_remove(ProfBuff buffer, ProfBuffEntry* entry)
+{
+    if (!entry->id) {
+        return;
+    }
+
+    ProfBuffEntry* oldest = g_hash_table_lookup(buffer->ids, entry->id);
+    if (oldest == entry) {
+        // the next oldest entry with the same id takes over
+        if (entry->next_dup) {
+            g_hash_table_replace(buffer->ids, entry->next_dup->id, entry->next_dup);
+        } else {
+            g_hash_table_remove(buffer->ids, entry->id);
+        }
+    } else {
+        ProfBuffEntry* prev = oldest;
+        while (prev->next_dup != entry) {
+            prev = prev->next_dup;
+        }
+        prev->next_dup = entry->next_dup;
+    }
+    entry->next_dup = NULL;
+}
+
+// takes entry out of the laid out range, keeping the larger part of the range
+// when it is in the middle. With removed the entries after it move up by one.
+static void
+_laid_out_cut(ProfBuff buffer, int entry, gboolean removed)
+{
+    if (entry < buffer->laid_from) {
+        if (removed) {
+            buffer->laid_from--;
+            buffer->laid_to--;
+        }
+    } else if (entry < buffer->laid_to) {
+        if (entry - buffer->laid_from < buffer->laid_to - 1 - entry) {
+            buffer->laid_from = removed ? entry : entry + 1;
+            if (removed) {
+                buffer->laid_to--;
+            }
+        } else {
+            buffer->laid_to = entry;
+        }
+    }
+}
+
+// makes room for one more entry, evicting the one at the other end when full
+static void
+_reserve(ProfBuff buffer, gboolean evict_first)
+{
+    if (buffer->size == BUFF_SIZE) {
+        if (evict_first) {
+            ProfBuffEntry* evicted = buffer->entries[buffer->head];
+            _laid_out_cut(buffer, 0, TRUE);
+            _index_remove(buffer, evicted);
+            _free_entry(evicted);
+            buffer->head = _slot(buffer, 1);
+            buffer->first_seq++;
+        } else {
+            ProfBuffEntry* evicted = buffer->entries[_slot(buffer, buffer->size - 1)];
+            _laid_out_cut(buffer, buffer->size - 1, TRUE);
+            _index_remove(buffer, evicted);
+            _free_entry(evicted);
+        }
+        buffer->size--;
+        return;
+    }
+
+    if (buffer->size < buffer->capacity) {
+        return;
+    }
+
+    int capacity = MIN(MAX(buffer->capacity * 2, 32), BUFF_SIZE);
+    ProfBuffEntry** entries = malloc(capacity * sizeof(ProfBuffEntry*));
+    for (int i = 0; i < buffer->size; i++) {
+        entries[i] = buffer->entries[_slot(buffer, i)];
+    }
+    free(buffer->entries);
+    buffer->entries = entries;
+    buffer->capacity = capacity;
+    buffer->head = 0;
+}
 
 ProfBuff
 buffer_create(void)
 {
     ProfBuff new_buff = malloc(sizeof(struct prof_buff_t));
     new_buff->entries = NULL;
+    new_buff->capacity = 0;
+    new_buff->head = 0;
+    new_buff->size = 0;
+    new_buff->ids = g_hash_table_new(g_str_hash, g_str_equal);
+    new_buff->first_seq = 0;
+    new_buff->laid_from = 0;
+    new_buff->laid_to = 0;
     return new_buff;
 }
 
 int
 buffer_size(ProfBuff buffer)
 {
-    return g_slist_length(buffer->entries);
+    return buffer->size;
 }
 
 void
 buffer_free(ProfBuff buffer)
 {
-    g_slist_free_full(buffer->entries, (GDestroyNotify)_free_entry);
+    for (int i = 0; i < buffer->size; i++) {
+        _free_entry(buffer->entries[_slot(buffer, i)]);
+    }
+    free(buffer->entries);
+    g_hash_table_destroy(buffer->ids);
     free(buffer);
 }
 
 void
 buffer_append(ProfBuff buffer, const char* show_char, int pad_indent, GDateTime* time, int flags, theme_item_t theme_item, const char* const display_from, const char* const from_jid, const char* const message, DeliveryReceipt* receipt, const char* const id)
 {
-    ProfBuffEntry* e = malloc(sizeof(struct prof_buff_entry_t));
-    e->show_char = strdup(show_char);
-    e->pad_indent = pad_indent;
-    e->flags = flags;
-    e->theme_item = theme_item;
-    e->time = g_date_time_ref(time);
-    e->display_from = display_from ? strdup(display_from) : NULL;
-    e->from_jid = from_jid ? strdup(from_jid) : NULL;
-    e->message = strdup(message);
-    e->receipt = receipt;
-    if (id) {
-        e->id = strdup(id);
-    } else {
-        e->id = NULL;
-    }
-
-    if (g_slist_length(buffer->entries) == BUFF_SIZE) {
-        _free_entry(buffer->entries->data);
-        buffer->entries = g_slist_delete_link(buffer->entries, buffer->entries);
-    }
+    ProfBuffEntry* e = _new_entry(show_char, pad_indent, time, flags, theme_item, display_from, from_jid, message, receipt, id);
 
-    buffer->entries = g_slist_append(buffer->entries, e);
+    _reserve(buffer, TRUE);
+    e->seq = buffer->first_seq + buffer->size;
+    buffer->entries[_slot(buffer, buffer->size)] = e;
+    buffer->size++;
+    _index_add(buffer, e);
 }
 
 void
 buffer_prepend(ProfBuff buffer, const char* show_char, int pad_indent, GDateTime* time, int flags, theme_item_t theme_item, const char* const display_from, const char* const from_jid, const char* const message, DeliveryReceipt* receipt, const char* const id)
 {
-    ProfBuffEntry* e = malloc(sizeof(struct prof_buff_entry_t));
-    e->show_char = strdup(show_char);
-    e->pad_indent = pad_indent;
-    e->flags = flags;
-    e->theme_item = theme_item;
-    e->time = g_date_time_ref(time);
-    e->display_from = display_from ? strdup(display_from) : NULL;
-    e->from_jid = from_jid ? strdup(from_jid) : NULL;
-    e->message = strdup(message);
-    e->receipt = receipt;
-    if (id) {
-        e->id = strdup(id);
-    } else {
-        e->id = NULL;
-    }
+    ProfBuffEntry* e = _new_entry(show_char, pad_indent, time, flags, theme_item, display_from, from_jid, message, receipt, id);
 
-    if (g_slist_length(buffer->entries) == BUFF_SIZE) {
-        GSList* last = g_slist_last(buffer->entries);
-        _free_entry(last->data);
-        buffer->entries = g_slist_delete_link(buffer->entries, last);
-    }
-
-    buffer->entries = g_slist_prepend(buffer->entries, e);
+    _reserve(buffer, FALSE);
+    buffer->head = buffer->head == 0 ? buffer->capacity - 1 : buffer->head - 1;
+    buffer->entries[buffer->head] = e;
+    buffer->first_seq--;
+    e->seq = buffer->first_seq;
+    buffer->size++;
+    buffer->laid_from++;
+    buffer->laid_to++;
+    _index_add(buffer, e);
 }
 
 void
 buffer_remove_entry_by_id(ProfBuff buffer, const char* const id)
 {
-    GSList* entries = buffer->entries;
-    while (entries) {
-        ProfBuffEntry* entry = entries->data;
-        if (entry->id && (g_strcmp0(entry->id, id) == 0)) {
-            _free_entry(entry);
-            buffer->entries = g_slist_delete_link(buffer->entries, entries);
-            break;
-        }
-        entries = g_slist_next(entries);
+    ProfBuffEntry* entry = buffer_get_entry_by_id(buffer, id);
+    if (entry) {
+        buffer_remove_entry(buffer, _index_of(buffer, entry));
     }
 }
 
+// closes the gap from whichever end is nearer
 void
 buffer_remove_entry(ProfBuff buffer, int entry)
 {
-    GSList* node = g_slist_nth(buffer->entries, entry);
-    _free_entry(node->data);
-    buffer->entries = g_slist_delete_link(buffer->entries, node);
+    assert(entry >= 0 && entry < buffer->size);
+    ProfBuffEntry* removed = buffer->entries[_slot(buffer, entry)];
+    _laid_out_cut(buffer, entry, TRUE);
+    _index_remove(buffer, removed);
+    _free_entry(removed);
+
+    if (entry < buffer->size / 2) {
+        for (int i = entry; i > 0; i--) {
+            ProfBuffEntry* moved = buffer->entries[_slot(buffer, i - 1)];
+            moved->seq++;
+            buffer->entries[_slot(buffer, i)] = moved;
+        }
+        buffer->head = _slot(buffer, 1);
+        buffer->first_seq++;
+    } else {
+        for (int i = entry; i < buffer->size - 1; i++) {
+            ProfBuffEntry* moved = buffer->entries[_slot(buffer, i + 1)];
+            moved->seq--;
+            buffer->entries[_slot(buffer, i)] = moved;
+        }
+    }
+    buffer->size--;
+}
+
+void
+buffer_set_entry_message(ProfBuff buffer, ProfBuffEntry* entry, const char* const message)
+{
+    free(entry->message);
+    entry->message = strdup(message);
+    _free_layout(entry);
+    _laid_out_cut(buffer, _index_of(buffer, entry), FALSE);
 }
 
 gboolean
 buffer_mark_received(ProfBuff buffer, const char* const id)
 {
-    GSList* entries = buffer->entries;
-    while (entries) {
-        ProfBuffEntry* entry = entries->data;
-        if (entry->receipt && g_strcmp0(entry->id, id) == 0) {
-            if (!entry->receipt->received) {
-                entry->receipt->received = TRUE;
-                return TRUE;
-            }
+    // with duplicate ids a later entry may be the one still waiting for its receipt
+    for (ProfBuffEntry* entry = buffer_get_entry_by_id(buffer, id); entry; entry = entry->next_dup) {
+        if (entry->receipt && !entry->receipt->received) {
+            entry->receipt->received = TRUE;
+            return TRUE;
         }
-        entries = g_slist_next(entries);
     }
 
     return FALSE;
 }
 
+// range of entries whose layouts follow each other, from is inclusive and
+// to exclusive
+void
+buffer_get_laid_out(ProfBuff buffer, int* from, int* to)
+{
+    *from = buffer->laid_from;
+    *to = buffer->laid_to;
+}
+
+void
+buffer_set_laid_out(ProfBuff buffer, int from, int to)
+{
+    assert(from >= 0 && from <= to && to <= buffer->size);
+    buffer->laid_from = from;
+    buffer->laid_to = to;
+}
+
 ProfBuffEntry*
 buffer_get_entry(ProfBuff buffer, int entry)
 {
-    GSList* node = g_slist_nth(buffer->entries, entry);
-    return node->data;
+    assert(entry >= 0 && entry < buffer->size);
+    return buffer->entries[_slot(buffer, entry)];
 }
 
 ProfBuffEntry*
 buffer_get_entry_by_id(ProfBuff buffer, const char* const id)
 {
-    GSList* entries = buffer->entries;
-    while (entries) {
-        ProfBuffEntry* entry = entries->data;
-        if (g_strcmp0(entry->id, id) == 0) {
-            return entry;
-        }
-        entries = g_slist_next(entries);
+    if (!id) {
+        return NULL;
     }
+    return g_hash_table_lookup(buffer->ids, id);
+}
+
+void
+buffer_set_entry_id(ProfBuff buffer, ProfBuffEntry* entry, const char* const id)
+{
+    _index_remove(buffer, entry);
+    free(entry->id);
+    entry->id = id ? strdup(id) : NULL;
+    _index_add(buffer, entry);
+}
 
-    return NULL;
+static ProfBuffEntry*
+_new_entry(const char* show_char, int pad_indent, GDateTime* time, int flags, theme_item_t theme_item, const char* const display_from, const char* const from_jid, const char* const message, DeliveryReceipt* receipt, const char* const id)
+{
+    ProfBuffEntry* e = malloc(sizeof(struct prof_buff_entry_t));
+    e->show_char = strdup(show_char);
+    e->pad_indent = pad_indent;
+    e->flags = flags;
+    e->theme_item = theme_item;
+    e->time = g_date_time_ref(time);
+    e->display_from = display_from ? strdup(display_from) : NULL;
+    e->from_jid = from_jid ? strdup(from_jid) : NULL;
+    e->message = strdup(message);
+    e->receipt = receipt;
+    if (id) {
+        e->id = strdup(id);
+    } else {
+        e->id = NULL;
+    }
+    e->layout = NULL;
+
+    return e;
+}
+
+static void
+_free_layout(ProfBuffEntry* entry)
+{
+    if (entry->layout) {
+        g_free(entry->layout->text);
+        g_free(entry->layout);
+        entry->layout = NULL;
+    }
 }
 
 static void
@@ -211,5 +413,6 @@ _free_entry(ProfBuffEntry* entry)
     free(entry->id);
     free(entry->receipt);
     g_date_time_unref(entry->time);
+    _free_layout(entry);
     free(entry);
 }
@@ -47,6 +47,25 @@ typedef struct delivery_receipt_t
     gboolean received;
 } DeliveryReceipt;
 
+// entry as laid out by the window, valid while width, startx and generation match
+typedef struct prof_buff_layout_t
+{
+    int width;
+    int startx;
+    int generation;
+    // rows the entry moves the cursor down and the column it ends in
+    int rows;
+    int endx;
+    // row the entry starts on, only meaningful relative to the other entries
+    // of the laid out range, see buffer_get_laid_out()
+    int line;
+    // timestamp and sender are the first time_len and from_len bytes of text
+    gsize time_len;
+    gsize from_len;
+    // entry with line breaks and indentation applied
+    gchar* text;
+} ProfBuffLayout;
+
 typedef struct prof_buff_entry_t
 {
     // pointer because it could be a unicode symbol as well
@@ -63,6 +82,11 @@ typedef struct prof_buff_entry_t
     DeliveryReceipt* receipt;
     // message id, in case we have it
     char* id;
+    ProfBuffLayout* layout;
+    // kept by the buffer to find the position of the entry
+    int seq;
+    // next newer entry with the same id
+    struct prof_buff_entry_t* next_dup;
 } ProfBuffEntry;
 
 typedef struct prof_buff_t* ProfBuff;
@@ -76,6 +100,10 @@ void buffer_remove_entry(ProfBuff buffer, int entry);
 int buffer_size(ProfBuff buffer);
 ProfBuffEntry* buffer_get_entry(ProfBuff buffer, int entry);
 ProfBuffEntry* buffer_get_entry_by_id(ProfBuff buffer, const char* const id);
+void buffer_set_entry_id(ProfBuff buffer, ProfBuffEntry* entry, const char* const id);
+void buffer_set_entry_message(ProfBuff buffer, ProfBuffEntry* entry, const char* const message);
 gboolean buffer_mark_received(ProfBuff buffer, const char* const id);
+void buffer_get_laid_out(ProfBuff buffer, int* from, int* to);
+void buffer_set_laid_out(ProfBuff buffer, int from, int to);
 
 #endif
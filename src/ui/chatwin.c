@@ -44,6 +44,7 @@
 #include "window_list.h"
 #include "xmpp/roster_list.h"
 #include "log.h"
+#include "common.h"
 #include "database.h"
 #include "config/preferences.h"
 #include "ui/ui.h"
@@ -586,63 +587,214 @@ chatwin_unset_outgoing_char(ProfChatWin* chatwin)
 }
 
 static void
-_chatwin_history(ProfChatWin* chatwin, const char* const contact_barejid)
+_chatwin_set_history_cursor(gint64* time, gint64* id, const ProfMessage* const message)
 {
-    if (!chatwin->history_shown) {
-        GSList* history = log_database_get_previous_chat(contact_barejid, NULL, NULL, FALSE, FALSE);
-        GSList* curr = history;
-
-        while (curr) {
-            ProfMessage* msg = curr->data;
-            char* msg_plain = msg->plain;
-            msg->plain = plugins_pre_chat_message_display(msg->from_jid->barejid, msg->from_jid->resourcepart, msg->plain);
-            // This is dirty workaround for memory leak. We reassign msg->plain above so have to free previous object
-            // TODO: Make a better solution, for example, pass msg object to the function and it will replace msg->plain properly if needed.
-            free(msg_plain);
-            win_print_history((ProfWin*)chatwin, msg);
-            curr = g_slist_next(curr);
-        }
-        chatwin->history_shown = TRUE;
-
-        g_slist_free_full(history, (GDestroyNotify)message_free);
-    }
+    *time = date_time_to_usec(message->timestamp);
+    *id = message->db_id;
 }
 
-// Print history starting from start_time to end_time if end_time is null the
-// first entry's timestamp in the buffer is used. Flip true to prepend to buffer.
-// Timestamps should be in iso8601
-gboolean
-chatwin_db_history(ProfChatWin* chatwin, const char* start_time, char* end_time, gboolean flip)
+// Remember the oldest and newest message of a history page loaded from the
+// chat log, so that paging continues exactly after them. Older pages only move
+// the oldest cursor and newer pages only the newest, unless it is not set yet.
+static void
+_chatwin_update_history_cursors(ProfChatWin* chatwin, GSList* history, gboolean older)
 {
-    if (!end_time) {
-        end_time = buffer_size(((ProfWin*)chatwin)->layout->buffer) == 0 ? NULL : g_date_time_format_iso8601(buffer_get_entry(((ProfWin*)chatwin)->layout->buffer, 0)->time);
+    if (!history) {
+        return;
     }
 
-    GSList* history = log_database_get_previous_chat(chatwin->barejid, start_time, end_time, !flip, flip);
-    gboolean has_items = g_slist_length(history) != 0;
-    GSList* curr = history;
+    // older pages are ordered newest first
+    const ProfMessage* oldest = older ? g_slist_last(history)->data : history->data;
+    const ProfMessage* newest = older ? history->data : g_slist_last(history)->data;
+
+    if (older || !chatwin->history_oldest_time) {
+        _chatwin_set_history_cursor(&chatwin->history_oldest_time, &chatwin->history_oldest_id, oldest);
+    }
+    if (!older || !chatwin->history_newest_time) {
+        _chatwin_set_history_cursor(&chatwin->history_newest_time, &chatwin->history_newest_id, newest);
+    }
+}
 
-    while (curr) {
+// Print a history page, older pages are prepended and ordered newest first
+static void
+_chatwin_print_history(ProfChatWin* chatwin, GSList* history, gboolean older)
+{
+    for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
         ProfMessage* msg = curr->data;
         char* msg_plain = msg->plain;
         msg->plain = plugins_pre_chat_message_display(msg->from_jid->barejid, msg->from_jid->resourcepart, msg->plain);
         // This is dirty workaround for memory leak. We reassign msg->plain above so have to free previous object
         // TODO: Make a better solution, for example, pass msg object to the function and it will replace msg->plain properly if needed.
         free(msg_plain);
-        if (flip) {
+        if (older) {
             win_print_old_history((ProfWin*)chatwin, msg);
         } else {
             win_print_history((ProfWin*)chatwin, msg);
         }
-        curr = g_slist_next(curr);
+    }
+
+    _chatwin_update_history_cursors(chatwin, history, older);
+}
+
+// Remove the placeholder shown while a history page is read
+static void
+_chatwin_remove_loading(ProfChatWin* chatwin)
+{
+    ProfBuff buffer = ((ProfWin*)chatwin)->layout->buffer;
+    ProfBuffEntry* first_entry = buffer_size(buffer) != 0 ? buffer_get_entry(buffer, 0) : NULL;
+
+    if (first_entry && first_entry->theme_item == THEME_ROOMINFO && g_strcmp0(first_entry->message, LOADING_MESSAGE) == 0) {
+        buffer_remove_entry(buffer, 0);
+    }
+}
+
+static void
+_chatwin_history_loaded(GSList* history, gpointer user_data)
+{
+    ProfChatWin* chatwin = user_data;
+    history_load_t load = chatwin->history_load;
+
+    if (chatwin->history_request && load != HISTORY_LOAD_NEWER) {
+        _chatwin_remove_loading(chatwin);
+    }
+    chatwin->history_request = 0;
+    chatwin->history_load = HISTORY_LOAD_NONE;
+
+    switch (load) {
+    case HISTORY_LOAD_INITIAL:
+        // messages may have arrived in the meantime, the history goes before them
+        history = g_slist_reverse(history);
+        _chatwin_print_history(chatwin, history, TRUE);
+        break;
+    case HISTORY_LOAD_OLDER:
+        if (history) {
+            _chatwin_print_history(chatwin, history, TRUE);
+        } else if (prefs_get_boolean(PREF_MAM) && connection_get_status() == JABBER_CONNECTED) {
+            win_print_loading_history((ProfWin*)chatwin);
+            iq_mam_request_older(chatwin);
+        }
+        break;
+    case HISTORY_LOAD_NEWER:
+        _chatwin_print_history(chatwin, history, FALSE);
+        break;
+    case HISTORY_LOAD_NONE:
+        break;
     }
 
     g_slist_free_full(history, (GDestroyNotify)message_free);
     win_redraw((ProfWin*)chatwin);
+}
+
+// Start reading a history page in the background. A load that is still
+// running is for a part of the history the window no longer shows, it is
+// cancelled. Older pages show a placeholder at the top until they arrive.
+static void
+_chatwin_history_request(ProfChatWin* chatwin, history_load_t load, gint64 start_time, gint64 start_id, gint64 end_time, gint64 end_id, gboolean from_start, gboolean flip)
+{
+    if (chatwin->history_request) {
+        log_database_cancel_history(chatwin->history_request);
+        if (chatwin->history_load != HISTORY_LOAD_NEWER) {
+            _chatwin_remove_loading(chatwin);
+        }
+        chatwin->history_request = 0;
+    }
+
+    chatwin->history_load = load;
+    guint request = log_database_get_previous_chat_async(chatwin->barejid, start_time, start_id, end_time, end_id, from_start, flip, _chatwin_history_loaded, chatwin);
+
+    // 0 if the page was cached and is shown already
+    if (request) {
+        chatwin->history_request = request;
+        if (load != HISTORY_LOAD_NEWER) {
+            win_print_loading_history((ProfWin*)chatwin);
+        }
+    }
+}
+
+static void
+_chatwin_history(ProfChatWin* chatwin, const char* const contact_barejid)
+{
+    if (!chatwin->history_shown) {
+        chatwin->history_shown = TRUE;
+        _chatwin_history_request(chatwin, HISTORY_LOAD_INITIAL, 0, G_MAXINT64, 0, 0, FALSE, FALSE);
+    }
+}
+
+static void
+_chatwin_history_bounds(ProfChatWin* chatwin, gint64 start_time, gint64* start_id, gint64* end_time, gint64* end_id)
+{
+    ProfBuff buffer = ((ProfWin*)chatwin)->layout->buffer;
+    if (!*end_time && buffer_size(buffer) != 0) {
+        *end_time = date_time_to_usec(buffer_get_entry(buffer, 0)->time);
+    }
+
+    *start_id = start_time && start_time == chatwin->history_newest_time ? chatwin->history_newest_id : G_MAXINT64;
+    *end_id = *end_time && *end_time == chatwin->history_oldest_time ? chatwin->history_oldest_id : 0;
+}
+
+// Print history starting from start_time to end_time if end_time is 0 the
+// first entry's timestamp in the buffer is used. Flip true to prepend to buffer.
+// Timestamps are microseconds since the epoch, a start_time of 0 reads from the
+// beginning. A bound equal to the oldest or newest message loaded so far
+// continues right after that message.
+gboolean
+chatwin_db_history(ProfChatWin* chatwin, gint64 start_time, gint64 end_time, gboolean flip)
+{
+    gint64 start_id, end_id;
+    _chatwin_history_bounds(chatwin, start_time, &start_id, &end_time, &end_id);
+
+    GSList* history = log_database_get_previous_chat(chatwin->barejid, start_time, start_id, end_time, end_id, !flip, flip);
+    gboolean has_items = g_slist_length(history) != 0;
+
+    _chatwin_print_history(chatwin, history, flip);
+    g_slist_free_full(history, (GDestroyNotify)message_free);
+    win_redraw((ProfWin*)chatwin);
 
     return has_items;
 }
 
+// Like chatwin_db_history(), but the page is read in the background and
+// printed once it arrives. If there are no older messages in the database
+// they are requested from the server with MAM if enabled.
+void
+chatwin_db_history_async(ProfChatWin* chatwin, gint64 start_time, gint64 end_time, gboolean flip)
+{
+    gint64 start_id, end_id;
+    _chatwin_history_bounds(chatwin, start_time, &start_id, &end_time, &end_id);
+
+    _chatwin_history_request(chatwin, flip ? HISTORY_LOAD_OLDER : HISTORY_LOAD_NEWER, start_time, start_id, end_time, end_id, !flip, flip);
+}
+
+// Replace the window contents with the history starting at the message with
+// the given time and id, used to jump to a search result. Paging up and down
+// loads more from there.
+void
+chatwin_db_history_from(ProfChatWin* chatwin, GDateTime* time, gint64 id)
+{
+    ProfWin* window = (ProfWin*)chatwin;
+
+    // a load still running is for what is about to be replaced
+    log_database_cancel_history(chatwin->history_request);
+    chatwin->history_request = 0;
+    chatwin->history_load = HISTORY_LOAD_NONE;
+
+    werase(window->layout->win);
+    buffer_free(window->layout->buffer);
+    window->layout->buffer = buffer_create();
+    chatwin->history_shown = TRUE;
+    chatwin->history_oldest_time = 0;
+
+    // the start of the keyset is exclusive, continue as if the message
+    // before it was shown
+    chatwin->history_newest_time = date_time_to_usec(time);
+    chatwin->history_newest_id = id - 1;
+    chatwin_db_history(chatwin, chatwin->history_newest_time, 0, FALSE);
+
+    window->layout->y_pos = 0;
+    window->layout->paged = 1;
+    win_update_virtual(window);
+}
+
 static void
 _chatwin_set_last_message(ProfChatWin* chatwin, const char* const id, const char* const message)
 {
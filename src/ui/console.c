@@ -56,6 +56,7 @@
 #include "log.h"
 #include "config/files.h"
 #include "config/preferences.h"
+#include "config/accounts.h"
 #include "config/theme.h"
 #include "command/cmd_defs.h"
 #include "ui/window_list.h"
@@ -65,6 +66,7 @@
 #include "xmpp/xmpp.h"
 #include "xmpp/muc.h"
 #include "xmpp/roster_list.h"
+#include "database.h"
 
 static void _cons_splash_logo(void);
 static void _show_roster_contacts(GSList* list, gboolean show_groups);
@@ -394,8 +396,6 @@ void
 cons_about(void)
 {
     ProfWin* console = wins_get_console();
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
 
     if (prefs_get_boolean(PREF_SPLASH)) {
         _cons_splash_logo();
@@ -420,7 +420,7 @@ cons_about(void)
 
     _cons_welcome_first_start();
 
-    pnoutrefresh(console->layout->win, 0, 0, 1, 0, rows - 3, cols - 1);
+    win_update_virtual(console);
 
     cons_alert(NULL);
 }
@@ -1035,6 +1035,18 @@ cons_show_account(ProfAccount* account)
     if (account->max_sessions > 0) {
         cons_show("Max sessions alarm: %d", account->max_sessions);
     }
+    auto_gchar gchar* retention_chat = accounts_get_retention(account->name, "chat");
+    if (retention_chat) {
+        cons_show("Chat retention    : %s", retention_chat);
+    }
+    auto_gchar gchar* retention_muc = accounts_get_retention(account->name, "muc");
+    if (retention_muc) {
+        cons_show("Room retention    : %s", retention_muc);
+    }
+    auto_gchar gchar* retention_mucpm = accounts_get_retention(account->name, "mucpm");
+    if (retention_mucpm) {
+        cons_show("Room PM retention : %s", retention_mucpm);
+    }
     if (account->theme) {
         cons_show("Theme             : %s", account->theme);
     }
@@ -1956,36 +1968,72 @@ cons_winpos_setting(void)
 void
 cons_log_setting(void)
 {
-    cons_show("Log file location           : %s", get_log_file_location());
-    cons_show("Max log size (/log maxsize) : %d bytes", prefs_get_max_log_size());
+    cons_show("Log file location                       : %s", get_log_file_location());
+    cons_show("Max log size (/log maxsize)             : %d bytes", prefs_get_max_log_size());
+    cons_show("Rotated logs kept (/log segments)       : %d", prefs_get_log_segments());
+    cons_show("Rotated logs max size (/log segmentsize): %d bytes", prefs_get_log_segments_size());
 
     if (prefs_get_boolean(PREF_LOG_ROTATE))
-        cons_show("Log rotation (/log rotate)  : ON");
+        cons_show("Log rotation (/log rotate)              : ON");
     else
-        cons_show("Log rotation (/log rotate)  : OFF");
+        cons_show("Log rotation (/log rotate)              : OFF");
 
     if (prefs_get_boolean(PREF_LOG_SHARED))
-        cons_show("Shared log (/log shared)    : ON");
+        cons_show("Shared log (/log shared)                : ON");
     else
-        cons_show("Shared log (/log shared)    : OFF");
+        cons_show("Shared log (/log shared)                : OFF");
 
     log_level_t filter = log_get_filter();
     const gchar* level = log_string_from_level(filter);
-    cons_show("Log level (/log level)      : %s", level);
+    cons_show("Log level (/log level)                  : %s", level);
 }
 
 void
 cons_logging_setting(void)
 {
     if (prefs_get_boolean(PREF_CHLOG))
-        cons_show("Chat logging (/logging chat)                : ON");
+        cons_show("Chat logging (/logging chat)                    : ON");
     else
-        cons_show("Chat logging (/logging chat)                : OFF");
+        cons_show("Chat logging (/logging chat)                    : OFF");
 
     if (prefs_get_boolean(PREF_GRLOG))
-        cons_show("Groupchat logging (/logging group)          : ON");
+        cons_show("Groupchat logging (/logging group)              : ON");
+    else
+        cons_show("Groupchat logging (/logging group)              : OFF");
+
+    cons_show("Database batch size (/logging db batch)         : %d messages", prefs_get_dblog_batch_size());
+    cons_show("Database batch interval (/logging db interval)  : %d ms", prefs_get_dblog_batch_interval());
+    cons_show("Database history cache (/logging db cache)      : %d KiB", prefs_get_dblog_cache_size());
+
+    DbCacheStats stats;
+    log_database_get_cache_stats(&stats);
+    cons_show("Database history cache usage                    : %u pages, %" G_GSIZE_FORMAT " KiB, %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " evicted, %" G_GUINT64_FORMAT " invalidated", stats.pages, stats.size / 1024, stats.hits, stats.misses, stats.evictions, stats.invalidations);
+
+    if (prefs_get_boolean(PREF_DBLOG_WAL))
+        cons_show("Database write-ahead log (/logging db wal)      : ON");
     else
-        cons_show("Groupchat logging (/logging group)          : OFF");
+        cons_show("Database write-ahead log (/logging db wal)      : OFF");
+
+    auto_gchar gchar* dblog_sync = prefs_get_string(PREF_DBLOG_SYNC);
+    cons_show("Database synchronous level (/logging db sync)   : %s", dblog_sync);
+
+    auto_gchar gchar* retention_chat = prefs_get_string(PREF_DBLOG_RETENTION_CHAT);
+    auto_gchar gchar* retention_muc = prefs_get_string(PREF_DBLOG_RETENTION_MUC);
+    auto_gchar gchar* retention_mucpm = prefs_get_string(PREF_DBLOG_RETENTION_MUCPM);
+    cons_show("Chat retention (/logging db retention chat)     : %s", retention_chat);
+    cons_show("Room retention (/logging db retention muc)      : %s", retention_muc);
+    cons_show("Room PM retention (/logging db retention mucpm) : %s", retention_mucpm);
+
+    DbRetentionStats retention;
+    log_database_get_retention_stats(&retention);
+    if (retention.last_run == 0) {
+        cons_show("Last retention run                              : never");
+    } else {
+        GDateTime* last_run = date_time_new_from_usec(retention.last_run);
+        auto_gchar gchar* last_run_str = g_date_time_format(last_run, "%F %T");
+        g_date_time_unref(last_run);
+        cons_show("Last retention run                              : %s, %" G_GUINT64_FORMAT " messages removed, %" G_GINT64_FORMAT " KiB reclaimed", last_run_str, retention.deleted, retention.reclaimed / 1024);
+    }
 }
 
 void
@@ -43,6 +43,8 @@
 #include <stdlib.h>
 
 #include "log.h"
+#include "common.h"
+#include "database.h"
 #include "config/preferences.h"
 #include "plugins/plugins.h"
 #include "ui/window.h"
@@ -380,6 +382,50 @@ mucwin_history(ProfMucWin* mucwin, const ProfMessage* const message)
     plugins_on_room_history_message(mucwin->roomjid, nick, message->plain, message->timestamp);
 }
 
+// Replace the window contents with the messages stored in the chat log from
+// the one with the given time and id on, used to jump to a search result.
+// Pages are read until they fill the window, private messages are left out.
+void
+mucwin_db_history_from(ProfMucWin* mucwin, GDateTime* time, gint64 id)
+{
+    assert(mucwin != NULL);
+    ProfWin* window = (ProfWin*)mucwin;
+
+    werase(window->layout->win);
+    buffer_free(window->layout->buffer);
+    window->layout->buffer = buffer_create();
+
+    // the start of the keyset is exclusive
+    gint64 start_time = date_time_to_usec(time);
+    gint64 start_id = id - 1;
+    int rows = getmaxy(window->layout->win);
+    int shown = 0;
+
+    while (shown < rows) {
+        GSList* history = log_database_get_previous_chat(mucwin->roomjid, start_time, start_id, 0, 0, TRUE, FALSE);
+        if (!history) {
+            break;
+        }
+
+        for (GSList* curr = history; curr; curr = g_slist_next(curr)) {
+            ProfMessage* msg = curr->data;
+            if (msg->type == PROF_MSG_TYPE_MUC) {
+                win_print_history(window, msg);
+                shown++;
+            }
+        }
+
+        ProfMessage* last = g_slist_last(history)->data;
+        start_time = date_time_to_usec(last->timestamp);
+        start_id = last->db_id;
+        g_slist_free_full(history, (GDestroyNotify)message_free);
+    }
+
+    window->layout->y_pos = 0;
+    window->layout->paged = 1;
+    win_update_virtual(window);
+}
+
 static void
 _mucwin_print_mention(ProfWin* window, const char* const message, const char* const from, const char* const mynick, GSList* mentions, const char* const ch, int flags)
 {
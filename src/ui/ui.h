@@ -146,7 +146,9 @@ void chatwin_set_incoming_char(ProfChatWin* chatwin, const char* const ch);
 void chatwin_unset_incoming_char(ProfChatWin* chatwin);
 void chatwin_set_outgoing_char(ProfChatWin* chatwin, const char* const ch);
 void chatwin_unset_outgoing_char(ProfChatWin* chatwin);
-gboolean chatwin_db_history(ProfChatWin* chatwin, const char* start_time, char* end_time, gboolean flip);
+gboolean chatwin_db_history(ProfChatWin* chatwin, gint64 start_time, gint64 end_time, gboolean flip);
+void chatwin_db_history_async(ProfChatWin* chatwin, gint64 start_time, gint64 end_time, gboolean flip);
+void chatwin_db_history_from(ProfChatWin* chatwin, GDateTime* time, gint64 id);
 
 // MUC window
 ProfMucWin* mucwin_new(const char* const barejid);
@@ -163,6 +165,7 @@ void mucwin_occupant_role_and_affiliation_change(ProfMucWin* mucwin, const char*
                                                  const char* const role, const char* const affiliation, const char* const actor, const char* const reason);
 void mucwin_roster(ProfMucWin* mucwin, GList* occupants, const char* const presence);
 void mucwin_history(ProfMucWin* mucwin, const ProfMessage* const message);
+void mucwin_db_history_from(ProfMucWin* mucwin, GDateTime* time, gint64 id);
 void mucwin_outgoing_msg(ProfMucWin* mucwin, const char* const message, const char* const id, prof_enc_t enc_mode, const char* const replace_id);
 void mucwin_incoming_msg(ProfMucWin* mucwin, const ProfMessage* const message, GSList* mentions, GList* triggers, gboolean filter_reflection);
 void mucwin_subject(ProfMucWin* mucwin, const char* const nick, const char* const subject);
@@ -120,6 +120,8 @@ typedef struct prof_layout_t
     ProfBuff buffer;
     int y_pos;
     int paged;
+    // bumped to lay out the buffer again, see win_redraw()
+    int generation;
 } ProfLayout;
 
 typedef struct prof_layout_simple_t
@@ -159,6 +161,14 @@ typedef struct prof_console_win_t
     ProfWin window;
 } ProfConsoleWin;
 
+// What a pending history load of a chat window is for
+typedef enum {
+    HISTORY_LOAD_NONE,
+    HISTORY_LOAD_INITIAL,
+    HISTORY_LOAD_OLDER,
+    HISTORY_LOAD_NEWER
+} history_load_t;
+
 typedef struct prof_chat_win_t
 {
     ProfWin window;
@@ -173,6 +183,16 @@ typedef struct prof_chat_win_t
     gboolean is_ox; // XEP-0373: OpenPGP for XMPP
     char* resource_override;
     gboolean history_shown;
+    // Timestamp (microseconds since the epoch, 0 if unset) and row id of the
+    // oldest and newest message loaded from the chat log, the keyset cursors
+    // for paging through the history
+    gint64 history_oldest_time;
+    gint64 history_oldest_id;
+    gint64 history_newest_time;
+    gint64 history_newest_id;
+    // History page being read in the background, 0 if none
+    guint history_request;
+    history_load_t history_load;
     unsigned long memcheck;
     char* enctext;
     char* incoming_char;
@@ -54,11 +54,13 @@
 #endif
 
 #include "log.h"
+#include "common.h"
 #include "config/theme.h"
 #include "config/preferences.h"
 #include "ui/ui.h"
 #include "ui/window.h"
 #include "ui/screen.h"
+#include "tools/textwidth.h"
 #include "xmpp/xmpp.h"
 #include "xmpp/roster_list.h"
 #include "xmpp/connection.h"
@@ -71,9 +73,10 @@
 
 static void
 _win_printf(ProfWin* window, const char* show_char, int pad_indent, GDateTime* timestamp, int flags, theme_item_t theme_item, const char* const display_from, const char* const from_jid, const char* const message_id, const char* const message, ...);
-static void _win_print_internal(ProfWin* window, const char* show_char, int pad_indent, GDateTime* time,
-                                int flags, theme_item_t theme_item, const char* const from, const char* const message, DeliveryReceipt* receipt);
 static void _win_print_wrapped(WINDOW* win, const char* const message, size_t indent, int pad_indent);
+static int _win_view_rows(void);
+static int _win_content_rows(ProfWin* window);
+static void _win_paint(ProfWin* window, int rows);
 
 int
 win_roster_cols(void)
@@ -98,12 +101,12 @@ _win_create_simple_layout(void)
 
     ProfLayoutSimple* layout = malloc(sizeof(ProfLayoutSimple));
     layout->base.type = LAYOUT_SIMPLE;
-    layout->base.win = newpad(PAD_SIZE, cols);
+    layout->base.win = newpad(_win_view_rows(), cols);
     wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
     layout->base.buffer = buffer_create();
     layout->base.y_pos = 0;
     layout->base.paged = 0;
-    scrollok(layout->base.win, TRUE);
+    layout->base.generation = 0;
 
     return &layout->base;
 }
@@ -115,12 +118,12 @@ _win_create_split_layout(void)
 
     ProfLayoutSplit* layout = malloc(sizeof(ProfLayoutSplit));
     layout->base.type = LAYOUT_SPLIT;
-    layout->base.win = newpad(PAD_SIZE, cols);
+    layout->base.win = newpad(_win_view_rows(), cols);
     wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
     layout->base.buffer = buffer_create();
     layout->base.y_pos = 0;
     layout->base.paged = 0;
-    scrollok(layout->base.win, TRUE);
+    layout->base.generation = 0;
     layout->subwin = NULL;
     layout->sub_y_pos = 0;
     layout->memcheck = LAYOUT_SPLIT_MEMCHECK;
@@ -154,6 +157,12 @@ win_create_chat(const char* const barejid)
     new_win->is_omemo = FALSE;
     new_win->is_ox = FALSE;
     new_win->history_shown = FALSE;
+    new_win->history_oldest_time = 0;
+    new_win->history_oldest_id = 0;
+    new_win->history_newest_time = 0;
+    new_win->history_newest_id = 0;
+    new_win->history_request = 0;
+    new_win->history_load = HISTORY_LOAD_NONE;
     new_win->unread = 0;
     new_win->state = chat_state_new();
     new_win->enctext = NULL;
@@ -179,12 +188,12 @@ win_create_muc(const char* const roomjid)
 
     if (prefs_get_boolean(PREF_OCCUPANTS)) {
         int subwin_cols = win_occpuants_cols();
-        layout->base.win = newpad(PAD_SIZE, cols - subwin_cols);
+        layout->base.win = newpad(_win_view_rows(), cols - subwin_cols);
         wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
         layout->subwin = newpad(PAD_SIZE, subwin_cols);
         wbkgd(layout->subwin, theme_attrs(THEME_TEXT));
     } else {
-        layout->base.win = newpad(PAD_SIZE, (cols));
+        layout->base.win = newpad(_win_view_rows(), (cols));
         wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
         layout->subwin = NULL;
     }
@@ -193,7 +202,7 @@ win_create_muc(const char* const roomjid)
     layout->base.buffer = buffer_create();
     layout->base.y_pos = 0;
     layout->base.paged = 0;
-    scrollok(layout->base.win, TRUE);
+    layout->base.generation = 0;
     new_win->window.layout = (ProfLayout*)layout;
 
     new_win->roomjid = strdup(roomjid);
@@ -519,11 +528,11 @@ win_hide_subwin(ProfWin* window)
         layout->subwin = NULL;
         layout->sub_y_pos = 0;
         int cols = getmaxx(stdscr);
-        wresize(layout->base.win, PAD_SIZE, cols);
+        wresize(layout->base.win, _win_view_rows(), cols);
         win_redraw(window);
     } else {
         int cols = getmaxx(stdscr);
-        wresize(window->layout->win, PAD_SIZE, cols);
+        wresize(window->layout->win, _win_view_rows(), cols);
         win_redraw(window);
     }
 }
@@ -547,7 +556,7 @@ win_show_subwin(ProfWin* window)
     ProfLayoutSplit* layout = (ProfLayoutSplit*)window->layout;
     layout->subwin = newpad(PAD_SIZE, subwin_cols);
     wbkgd(layout->subwin, theme_attrs(THEME_TEXT));
-    wresize(layout->base.win, PAD_SIZE, cols - subwin_cols);
+    wresize(layout->base.win, _win_view_rows(), cols - subwin_cols);
     win_redraw(window);
 }
 
@@ -571,6 +580,7 @@ win_free(ProfWin* window)
     case WIN_CHAT:
     {
         ProfChatWin* chatwin = (ProfChatWin*)window;
+        log_database_cancel_history(chatwin->history_request);
         free(chatwin->barejid);
         free(chatwin->resource_override);
         free(chatwin->enctext);
@@ -623,7 +633,7 @@ void
 win_page_up(ProfWin* window)
 {
     int rows = getmaxy(stdscr);
-    int y = getcury(window->layout->win);
+    int y = _win_content_rows(window);
     int page_space = rows - 4;
     int* page_start = &(window->layout->y_pos);
 
@@ -633,12 +643,9 @@ win_page_up(ProfWin* window)
         ProfChatWin* chatwin = (ProfChatWin*)window;
         ProfBuffEntry* first_entry = buffer_size(window->layout->buffer) != 0 ? buffer_get_entry(window->layout->buffer, 0) : NULL;
 
-        // Don't do anything if still fetching mam messages
+        // Don't do anything if still fetching history or mam messages
         if (first_entry && !(first_entry->theme_item == THEME_ROOMINFO && g_strcmp0(first_entry->message, LOADING_MESSAGE) == 0)) {
-            if (!chatwin_db_history(chatwin, NULL, NULL, TRUE) && prefs_get_boolean(PREF_MAM)) {
-                win_print_loading_history(window);
-                iq_mam_request_older(chatwin);
-            }
+            chatwin_db_history_async(chatwin, 0, 0, TRUE);
         }
     }
 
@@ -659,7 +666,7 @@ void
 win_page_down(ProfWin* window)
 {
     int rows = getmaxy(stdscr);
-    int y = getcury(window->layout->win);
+    int y = _win_content_rows(window);
     int page_space = rows - 4;
     int* page_start = &(window->layout->y_pos);
 
@@ -669,13 +676,8 @@ win_page_down(ProfWin* window)
     if ((*page_start == y || (*page_start == page_space && *page_start >= y)) && window->type == WIN_CHAT) {
         int bf_size = buffer_size(window->layout->buffer);
         if (bf_size > 0) {
-            auto_gchar gchar* start = g_date_time_format_iso8601(buffer_get_entry(window->layout->buffer, bf_size - 1)->time);
-            GDateTime* now = g_date_time_new_now_local();
-            gchar* end = g_date_time_format_iso8601(now);
-            // end is free'd inside
-            chatwin_db_history((ProfChatWin*)window, start, end, FALSE);
-
-            g_date_time_unref(now);
+            gint64 start = date_time_to_usec(buffer_get_entry(window->layout->buffer, bf_size - 1)->time);
+            chatwin_db_history_async((ProfChatWin*)window, start, 0, FALSE);
         }
     }
 
@@ -749,7 +751,7 @@ win_clear(ProfWin* window)
         return;
     }
 
-    int y = getcury(window->layout->win);
+    int y = _win_content_rows(window);
     int* page_start = &(window->layout->y_pos);
     *page_start = y;
     window->layout->paged = 1;
@@ -771,7 +773,7 @@ win_resize(ProfWin* window)
                 subwin_cols = win_occpuants_cols();
             }
             wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
-            wresize(layout->base.win, PAD_SIZE, cols - subwin_cols);
+            wresize(layout->base.win, _win_view_rows(), cols - subwin_cols);
             wbkgd(layout->subwin, theme_attrs(THEME_TEXT));
             wresize(layout->subwin, PAD_SIZE, subwin_cols);
             if (window->type == WIN_CONSOLE) {
@@ -783,11 +785,11 @@ win_resize(ProfWin* window)
             }
         } else {
             wbkgd(layout->base.win, theme_attrs(THEME_TEXT));
-            wresize(layout->base.win, PAD_SIZE, cols);
+            wresize(layout->base.win, _win_view_rows(), cols);
         }
     } else {
         wbkgd(window->layout->win, theme_attrs(THEME_TEXT));
-        wresize(window->layout->win, PAD_SIZE, cols);
+        wresize(window->layout->win, _win_view_rows(), cols);
     }
 
     win_redraw(window);
@@ -800,6 +802,7 @@ win_update_virtual(ProfWin* window)
 
     int row_start = screen_mainwin_row_start();
     int row_end = screen_mainwin_row_end();
+    _win_paint(window, row_end - row_start + 1);
     if (window->layout->type == LAYOUT_SPLIT) {
         ProfLayoutSplit* layout = (ProfLayoutSplit*)window->layout;
         if (layout->subwin) {
@@ -809,13 +812,13 @@ win_update_virtual(ProfWin* window)
             } else {
                 subwin_cols = win_roster_cols();
             }
-            pnoutrefresh(layout->base.win, layout->base.y_pos, 0, row_start, 0, row_end, (cols - subwin_cols) - 1);
+            pnoutrefresh(layout->base.win, 0, 0, row_start, 0, row_end, (cols - subwin_cols) - 1);
             pnoutrefresh(layout->subwin, layout->sub_y_pos, 0, row_start, (cols - subwin_cols), row_end, cols - 1);
         } else {
-            pnoutrefresh(layout->base.win, layout->base.y_pos, 0, row_start, 0, row_end, cols - 1);
+            pnoutrefresh(layout->base.win, 0, 0, row_start, 0, row_end, cols - 1);
         }
     } else {
-        pnoutrefresh(window->layout->win, window->layout->y_pos, 0, row_start, 0, row_end, cols - 1);
+        pnoutrefresh(window->layout->win, 0, 0, row_start, 0, row_end, cols - 1);
     }
 }
 
@@ -827,7 +830,8 @@ win_refresh_without_subwin(ProfWin* window)
     if ((window->type == WIN_MUC) || (window->type == WIN_CONSOLE)) {
         int row_start = screen_mainwin_row_start();
         int row_end = screen_mainwin_row_end();
-        pnoutrefresh(window->layout->win, window->layout->y_pos, 0, row_start, 0, row_end, cols - 1);
+        _win_paint(window, row_end - row_start + 1);
+        pnoutrefresh(window->layout->win, 0, 0, row_start, 0, row_end, cols - 1);
     }
 }
 
@@ -849,7 +853,8 @@ win_refresh_with_subwin(ProfWin* window)
         return;
     }
 
-    pnoutrefresh(layout->base.win, layout->base.y_pos, 0, row_start, 0, row_end, (cols - subwin_cols) - 1);
+    _win_paint(window, row_end - row_start + 1);
+    pnoutrefresh(layout->base.win, 0, 0, row_start, 0, row_end, (cols - subwin_cols) - 1);
     pnoutrefresh(layout->subwin, layout->sub_y_pos, 0, row_start, (cols - subwin_cols), row_end, cols - 1);
 }
 
@@ -859,7 +864,7 @@ win_move_to_end(ProfWin* window)
     window->layout->paged = 0;
 
     int rows = getmaxy(stdscr);
-    int y = getcury(window->layout->win);
+    int y = _win_content_rows(window);
     int size = rows - 3;
 
     window->layout->y_pos = y - (size - 1);
@@ -1353,17 +1358,9 @@ _win_correct(ProfWin* window, const char* const message, const char* const id, c
     g_free(entry->show_char);
     entry->show_char = prefs_get_correction_char();
 
-    if (entry->message) {
-        free(entry->message);
-    }
-    entry->message = strdup(message);
-
-    if (entry->id) {
-        free(entry->id);
-    }
-    entry->id = strdup(id);
+    buffer_set_entry_message(window->layout->buffer, entry, message);
 
-    win_redraw(window);
+    buffer_set_entry_id(window->layout->buffer, entry, id);
 }
 
 void
@@ -1476,6 +1473,9 @@ win_print_history(ProfWin* window, const ProfMessage* const message)
 
     if (g_strcmp0(jidp->barejid, message->from_jid->barejid) == 0) {
         display_name = strdup("me");
+    } else if (message->type == PROF_MSG_TYPE_MUC && message->from_jid->resourcepart) {
+        display_name = strdup(message->from_jid->resourcepart);
+        flags = NO_ME;
     } else {
         display_name = roster_get_msg_display_name(message->from_jid->barejid, message->from_jid->resourcepart);
         flags = NO_ME;
@@ -1484,7 +1484,6 @@ win_print_history(ProfWin* window, const ProfMessage* const message)
     buffer_append(window->layout->buffer, "-", 0, message->timestamp, flags, THEME_TEXT_HISTORY, display_name, NULL, message->plain, NULL, NULL);
     wins_add_urls_ac(window, message, FALSE);
     wins_add_quotes_ac(window, message->plain, FALSE);
-    _win_print_internal(window, "-", 0, message->timestamp, flags, THEME_TEXT_HISTORY, display_name, message->plain, NULL);
 
     inp_nonblocking(TRUE);
     g_date_time_unref(message->timestamp);
@@ -1502,6 +1501,9 @@ win_print_old_history(ProfWin* window, const ProfMessage* const message)
 
     if (g_strcmp0(jidp->barejid, message->from_jid->barejid) == 0) {
         display_name = strdup("me");
+    } else if (message->type == PROF_MSG_TYPE_MUC && message->from_jid->resourcepart) {
+        display_name = strdup(message->from_jid->resourcepart);
+        flags = NO_ME;
     } else {
         display_name = roster_get_msg_display_name(message->from_jid->barejid, message->from_jid->resourcepart);
         flags = NO_ME;
@@ -1510,7 +1512,6 @@ win_print_old_history(ProfWin* window, const ProfMessage* const message)
     buffer_prepend(window->layout->buffer, "-", 0, message->timestamp, flags, THEME_TEXT_HISTORY, display_name, NULL, message->plain, NULL, NULL);
     wins_add_urls_ac(window, message, TRUE);
     wins_add_quotes_ac(window, message->plain, TRUE);
-    _win_print_internal(window, "-", 0, message->timestamp, flags, THEME_TEXT_HISTORY, display_name, message->plain, NULL);
 
     inp_nonblocking(TRUE);
     g_date_time_unref(message->timestamp);
@@ -1524,7 +1525,6 @@ win_println_va_internal(ProfWin* window, theme_item_t theme_item, int pad, int f
     auto_gchar gchar* msg = g_strdup_vprintf(message, arg);
 
     buffer_append(window->layout->buffer, show_char, pad, timestamp, flags, theme_item, "", NULL, msg, NULL, NULL);
-    _win_print_internal(window, show_char, pad, timestamp, flags, theme_item, "", msg, NULL);
 
     inp_nonblocking(TRUE);
     g_date_time_unref(timestamp);
@@ -1619,7 +1619,6 @@ win_print_outgoing_with_receipt(ProfWin* window, const char* show_char, const ch
         free(receipt); // TODO: probably we should use this in _win_correct()
     } else {
         buffer_append(window->layout->buffer, show_char, 0, time, 0, THEME_TEXT_ME, from, myjid, message, receipt, id);
-        _win_print_internal(window, show_char, 0, time, 0, THEME_TEXT_ME, from, message, receipt);
     }
 
     // TODO: cross-reference.. this should be replaced by a real event-based system
@@ -1632,10 +1631,7 @@ win_mark_received(ProfWin* window, const char* const id)
 {
     if (window->type == WIN_CONSOLE)
         return;
-    gboolean received = buffer_mark_received(window->layout->buffer, id);
-    if (received) {
-        win_redraw(window);
-    }
+    buffer_mark_received(window->layout->buffer, id);
 }
 
 void
@@ -1645,9 +1641,7 @@ win_update_entry_message(ProfWin* window, const char* const id, const char* cons
         return;
     ProfBuffEntry* entry = buffer_get_entry_by_id(window->layout->buffer, id);
     if (entry) {
-        free(entry->message);
-        entry->message = strdup(message);
-        win_redraw(window);
+        buffer_set_entry_message(window->layout->buffer, entry, message);
     }
 }
 
@@ -1655,7 +1649,6 @@ void
 win_remove_entry_message(ProfWin* window, const char* const id)
 {
     buffer_remove_entry_by_id(window->layout->buffer, id);
-    win_redraw(window);
 }
 
 void
@@ -1679,7 +1672,6 @@ _win_printf(ProfWin* window, const char* show_char, int pad_indent, GDateTime* t
     auto_gchar gchar* msg = g_strdup_vprintf(message, arg);
 
     buffer_append(window->layout->buffer, show_char, pad_indent, timestamp, flags, theme_item, display_from, from_jid, msg, NULL, message_id);
-    _win_print_internal(window, show_char, pad_indent, timestamp, flags, theme_item, display_from, msg, NULL);
 
     inp_nonblocking(TRUE);
     g_date_time_unref(timestamp);
@@ -1687,151 +1679,217 @@ _win_printf(ProfWin* window, const char* show_char, int pad_indent, GDateTime* t
     va_end(arg);
 }
 
-static void
-_win_print_internal(ProfWin* window, const char* show_char, int pad_indent, GDateTime* time,
-                    int flags, theme_item_t theme_item, const char* const from, const char* const message, DeliveryReceipt* receipt)
+static gchar*
+_win_time_pref(ProfWin* window)
 {
-    // flags : 1st bit =  0/1 - me/not me. define: NO_ME
-    //         2nd bit =  0/1 - date/no date. define: NO_DATE
-    //         3rd bit =  0/1 - eol/no eol. define: NO_EOL
-    //         4th bit =  0/1 - color from/no color from. define: NO_COLOUR_FROM
-    //         5th bit =  0/1 - color date/no date. define: NO_COLOUR_DATE
-    //         6th bit =  0/1 - trusted/untrusted. define: UNTRUSTED
-    gboolean me_message = FALSE;
-    int offset = 0;
-    int colour = theme_attrs(THEME_ME);
-    size_t indent = 0;
-
-    auto_gchar gchar* time_pref = NULL;
     switch (window->type) {
     case WIN_CHAT:
-        time_pref = prefs_get_string(PREF_TIME_CHAT);
-        break;
+        return prefs_get_string(PREF_TIME_CHAT);
     case WIN_MUC:
-        time_pref = prefs_get_string(PREF_TIME_MUC);
-        break;
+        return prefs_get_string(PREF_TIME_MUC);
     case WIN_CONFIG:
-        time_pref = prefs_get_string(PREF_TIME_CONFIG);
-        break;
+        return prefs_get_string(PREF_TIME_CONFIG);
     case WIN_PRIVATE:
-        time_pref = prefs_get_string(PREF_TIME_PRIVATE);
-        break;
+        return prefs_get_string(PREF_TIME_PRIVATE);
     case WIN_XML:
-        time_pref = prefs_get_string(PREF_TIME_XMLCONSOLE);
-        break;
+        return prefs_get_string(PREF_TIME_XMLCONSOLE);
     default:
-        time_pref = prefs_get_string(PREF_TIME_CONSOLE);
-        break;
+        return prefs_get_string(PREF_TIME_CONSOLE);
     }
+}
 
-    auto_gchar gchar* date_fmt = NULL;
-    if (g_strcmp0(time_pref, "off") == 0 || time == NULL) {
-        date_fmt = g_strdup("");
-    } else {
-        date_fmt = g_date_time_format(time, time_pref);
-    }
-    assert(date_fmt != NULL);
+// tracks where curses would put the cursor while text is laid out, so a
+// window can tell how many rows its buffer takes and paint any part of it
+typedef struct wrap_cursor_t
+{
+    GString* out;
+    int x;
+    int line;
+    int maxx;
+} WrapCursor;
 
-    if (strlen(date_fmt) != 0) {
-        indent = 3 + strlen(date_fmt);
+static void
+_wrap_newline(WrapCursor* cursor)
+{
+    g_string_append_c(cursor->out, '\n');
+    cursor->x = 0;
+    cursor->line++;
+}
+
+// adds a character that takes one column
+static void
+_wrap_add_char(WrapCursor* cursor, char ch)
+{
+    g_string_append_c(cursor->out, ch);
+    cursor->x++;
+    if (cursor->x >= cursor->maxx) {
+        cursor->x = 0;
+        cursor->line++;
     }
+}
 
-    if ((flags & NO_DATE) == 0) {
-        if (date_fmt && strlen(date_fmt)) {
-            if ((flags & NO_COLOUR_DATE) == 0) {
-                wbkgdset(window->layout->win, theme_attrs(THEME_TIME));
-                wattron(window->layout->win, theme_attrs(THEME_TIME));
-            }
-            wprintw(window->layout->win, "%s %s ", date_fmt, show_char);
-            if ((flags & NO_COLOUR_DATE) == 0) {
-                wattroff(window->layout->win, theme_attrs(THEME_TIME));
+// control characters are laid out the way curses prints them
+static void
+_wrap_control(WrapCursor* cursor, char ch)
+{
+    switch (ch) {
+    case '\t':
+    {
+        // tabs fill up to the next tab stop, or clear the line if it isn't on it
+        int tabx = cursor->x + textwidth_char("\t", cursor->x);
+        if (tabx < cursor->maxx) {
+            for (; cursor->x < tabx; cursor->x++) {
+                g_string_append_c(cursor->out, ' ');
             }
+        } else {
+            _wrap_newline(cursor);
         }
+        break;
     }
-
-    if (from && strlen(from) > 0) {
-        if (flags & NO_ME) {
-            colour = theme_attrs(THEME_THEM);
+    case '\r':
+        g_string_append_c(cursor->out, ch);
+        cursor->x = 0;
+        break;
+    case '\b':
+        if (cursor->x > 0) {
+            g_string_append_c(cursor->out, ch);
+            cursor->x--;
         }
+        break;
+    default:
+    {
+        // ^X, each half wraps on its own
+        _wrap_add_char(cursor, '^');
+        _wrap_add_char(cursor, ch ^ 0x40);
+        break;
+    }
+    }
+}
 
-        auto_gchar gchar* color_pref = prefs_get_string(PREF_COLOR_NICK);
-        if (color_pref != NULL && (strcmp(color_pref, "false") != 0)) {
-            if ((flags & NO_ME) || (!(flags & NO_ME) && prefs_get_boolean(PREF_COLOR_NICK_OWN))) {
-                colour = theme_hash_attrs(from);
+static void
+_wrap_add_len(WrapCursor* cursor, const char* const str, gsize len)
+{
+    const gchar* curr = str;
+    const gchar* end = str + len;
+    while (curr < end) {
+        // printable ASCII takes a column per byte, add as much as fits the line
+        gsize ascii = textwidth_printable_len(curr, end - curr);
+        while (ascii > 0) {
+            gsize fits = MIN(ascii, cursor->maxx - cursor->x);
+            g_string_append_len(cursor->out, curr, fits);
+            cursor->x += fits;
+            if (cursor->x >= cursor->maxx) {
+                cursor->x = 0;
+                cursor->line++;
             }
+            curr += fits;
+            ascii -= fits;
         }
-
-        if (flags & NO_COLOUR_FROM) {
-            colour = 0;
+        if (curr >= end) {
+            break;
         }
 
-        if (receipt && !receipt->received) {
-            colour = theme_attrs(THEME_RECEIPT_SENT);
+        if (*curr == '\n') {
+            _wrap_newline(cursor);
+            curr++;
+            continue;
+        }
+        if ((guchar)*curr < 0x20 || *curr == 0x7f) {
+            _wrap_control(cursor, *curr);
+            curr++;
+            continue;
         }
 
-        wbkgdset(window->layout->win, colour);
-        wattron(window->layout->win, colour);
-        if (strncmp(message, "/me ", 4) == 0) {
-            wprintw(window->layout->win, "*%s ", from);
-            offset = 4;
-            me_message = TRUE;
-        } else {
-            wprintw(window->layout->win, "%s: ", from);
-            wattroff(window->layout->win, colour);
+        const gchar* next = g_utf8_next_char(curr);
+        int width = textwidth_char(curr, cursor->x);
+
+        // wide characters that don't fit go to the next line
+        if (cursor->x + width > cursor->maxx) {
+            cursor->x = 0;
+            cursor->line++;
         }
-    }
+        g_string_append_len(cursor->out, curr, next - curr);
+        cursor->x += width;
 
-    if (!me_message) {
-        if (receipt && !receipt->received) {
-            wbkgdset(window->layout->win, theme_attrs(THEME_RECEIPT_SENT));
-            wattron(window->layout->win, theme_attrs(THEME_RECEIPT_SENT));
-        } else if (flags & UNTRUSTED) {
-            wbkgdset(window->layout->win, theme_attrs(THEME_UNTRUSTED));
-            wattron(window->layout->win, theme_attrs(THEME_UNTRUSTED));
-        } else {
-            wbkgdset(window->layout->win, theme_attrs(theme_item));
-            wattron(window->layout->win, theme_attrs(theme_item));
+        // writing the last column moves the cursor to the next line
+        if (cursor->x >= cursor->maxx) {
+            cursor->x = 0;
+            cursor->line++;
         }
+        curr = next;
     }
+}
 
-    if (prefs_get_boolean(PREF_WRAP)) {
-        _win_print_wrapped(window->layout->win, message + offset, indent, pad_indent);
-    } else {
-        wprintw(window->layout->win, "%s", message + offset);
-    }
+static void
+_wrap_add(WrapCursor* cursor, const char* const str)
+{
+    _wrap_add_len(cursor, str, strlen(str));
+}
 
-    if ((flags & NO_EOL) == 0) {
-        int curx = getcurx(window->layout->win);
-        if (curx != 0) {
-            wprintw(window->layout->win, "\n");
-        }
+static void
+_wrap_indent(WrapCursor* cursor, int size)
+{
+    for (int i = 0; i < size; i++) {
+        _wrap_add(cursor, " ");
     }
+}
 
-    if (me_message) {
-        wattroff(window->layout->win, colour);
-    } else {
-        if (receipt && !receipt->received) {
-            wattroff(window->layout->win, theme_attrs(THEME_RECEIPT_SENT));
-        } else {
-            wattroff(window->layout->win, theme_attrs(theme_item));
-        }
+static void
+_wrap_indent_line(WrapCursor* cursor, gboolean firstline, size_t indent, int pad_indent)
+{
+    if (firstline && cursor->x < indent) {
+        _wrap_indent(cursor, indent);
+    }
+    if (!firstline && cursor->x < (indent + pad_indent)) {
+        _wrap_indent(cursor, indent + pad_indent);
     }
 }
 
 static void
-_win_indent(WINDOW* win, int size)
-{
-    for (int i = 0; i < size; i++) {
-        waddch(win, ' ');
+_wrap_ascii_word(WrapCursor* cursor, const char* const word, int wordlen, int startline, size_t indent, int pad_indent)
+{
+    // wrap required
+    if (cursor->x + wordlen > cursor->maxx) {
+        int linelen = cursor->maxx - (indent + pad_indent);
+
+        // word larger than line, split it where the lines end
+        if (wordlen > linelen) {
+            const char* curr = word;
+            const char* end = word + wordlen;
+            while (curr < end) {
+                _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
+
+                size_t line_indent = cursor->line == startline ? indent : indent + pad_indent;
+                gsize chunk = 1;
+                if (cursor->x >= line_indent && cursor->x < cursor->maxx) {
+                    chunk = MIN(end - curr, cursor->maxx - cursor->x);
+                }
+                _wrap_add_len(cursor, curr, chunk);
+                curr += chunk;
+            }
+
+            // newline and print word
+        } else {
+            _wrap_newline(cursor);
+            _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
+            _wrap_add_len(cursor, word, wordlen);
+        }
+
+        // no wrap required
+    } else {
+        _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
+        _wrap_add_len(cursor, word, wordlen);
     }
 }
 
 static void
-_win_print_wrapped(WINDOW* win, const char* const message, size_t indent, int pad_indent)
+_wrap_message(WrapCursor* cursor, const char* const message, size_t indent, int pad_indent)
 {
-    int starty = getcury(win);
+    int startline = cursor->line;
     int wordi = 0;
-    auto_char char* word = malloc(strlen(message) + 1);
+    size_t msglen = strlen(message);
+    const gchar* msgend = message + msglen;
+    auto_char char* word = malloc(msglen + 1);
 
     gchar* curr_ch = g_utf8_offset_to_pointer(message, 0);
 
@@ -1839,15 +1897,20 @@ _win_print_wrapped(WINDOW* win, const char* const message, size_t indent, int pa
 
         // handle space
         if (*curr_ch == ' ') {
-            waddch(win, ' ');
+            _wrap_add(cursor, " ");
             curr_ch = g_utf8_next_char(curr_ch);
 
             // handle newline
         } else if (*curr_ch == '\n') {
-            waddch(win, '\n');
-            _win_indent(win, indent + pad_indent);
+            _wrap_newline(cursor);
+            _wrap_indent(cursor, indent + pad_indent);
             curr_ch = g_utf8_next_char(curr_ch);
 
+            // handle printable ASCII word, one column per byte
+        } else if ((wordi = textwidth_ascii_word(curr_ch, msgend - curr_ch)) > 0) {
+            _wrap_ascii_word(cursor, curr_ch, wordi, startline, indent, pad_indent);
+            curr_ch += wordi;
+
             // handle word
         } else {
             wordi = 0;
@@ -1867,114 +1930,462 @@ _win_print_wrapped(WINDOW* win, const char* const message, size_t indent, int pa
             word[wordi] = '\0';
             wordlen = utf8_display_len(word);
 
-            int curx = getcurx(win);
-            int cury;
-            int maxx = getmaxx(win);
-
             // wrap required
-            if (curx + wordlen > maxx) {
-                int linelen = maxx - (indent + pad_indent);
+            if (cursor->x + wordlen > cursor->maxx) {
+                int linelen = cursor->maxx - (indent + pad_indent);
 
                 // word larger than line
                 if (wordlen > linelen) {
                     gchar* word_ch = g_utf8_offset_to_pointer(word, 0);
                     while (*word_ch != '\0') {
-                        curx = getcurx(win);
-                        cury = getcury(win);
-                        gboolean firstline = cury == starty;
-
-                        if (firstline && curx < indent) {
-                            _win_indent(win, indent);
-                        }
-                        if (!firstline && curx < (indent + pad_indent)) {
-                            _win_indent(win, indent + pad_indent);
-                        }
+                        _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
 
                         gchar copy[wordi + 1];
                         g_utf8_strncpy(copy, word_ch, 1);
-                        waddstr(win, copy);
+                        _wrap_add(cursor, copy);
 
                         word_ch = g_utf8_next_char(word_ch);
                     }
 
                     // newline and print word
                 } else {
-                    waddch(win, '\n');
-                    curx = getcurx(win);
-                    cury = getcury(win);
-                    gboolean firstline = cury == starty;
-
-                    if (firstline && curx < indent) {
-                        _win_indent(win, indent);
-                    }
-                    if (!firstline && curx < (indent + pad_indent)) {
-                        _win_indent(win, indent + pad_indent);
-                    }
-                    waddstr(win, word);
+                    _wrap_newline(cursor);
+                    _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
+                    _wrap_add(cursor, word);
                 }
 
                 // no wrap required
             } else {
-                curx = getcurx(win);
-                cury = getcury(win);
-                gboolean firstline = cury == starty;
+                _wrap_indent_line(cursor, cursor->line == startline, indent, pad_indent);
+                _wrap_add(cursor, word);
+            }
+        }
 
-                if (firstline && curx < indent) {
-                    _win_indent(win, indent);
-                }
-                if (!firstline && curx < (indent + pad_indent)) {
-                    _win_indent(win, indent + pad_indent);
+        // consume first space of next line
+        if (cursor->line != startline && cursor->x == 0 && *curr_ch == ' ') {
+            curr_ch = g_utf8_next_char(curr_ch);
+        }
+    }
+}
+
+static void
+_win_print_wrapped(WINDOW* win, const char* const message, size_t indent, int pad_indent)
+{
+    WrapCursor cursor = { g_string_sized_new(strlen(message) + 16), getcurx(win), 0, getmaxx(win) };
+    _wrap_message(&cursor, message, indent, pad_indent);
+
+    auto_gchar gchar* wrapped = g_string_free(cursor.out, FALSE);
+    waddstr(win, wrapped);
+}
+
+static gboolean
+_win_is_trackbar(ProfBuffEntry* e)
+{
+    // just an indicator to print the trackbar/separator not the actual message
+    return e->display_from == NULL && e->message && e->message[0] == '-';
+}
+
+// lays out a buffer entry starting at column startx, the layout is kept in the
+// entry until the width, the start column or the window's generation change
+static ProfBuffLayout*
+_win_entry_layout(ProfWin* window, ProfBuffEntry* e, int startx, int maxx)
+{
+    // flags : 1st bit =  0/1 - me/not me. define: NO_ME
+    //         2nd bit =  0/1 - date/no date. define: NO_DATE
+    //         3rd bit =  0/1 - eol/no eol. define: NO_EOL
+    //         4th bit =  0/1 - color from/no color from. define: NO_COLOUR_FROM
+    //         5th bit =  0/1 - color date/no date. define: NO_COLOUR_DATE
+    //         6th bit =  0/1 - trusted/untrusted. define: UNTRUSTED
+    ProfBuffLayout* layout = e->layout;
+    if (layout && layout->width == maxx && layout->startx == startx && layout->generation == window->layout->generation) {
+        return layout;
+    }
+
+    if (layout == NULL) {
+        layout = g_new0(ProfBuffLayout, 1);
+        e->layout = layout;
+    } else {
+        g_free(layout->text);
+    }
+
+    WrapCursor cursor = { g_string_sized_new(strlen(e->message) + 32), startx, 0, maxx };
+
+    if (_win_is_trackbar(e)) {
+        for (int i = 1; i <= maxx; i++) {
+            _wrap_add(&cursor, "-");
+        }
+        layout->time_len = 0;
+        layout->from_len = 0;
+    } else {
+        size_t indent = 0;
+        auto_gchar gchar* time_pref = _win_time_pref(window);
+        auto_gchar gchar* date_fmt = NULL;
+        if (g_strcmp0(time_pref, "off") == 0 || e->time == NULL) {
+            date_fmt = g_strdup("");
+        } else {
+            date_fmt = g_date_time_format(e->time, time_pref);
+        }
+        assert(date_fmt != NULL);
+
+        if (strlen(date_fmt) != 0) {
+            indent = 3 + strlen(date_fmt);
+        }
+
+        if ((e->flags & NO_DATE) == 0 && strlen(date_fmt) != 0) {
+            auto_gchar gchar* date = g_strdup_printf("%s %s ", date_fmt, e->show_char);
+            _wrap_add(&cursor, date);
+        }
+        layout->time_len = cursor.out->len;
+
+        int offset = 0;
+        if (e->display_from && strlen(e->display_from) > 0) {
+            auto_gchar gchar* from = NULL;
+            if (strncmp(e->message, "/me ", 4) == 0) {
+                from = g_strdup_printf("*%s ", e->display_from);
+                offset = 4;
+            } else {
+                from = g_strdup_printf("%s: ", e->display_from);
+            }
+            _wrap_add(&cursor, from);
+        }
+        layout->from_len = cursor.out->len - layout->time_len;
+
+        if (prefs_get_boolean(PREF_WRAP)) {
+            _wrap_message(&cursor, e->message + offset, indent, e->pad_indent);
+        } else {
+            _wrap_add(&cursor, e->message + offset);
+        }
+
+        if ((e->flags & NO_EOL) == 0 && cursor.x != 0) {
+            _wrap_newline(&cursor);
+        }
+    }
+
+    layout->width = maxx;
+    layout->startx = startx;
+    layout->generation = window->layout->generation;
+    layout->rows = cursor.line;
+    layout->endx = cursor.x;
+    layout->text = g_string_free(cursor.out, FALSE);
+
+    return layout;
+}
+
+static void
+_win_paint_run(WINDOW* win, WrapCursor* cursor, int x, const gchar* run, const gchar* end, int top, int rows)
+{
+    if (run && run < end && cursor->line >= top && cursor->line < top + rows) {
+        mvwaddnstr(win, cursor->line - top, x, run, end - run);
+    }
+}
+
+// paints text laid out by _win_entry_layout(), rows top to top + rows of the
+// laid out buffer are visible
+static void
+_win_paint_text(WINDOW* win, WrapCursor* cursor, const gchar* text, gsize len, int top, int rows)
+{
+    const gchar* curr = text;
+    const gchar* end = text + len;
+    const gchar* run = NULL;
+    int run_x = 0;
+
+    while (curr < end) {
+        if (*curr == '\n') {
+            _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+            run = NULL;
+            if (cursor->line >= top && cursor->line < top + rows) {
+                wmove(win, cursor->line - top, cursor->x);
+                wclrtoeol(win);
+            }
+            cursor->x = 0;
+            cursor->line++;
+            curr++;
+            continue;
+        }
+        // the layout only keeps control characters that move the cursor back
+        if (*curr == '\r' || *curr == '\b') {
+            _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+            run = NULL;
+            cursor->x = *curr == '\r' ? 0 : cursor->x - 1;
+            curr++;
+            continue;
+        }
+
+        // extend the run over printable ASCII up to the end of the line
+        gsize ascii = textwidth_printable_len(curr, end - curr);
+        if (ascii > 0 && cursor->x < cursor->maxx) {
+            gsize fits = MIN(ascii, cursor->maxx - cursor->x);
+            if (run == NULL) {
+                run = curr;
+                run_x = cursor->x;
+            }
+            cursor->x += fits;
+            curr += fits;
+
+            if (cursor->x >= cursor->maxx) {
+                _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+                run = NULL;
+                cursor->x = 0;
+                cursor->line++;
+            }
+            continue;
+        }
+
+        const gchar* next = g_utf8_next_char(curr);
+        int width = textwidth_char(curr, cursor->x);
+
+        // wide characters that don't fit go to the next line, curses blanks the rest
+        if (cursor->x + width > cursor->maxx) {
+            _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+            run = NULL;
+            if (cursor->line >= top && cursor->line < top + rows) {
+                for (int col = cursor->x; col < cursor->maxx; col++) {
+                    mvwaddch(win, cursor->line - top, col, ' ');
                 }
-                waddstr(win, word);
             }
+            cursor->x = 0;
+            cursor->line++;
+        }
+        if (run == NULL) {
+            run = curr;
+            run_x = cursor->x;
         }
+        cursor->x += width;
+        curr = next;
+
+        if (cursor->x >= cursor->maxx) {
+            _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+            run = NULL;
+            cursor->x = 0;
+            cursor->line++;
+        }
+    }
 
-        // consume first space of next line
-        int curx = getcurx(win);
-        int cury = getcury(win);
-        gboolean firstline = (cury == starty);
+    _win_paint_run(win, cursor, run_x, run, curr, top, rows);
+}
 
-        if (!firstline && curx == 0 && *curr_ch == ' ') {
-            curr_ch = g_utf8_next_char(curr_ch);
+static void
+_win_paint_entry(ProfWin* window, ProfBuffEntry* e, ProfBuffLayout* layout, WrapCursor* cursor, int top, int rows)
+{
+    WINDOW* win = window->layout->win;
+    const gchar* text = layout->text;
+    gsize len = strlen(text);
+
+    // entries don't inherit attributes from the ones before them
+    wattrset(win, A_NORMAL);
+    wbkgdset(win, theme_attrs(THEME_TEXT));
+
+    if (_win_is_trackbar(e)) {
+        wbkgdset(win, theme_attrs(THEME_TRACKBAR));
+        wattron(win, theme_attrs(THEME_TRACKBAR));
+        _win_paint_text(win, cursor, text, len, top, rows);
+        wattroff(win, theme_attrs(THEME_TRACKBAR));
+        return;
+    }
+
+    if (layout->time_len > 0) {
+        if ((e->flags & NO_COLOUR_DATE) == 0) {
+            wbkgdset(win, theme_attrs(THEME_TIME));
+            wattron(win, theme_attrs(THEME_TIME));
+        }
+        _win_paint_text(win, cursor, text, layout->time_len, top, rows);
+        if ((e->flags & NO_COLOUR_DATE) == 0) {
+            wattroff(win, theme_attrs(THEME_TIME));
+        }
+    }
+    text += layout->time_len;
+    len -= layout->time_len;
+
+    gboolean me_message = FALSE;
+    int colour = theme_attrs(THEME_ME);
+    if (layout->from_len > 0) {
+        if (e->flags & NO_ME) {
+            colour = theme_attrs(THEME_THEM);
+        }
+
+        auto_gchar gchar* color_pref = prefs_get_string(PREF_COLOR_NICK);
+        if (color_pref != NULL && (strcmp(color_pref, "false") != 0)) {
+            if ((e->flags & NO_ME) || (!(e->flags & NO_ME) && prefs_get_boolean(PREF_COLOR_NICK_OWN))) {
+                colour = theme_hash_attrs(e->display_from);
+            }
+        }
+
+        if (e->flags & NO_COLOUR_FROM) {
+            colour = 0;
+        }
+
+        if (e->receipt && !e->receipt->received) {
+            colour = theme_attrs(THEME_RECEIPT_SENT);
+        }
+
+        wbkgdset(win, colour);
+        wattron(win, colour);
+        _win_paint_text(win, cursor, text, layout->from_len, top, rows);
+        if (strncmp(e->message, "/me ", 4) == 0) {
+            me_message = TRUE;
+        } else {
+            wattroff(win, colour);
+        }
+    }
+    text += layout->from_len;
+    len -= layout->from_len;
+
+    if (!me_message) {
+        if (e->receipt && !e->receipt->received) {
+            wbkgdset(win, theme_attrs(THEME_RECEIPT_SENT));
+            wattron(win, theme_attrs(THEME_RECEIPT_SENT));
+        } else if (e->flags & UNTRUSTED) {
+            wbkgdset(win, theme_attrs(THEME_UNTRUSTED));
+            wattron(win, theme_attrs(THEME_UNTRUSTED));
+        } else {
+            wbkgdset(win, theme_attrs(e->theme_item));
+            wattron(win, theme_attrs(e->theme_item));
+        }
+    }
+
+    _win_paint_text(win, cursor, text, len, top, rows);
+
+    if (me_message) {
+        wattroff(win, colour);
+    } else {
+        if (e->receipt && !e->receipt->received) {
+            wattroff(win, theme_attrs(THEME_RECEIPT_SENT));
+        } else {
+            wattroff(win, theme_attrs(e->theme_item));
         }
     }
 }
 
-void
-win_print_trackbar(ProfWin* window)
+static int
+_win_view_rows(void)
 {
-    int cols = getmaxx(window->layout->win);
+    return MAX(1, screen_mainwin_row_end() - screen_mainwin_row_start() + 1);
+}
 
-    wbkgdset(window->layout->win, theme_attrs(THEME_TRACKBAR));
-    wattron(window->layout->win, theme_attrs(THEME_TRACKBAR));
+// row the cursor ends up on once the whole buffer is laid out, this is where
+// the next line would be printed. Only the entries outside the buffer's laid
+// out range are laid out and get their line, the range then covers the
+// buffer.
+static int
+_win_content_rows(ProfWin* window)
+{
+    ProfBuff buffer = window->layout->buffer;
+    int maxx = getmaxx(window->layout->win);
+    int size = buffer_size(buffer);
+    int from, to;
 
-    for (int i = 1; i <= cols; i++) {
-        wprintw(window->layout->win, "-");
+    if (size == 0) {
+        return 0;
     }
 
-    wattroff(window->layout->win, theme_attrs(THEME_TRACKBAR));
+    buffer_get_laid_out(buffer, &from, &to);
+    if (from < to) {
+        // all entries of the range were laid out together
+        ProfBuffLayout* layout = buffer_get_entry(buffer, from)->layout;
+        if (layout->width != maxx || layout->generation != window->layout->generation) {
+            from = 0;
+            to = 0;
+        }
+    } else {
+        from = 0;
+        to = 0;
+    }
+
+    if (from == 0 && to > 0 && buffer_get_entry(buffer, 0)->layout->startx != 0) {
+        // the entry the range continued was removed
+        to = 0;
+    } else if (from > 0) {
+        // entries before the range, usually history that was prepended
+        int line = 0;
+        int x = 0;
+        for (int i = 0; i < from; i++) {
+            ProfBuffLayout* layout = _win_entry_layout(window, buffer_get_entry(buffer, i), x, maxx);
+            layout->line = line;
+            line += layout->rows;
+            x = layout->endx;
+        }
+
+        ProfBuffLayout* first = buffer_get_entry(buffer, from)->layout;
+        if (first->startx == x) {
+            int shift = first->line - line;
+            for (int i = 0; i < from; i++) {
+                buffer_get_entry(buffer, i)->layout->line += shift;
+            }
+        } else {
+            // the range starts in another column now and has to be laid out again
+            to = from;
+        }
+    }
+
+    for (int i = to; i < size; i++) {
+        ProfBuffLayout* prev = i > 0 ? buffer_get_entry(buffer, i - 1)->layout : NULL;
+        ProfBuffLayout* layout = _win_entry_layout(window, buffer_get_entry(buffer, i), prev ? prev->endx : 0, maxx);
+        layout->line = prev ? prev->line + prev->rows : 0;
+    }
+    buffer_set_laid_out(buffer, 0, size);
+
+    ProfBuffLayout* first = buffer_get_entry(buffer, 0)->layout;
+    ProfBuffLayout* last = buffer_get_entry(buffer, size - 1)->layout;
+    return last->line + last->rows - first->line;
 }
 
-void
-win_redraw(ProfWin* window)
+// draws the rows of the buffer that are visible from y_pos into the window,
+// which is only as high as the screen area it is shown in
+static void
+_win_paint(ProfWin* window, int rows)
 {
-    int size;
-    werase(window->layout->win);
-    size = buffer_size(window->layout->buffer);
+    WINDOW* win = window->layout->win;
+    if (getmaxy(win) != rows) {
+        wresize(win, rows, getmaxx(win));
+    }
 
-    for (int i = 0; i < size; i++) {
-        ProfBuffEntry* e = buffer_get_entry(window->layout->buffer, i);
+    ProfBuff buffer = window->layout->buffer;
+    int top = MAX(window->layout->y_pos, 0);
+    int size = buffer_size(buffer);
+    WrapCursor cursor = { NULL, 0, 0, getmaxx(win) };
 
-        if (e->display_from == NULL && e->message && e->message[0] == '-') {
-            // just an indicator to print the trackbar/separator not the actual message
-            win_print_trackbar(window);
+    wbkgdset(win, theme_attrs(THEME_TEXT));
+    werase(win);
+
+    if (size == 0) {
+        return;
+    }
+    _win_content_rows(window);
+    int base = buffer_get_entry(buffer, 0)->layout->line;
+
+    // first entry that reaches down to the top row, the rows entries end on
+    // never decrease
+    int low = 0;
+    int high = size;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        ProfBuffLayout* layout = buffer_get_entry(buffer, mid)->layout;
+        if (layout->line - base + layout->rows >= top) {
+            high = mid;
         } else {
-            // regular thing to print
-            _win_print_internal(window, e->show_char, e->pad_indent, e->time, e->flags, e->theme_item, e->display_from, e->message, e->receipt);
+            low = mid + 1;
+        }
+    }
+
+    for (int i = low; i < size; i++) {
+        ProfBuffEntry* e = buffer_get_entry(buffer, i);
+        ProfBuffLayout* layout = e->layout;
+        cursor.line = layout->line - base;
+        if (cursor.line >= top + rows) {
+            break;
         }
+        cursor.x = layout->startx;
+        _win_paint_entry(window, e, layout, &cursor, top, rows);
     }
 }
 
+void
+win_redraw(ProfWin* window)
+{
+    // lay out all entries again on the next paint, picks up changed preferences
+    window->layout->generation++;
+}
+
 void
 win_print_loading_history(ProfWin* window)
 {
@@ -1991,8 +2402,6 @@ win_print_loading_history(ProfWin* window)
 
     if (is_buffer_empty)
         g_date_time_unref(timestamp);
-
-    win_redraw(window);
 }
 
 gboolean
@@ -2187,26 +2596,17 @@ win_handle_command_exec_result_note(ProfWin* window, const char* const type, con
 void
 win_insert_last_read_position_marker(ProfWin* window, char* id)
 {
-    int size = buffer_size(window->layout->buffer);
-
-    // TODO: this is somewhat costly. We should improve this later.
-    // check if we already have a separator present
-    for (int i = 0; i < size; i++) {
-        ProfBuffEntry* e = buffer_get_entry(window->layout->buffer, i);
-
-        // if yes, don't print a new one
-        if (e->id && (g_strcmp0(e->id, id) == 0)) {
-            return;
-        }
+    // check if we already have a separator present, if yes, don't print a new one
+    if (buffer_get_entry_by_id(window->layout->buffer, id)) {
+        return;
     }
 
     GDateTime* time = g_date_time_new_now_local();
 
-    // the trackbar/separator will actually be print in win_redraw().
-    // this only puts it in the buffer and win_redraw() will interpret it.
+    // the trackbar/separator will actually be print when the window is painted.
+    // this only puts it in the buffer and _win_entry_layout() will interpret it.
     // so that we have the correct length even when resizing.
     buffer_append(window->layout->buffer, " ", 0, time, 0, THEME_TEXT, NULL, NULL, "-", NULL, id);
-    win_redraw(window);
 
     g_date_time_unref(time);
 }
@@ -577,6 +577,7 @@ wins_close_by_num(int i)
             }
             case WIN_XML:
             {
+                connection_set_stanza_tap(FALSE);
                 autocomplete_remove(wins_ac, "xmlconsole");
                 autocomplete_remove(wins_close_ac, "xmlconsole");
                 break;
@@ -622,6 +623,7 @@ wins_new_xmlconsole(void)
     g_hash_table_insert(windows, GINT_TO_POINTER(result), newwin);
     autocomplete_add(wins_ac, "xmlconsole");
     autocomplete_add(wins_close_ac, "xmlconsole");
+    connection_set_stanza_tap(TRUE);
     return newwin;
 }
 
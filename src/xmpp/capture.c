@@ -0,0 +1,398 @@
+/*
+ * capture.c
+ * vim: expandtab:ts=4:sts=4:sw=4
+ *
+ * Copyright (C) 2020 - 2023 Michael Vetter <jubalh@iodoru.org>
+ *
+ * This file is part of Profanity.
+ *
+ * Profanity is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Profanity is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Profanity.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * In addition, as a special exception, the copyright holders give permission to
+ * link the code of portions of this program with the OpenSSL library under
+ * certain conditions as described in each individual source file, and
+ * distribute linked combinations including the two.
+ *
+ * You must obey the GNU General Public License in all respects for all of the
+ * code used other than OpenSSL. If you modify file(s) with this exception, you
+ * may extend this exception to your version of the file(s), but you are not
+ * obligated to do so. If you do not wish to do so, delete this exception
+ * statement from your version. If you delete this exception statement from all
+ * source files in the program, then also delete it here.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <strophe.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "log.h"
+#include "common.h"
+#include "chatlog.h"
+#include "database.h"
+#include "xmpp/session.h"
+#include "xmpp/connection.h"
+#include "xmpp/stanza.h"
+#include "xmpp/message.h"
+#include "xmpp/presence.h"
+#include "xmpp/iq.h"
+#include "xmpp/capture.h"
+
+// A capture is a gzip stream starting with CAPTURE_MAGIC, followed by records
+// of one type byte, the payload length as a little endian guint32 and the
+// payload. CAPTURE_SESSION holds the full JID that logged in, CAPTURE_STANZA
+// one inbound stanza as serialised by libstrophe.
+#define CAPTURE_MAGIC        "PROFCAP1"
+#define CAPTURE_SESSION      'S'
+#define CAPTURE_STANZA       'I'
+#define CAPTURE_RECORD_MAX   (64 * 1024 * 1024)
+#define CAPTURE_BUFFER_SIZE  (256 * 1024)
+#define CAPTURE_EVENTS_EVERY 256
+
+typedef enum {
+    CAPTURE_HANDLER_MESSAGE,
+    CAPTURE_HANDLER_PRESENCE,
+    CAPTURE_HANDLER_IQ,
+    CAPTURE_HANDLER_COUNT
+} capture_handler_t;
+
+static const char* const capture_handler_names[CAPTURE_HANDLER_COUNT] = { "message", "presence", "iq" };
+
+static GOutputStream* capture_out = NULL;
+static gchar* capture_path = NULL;
+static gchar* capture_jid = NULL;
+
+static int _capture_handler(xmpp_conn_t* const conn, xmpp_stanza_t* const stanza, void* const userdata);
+
+gboolean
+capture_open(const char* const path, GError** error)
+{
+    capture_close();
+
+    GFile* file = g_file_new_for_path(path);
+    GFileOutputStream* file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, error);
+    g_object_unref(file);
+    if (!file_stream) {
+        return FALSE;
+    }
+
+    GZlibCompressor* compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    GOutputStream* gzip = g_converter_output_stream_new(G_OUTPUT_STREAM(file_stream), G_CONVERTER(compressor));
+    g_object_unref(compressor);
+    g_object_unref(file_stream);
+
+    capture_out = g_buffered_output_stream_new_sized(gzip, CAPTURE_BUFFER_SIZE);
+    g_object_unref(gzip);
+
+    if (!g_output_stream_write_all(capture_out, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC), NULL, NULL, error)) {
+        g_clear_object(&capture_out);
+        return FALSE;
+    }
+
+    capture_path = g_strdup(path);
+
+    return TRUE;
+}
+
+void
+capture_close(void)
+{
+    if (capture_out) {
+        GError* error = NULL;
+        if (!g_output_stream_close(capture_out, NULL, &error)) {
+            log_error("Could not finish stanza capture %s: %s", capture_path, error->message);
+            g_error_free(error);
+        }
+        g_clear_object(&capture_out);
+    }
+    g_free(capture_path);
+    capture_path = NULL;
+    g_free(capture_jid);
+    capture_jid = NULL;
+}
+
+static void
+_capture_write(char type, const char* const data, gsize len)
+{
+    guchar header[5];
+    guint32 len_le = GUINT32_TO_LE((guint32)len);
+    header[0] = type;
+    memcpy(header + 1, &len_le, sizeof(len_le));
+
+    GError* error = NULL;
+    if (!g_output_stream_write_all(capture_out, header, sizeof(header), NULL, NULL, &error)
+        || !g_output_stream_write_all(capture_out, data, len, NULL, NULL, &error)) {
+        log_error("Stanza capture to %s failed, stopping: %s", capture_path, error->message);
+        g_error_free(error);
+        capture_close();
+    }
+}
+
+// Called on every login, the catch-all handler sees each inbound stanza once
+// before the message, presence and iq handlers
+void
+capture_handlers_init(void)
+{
+    if (!capture_out) {
+        return;
+    }
+
+    const char* jid = connection_get_fulljid();
+    if (jid && g_strcmp0(jid, capture_jid) != 0) {
+        g_free(capture_jid);
+        capture_jid = g_strdup(jid);
+        _capture_write(CAPTURE_SESSION, jid, strlen(jid));
+    }
+
+    xmpp_handler_add(connection_get_conn(), _capture_handler, NULL, NULL, NULL, NULL);
+}
+
+static int
+_capture_handler(xmpp_conn_t* const conn, xmpp_stanza_t* const stanza, void* const userdata)
+{
+    if (!capture_out) {
+        return 0;
+    }
+
+    char* text;
+    size_t text_size;
+    if (xmpp_stanza_to_text(stanza, &text, &text_size) == XMPP_EOK) {
+        _capture_write(CAPTURE_STANZA, text, text_size);
+        xmpp_free(connection_get_ctx(), text);
+    }
+
+    return 1;
+}
+
+// Reads the next record, returns TRUE with *data NULL at the end of the capture
+static gboolean
+_replay_read(GInputStream* in, char* type, gchar** data, GError** error)
+{
+    guchar header[5];
+    gsize bytes_read = 0;
+
+    *data = NULL;
+    if (!g_input_stream_read_all(in, header, sizeof(header), &bytes_read, NULL, error)) {
+        return FALSE;
+    }
+    if (bytes_read == 0) {
+        return TRUE;
+    }
+
+    guint32 len_le;
+    memcpy(&len_le, header + 1, sizeof(len_le));
+    gsize len = GUINT32_FROM_LE(len_le);
+    if (bytes_read != sizeof(header) || len > CAPTURE_RECORD_MAX) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated or corrupt capture record");
+        return FALSE;
+    }
+
+    auto_gchar gchar* payload = g_malloc(len + 1);
+    if (!g_input_stream_read_all(in, payload, len, &bytes_read, NULL, error)) {
+        return FALSE;
+    }
+    if (bytes_read != len) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated capture record");
+        return FALSE;
+    }
+    payload[len] = '\0';
+
+    *type = header[0];
+    *data = g_steal_pointer(&payload);
+
+    return TRUE;
+}
+
+static gint
+_replay_cmp_sample(gconstpointer a, gconstpointer b)
+{
+    gint64 sa = *(const gint64*)a;
+    gint64 sb = *(const gint64*)b;
+    return sa < sb ? -1 : sa > sb;
+}
+
+// nearest-rank percentile of sorted samples
+static gint64
+_replay_percentile(GArray* samples, guint percent)
+{
+    if (samples->len == 0) {
+        return 0;
+    }
+    guint rank = (samples->len * percent + 99) / 100;
+    return g_array_index(samples, gint64, rank > 0 ? rank - 1 : 0);
+}
+
+static void
+_replay_report(FILE* report, GArray** samples, guint64 stanzas, guint64 skipped, gint64 elapsed)
+{
+    gdouble seconds = elapsed / (gdouble)G_USEC_PER_SEC;
+    gint64 handler_total = 0;
+
+    fprintf(report, "%-10s %10s %10s %10s %10s %10s %12s\n", "handler", "stanzas", "p50 us", "p90 us", "p99 us", "max us", "total ms");
+    for (int i = 0; i < CAPTURE_HANDLER_COUNT; i++) {
+        GArray* handler = samples[i];
+        gint64 total = 0;
+        for (guint j = 0; j < handler->len; j++) {
+            total += g_array_index(handler, gint64, j);
+        }
+        handler_total += total;
+
+        g_array_sort(handler, _replay_cmp_sample);
+        fprintf(report, "%-10s %10u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %12.3f\n",
+                capture_handler_names[i], handler->len,
+                _replay_percentile(handler, 50), _replay_percentile(handler, 90), _replay_percentile(handler, 99), _replay_percentile(handler, 100),
+                total / 1000.0);
+    }
+
+    fprintf(report, "Replayed %" G_GUINT64_FORMAT " stanzas in %.3f s (%.0f stanzas/s), %.3f s in handlers, %" G_GUINT64_FORMAT " skipped\n",
+            stanzas, seconds, seconds > 0 ? stanzas / seconds : 0.0, handler_total / (gdouble)G_USEC_PER_SEC, skipped);
+    log_info("Replayed %" G_GUINT64_FORMAT " stanzas in %.3f s", stanzas, seconds);
+}
+
+// Feeds a capture through the message, presence and iq handlers as fast as
+// possible while logged in to account_name without a connection, so anything
+// the handlers send is dropped by libstrophe. Returns non-zero if the capture
+// could not be read to its end or holds no session.
+int
+capture_replay(const char* const path, const char* const account_name, FILE* report)
+{
+    GError* error = NULL;
+    GFile* file = g_file_new_for_path(path);
+    GFileInputStream* file_stream = g_file_read(file, NULL, &error);
+    g_object_unref(file);
+    if (!file_stream) {
+        fprintf(report, "Could not open capture %s: %s\n", path, error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    GZlibDecompressor* decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+    GInputStream* gzip = g_converter_input_stream_new(G_INPUT_STREAM(file_stream), G_CONVERTER(decompressor));
+    g_object_unref(decompressor);
+    g_object_unref(file_stream);
+    GInputStream* in = g_buffered_input_stream_new_sized(gzip, CAPTURE_BUFFER_SIZE);
+    g_object_unref(gzip);
+
+    char magic[sizeof(CAPTURE_MAGIC) - 1];
+    gsize bytes_read = 0;
+    if (!g_input_stream_read_all(in, magic, sizeof(magic), &bytes_read, NULL, &error)
+        || bytes_read != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(report, "%s is not a stanza capture%s%s\n", path, error ? ": " : "", error ? error->message : "");
+        g_clear_error(&error);
+        g_object_unref(in);
+        return 1;
+    }
+
+    GArray* samples[CAPTURE_HANDLER_COUNT];
+    for (int i = 0; i < CAPTURE_HANDLER_COUNT; i++) {
+        samples[i] = g_array_new(FALSE, FALSE, sizeof(gint64));
+    }
+
+    gboolean logged_in = FALSE;
+    gboolean complete = TRUE;
+    guint64 stanzas = 0;
+    guint64 skipped = 0;
+    gint64 start = g_get_monotonic_time();
+
+    while (TRUE) {
+        char type = 0;
+        auto_gchar gchar* data = NULL;
+        if (!_replay_read(in, &type, &data, &error)) {
+            fprintf(report, "Stopped reading %s: %s\n", path, error->message);
+            g_clear_error(&error);
+            complete = FALSE;
+            break;
+        }
+        if (!data) {
+            break;
+        }
+
+        if (type == CAPTURE_SESSION) {
+            if (!logged_in) {
+                session_replay_login(account_name, data);
+                logged_in = TRUE;
+            }
+            continue;
+        }
+
+        xmpp_stanza_t* stanza = NULL;
+        if (type == CAPTURE_STANZA && logged_in) {
+            stanza = xmpp_stanza_new_from_string(connection_get_ctx(), data);
+        }
+        const char* name = stanza ? xmpp_stanza_get_name(stanza) : NULL;
+
+        int handler;
+        if (g_strcmp0(name, STANZA_NAME_MESSAGE) == 0) {
+            handler = CAPTURE_HANDLER_MESSAGE;
+        } else if (g_strcmp0(name, STANZA_NAME_PRESENCE) == 0) {
+            handler = CAPTURE_HANDLER_PRESENCE;
+        } else if (g_strcmp0(name, STANZA_NAME_IQ) == 0) {
+            handler = CAPTURE_HANDLER_IQ;
+        } else {
+            if (stanza) {
+                xmpp_stanza_release(stanza);
+            }
+            skipped++;
+            continue;
+        }
+
+        gint64 handler_start = g_get_monotonic_time();
+        switch (handler) {
+        case CAPTURE_HANDLER_MESSAGE:
+            message_handle_stanza(stanza);
+            break;
+        case CAPTURE_HANDLER_PRESENCE:
+            presence_handle_stanza(stanza);
+            break;
+        default:
+            iq_handle_stanza(stanza);
+            break;
+        }
+        gint64 handler_time = g_get_monotonic_time() - handler_start;
+        g_array_append_val(samples[handler], handler_time);
+        xmpp_stanza_release(stanza);
+
+        // keep the database and chat log queues from growing without bound
+        if (++stanzas % CAPTURE_EVENTS_EVERY == 0) {
+            log_database_process_events();
+            chat_log_process_events();
+        }
+    }
+    // the messages are only stored once the writer committed them
+    log_database_flush();
+    log_database_process_events();
+    chat_log_process_events();
+
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_object_unref(in);
+
+    if (!logged_in) {
+        fprintf(report, "%s does not contain a session\n", path);
+    } else {
+        _replay_report(report, samples, stanzas, skipped, elapsed);
+    }
+
+    for (int i = 0; i < CAPTURE_HANDLER_COUNT; i++) {
+        g_array_free(samples[i], TRUE);
+    }
+
+    return logged_in && complete ? 0 : 1;
+}
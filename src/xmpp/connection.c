@@ -82,6 +82,7 @@ typedef struct
 static ProfConnection conn;
 static gchar* profanity_instance_id = NULL;
 static gchar* prof_identifier = NULL;
+static gboolean stanza_tap = FALSE;
 
 static void _xmpp_file_logger(void* const userdata, const xmpp_log_level_t level, const char* const area, const char* const msg);
 
@@ -140,19 +141,39 @@ connection_init(void)
     conn.requested_features = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
 
     conn.xmpp_ctx = xmpp_ctx_new(&prof_mem, &prof_log);
-    auto_gchar gchar* v = prefs_get_string(PREF_STROPHE_VERBOSITY);
-    auto_gchar gchar* err_msg = NULL;
-    int verbosity;
-    if (string_to_verbosity(v, &verbosity, &err_msg)) {
-        xmpp_ctx_set_verbosity(conn.xmpp_ctx, verbosity);
-    } else {
-        cons_show(err_msg);
-    }
+    connection_reload_log_level();
     conn.xmpp_conn = xmpp_conn_new(conn.xmpp_ctx);
 
     _random_bytes_init();
 }
 
+// libstrophe only produces its verbose debug output when we would log it
+void
+connection_reload_log_level(void)
+{
+    if (!conn.xmpp_ctx) {
+        return;
+    }
+
+    int verbosity = 0;
+    if (log_get_filter() == PROF_LEVEL_DEBUG) {
+        auto_gchar gchar* v = prefs_get_string(PREF_STROPHE_VERBOSITY);
+        auto_gchar gchar* err_msg = NULL;
+        if (!string_to_verbosity(v, &verbosity, &err_msg)) {
+            cons_show(err_msg);
+            verbosity = 0;
+        }
+    }
+    xmpp_ctx_set_verbosity(conn.xmpp_ctx, verbosity);
+}
+
+// Registered by the XML console while it is open
+void
+connection_set_stanza_tap(gboolean enabled)
+{
+    stanza_tap = enabled;
+}
+
 void
 connection_check_events(void)
 {
@@ -573,6 +594,19 @@ connection_set_disconnected(void)
     conn.conn_status = JABBER_DISCONNECTED;
 }
 
+// Marks us as connected as fulljid without a socket, so libstrophe drops
+// whatever is sent. conn_last_event stays at disconnect, so disconnecting
+// does not wait for the server.
+void
+connection_replay_init(const char* const fulljid)
+{
+    auto_jid Jid* jidp = jid_create(fulljid);
+    xmpp_conn_set_jid(conn.xmpp_conn, fulljid);
+    FREE_SET_NULL(conn.domain);
+    conn.domain = jidp ? strdup(jidp->domainpart) : NULL;
+    conn.conn_status = JABBER_CONNECTED;
+}
+
 void
 connection_clear_data(void)
 {
@@ -1092,9 +1126,11 @@ _xmpp_file_logger(void* const userdata, const xmpp_log_level_t xmpp_level, const
         break;
     }
 
-    log_msg(prof_level, area, msg);
+    if (prof_level >= log_get_filter()) {
+        log_msg(prof_level, area, msg);
+    }
 
-    if ((g_strcmp0(area, "xmpp") == 0) || (g_strcmp0(area, "conn")) == 0) {
+    if (stanza_tap && ((g_strcmp0(area, "xmpp") == 0) || (g_strcmp0(area, "conn")) == 0)) {
         sv_ev_xmpp_stanza(msg);
     }
 }
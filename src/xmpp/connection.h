@@ -49,6 +49,7 @@ jabber_conn_status_t connection_connect(const char* const fulljid, const char* c
 jabber_conn_status_t connection_register(const char* const altdomain, int port, const char* const tls_policy,
                                          const char* const username, const char* const password);
 void connection_set_disconnected(void);
+void connection_replay_init(const char* const fulljid);
 
 void connection_set_priority(const int priority);
 void connection_set_priority(int priority);
@@ -44,6 +44,7 @@
 
 #include "profanity.h"
 #include "log.h"
+#include "common.h"
 #include "config/preferences.h"
 #include "event/server_events.h"
 #include "plugins/plugins.h"
@@ -248,6 +249,14 @@ _iq_handler(xmpp_conn_t* const conn, xmpp_stanza_t* const stanza, void* const us
     return 1;
 }
 
+// Runs the handler for a stanza that did not come from the connection, used
+// when replaying a capture
+int
+iq_handle_stanza(xmpp_stanza_t* const stanza)
+{
+    return _iq_handler(connection_get_conn(), stanza, connection_get_ctx());
+}
+
 void
 iq_handlers_init(void)
 {
@@ -2556,7 +2565,7 @@ _mam_buffer_commit_handler(xmpp_stanza_t* const stanza, void* const userdata)
     ProfChatWin* chatwin = (ProfChatWin*)userdata;
     // Remove the "Loading messages …" message
     buffer_remove_entry(((ProfWin*)chatwin)->layout->buffer, 0);
-    chatwin_db_history(chatwin, NULL, NULL, TRUE);
+    chatwin_db_history(chatwin, 0, 0, TRUE);
     return 0;
 }
 
@@ -2682,6 +2691,25 @@ iq_mam_request(ProfChatWin* win, GDateTime* enddate)
     return;
 }
 
+// Get a MAM request bound as chat log time, 0 if there is none
+static gint64
+_mam_datestr_to_usec(const char* const datestr)
+{
+    if (!datestr) {
+        return 0;
+    }
+
+    GDateTime* dt = g_date_time_new_from_iso8601(datestr, NULL);
+    if (!dt) {
+        return 0;
+    }
+
+    gint64 usec = date_time_to_usec(dt);
+    g_date_time_unref(dt);
+
+    return usec;
+}
+
 static int
 _mam_rsm_id_handler(xmpp_stanza_t* const stanza, void* const userdata)
 {
@@ -2699,25 +2727,15 @@ _mam_rsm_id_handler(xmpp_stanza_t* const stanza, void* const userdata)
 
             buffer_remove_entry(window->layout->buffer, 0);
 
-            auto_char char* start_str = NULL;
-            if (data->start_datestr) {
-                start_str = strdup(data->start_datestr);
-                // Convert to iso8601
-                start_str[strlen(start_str) - 3] = '\0';
-            }
-            char* end_str = NULL;
-            if (data->end_datestr) {
-                end_str = strdup(data->end_datestr);
-                // Convert to iso8601
-                end_str[strlen(end_str) - 3] = '\0';
-            }
+            gint64 start_time = _mam_datestr_to_usec(data->start_datestr);
+            gint64 end_time = _mam_datestr_to_usec(data->end_datestr);
 
             if (is_complete || !data->fetch_next) {
-                chatwin_db_history(data->win, is_complete ? NULL : start_str, end_str, TRUE);
+                chatwin_db_history(data->win, is_complete ? 0 : start_time, end_time, TRUE);
                 return 0;
             }
 
-            chatwin_db_history(data->win, start_str, end_str, TRUE);
+            chatwin_db_history(data->win, start_time, end_time, TRUE);
 
             xmpp_stanza_t* set = xmpp_stanza_get_child_by_name_and_ns(fin, STANZA_TYPE_SET, STANZA_NS_RSM);
             if (set) {
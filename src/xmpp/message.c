@@ -309,6 +309,14 @@ _handle_form(xmpp_stanza_t* const stanza)
     return TRUE;
 }
 
+// Runs the handler for a stanza that did not come from the connection, used
+// when replaying a capture
+int
+message_handle_stanza(xmpp_stanza_t* const stanza)
+{
+    return _message_handler(connection_get_conn(), stanza, connection_get_ctx());
+}
+
 void
 message_handlers_init(void)
 {
@@ -349,6 +357,7 @@ message_init(void)
     message->plain = NULL;
     message->enc = PROF_MSG_ENC_NONE;
     message->timestamp = NULL;
+    message->db_id = 0;
     message->trusted = true;
     message->type = PROF_MSG_TYPE_UNINITIALIZED;
 
@@ -635,7 +644,7 @@ message_send_chat_omemo(const char* const jid, uint32_t sid, GList* keys,
     xmpp_stanza_t* header = xmpp_stanza_new(ctx);
     xmpp_stanza_set_name(header, "header");
     auto_gchar gchar* sid_text = g_strdup_printf("%d", sid);
-    log_debug("[OMEMO] Sending from device sid %s", sid_text);
+    LOG_DEBUG("[OMEMO] Sending from device sid %s", sid_text);
     xmpp_stanza_set_attribute(header, "sid", sid_text);
 
     GList* key_iter;
@@ -645,7 +654,7 @@ message_send_chat_omemo(const char* const jid, uint32_t sid, GList* keys,
         xmpp_stanza_t* key_stanza = xmpp_stanza_new(ctx);
         xmpp_stanza_set_name(key_stanza, "key");
         auto_gchar gchar* rid = g_strdup_printf("%d", key->device_id);
-        log_debug("[OMEMO] Sending to device rid %s", STR_MAYBE_NULL(rid));
+        LOG_DEBUG("[OMEMO] Sending to device rid %s", STR_MAYBE_NULL(rid));
         xmpp_stanza_set_attribute(key_stanza, "rid", rid);
         if (key->prekey) {
             xmpp_stanza_set_attribute(key_stanza, "prekey", "true");
@@ -1120,7 +1129,7 @@ _handle_groupchat(xmpp_stanza_t* const stanza)
 #endif
 
     if (!message->plain && !message->body) {
-        log_info("Message received without body for room: %s", from_jid->str);
+        LOG_INFO("Message received without body for room: %s", from_jid->str);
         goto out;
     } else if (!message->plain) {
         message->plain = strdup(message->body);
@@ -1275,7 +1284,7 @@ _handle_muc_private_message(xmpp_stanza_t* const stanza)
     message->body = xmpp_message_get_body(stanza);
 
     if (!message->plain && !message->body) {
-        log_info("Message received without body from: %s", message->from_jid->str);
+        LOG_INFO("Message received without body from: %s", message->from_jid->str);
         goto out;
     } else if (!message->plain) {
         message->plain = strdup(message->body);
@@ -1720,7 +1729,7 @@ _should_ignore_based_on_silence(xmpp_stanza_t* const stanza)
         auto_jid Jid* from_jid = jid_create(from);
         PContact contact = roster_get_contact(from_jid->barejid);
         if (!contact) {
-            log_debug("[Silence] Ignoring message from: %s", from);
+            LOG_DEBUG("[Silence] Ignoring message from: %s", from);
             return TRUE;
         }
     }
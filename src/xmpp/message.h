@@ -44,6 +44,7 @@ typedef void (*ProfMessageFreeCallback)(void* userdata);
 ProfMessage* message_init(void);
 void message_free(ProfMessage* message);
 void message_handlers_init(void);
+int message_handle_stanza(xmpp_stanza_t* const stanza);
 void message_handlers_clear(void);
 void message_pubsub_event_handler_add(const char* const node, ProfMessageCallback func, ProfMessageFreeCallback free_func, void* userdata);
 
@@ -91,6 +91,14 @@ presence_handlers_init(void)
     xmpp_handler_add(conn, _presence_handler, NULL, STANZA_NAME_PRESENCE, NULL, ctx);
 }
 
+// Runs the handler for a stanza that did not come from the connection, used
+// when replaying a capture
+int
+presence_handle_stanza(xmpp_stanza_t* const stanza)
+{
+    return _presence_handler(connection_get_conn(), stanza, connection_get_ctx());
+}
+
 void
 presence_subscription(const char* const jid, const jabber_subscr_t action)
 {
@@ -468,7 +476,7 @@ _unsubscribed_handler(xmpp_stanza_t* const stanza)
         log_warning("Unsubscribed presence handler received with no from attribute");
         return;
     }
-    log_debug("Unsubscribed presence handler fired for %s", from);
+    LOG_DEBUG("Unsubscribed presence handler fired for %s", from);
 
     auto_jid Jid* from_jid = jid_create(from);
     sv_ev_subscription(from_jid->barejid, PRESENCE_UNSUBSCRIBED);
@@ -483,7 +491,7 @@ _subscribed_handler(xmpp_stanza_t* const stanza)
         log_warning("Subscribed presence handler received with no from attribute");
         return;
     }
-    log_debug("Subscribed presence handler fired for %s", from);
+    LOG_DEBUG("Subscribed presence handler fired for %s", from);
 
     auto_jid Jid* from_jid = jid_create(from);
     sv_ev_subscription(from_jid->barejid, PRESENCE_SUBSCRIBED);
@@ -497,7 +505,7 @@ _subscribe_handler(xmpp_stanza_t* const stanza)
     if (!from) {
         log_warning("Subscribe presence handler received with no from attribute", from);
     }
-    log_debug("Subscribe presence handler fired for %s", from);
+    LOG_DEBUG("Subscribe presence handler fired for %s", from);
 
     auto_jid Jid* from_jid = jid_create(from);
     if (from_jid == NULL) {
@@ -519,7 +527,7 @@ _unavailable_handler(xmpp_stanza_t* const stanza)
     if (!from) {
         log_warning("Unavailable presence received with no from attribute");
     }
-    log_debug("Unavailable presence handler fired for %s", from);
+    LOG_DEBUG("Unavailable presence handler fired for %s", from);
 
     auto_jid Jid* my_jid = jid_create(jid);
     auto_jid Jid* from_jid = jid_create(from);
@@ -548,13 +556,13 @@ _handle_caps(const char* const jid, XMPPCaps* caps)
 {
     // hash supported, xep-0115, cache against ver
     if (g_strcmp0(caps->hash, "sha-1") == 0) {
-        log_debug("Hash %s supported for %s", caps->hash, jid);
+        LOG_DEBUG("Hash %s supported for %s", caps->hash, jid);
         if (caps->ver) {
             if (caps_cache_contains(caps->ver)) {
-                log_debug("Capabilities cache hit: %s, for %s.", caps->ver, jid);
+                LOG_DEBUG("Capabilities cache hit: %s, for %s.", caps->ver, jid);
                 caps_map_jid_to_ver(jid, caps->ver);
             } else {
-                log_debug("Capabilities cache miss: %s, for %s, sending service discovery request", caps->ver, jid);
+                LOG_DEBUG("Capabilities cache miss: %s, for %s, sending service discovery request", caps->ver, jid);
                 auto_char char* id = connection_create_stanza_id();
                 iq_send_caps_request(jid, id, caps->node, caps->ver);
             }
@@ -562,17 +570,17 @@ _handle_caps(const char* const jid, XMPPCaps* caps)
 
         // unsupported hash, xep-0115, associate with JID, no cache
     } else if (caps->hash) {
-        log_info("Hash %s not supported: %s, sending service discovery request", caps->hash, jid);
+        LOG_INFO("Hash %s not supported: %s, sending service discovery request", caps->hash, jid);
         auto_char char* id = connection_create_stanza_id();
         iq_send_caps_request_for_jid(jid, id, caps->node, caps->ver);
 
         // no hash, legacy caps, cache against node#ver
     } else if (caps->node && caps->ver) {
-        log_info("No hash specified: %s, legacy request made for %s#%s", jid, caps->node, caps->ver);
+        LOG_INFO("No hash specified: %s, legacy request made for %s#%s", jid, caps->node, caps->ver);
         auto_char char* id = connection_create_stanza_id();
         iq_send_caps_request_legacy(jid, id, caps->node, caps->ver);
     } else {
-        log_info("No hash specified: %s, could not create ver string, not sending service discovery request.", jid);
+        LOG_INFO("No hash specified: %s, could not create ver string, not sending service discovery request.", jid);
     }
 }
 
@@ -616,7 +624,7 @@ _available_handler(xmpp_stanza_t* const stanza)
         return;
     } else {
         char* jid = jid_fulljid_or_barejid(xmpp_presence->jid);
-        log_debug("Presence available handler fired for: %s", jid);
+        LOG_DEBUG("Presence available handler fired for: %s", jid);
     }
 
     xmpp_conn_t* conn = connection_get_conn();
@@ -719,13 +727,13 @@ _send_caps_request(char* node, char* caps_key, char* id, char* from)
         return;
     }
 
-    log_debug("Node string: %s.", node);
+    LOG_DEBUG("Node string: %s.", node);
     if (caps_cache_contains(caps_key)) {
-        log_debug("Capabilities already cached, for %s", caps_key);
+        LOG_DEBUG("Capabilities already cached, for %s", caps_key);
         return;
     }
 
-    log_debug("Capabilities not cached for '%s', sending discovery IQ.", from);
+    LOG_DEBUG("Capabilities not cached for '%s', sending discovery IQ.", from);
     xmpp_ctx_t* ctx = connection_get_ctx();
     xmpp_stanza_t* iq = stanza_create_disco_info_iq(ctx, id, from, node);
 
@@ -740,7 +748,7 @@ _muc_user_self_handler(xmpp_stanza_t* stanza)
     const char* from = xmpp_stanza_get_from(stanza);
     auto_jid Jid* from_jid = jid_create(from);
 
-    log_debug("Room self presence received from %s", from_jid->fulljid);
+    LOG_DEBUG("Room self presence received from %s", from_jid->fulljid);
 
     char* room = from_jid->barejid;
 
@@ -817,7 +825,7 @@ _muc_user_occupant_handler(xmpp_stanza_t* stanza)
     const char* from = xmpp_stanza_get_from(stanza);
     auto_jid Jid* from_jid = jid_create(from);
 
-    log_debug("Room presence received from %s", from_jid->fulljid);
+    LOG_DEBUG("Room presence received from %s", from_jid->fulljid);
 
     char* room = from_jid->barejid;
     char* nick = from_jid->resourcepart;
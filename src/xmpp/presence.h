@@ -37,6 +37,7 @@
 #define XMPP_PRESENCE_H
 
 void presence_handlers_init(void);
+int presence_handle_stanza(xmpp_stanza_t* const stanza);
 void presence_sub_requests_init(void);
 void presence_clear_sub_requests(void);
 
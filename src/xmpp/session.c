@@ -60,6 +60,7 @@
 #include "xmpp/muc.h"
 #include "xmpp/chat_session.h"
 #include "xmpp/jid.h"
+#include "xmpp/capture.h"
 
 #ifdef HAVE_OMEMO
 #include "omemo/omemo.h"
@@ -319,6 +320,7 @@ session_login_success(gboolean secured)
 {
     chat_sessions_init();
 
+    capture_handlers_init();
     message_handlers_init();
     presence_handlers_init();
     iq_handlers_init();
@@ -365,6 +367,21 @@ session_login_success(gboolean secured)
     }
 }
 
+// Acts as if the account had just logged in as fulljid, without connecting.
+// Used to replay a stanza capture
+void
+session_replay_login(const char* const account_name, const char* const fulljid)
+{
+    log_info("Replaying stanzas as %s using account: %s", fulljid, account_name);
+
+    _session_free_internals();
+    saved_account.name = strdup(account_name);
+    saved_account.passwd = strdup("");
+
+    connection_replay_init(fulljid);
+    session_login_success(FALSE);
+}
+
 void
 session_login_failed(void)
 {
@@ -171,6 +171,8 @@ typedef struct prof_message_t
     /* The message that will be printed on screen and logs */
     char* plain;
     GDateTime* timestamp;
+    /* row id in our database, 0 if the message was not read from it */
+    gint64 db_id;
     prof_enc_t enc;
     gboolean trusted;
     gboolean is_mam;
@@ -206,6 +208,8 @@ gboolean connection_supports(const char* const feature);
 char* connection_jid_for_feature(const char* const feature);
 
 const char* connection_get_profanity_identifier(void);
+void connection_reload_log_level(void);
+void connection_set_stanza_tap(gboolean enabled);
 
 char* message_send_chat(const char* const barejid, const char* const msg, const char* const oob_url, gboolean request_receipt, const char* const replace_id);
 char* message_send_chat_otr(const char* const barejid, const char* const msg, gboolean request_receipt, const char* const replace_id);
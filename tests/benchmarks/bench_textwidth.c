@@ -0,0 +1,339 @@
+/*
+ * Compares the text measurement used when wrapping messages with the
+ * implementation it replaced.
+ *
+ * Usage: bench_textwidth [FILE...]
+ *
+ * Without arguments the built in corpora are measured, otherwise every line
+ * of each FILE is taken as a message.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <locale.h>
+#include <wchar.h>
+#include <glib.h>
+
+#include "tools/textwidth.h"
+
+// enough rounds for the timings to be stable, scaled down for large corpora
+#define BENCH_BYTES (64 * 1024 * 1024)
+
+typedef struct bench_corpus_t
+{
+    const char* name;
+    GPtrArray* messages;
+    gsize bytes;
+} BenchCorpus;
+
+static const char* chat_messages[] = {
+    "hey, are you around?",
+    "yes, just got back from lunch",
+    "did you see the release notes for the new version? I think they finally fixed the roster bug",
+    "ok",
+    "lol",
+    "I'm going to be a bit late for the meeting, start without me please",
+    "Can someone review my pull request when they get a chance? It's mostly refactoring, nothing too exciting, but it touches a lot of files so it would be good to have a second pair of eyes on it before we merge.",
+    "thanks!",
+    "brb",
+    "The build is broken on master again, looks like a missing include in one of the headers.",
+    "sure, I'll have a look after I finish this",
+    "good morning everyone",
+};
+
+static const char* link_messages[] = {
+    "https://profanity-im.github.io/guide/latest/userguide.html",
+    "see https://github.com/profanity-im/profanity/issues?q=is%3Aissue+is%3Aopen+label%3Abug for the list",
+    "try `./configure --enable-python-plugins --enable-c-plugins && make -j8 check`",
+    "if (window->layout->buffer == NULL) { return; }",
+    "/home/user/.local/share/profanity/chatlogs/user_at_example.org/room_at_conference.example.org",
+    "sha256: 3a7bd3e2360a3d29eea436fcfb7e44c735d117c42d1c1835420b6b9942dd4f1b",
+    "error: implicit declaration of function 'g_hash_table_lookup' [-Werror=implicit-function-declaration]",
+};
+
+static const char* mixed_messages[] = {
+    "こんにちは、元気ですか？",
+    "今天晚上一起吃饭吗？我知道一家很好的餐厅",
+    "안녕하세요! 오늘 회의는 세 시에 시작합니다",
+    "Grüße aus München, das Wetter ist schön 🌞",
+    "ça va? on se voit à la réunion demain 👍",
+    "the café on the corner has the best crème brûlée 😋😋",
+    "Привет, как дела? Давно не виделись",
+    "😂😂😂",
+    "meeting moved to 15:00 — 会議室 B",
+};
+
+static gint64
+_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+// utf8_display_len() as it was before tools/textwidth
+static int
+_old_display_len(const char* const str)
+{
+    int len = 0;
+    const gchar* curr = str;
+    while (*curr != '\0') {
+        gunichar curru = g_utf8_get_char(curr);
+        if (g_unichar_iswide(curru)) {
+            len += 2;
+        } else {
+            len++;
+        }
+        curr = g_utf8_next_char(curr);
+    }
+
+    return len;
+}
+
+// word splitting and measuring as the wrapping code did before tools/textwidth
+static int
+_old_words(const char* const message, char* word)
+{
+    int total = 0;
+    const gchar* curr_ch = message;
+
+    while (*curr_ch != '\0') {
+        if (*curr_ch == ' ' || *curr_ch == '\n') {
+            total++;
+            curr_ch++;
+            continue;
+        }
+
+        int wordi = 0;
+        while (*curr_ch != ' ' && *curr_ch != '\n' && *curr_ch != '\0') {
+            size_t ch_len = mbrlen(curr_ch, MB_CUR_MAX, NULL);
+            if ((ch_len == (size_t)-2) || (ch_len == (size_t)-1)) {
+                curr_ch++;
+                continue;
+            }
+            int offset = 0;
+            while (offset < ch_len) {
+                word[wordi++] = curr_ch[offset++];
+            }
+            curr_ch = g_utf8_next_char(curr_ch);
+        }
+        word[wordi] = '\0';
+        total += _old_display_len(word);
+    }
+
+    return total;
+}
+
+// word splitting and measuring as the wrapping code does now
+static int
+_new_words(const char* const message, gsize len, char* word)
+{
+    int total = 0;
+    const gchar* curr_ch = message;
+    const gchar* end = message + len;
+
+    while (*curr_ch != '\0') {
+        if (*curr_ch == ' ' || *curr_ch == '\n') {
+            total++;
+            curr_ch++;
+            continue;
+        }
+
+        gsize ascii = textwidth_ascii_word(curr_ch, end - curr_ch);
+        if (ascii > 0) {
+            total += ascii;
+            curr_ch += ascii;
+            continue;
+        }
+
+        int wordi = 0;
+        while (*curr_ch != ' ' && *curr_ch != '\n' && *curr_ch != '\0') {
+            size_t ch_len = mbrlen(curr_ch, MB_CUR_MAX, NULL);
+            if ((ch_len == (size_t)-2) || (ch_len == (size_t)-1)) {
+                curr_ch++;
+                continue;
+            }
+            int offset = 0;
+            while (offset < ch_len) {
+                word[wordi++] = curr_ch[offset++];
+            }
+            curr_ch = g_utf8_next_char(curr_ch);
+        }
+        word[wordi] = '\0';
+        total += textwidth_str(word);
+    }
+
+    return total;
+}
+
+static BenchCorpus*
+_corpus_new(const char* const name)
+{
+    BenchCorpus* corpus = g_new0(BenchCorpus, 1);
+    corpus->name = name;
+    corpus->messages = g_ptr_array_new_with_free_func(g_free);
+
+    return corpus;
+}
+
+static void
+_corpus_add(BenchCorpus* corpus, const char* const message)
+{
+    g_ptr_array_add(corpus->messages, g_strdup(message));
+    corpus->bytes += strlen(message);
+}
+
+static BenchCorpus*
+_corpus_from_array(const char* const name, const char** messages, gsize count)
+{
+    BenchCorpus* corpus = _corpus_new(name);
+    for (gsize i = 0; i < count; i++) {
+        _corpus_add(corpus, messages[i]);
+    }
+
+    return corpus;
+}
+
+static BenchCorpus*
+_corpus_from_file(const char* const path)
+{
+    gchar* contents = NULL;
+    GError* error = NULL;
+    if (!g_file_get_contents(path, &contents, NULL, &error)) {
+        fprintf(stderr, "Could not read %s: %s\n", path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    BenchCorpus* corpus = _corpus_new(path);
+    gchar** lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i] != NULL; i++) {
+        if (lines[i][0] != '\0' && g_utf8_validate(lines[i], -1, NULL)) {
+            _corpus_add(corpus, lines[i]);
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+
+    return corpus;
+}
+
+static void
+_corpus_free(BenchCorpus* corpus)
+{
+    g_ptr_array_free(corpus->messages, TRUE);
+    g_free(corpus);
+}
+
+static void
+_report(const char* const what, gint64 old_ns, gint64 new_ns, gsize count)
+{
+    double old_msg = (double)old_ns / count;
+    double new_msg = (double)new_ns / count;
+
+    printf("  %-8s old %9.1f ns/msg   new %9.1f ns/msg   %5.2fx\n",
+           what, old_msg, new_msg, new_msg > 0 ? old_msg / new_msg : 0.0);
+}
+
+// returns FALSE when the old and new implementations disagree
+static gboolean
+_bench(BenchCorpus* corpus)
+{
+    GPtrArray* messages = corpus->messages;
+    if (messages->len == 0 || corpus->bytes == 0) {
+        printf("%s: no messages\n", corpus->name);
+        return TRUE;
+    }
+
+    gsize maxlen = 0;
+    gsize* lens = g_new(gsize, messages->len);
+    for (guint i = 0; i < messages->len; i++) {
+        lens[i] = strlen(g_ptr_array_index(messages, i));
+        maxlen = MAX(maxlen, lens[i]);
+    }
+    char* word = g_malloc(maxlen + 1);
+
+    gboolean same = TRUE;
+    for (guint i = 0; i < messages->len; i++) {
+        const char* msg = g_ptr_array_index(messages, i);
+        if (_old_display_len(msg) != textwidth_str(msg) || _old_words(msg, word) != _new_words(msg, lens[i], word)) {
+            fprintf(stderr, "%s: results differ for \"%s\"\n", corpus->name, msg);
+            same = FALSE;
+        }
+    }
+
+    int rounds = MAX(1, BENCH_BYTES / corpus->bytes);
+    gsize count = (gsize)rounds * messages->len;
+    volatile int sink = 0;
+
+    printf("%s: %u messages, %zu bytes, %d rounds\n", corpus->name, messages->len, corpus->bytes, rounds);
+
+    gint64 start = _now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (guint i = 0; i < messages->len; i++) {
+            sink += _old_display_len(g_ptr_array_index(messages, i));
+        }
+    }
+    gint64 old_ns = _now_ns() - start;
+
+    start = _now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (guint i = 0; i < messages->len; i++) {
+            sink += textwidth_str(g_ptr_array_index(messages, i));
+        }
+    }
+    _report("width", old_ns, _now_ns() - start, count);
+
+    start = _now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (guint i = 0; i < messages->len; i++) {
+            sink += _old_words(g_ptr_array_index(messages, i), word);
+        }
+    }
+    old_ns = _now_ns() - start;
+
+    start = _now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (guint i = 0; i < messages->len; i++) {
+            sink += _new_words(g_ptr_array_index(messages, i), lens[i], word);
+        }
+    }
+    _report("words", old_ns, _now_ns() - start, count);
+
+    g_free(word);
+    g_free(lens);
+
+    return same;
+}
+
+int
+main(int argc, char* argv[])
+{
+    setlocale(LC_ALL, "");
+
+    GPtrArray* corpora = g_ptr_array_new_with_free_func((GDestroyNotify)_corpus_free);
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            BenchCorpus* corpus = _corpus_from_file(argv[i]);
+            if (!corpus) {
+                g_ptr_array_free(corpora, TRUE);
+                return 1;
+            }
+            g_ptr_array_add(corpora, corpus);
+        }
+    } else {
+        g_ptr_array_add(corpora, _corpus_from_array("chat", chat_messages, G_N_ELEMENTS(chat_messages)));
+        g_ptr_array_add(corpora, _corpus_from_array("links", link_messages, G_N_ELEMENTS(link_messages)));
+        g_ptr_array_add(corpora, _corpus_from_array("mixed", mixed_messages, G_N_ELEMENTS(mixed_messages)));
+    }
+
+    gboolean same = TRUE;
+    for (guint i = 0; i < corpora->len; i++) {
+        same = _bench(g_ptr_array_index(corpora, i)) && same;
+    }
+    g_ptr_array_free(corpora, TRUE);
+
+    return same ? 0 : 1;
+}
@@ -65,6 +65,11 @@ chat_log_omemo_msg_in(ProfMessage* message)
 {
 }
 
+void
+chat_log_process_events(void)
+{
+}
+
 void
 chat_log_close(void)
 {
@@ -322,6 +322,19 @@ accounts_clear_max_sessions(const char* const account_name)
 {
 }
 void
+accounts_set_retention(const char* const account_name, const char* const type, const char* const value)
+{
+}
+gchar*
+accounts_get_retention(const char* const account_name, const char* const type)
+{
+    return NULL;
+}
+void
+accounts_clear_retention(const char* const account_name, const char* const type)
+{
+}
+void
 accounts_add_otr_policy(const char* const account_name, const char* const contact_jid, const char* const policy)
 {
 }
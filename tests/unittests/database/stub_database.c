@@ -21,6 +21,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 #include <setjmp.h>
 #include <cmocka.h>
 
@@ -47,6 +48,71 @@ void
 log_database_add_outgoing_muc_pm(const char* const id, const char* const barejid, const char* const message, const char* const replace_id, prof_enc_t enc)
 {
 }
+gboolean
+log_database_search_available(void)
+{
+    return FALSE;
+}
+guint
+log_database_search_async(gchar** terms, const char* const with_jid, const char* const type, gint64 after, gint64 before, gint64 after_id, DbHistoryCallback callback, gpointer user_data)
+{
+    callback(NULL, user_data);
+    return 0;
+}
+void
+log_database_get_cache_stats(DbCacheStats* stats)
+{
+    memset(stats, 0, sizeof(DbCacheStats));
+}
+void
+log_database_trim_cache(void)
+{
+}
+gboolean
+log_database_parse_retention(const char* const policy, gint* days, gint* messages)
+{
+    *days = 0;
+    *messages = 0;
+    return TRUE;
+}
+void
+log_database_update_retention(void)
+{
+}
+void
+log_database_get_retention_stats(DbRetentionStats* stats)
+{
+    memset(stats, 0, sizeof(DbRetentionStats));
+}
+guint
+log_database_export_async(const char* const path, db_export_format_t format, const char* const with_jid, const char* const type, gint64 after, gint64 before, DbExportCallback callback, gpointer user_data)
+{
+    callback(FALSE, 0, NULL, user_data);
+    return 0;
+}
+gboolean
+log_database_import_begin(void)
+{
+    return FALSE;
+}
+gboolean
+log_database_import_add(const char* const from_jid, const char* const from_resource, const char* const to_jid, const char* const to_resource, const char* const message, gint64 timestamp, prof_msg_type_t type)
+{
+    return FALSE;
+}
+void
+log_database_import_end(DbImportStats* stats)
+{
+    memset(stats, 0, sizeof(DbImportStats));
+}
+void
+log_database_flush(void)
+{
+}
+void
+log_database_process_events(void)
+{
+}
 void
 log_database_close(void)
 {
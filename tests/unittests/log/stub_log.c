@@ -41,6 +41,10 @@ log_close(void)
 {
 }
 void
+log_reload_rotation(void)
+{
+}
+void
 log_debug(const char* const msg, ...)
 {
 }
@@ -0,0 +1,469 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "ui/buffer.h"
+
+// BUFF_SIZE in buffer.c
+#define BUFFER_MAX 1200
+
+static void
+_add(ProfBuff buffer, gboolean prepend, int number, const char* const id, DeliveryReceipt* receipt)
+{
+    GDateTime* time = g_date_time_new_now_local();
+    gchar* message = g_strdup_printf("message %d", number);
+
+    if (prepend) {
+        buffer_prepend(buffer, "-", 0, time, 0, THEME_TEXT, "from", NULL, message, receipt, id);
+    } else {
+        buffer_append(buffer, "-", 0, time, 0, THEME_TEXT, "from", NULL, message, receipt, id);
+    }
+
+    g_free(message);
+    g_date_time_unref(time);
+}
+
+// appends messages first up to last with ids of the same numbers
+static void
+_append_range(ProfBuff buffer, int first, int last)
+{
+    for (int i = first; i <= last; i++) {
+        gchar* id = g_strdup_printf("id%d", i);
+        _add(buffer, FALSE, i, id, NULL);
+        g_free(id);
+    }
+}
+
+static void
+_assert_message(ProfBuff buffer, int entry, int number)
+{
+    gchar* message = g_strdup_printf("message %d", number);
+    assert_string_equal(message, buffer_get_entry(buffer, entry)->message);
+    g_free(message);
+}
+
+static DeliveryReceipt*
+_receipt(void)
+{
+    DeliveryReceipt* receipt = malloc(sizeof(DeliveryReceipt));
+    receipt->received = FALSE;
+    return receipt;
+}
+
+void
+append_past_max_evicts_oldest(void** state)
+{
+    ProfBuff buffer = buffer_create();
+
+    _append_range(buffer, 0, BUFFER_MAX + 9);
+
+    assert_int_equal(BUFFER_MAX, buffer_size(buffer));
+    _assert_message(buffer, 0, 10);
+    _assert_message(buffer, BUFFER_MAX - 1, BUFFER_MAX + 9);
+    assert_null(buffer_get_entry_by_id(buffer, "id0"));
+    assert_null(buffer_get_entry_by_id(buffer, "id9"));
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "id10"));
+    assert_true(buffer_get_entry(buffer, 600) == buffer_get_entry_by_id(buffer, "id610"));
+    assert_true(buffer_get_entry(buffer, BUFFER_MAX - 1) == buffer_get_entry_by_id(buffer, "id1209"));
+
+    buffer_free(buffer);
+}
+
+void
+append_evicts_indexed_duplicate_id(void** state)
+{
+    ProfBuff buffer = buffer_create();
+
+    _add(buffer, FALSE, 0, "dup", NULL);
+    _append_range(buffer, 1, 9);
+    _add(buffer, FALSE, 10, "dup", NULL);
+    _append_range(buffer, 11, BUFFER_MAX - 1);
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "dup"));
+
+    // the oldest entry goes and the next one with the id takes over
+    _append_range(buffer, BUFFER_MAX, BUFFER_MAX);
+    _assert_message(buffer, 9, 10);
+    assert_true(buffer_get_entry(buffer, 9) == buffer_get_entry_by_id(buffer, "dup"));
+
+    buffer_remove_entry(buffer, 9);
+    assert_null(buffer_get_entry_by_id(buffer, "dup"));
+
+    buffer_free(buffer);
+}
+
+void
+prepend_evicts_duplicate_id(void** state)
+{
+    ProfBuff buffer = buffer_create();
+
+    _append_range(buffer, 0, 4);
+    _add(buffer, FALSE, 5, "dup", NULL);
+    _append_range(buffer, 6, BUFFER_MAX - 2);
+    _add(buffer, FALSE, BUFFER_MAX - 1, "dup", NULL);
+
+    // the newest entry goes and the id still maps to the older one
+    _add(buffer, TRUE, -1, "first", NULL);
+    assert_int_equal(BUFFER_MAX, buffer_size(buffer));
+    _assert_message(buffer, 0, -1);
+    _assert_message(buffer, BUFFER_MAX - 1, BUFFER_MAX - 2);
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "first"));
+    assert_true(buffer_get_entry(buffer, 6) == buffer_get_entry_by_id(buffer, "dup"));
+
+    // no other entry is left to take over the id
+    buffer_remove_entry(buffer, 6);
+    assert_null(buffer_get_entry_by_id(buffer, "dup"));
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_near_front(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 0, 9);
+
+    buffer_remove_entry(buffer, 1);
+    buffer_remove_entry(buffer, 0);
+
+    assert_int_equal(8, buffer_size(buffer));
+    for (int i = 0; i < 8; i++) {
+        _assert_message(buffer, i, i + 2);
+    }
+    assert_null(buffer_get_entry_by_id(buffer, "id0"));
+    assert_null(buffer_get_entry_by_id(buffer, "id1"));
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "id2"));
+
+    // the freed slots at the front are used again
+    _add(buffer, TRUE, 1, "id1", NULL);
+    _assert_message(buffer, 0, 1);
+    _assert_message(buffer, 8, 9);
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_near_back(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 0, 9);
+
+    buffer_remove_entry(buffer, 8);
+    buffer_remove_entry(buffer, 8);
+
+    assert_int_equal(8, buffer_size(buffer));
+    for (int i = 0; i < 8; i++) {
+        _assert_message(buffer, i, i);
+    }
+    assert_null(buffer_get_entry_by_id(buffer, "id8"));
+    assert_null(buffer_get_entry_by_id(buffer, "id9"));
+    assert_true(buffer_get_entry(buffer, 7) == buffer_get_entry_by_id(buffer, "id7"));
+
+    _append_range(buffer, 10, 10);
+    _assert_message(buffer, 8, 10);
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_by_id_with_duplicates(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _add(buffer, FALSE, 0, "dup", NULL);
+    _add(buffer, FALSE, 1, "dup", NULL);
+    _add(buffer, FALSE, 2, "dup", NULL);
+
+    buffer_remove_entry_by_id(buffer, "dup");
+    assert_int_equal(2, buffer_size(buffer));
+    _assert_message(buffer, 0, 1);
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "dup"));
+
+    buffer_remove_entry_by_id(buffer, "dup");
+    buffer_remove_entry_by_id(buffer, "dup");
+    assert_int_equal(0, buffer_size(buffer));
+    assert_null(buffer_get_entry_by_id(buffer, "dup"));
+
+    buffer_free(buffer);
+}
+
+void
+set_entry_id_onto_existing_id(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 0, 2);
+    ProfBuffEntry* first = buffer_get_entry(buffer, 0);
+    ProfBuffEntry* last = buffer_get_entry(buffer, 2);
+
+    // the oldest entry with an id is the one found
+    buffer_set_entry_id(buffer, last, "id0");
+    assert_null(buffer_get_entry_by_id(buffer, "id2"));
+    assert_true(first == buffer_get_entry_by_id(buffer, "id0"));
+
+    buffer_set_entry_id(buffer, first, "other");
+    assert_true(last == buffer_get_entry_by_id(buffer, "id0"));
+    assert_true(first == buffer_get_entry_by_id(buffer, "other"));
+
+    buffer_set_entry_id(buffer, last, NULL);
+    assert_null(buffer_get_entry_by_id(buffer, "id0"));
+
+    buffer_free(buffer);
+}
+
+void
+set_entry_id_onto_newer_id(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 0, 2);
+    ProfBuffEntry* first = buffer_get_entry(buffer, 0);
+    ProfBuffEntry* last = buffer_get_entry(buffer, 2);
+
+    buffer_set_entry_id(buffer, first, "id2");
+    assert_null(buffer_get_entry_by_id(buffer, "id0"));
+    assert_true(first == buffer_get_entry_by_id(buffer, "id2"));
+
+    buffer_remove_entry(buffer, 0);
+    assert_true(last == buffer_get_entry_by_id(buffer, "id2"));
+
+    buffer_remove_entry(buffer, 1);
+    assert_null(buffer_get_entry_by_id(buffer, "id2"));
+
+    buffer_free(buffer);
+}
+
+void
+mark_received_unique_id(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _add(buffer, FALSE, 0, "id0", _receipt());
+    _add(buffer, FALSE, 1, "id1", NULL);
+
+    assert_true(buffer_mark_received(buffer, "id0"));
+    assert_true(buffer_get_entry(buffer, 0)->receipt->received);
+    assert_false(buffer_mark_received(buffer, "id0"));
+    assert_false(buffer_mark_received(buffer, "id1"));
+    assert_false(buffer_mark_received(buffer, "unknown"));
+
+    buffer_free(buffer);
+}
+
+void
+mark_received_duplicate_ids(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _add(buffer, FALSE, 0, "dup", _receipt());
+    _add(buffer, FALSE, 1, "dup", NULL);
+    _add(buffer, FALSE, 2, "dup", _receipt());
+
+    // each receipt marks the oldest entry still waiting for one
+    assert_true(buffer_mark_received(buffer, "dup"));
+    assert_true(buffer_get_entry(buffer, 0)->receipt->received);
+    assert_false(buffer_get_entry(buffer, 2)->receipt->received);
+
+    assert_true(buffer_mark_received(buffer, "dup"));
+    assert_true(buffer_get_entry(buffer, 2)->receipt->received);
+
+    assert_false(buffer_mark_received(buffer, "dup"));
+
+    // with the duplicate gone the index alone is used again
+    buffer_remove_entry(buffer, 2);
+    buffer_remove_entry(buffer, 1);
+    assert_false(buffer_mark_received(buffer, "dup"));
+
+    buffer_free(buffer);
+}
+
+// prepends messages last down to first, leaving the head of the array
+// behind its start
+static void
+_prepend_range(ProfBuff buffer, int last, int first)
+{
+    for (int i = last; i >= first; i--) {
+        gchar* id = g_strdup_printf("id%d", i);
+        _add(buffer, TRUE, i, id, NULL);
+        g_free(id);
+    }
+}
+
+// entries hold first up to last except skipped, which is -1 for none
+static void
+_assert_messages(ProfBuff buffer, int first, int last, int skipped)
+{
+    int entry = 0;
+    for (int i = first; i <= last; i++) {
+        if (i == skipped) {
+            continue;
+        }
+        gchar* id = g_strdup_printf("id%d", i);
+        _assert_message(buffer, entry, i);
+        assert_true(buffer_get_entry(buffer, entry) == buffer_get_entry_by_id(buffer, id));
+        g_free(id);
+        entry++;
+    }
+    assert_int_equal(entry, buffer_size(buffer));
+}
+
+void
+grow_with_wrapped_head(void** state)
+{
+    ProfBuff buffer = buffer_create();
+
+    // the array starts with room for 32 entries, fill it from both ends
+    _append_range(buffer, 112, 131);
+    _prepend_range(buffer, 111, 100);
+    _assert_messages(buffer, 100, 131, -1);
+
+    // the entries are moved in order when the array grows
+    _append_range(buffer, 132, 140);
+    _assert_messages(buffer, 100, 140, -1);
+
+    _prepend_range(buffer, 99, 70);
+    _append_range(buffer, 141, 200);
+    _assert_messages(buffer, 70, 200, -1);
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_front_across_wrap(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 13, 32);
+    _prepend_range(buffer, 12, 1);
+
+    // closer to the front, the entries before it move back over the end of
+    // the array
+    buffer_remove_entry(buffer, 14);
+    _assert_messages(buffer, 1, 32, 15);
+
+    _prepend_range(buffer, 0, 0);
+    _assert_messages(buffer, 0, 32, 15);
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_back_across_wrap(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 20, 31);
+    _prepend_range(buffer, 19, 0);
+
+    // closer to the back, the entries after it move forward over the end of
+    // the array
+    buffer_remove_entry(buffer, 17);
+    _assert_messages(buffer, 0, 31, 17);
+
+    _append_range(buffer, 32, 32);
+    _assert_messages(buffer, 0, 32, 17);
+
+    buffer_free(buffer);
+}
+
+void
+remove_entry_full_wrapped(void** state)
+{
+    ProfBuff buffer = buffer_create();
+
+    // evicting moves the head, so the newest entries wrap to the start of
+    // the array
+    _append_range(buffer, 0, BUFFER_MAX + 49);
+    _assert_messages(buffer, 50, BUFFER_MAX + 49, -1);
+
+    buffer_remove_entry(buffer, BUFFER_MAX - 60);
+    _assert_messages(buffer, 50, BUFFER_MAX + 49, BUFFER_MAX - 10);
+
+    buffer_remove_entry(buffer, 0);
+    _assert_messages(buffer, 51, BUFFER_MAX + 49, BUFFER_MAX - 10);
+
+    // the buffer fills up again and evicts from the new front
+    _append_range(buffer, BUFFER_MAX + 50, BUFFER_MAX + 52);
+    assert_int_equal(BUFFER_MAX, buffer_size(buffer));
+    _assert_message(buffer, 0, 52);
+    _assert_message(buffer, BUFFER_MAX - 1, BUFFER_MAX + 52);
+    assert_null(buffer_get_entry_by_id(buffer, "id51"));
+
+    buffer_free(buffer);
+}
+
+void
+set_entry_message_after_shifts(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _append_range(buffer, 2, 9);
+    _prepend_range(buffer, 1, 0);
+    buffer_remove_entry(buffer, 2);
+    buffer_remove_entry(buffer, 7);
+    buffer_set_laid_out(buffer, 0, buffer_size(buffer));
+
+    // the range is cut at the entries that changed, wherever they moved to
+    int from, to;
+    ProfBuffEntry* entry = buffer_get_entry_by_id(buffer, "id7");
+    buffer_set_entry_message(buffer, entry, "changed");
+    buffer_get_laid_out(buffer, &from, &to);
+    assert_int_equal(0, from);
+    assert_int_equal(6, to);
+
+    entry = buffer_get_entry_by_id(buffer, "id1");
+    buffer_set_entry_message(buffer, entry, "changed");
+    buffer_get_laid_out(buffer, &from, &to);
+    assert_int_equal(2, from);
+    assert_int_equal(6, to);
+
+    buffer_free(buffer);
+}
+
+void
+duplicate_ids_keep_buffer_order(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _add(buffer, FALSE, 1, "dup", NULL);
+    _append_range(buffer, 2, 3);
+    _add(buffer, FALSE, 4, "dup", NULL);
+    _add(buffer, TRUE, 0, "dup", NULL);
+
+    // moved onto the id between the others
+    buffer_set_entry_id(buffer, buffer_get_entry(buffer, 2), "dup");
+
+    // each removal hands the id to the next entry in buffer order
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "dup"));
+    buffer_remove_entry(buffer, 0);
+    _assert_message(buffer, 0, 1);
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "dup"));
+    buffer_remove_entry(buffer, 0);
+    _assert_message(buffer, 0, 2);
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "dup"));
+    buffer_remove_entry(buffer, 0);
+    _assert_message(buffer, 1, 4);
+    assert_true(buffer_get_entry(buffer, 1) == buffer_get_entry_by_id(buffer, "dup"));
+    assert_true(buffer_get_entry(buffer, 0) == buffer_get_entry_by_id(buffer, "id3"));
+
+    buffer_remove_entry(buffer, 1);
+    assert_null(buffer_get_entry_by_id(buffer, "dup"));
+    assert_int_equal(1, buffer_size(buffer));
+
+    buffer_free(buffer);
+}
+
+void
+mark_received_prepended_duplicate(void** state)
+{
+    ProfBuff buffer = buffer_create();
+    _add(buffer, FALSE, 1, "dup", _receipt());
+    _add(buffer, FALSE, 2, "dup", _receipt());
+    _add(buffer, TRUE, 0, "dup", _receipt());
+
+    assert_true(buffer_mark_received(buffer, "dup"));
+    assert_true(buffer_get_entry(buffer, 0)->receipt->received);
+    assert_false(buffer_get_entry(buffer, 1)->receipt->received);
+
+    // with the one in the middle gone the newest is next
+    buffer_remove_entry(buffer, 1);
+    assert_true(buffer_mark_received(buffer, "dup"));
+    assert_true(buffer_get_entry(buffer, 1)->receipt->received);
+    assert_false(buffer_mark_received(buffer, "dup"));
+
+    buffer_free(buffer);
+}
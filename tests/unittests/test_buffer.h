@@ -0,0 +1,17 @@
+void append_past_max_evicts_oldest(void** state);
+void append_evicts_indexed_duplicate_id(void** state);
+void prepend_evicts_duplicate_id(void** state);
+void remove_entry_near_front(void** state);
+void remove_entry_near_back(void** state);
+void remove_entry_by_id_with_duplicates(void** state);
+void set_entry_id_onto_existing_id(void** state);
+void set_entry_id_onto_newer_id(void** state);
+void mark_received_unique_id(void** state);
+void mark_received_duplicate_ids(void** state);
+void grow_with_wrapped_head(void** state);
+void remove_entry_front_across_wrap(void** state);
+void remove_entry_back_across_wrap(void** state);
+void remove_entry_full_wrapped(void** state);
+void set_entry_message_after_shifts(void** state);
+void duplicate_ids_keep_buffer_order(void** state);
+void mark_received_prepended_duplicate(void** state);
@@ -0,0 +1,137 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "chatlog_import.h"
+
+// 2023-05-01T10:20:30Z
+#define TIMESTAMP_UTC G_GINT64_CONSTANT(1682936430000000)
+
+static gboolean
+_parse(const char* const line, GTimeZone* tz, ChatLogImportHeader* header)
+{
+    return chat_log_import_parse_header(line, strlen(line), tz, header);
+}
+
+static void
+_assert_header(ChatLogImportHeader* header, const char* const name, const char* const text)
+{
+    assert_int_equal(strlen(name), header->name_len);
+    assert_memory_equal(name, header->name, header->name_len);
+    assert_int_equal(strlen(text), header->text_len);
+    assert_memory_equal(text, header->text, header->text_len);
+}
+
+void
+parse_header_plain_message(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_utc();
+    ChatLogImportHeader header;
+
+    assert_true(_parse("2023-05-01T10:20:30Z - thor: hello there", tz, &header));
+    _assert_header(&header, "thor", "hello there");
+    assert_false(header.me);
+    assert_true(header.timestamp == TIMESTAMP_UTC);
+
+    g_time_zone_unref(tz);
+}
+
+void
+parse_header_me_message(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_utc();
+    ChatLogImportHeader header;
+
+    assert_true(_parse("2023-05-01T10:20:30Z - *thor drinks mead", tz, &header));
+    _assert_header(&header, "thor", "drinks mead");
+    assert_true(header.me);
+    assert_true(header.timestamp == TIMESTAMP_UTC);
+
+    // a /me line needs a name and an action
+    assert_false(_parse("2023-05-01T10:20:30Z - *thor", tz, &header));
+    assert_false(_parse("2023-05-01T10:20:30Z - * drinks mead", tz, &header));
+
+    g_time_zone_unref(tz);
+}
+
+void
+parse_header_continuation_lines(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_utc();
+    ChatLogImportHeader header;
+
+    assert_false(_parse("", tz, &header));
+    assert_false(_parse("and the rest of the message", tz, &header));
+    assert_false(_parse("  - indented: list item", tz, &header));
+    assert_false(_parse("42 - the answer: is not a date", tz, &header));
+    assert_false(_parse("2023-05-01T10:20:30Z no separator: here", tz, &header));
+    assert_false(_parse("2023-05-01T10:20:30Z - no name here", tz, &header));
+    assert_false(_parse("2023-05-01T10:20:30Z - : empty name", tz, &header));
+
+    g_time_zone_unref(tz);
+}
+
+void
+parse_header_name_with_colon(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_utc();
+    ChatLogImportHeader header;
+
+    assert_true(_parse("2023-05-01T10:20:30Z - odin: note: ravens are back", tz, &header));
+    _assert_header(&header, "odin", "note: ravens are back");
+
+    assert_true(_parse("2023-05-01T10:20:30Z - loki:trickster: hi", tz, &header));
+    _assert_header(&header, "loki:trickster", "hi");
+
+    g_time_zone_unref(tz);
+}
+
+void
+parse_header_timestamp_without_offset(void** state)
+{
+    GTimeZone* utc = g_time_zone_new_utc();
+    GTimeZone* tz = g_time_zone_new_offset(2 * 3600);
+    ChatLogImportHeader header;
+
+    assert_true(_parse("2023-05-01T10:20:30 - thor: hello", utc, &header));
+    assert_true(header.timestamp == TIMESTAMP_UTC);
+
+    assert_true(_parse("2023-05-01T12:20:30 - thor: hello", tz, &header));
+    assert_true(header.timestamp == TIMESTAMP_UTC);
+
+    g_time_zone_unref(tz);
+    g_time_zone_unref(utc);
+}
+
+void
+parse_header_timestamp_with_offset(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_offset(-5 * 3600);
+    ChatLogImportHeader header;
+
+    // the offset in the log wins over the one the file is read in
+    assert_true(_parse("2023-05-01T12:20:30+02:00 - thor: hello", tz, &header));
+    assert_true(header.timestamp == TIMESTAMP_UTC);
+
+    assert_true(_parse("2023-05-01T10:20:30.250Z - thor: hello", tz, &header));
+    assert_true(header.timestamp == TIMESTAMP_UTC + 250000);
+
+    g_time_zone_unref(tz);
+}
+
+void
+parse_header_respects_len(void** state)
+{
+    GTimeZone* tz = g_time_zone_new_utc();
+    ChatLogImportHeader header;
+    const char* line = "2023-05-01T10:20:30Z - thor: hello\n2023-05-01T10:20:31Z - odin: hi";
+
+    assert_true(chat_log_import_parse_header(line, strchr(line, '\n') - line, tz, &header));
+    _assert_header(&header, "thor", "hello");
+
+    g_time_zone_unref(tz);
+}
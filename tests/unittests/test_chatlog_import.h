@@ -0,0 +1,7 @@
+void parse_header_plain_message(void** state);
+void parse_header_me_message(void** state);
+void parse_header_continuation_lines(void** state);
+void parse_header_name_with_colon(void** state);
+void parse_header_timestamp_without_offset(void** state);
+void parse_header_timestamp_with_offset(void** state);
+void parse_header_respects_len(void** state);
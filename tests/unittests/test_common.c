@@ -849,3 +849,32 @@ prof_whole_occurrences_tests(void** state)
     g_slist_free(expected);
     expected = NULL;
 }
+
+void
+date_time_usec_roundtrip(void** state)
+{
+    GDateTime* dt = g_date_time_new_from_iso8601("2020-03-24T11:12:14.123456+01:00", NULL);
+    gint64 usec = date_time_to_usec(dt);
+
+    assert_int_equal(1585044734123456, usec);
+
+    GDateTime* back = date_time_new_from_usec(usec);
+    assert_true(g_date_time_equal(dt, back));
+    assert_int_equal(123456, g_date_time_get_microsecond(back));
+
+    g_date_time_unref(back);
+    g_date_time_unref(dt);
+}
+
+void
+date_time_usec_before_epoch(void** state)
+{
+    GDateTime* dt = date_time_new_from_usec(-1);
+    GDateTime* expected = g_date_time_new_from_iso8601("1969-12-31T23:59:59.999999Z", NULL);
+
+    assert_true(g_date_time_equal(expected, dt));
+    assert_int_equal(-1, date_time_to_usec(dt));
+
+    g_date_time_unref(expected);
+    g_date_time_unref(dt);
+}
@@ -37,3 +37,22 @@ statuses_muc_defaults_to_all(void** state)
     assert_string_equal("none", setting);
     g_free(setting);
 }
+
+void
+dblog_batch_defaults(void** state)
+{
+    assert_int_equal(PREFS_DBLOG_BATCH_DEFAULT, prefs_get_dblog_batch_size());
+    assert_int_equal(PREFS_DBLOG_BATCH_INTERVAL_DEFAULT, prefs_get_dblog_batch_interval());
+
+    prefs_set_dblog_batch_size(1);
+    assert_int_equal(1, prefs_get_dblog_batch_size());
+}
+
+void
+dblog_cache_defaults(void** state)
+{
+    assert_int_equal(PREFS_DBLOG_CACHE_DEFAULT, prefs_get_dblog_cache_size());
+
+    prefs_set_dblog_cache_size(0);
+    assert_int_equal(0, prefs_get_dblog_cache_size());
+}
@@ -1,3 +1,5 @@
 void statuses_console_defaults_to_all(void** state);
 void statuses_chat_defaults_to_all(void** state);
 void statuses_muc_defaults_to_all(void** state);
+void dblog_batch_defaults(void** state);
+void dblog_cache_defaults(void** state);
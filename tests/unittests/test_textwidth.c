@@ -0,0 +1,175 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "tools/textwidth.h"
+
+void
+ascii_len_empty(void** state)
+{
+    assert_int_equal(0, textwidth_ascii_len("", 0));
+}
+
+void
+ascii_len_all_ascii(void** state)
+{
+    char* str = "the quick brown fox jumps over the lazy dog, twice: the quick brown fox";
+
+    assert_int_equal(strlen(str), textwidth_ascii_len(str, strlen(str)));
+}
+
+void
+ascii_len_stops_at_non_ascii_in_every_position(void** state)
+{
+    // cover the bulk and the bytewise parts of the scan
+    char str[70];
+    for (int i = 0; i < 64; i++) {
+        memset(str, 'a', sizeof(str));
+        memcpy(str + i, "é", 2);
+
+        assert_int_equal(i, textwidth_ascii_len(str, sizeof(str)));
+    }
+}
+
+void
+ascii_len_respects_len(void** state)
+{
+    char* str = "abcdefghijklmnopqrstuvwxyz四";
+
+    assert_int_equal(20, textwidth_ascii_len(str, 20));
+}
+
+void
+printable_len_stops_at_control_chars(void** state)
+{
+    char str[40];
+    for (int i = 0; i < 32; i++) {
+        memset(str, 'x', sizeof(str));
+        str[17] = i;
+
+        assert_int_equal(17, textwidth_printable_len(str, sizeof(str)));
+    }
+}
+
+void
+printable_len_stops_at_del(void** state)
+{
+    char* str = "0123456789abcdefghij\x7fklm";
+
+    assert_int_equal(20, textwidth_printable_len(str, strlen(str)));
+}
+
+void
+printable_len_stops_at_non_ascii(void** state)
+{
+    char* str = "hello wörld";
+
+    assert_int_equal(7, textwidth_printable_len(str, strlen(str)));
+}
+
+void
+ascii_word_stops_at_space(void** state)
+{
+    char* str = "hello world";
+
+    assert_int_equal(5, textwidth_ascii_word(str, strlen(str)));
+}
+
+void
+ascii_word_stops_at_newline(void** state)
+{
+    char* str = "hello\nworld";
+
+    assert_int_equal(5, textwidth_ascii_word(str, strlen(str)));
+}
+
+void
+ascii_word_until_end(void** state)
+{
+    char* str = "https://profanity-im.github.io/guide/latest/userguide.html";
+
+    assert_int_equal(strlen(str), textwidth_ascii_word(str, strlen(str)));
+}
+
+void
+ascii_word_returns_zero_for_non_ascii_word(void** state)
+{
+    char* str = "naïve word";
+
+    assert_int_equal(0, textwidth_ascii_word(str, strlen(str)));
+}
+
+void
+ascii_word_returns_zero_for_control_chars(void** state)
+{
+    char* str = "tab\there";
+
+    assert_int_equal(0, textwidth_ascii_word(str, strlen(str)));
+}
+
+void
+char_width_ascii(void** state)
+{
+    assert_int_equal(1, textwidth_char("a", 0));
+}
+
+void
+char_width_tab(void** state)
+{
+    assert_int_equal(8, textwidth_char("\t", 0));
+    assert_int_equal(5, textwidth_char("\t", 3));
+    assert_int_equal(8, textwidth_char("\t", 16));
+}
+
+void
+char_width_control(void** state)
+{
+    assert_int_equal(2, textwidth_char("\x01", 0));
+    assert_int_equal(2, textwidth_char("\x7f", 0));
+}
+
+void
+char_width_wide(void** state)
+{
+    assert_int_equal(2, textwidth_char("四", 0));
+}
+
+void
+char_width_zero_width(void** state)
+{
+    // combining acute accent
+    assert_int_equal(0, textwidth_char("\xcc\x81", 0));
+}
+
+void
+str_width_empty(void** state)
+{
+    assert_int_equal(0, textwidth_str(""));
+}
+
+void
+str_width_ascii(void** state)
+{
+    assert_int_equal(15, textwidth_str("123456789abcdef"));
+}
+
+void
+str_width_mixed(void** state)
+{
+    assert_int_equal(9, textwidth_str("a四b五c ü"));
+}
+
+void
+str_width_long_mixed(void** state)
+{
+    gchar* str = g_strdup_printf("%s四%sü%s", "a longer run of ascii text before",
+                                 "and after the wide character", "end");
+
+    assert_int_equal(33 + 2 + 28 + 1 + 3, textwidth_str(str));
+
+    g_free(str);
+}
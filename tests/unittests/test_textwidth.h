@@ -0,0 +1,21 @@
+void ascii_len_empty(void** state);
+void ascii_len_all_ascii(void** state);
+void ascii_len_stops_at_non_ascii_in_every_position(void** state);
+void ascii_len_respects_len(void** state);
+void printable_len_stops_at_control_chars(void** state);
+void printable_len_stops_at_del(void** state);
+void printable_len_stops_at_non_ascii(void** state);
+void ascii_word_stops_at_space(void** state);
+void ascii_word_stops_at_newline(void** state);
+void ascii_word_until_end(void** state);
+void ascii_word_returns_zero_for_non_ascii_word(void** state);
+void ascii_word_returns_zero_for_control_chars(void** state);
+void char_width_ascii(void** state);
+void char_width_tab(void** state);
+void char_width_control(void** state);
+void char_width_wide(void** state);
+void char_width_zero_width(void** state);
+void str_width_empty(void** state);
+void str_width_ascii(void** state);
+void str_width_mixed(void** state);
+void str_width_long_mixed(void** state);
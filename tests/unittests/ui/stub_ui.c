@@ -150,6 +150,11 @@ chatwin_new(const char* const barejid)
     return NULL;
 }
 
+void
+chatwin_db_history_from(ProfChatWin* chatwin, GDateTime* time, gint64 id)
+{
+}
+
 void
 ui_print_system_msg_from_recipient(const char* const barejid, const char* message)
 {
@@ -367,6 +372,10 @@ mucwin_history(ProfMucWin* mucwin, const ProfMessage* const message)
 {
 }
 void
+mucwin_db_history_from(ProfMucWin* mucwin, GDateTime* time, gint64 id)
+{
+}
+void
 mucwin_incoming_msg(ProfMucWin* mucwin, const ProfMessage* const message, GSList* mentions, GList* triggers, gboolean filter_reflection)
 {
 }
@@ -38,6 +38,9 @@
 #include "test_form.h"
 #include "test_callbacks.h"
 #include "test_plugins_disco.h"
+#include "test_textwidth.h"
+#include "test_chatlog_import.h"
+#include "test_buffer.h"
 
 int
 main(int argc, char* argv[])
@@ -92,6 +95,8 @@ main(int argc, char* argv[])
         unit_test(strip_quotes_strips_both),
         unit_test(format_call_external_argv_td),
         unit_test(unique_filename_from_url_td),
+        unit_test(date_time_usec_roundtrip),
+        unit_test(date_time_usec_before_epoch),
 
         unit_test(clear_empty),
         unit_test(reset_after_create),
@@ -447,6 +452,12 @@ main(int argc, char* argv[])
         unit_test_setup_teardown(statuses_muc_defaults_to_all,
                                  load_preferences,
                                  close_preferences),
+        unit_test_setup_teardown(dblog_batch_defaults,
+                                 load_preferences,
+                                 close_preferences),
+        unit_test_setup_teardown(dblog_cache_defaults,
+                                 load_preferences,
+                                 close_preferences),
 
         unit_test_setup_teardown(console_shows_online_presence_when_set_online,
                                  load_preferences,
@@ -633,6 +644,54 @@ main(int argc, char* argv[])
         unit_test(does_not_add_duplicate_feature),
         unit_test(removes_plugin_features),
         unit_test(does_not_remove_feature_when_more_than_one_reference),
+
+        unit_test(ascii_len_empty),
+        unit_test(ascii_len_all_ascii),
+        unit_test(ascii_len_stops_at_non_ascii_in_every_position),
+        unit_test(ascii_len_respects_len),
+        unit_test(printable_len_stops_at_control_chars),
+        unit_test(printable_len_stops_at_del),
+        unit_test(printable_len_stops_at_non_ascii),
+        unit_test(ascii_word_stops_at_space),
+        unit_test(ascii_word_stops_at_newline),
+        unit_test(ascii_word_until_end),
+        unit_test(ascii_word_returns_zero_for_non_ascii_word),
+        unit_test(ascii_word_returns_zero_for_control_chars),
+        unit_test(char_width_ascii),
+        unit_test(char_width_tab),
+        unit_test(char_width_control),
+        unit_test(char_width_wide),
+        unit_test(char_width_zero_width),
+        unit_test(str_width_empty),
+        unit_test(str_width_ascii),
+        unit_test(str_width_mixed),
+        unit_test(str_width_long_mixed),
+
+        unit_test(parse_header_plain_message),
+        unit_test(parse_header_me_message),
+        unit_test(parse_header_continuation_lines),
+        unit_test(parse_header_name_with_colon),
+        unit_test(parse_header_timestamp_without_offset),
+        unit_test(parse_header_timestamp_with_offset),
+        unit_test(parse_header_respects_len),
+
+        unit_test(append_past_max_evicts_oldest),
+        unit_test(append_evicts_indexed_duplicate_id),
+        unit_test(prepend_evicts_duplicate_id),
+        unit_test(remove_entry_near_front),
+        unit_test(remove_entry_near_back),
+        unit_test(remove_entry_by_id_with_duplicates),
+        unit_test(set_entry_id_onto_existing_id),
+        unit_test(set_entry_id_onto_newer_id),
+        unit_test(mark_received_unique_id),
+        unit_test(mark_received_duplicate_ids),
+        unit_test(grow_with_wrapped_head),
+        unit_test(remove_entry_front_across_wrap),
+        unit_test(remove_entry_back_across_wrap),
+        unit_test(remove_entry_full_wrapped),
+        unit_test(set_entry_message_after_shifts),
+        unit_test(duplicate_ids_keep_buffer_order),
+        unit_test(mark_received_prepended_duplicate),
     };
 
     return run_tests(all_tests);
@@ -0,0 +1,23 @@
+#include "xmpp/capture.h"
+
+gboolean
+capture_open(const char* const path, GError** error)
+{
+    return TRUE;
+}
+
+void
+capture_handlers_init(void)
+{
+}
+
+void
+capture_close(void)
+{
+}
+
+int
+capture_replay(const char* const path, const char* const account_name, FILE* report)
+{
+    return 0;
+}
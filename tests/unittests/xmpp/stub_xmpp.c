@@ -152,6 +152,16 @@ connection_get_profanity_identifier(void)
     return "profident";
 }
 
+void
+connection_reload_log_level(void)
+{
+}
+
+void
+connection_set_stanza_tap(gboolean enabled)
+{
+}
+
 jabber_conn_status_t
 connection_register(const char* const altdomain, int port, const char* const tls_policy,
                     const char* const username, const char* const password)